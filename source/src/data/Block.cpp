@@ -26,12 +26,15 @@
  */
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QStack>
 #include <QtCore/QStringList>
 
 #include <data/Block.hpp>
 #include <data/Library.hpp>
 #include <data/MetaBlock.hpp>
 
+#include <memory/BlockArena.hpp>
+
 namespace
 {
 
@@ -71,6 +74,7 @@ Block::Block()
     : _library( K_NULL )
     , _flags( 0 )
     , _index( -1 )
+    , _baseIndex( -1 )
 {
 }
 
@@ -93,6 +97,28 @@ Block::~Block()
     }
 }
 
+void* Block::operator new( size_t size )
+{
+    return Kore::memory::BlockArena::Allocate( size );
+}
+
+void* Block::operator new( size_t size, void* place )
+{
+    Q_UNUSED( size );
+    return place;
+}
+
+void Block::operator delete( void* ptr )
+{
+    Kore::memory::BlockArena::Free( ptr );
+}
+
+void Block::operator delete( void* ptr, void* place )
+{
+    Q_UNUSED( ptr );
+    Q_UNUSED( place );
+}
+
 void Block::index( kint idx )
 {
     if( _index != idx )
@@ -153,8 +179,9 @@ void Block::library( Library* lib )
 void Block::optimize( int cause )
 {
     Q_UNUSED( cause );
-    // Default does... well, nothing :D
-    // This is definitely an optimal Block.
+    // Prepare the serialization plan of this kind of blocks, other than that
+    // this is definitely an optimal Block.
+    metaBlock()->createPropertiesCache();
 }
 
 QString Block::objectClassName() const
@@ -188,7 +215,78 @@ void Block::addFlags( kuint64 flag )
 
 void Block::removeFlag( kuint64 flag )
 {
-    ( _flags & flag ) ? ( _flags ^= flag ) : _flags;
+    _flags &= ~flag;
+}
+
+void Block::markDirty()
+{
+    emit blockChanged();
+
+    // The hashes may have been computed since the block was marked
+    clearHashCache();
+
+    if( ! checkFlag( Dirty ) )
+    {
+        addFlags( Dirty );
+        markAncestorsDirty();
+    }
+}
+
+void Block::markAncestorsDirty()
+{
+    // Stop at the first ancestor already marked, its own ancestors are too
+    for( Block* b = _library;
+         ( K_NULL != b ) &&
+            ! b->checkFlag( DirtyDescendants | IsBeingDeleted );
+         b = b->_library )
+    {
+        b->addFlags( DirtyDescendants );
+    }
+}
+
+void Block::setHashCache( const QByteArray& hash ) const
+{
+    _hashCache = hash;
+}
+
+void Block::clearHashCache()
+{
+    // A block without hashes has no ancestor with hashes either
+    for( Block* b = this;
+         ( K_NULL != b ) && ! b->_hashCache.isEmpty();
+         b = b->_library )
+    {
+        b->_hashCache.clear();
+    }
+}
+
+void Block::markClean()
+{
+    const kuint64 dirtyFlags = Dirty | DirtyDescendants |
+                               Library::ChildrenChanged;
+
+    // A dirty block either has a dirty ancestor or a library whose children
+    // changed above it, only these subtrees are visited.
+    QStack< Block* > blocks;
+    blocks.push( this );
+    while( ! blocks.empty() )
+    {
+        Block* b = blocks.pop();
+        if( b->isLibrary() &&
+            b->checkFlag( DirtyDescendants | Library::ChildrenChanged ) )
+        {
+            Library* lib = static_cast< Library* >( b );
+            for( kint i = 0; i < lib->_blocks.size(); ++i )
+            {
+                Block* child = lib->_blocks.at( i );
+                if( child->checkFlag( dirtyFlags ) )
+                {
+                    blocks.push( child );
+                }
+            }
+        }
+        b->removeFlag( dirtyFlags );
+    }
 }
 
 kbool Block::fastInherits( const MetaBlock* mb ) const
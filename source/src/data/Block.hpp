@@ -30,6 +30,7 @@
 #include <KoreTypes.hpp>
 #include <KoreMacros.hpp>
 
+#include <QtCore/QByteArray>
 #include <QtCore/QObject>
 #include <QtCore/QVariant>
 
@@ -80,8 +81,12 @@ public:
         Editable =          0x1 << 5,
         /// The block is owned by the system (can not be deleted by the user).
         SystemOwned =       0x1 << 6,
+        /// The block properties changed since the last snapshot.
+        Dirty =             0x1 << 7,
+        /// Some blocks below this one changed since the last snapshot.
+        DirtyDescendants =  0x1 << 8,
         /// MAX FLAG for subclasses flags
-        MAX_FLAG =          0x1 << 7,
+        MAX_FLAG =          0x1 << 9,
         /// MAX MAX FLAG to set the enumeration size (64 bits)
         MAX_MAX_FLAG =      0x1 << 63
     };
@@ -123,6 +128,17 @@ public:
 
     virtual ~Block();
 
+    /*!
+     * @brief Blocks are allocated from the arena current on their thread,
+     *        if any, and from the heap otherwise.
+     *
+     * \sa Kore::memory::BlockArena
+     */
+    static void* operator new( size_t size );
+    static void* operator new( size_t size, void* place );
+    static void operator delete( void* ptr );
+    static void operator delete( void* ptr, void* place );
+
     /*!
      * @brief Convert to type, no check made simply avoid typing static_cast
      *        each time.
@@ -186,6 +202,46 @@ public:
      */
     inline kbool checkFlag( kuint64 flag ) const;
 
+    /*!
+     * @brief Whether the block properties changed since the last snapshot.
+     *
+     * Setters of serialized properties must call markDirty(), the ancestors
+     * of the block are then marked as having dirty descendants, and
+     * blockChanged() is emitted. Libraries track the changes of their
+     * children by themselves.
+     *
+     * \sa Kore::serialization::KoreSerializer::deflateDelta
+     */
+    inline kbool isDirty() const;
+    inline kbool hasDirtyDescendants() const;
+    void markDirty();
+
+    /*!
+     * @brief Clear the dirty state of the block and of its subtree.
+     *
+     * Only the dirty parts of the subtree are visited.
+     */
+    void markClean();
+
+    /*!
+     * @brief Rank of the block among the serialized children of its library
+     *        at the last snapshot, -1 if the block was added since.
+     *
+     * Only meaningful when the children of the library changed.
+     */
+    inline kint baseIndex() const;
+
+    /*!
+     * @brief Content hashes of the block and of its subtree, as cached by
+     *        Kore::serialization::KoreSerializer::hash(), empty if they were
+     *        not computed since the last change.
+     *
+     * markDirty() and the changes of the children of a library clear the
+     * cache of the block and of its ancestors.
+     */
+    inline const QByteArray& hashCache() const;
+    void setHashCache( const QByteArray& hash ) const;
+
     /*!
      * \brief isLibrary
      * \return true if this block is indeed a library, false otherwise
@@ -233,12 +289,23 @@ protected:
      */
     void removeFlag( kuint64 flag );
 
+    /*!
+     * @brief Mark the ancestors as having dirty descendants.
+     */
+    void markAncestorsDirty();
+
+    /*!
+     * @brief Clear the hash cache of the block and of its ancestors.
+     */
+    void clearHashCache();
+
 signals:
     void blockNameChanged( const QString& name );
     void blockInserted();
     void blockRemoved();
     void blockDeleted();
     void indexChanged( kint oldIndex, kint newIndex );
+    void blockChanged();
 
 public:
     static QVariant DefaultBlockProperty( kint property );
@@ -249,6 +316,8 @@ private:
     // Members afterwards
     kuint64     _flags;		//!	The block flags
     kint        _index;		//! The block Index of this Block in its Library.
+    kint        _baseIndex;	//! The block Index at the last snapshot.
+    mutable QByteArray _hashCache;	//! The hashes, empty if not computed.
 };
 
 } /* namespace data */ } /* namespace Kore */
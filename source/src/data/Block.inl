@@ -79,6 +79,26 @@ inline kbool Kore::data::Block::isBeingDeleted() const
     return checkFlag( IsBeingDeleted );
 }
 
+inline kbool Kore::data::Block::isDirty() const
+{
+    return checkFlag( Dirty );
+}
+
+inline kbool Kore::data::Block::hasDirtyDescendants() const
+{
+    return checkFlag( DirtyDescendants );
+}
+
+inline kint Kore::data::Block::baseIndex() const
+{
+    return _baseIndex;
+}
+
+inline const QByteArray& Kore::data::Block::hashCache() const
+{
+    return _hashCache;
+}
+
 template<typename T>
 inline kbool Kore::data::Block::fastInherits() const
 {
@@ -38,6 +38,7 @@ K_BLOCK_IMPLEMENTATION
 using namespace Kore::data;
 
 Library::Library( kuint64 extraFlags )
+    : _loader( K_NULL )
 {
     // By default a library is browsable
     addFlags( Browsable );
@@ -48,6 +49,12 @@ Library::~Library()
 {
     addFlags( IsBeingDeleted );
 
+    if( K_NULL != _loader )
+    {
+        _loader->release( this );
+        _loader = K_NULL;
+    }
+
     // Make a copy of the blocks...
     QList< Block* > blocks = _blocks;
 
@@ -65,11 +72,25 @@ Library::~Library()
 
 void Library::clear()
 {
+    if( ! isLoaded() )
+    {
+        // Drop the children without loading them: the library is now known
+        // to be empty, which modifying() reports to the loader.
+        removeFlag( NotLoaded );
+        modifying();
+
+        emit clearing();
+        emit cleared();
+        return;
+    }
+
     if( isEmpty() )
     {
         return; // Nothing to clear !
     }
 
+    modifying();
+
     emit clearing();
 
     // Make a copy of the blocks...
@@ -95,6 +116,8 @@ void Library::clear()
 
 kint Library::totalSize() const
 {
+    materialize();
+
     kint size = _blocks.size();
     for( kint i = 0; i < _blocks.size(); ++i )
     {
@@ -106,8 +129,10 @@ kint Library::totalSize() const
     return size;
 }
 
-void Library::optimize( int )
+void Library::optimize( int cause )
 {
+    Block::optimize( cause );
+
     QList< Block* > list;
     list.reserve( _blocks.size() );
     list.append( _blocks );
@@ -136,6 +161,11 @@ kbool Library::acceptsBlock( Block* b ) const
 
 void Library::addBlock( Block* b )
 {
+    modifying();
+
+    // Not part of the last snapshot
+    b->_baseIndex = -1;
+
     K_ASSERT( ! _blocks.contains( b ) )
 
     const kint index = _blocks.size();
@@ -150,6 +180,8 @@ void Library::addBlock( Block* b )
 
 void Library::removeBlock( Block* b )
 {
+    modifying();
+
     K_ASSERT( _blocks.contains( b ) )
 
     const kint index = b->index();
@@ -174,6 +206,11 @@ void Library::removeBlock( Block* b )
 
 void Library::insertBlock( Block* b, kint index )
 {
+    modifying();
+
+    // Not part of the last snapshot
+    b->_baseIndex = -1;
+
     K_ASSERT( ! _blocks.contains( b ) )
 
     emit addingBlock( index );
@@ -188,6 +225,8 @@ void Library::insertBlock( Block* b, kint index )
 
 void Library::swapBlocks( Block* a, Block* b )
 {
+    modifying();
+
     K_ASSERT( _blocks.contains( a ) && _blocks.contains( b ) )
 
     emit swappingBlocks( a->index(), b->index() );
@@ -202,6 +241,8 @@ void Library::swapBlocks( Block* a, Block* b )
 
 void Library::moveBlock( Block* block, kint to )
 {
+    modifying();
+
     K_ASSERT( _blocks.contains( block ) )
 
     kint from = ( -1 == block->index() )
@@ -226,7 +267,7 @@ void Library::indexBlocks( kint startOffset )
 {
     for( int i = startOffset; i < _blocks.size(); ++i )
     {
-        _blocks.at(startOffset)->index(startOffset);
+        _blocks.at( i )->index( i );
     }
 }
 
@@ -235,6 +276,97 @@ kbool Library::isBrowsable() const
     return checkFlag( Browsable );
 }
 
+void Library::setLoader( LibraryLoader* loader )
+{
+    K_ASSERT( _blocks.isEmpty() )
+
+    _loader = loader;
+    addFlags( NotLoaded );
+}
+
+kbool Library::unload()
+{
+    if( ( K_NULL == _loader ) || ! isLoaded() )
+    {
+        return false;
+    }
+
+    // Removing the children is not a modification of the library here, hide
+    // the loader while doing it. The library is marked as changed beforehand
+    // so that the removals are not tracked, the changes made to the children
+    // are lost anyway.
+    LibraryLoader* loader = _loader;
+    _loader = K_NULL;
+    addFlags( DirtyDescendants | ChildrenChanged | Loading );
+    clear();
+    removeFlag( DirtyDescendants | ChildrenChanged | Loading );
+    _loader = loader;
+
+    addFlags( NotLoaded );
+
+    return true;
+}
+
+void Library::load() const
+{
+    // Loading is transparent, hence const
+    Library* self = const_cast< Library* >( this );
+
+    // The loader adds the children, that is not a modification either
+    LibraryLoader* loader = self->_loader;
+    self->_loader = K_NULL;
+    self->removeFlag( NotLoaded );
+
+    // Nor does it make the tree dirty: the library is marked as changed
+    // beforehand so that nothing propagates, and the children are cleaned.
+    const kuint64 dirtyFlags = DirtyDescendants | ChildrenChanged;
+    self->addFlags( dirtyFlags | Loading );
+
+    if( ! loader->load( self ) )
+    {
+        qWarning( "Failed to load the content of Library %s",
+                  qPrintable( blockName() ) );
+    }
+
+    for( kint i = 0; i < _blocks.size(); ++i )
+    {
+        _blocks.at( i )->markClean();
+    }
+    self->removeFlag( dirtyFlags | Loading );
+
+    self->_loader = loader;
+}
+
+void Library::modifying()
+{
+    materialize();
+
+    if( K_NULL != _loader )
+    {
+        // The library no longer matches what the loader would load
+        LibraryLoader* loader = _loader;
+        _loader = K_NULL;
+        loader->modified( this );
+    }
+
+    clearHashCache();
+
+    if( ! checkFlag( ChildrenChanged | IsBeingDeleted ) )
+    {
+        // Remember the rank of the children in the last snapshot, among the
+        // ones that were serialized, see Block::baseIndex().
+        kint serialized = 0;
+        for( kint i = 0; i < _blocks.size(); ++i )
+        {
+            Block* b = _blocks.at( i );
+            b->_baseIndex = b->checkFlag( Serializable ) ? serialized++ : -1;
+        }
+
+        addFlags( ChildrenChanged );
+        markAncestorsDirty();
+    }
+}
+
 QVariant Library::LibraryProperty( kint property )
 {
     switch( property )
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <data/Block.hpp>
+#include <data/LibraryLoader.hpp>
 
 #include <QtCore/QList>
 #include <QtCore/QString>
@@ -39,6 +40,25 @@ class KoreExport Library : public Block
     Q_OBJECT
     K_BLOCK
 
+public:
+    /*!
+     * @enum	Flags.
+     *
+     * Library specific flags.
+     */
+    enum Flags
+    {
+        /// The children were not loaded yet
+        NotLoaded = Block::MAX_FLAG,
+        /// Children were added, removed or moved since the last snapshot
+        ChildrenChanged = ( Block::MAX_FLAG << 1 ),
+        /// The loader is adding the children, or they are being unloaded: the
+        /// signals of the children list are not edits
+        Loading = ( Block::MAX_FLAG << 2 ),
+        /// MAX FLAG for subclasses flags
+        MAX_FLAG =  ( Block::MAX_FLAG << 3 )
+    };
+
 public:
     Library( kuint64 extraFlags = 0 );
     virtual ~Library();
@@ -47,17 +67,18 @@ public:
 
     template< typename T >
     inline const T* at( kint i ) const
-        { return static_cast< T* >( _blocks.at( i ) ); }
+        { materialize(); return static_cast< T* >( _blocks.at( i ) ); }
     inline const Block* at( kint i ) const
-        { return _blocks.at( i ); }
+        { materialize(); return _blocks.at( i ); }
 
     template< typename T >
-    inline T* at( kint i ) { return static_cast< T* >( _blocks.at( i ) ); }
-    inline Block* at( kint i ) { return _blocks.at( i ); }
+    inline T* at( kint i )
+        { materialize(); return static_cast< T* >( _blocks.at( i ) ); }
+    inline Block* at( kint i ) { materialize(); return _blocks.at( i ); }
 
-    inline kint size() const { return _blocks.size(); }
+    inline kint size() const { materialize(); return _blocks.size(); }
     kint totalSize() const;
-    inline kbool isEmpty() const { return _blocks.empty(); }
+    inline kbool isEmpty() const { materialize(); return _blocks.empty(); }
 
     template< typename T >
     QList< T* > findChildren( int maxDepth = -1 );
@@ -78,11 +99,43 @@ public:
     kbool isBrowsable() const;
     virtual kbool isLibrary() const { return true; }
 
+    /*!
+     * @brief Load the children on demand.
+     *
+     * The library must be empty. Its children are requested from the loader
+     * the first time its content is accessed.
+     *
+     * @param loader    The loader, it must outlive the library or be
+     *                  released by it.
+     */
+    void setLoader( LibraryLoader* loader );
+
+    /*!
+     * @brief Whether the children are instantiated.
+     */
+    inline kbool isLoaded() const { return ! checkFlag( NotLoaded ); }
+
+    /*!
+     * @brief Delete the children of a library loaded through a loader.
+     *
+     * They will be loaded again on next access. Pointers to the blocks of
+     * the subtree become invalid.
+     *
+     * @return true on success, false if the library has no loader or is not
+     *         loaded.
+     */
+    kbool unload();
+
     static QVariant LibraryProperty( kint property );
 
 protected:
     void indexBlocks( kint startOffset = 0 );
 
+private:
+    inline void materialize() const { if( ! isLoaded() ) load(); }
+    void load() const;
+    void modifying();
+
 signals:
     void addingBlock( kint index );
     void blockAdded( kint index );
@@ -97,6 +150,7 @@ signals:
 
 private:
     QList< Block* > _blocks;
+    LibraryLoader*  _loader;
 };
 
 } /* namespace data */ } /* namespace Kore */
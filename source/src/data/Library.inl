@@ -28,6 +28,10 @@
 template<typename T>
 QList<T*> Kore::data::Library::findChildren(int maxDepth)
 {
+	if(maxDepth != 0)
+	{
+		materialize();
+	}
 	QList<T*> result;
 	if(this->fastInherits<T>())
 	{
@@ -50,6 +54,10 @@ QList<T*> Kore::data::Library::findChildren(int maxDepth)
 template<typename T>
 QList<const T*> Kore::data::Library::findChildrenConst(int maxDepth) const
 {
+	if(maxDepth != 0)
+	{
+		materialize();
+	}
 	QList<const T*> result;
 	if(this->fastInherits<T>())
 	{
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+namespace Kore { namespace data {
+
+class Library;
+
+/*!
+ * @brief Source of the children of a lazily loaded Library.
+ *
+ * A Library given a loader does not instantiate its children right away: the
+ * loader is asked for them the first time the library content is accessed.
+ * Once loaded, the library may be unloaded again, as long as its content was
+ * not modified.
+ *
+ * \sa	Kore::data::Library::setLoader
+ */
+class KoreExport LibraryLoader
+{
+public:
+    virtual ~LibraryLoader() {}
+
+    /*!
+     * @brief Instantiate the children of the library and add them to it.
+     *
+     * @param library   The library to load.
+     * @return true on success, false otherwise.
+     */
+    virtual kbool load( Library* library ) = K_VIRTUAL;
+
+    /*!
+     * @brief The content of the library is about to be modified.
+     *
+     * The library no longer matches its source: it is detached from its
+     * loader and must not be unloaded anymore.
+     */
+    virtual void modified( Library* library ) = K_VIRTUAL;
+
+    /*!
+     * @brief The library is being deleted.
+     */
+    virtual void release( Library* library ) = K_VIRTUAL;
+};
+
+} /* namespace data */ } /* namespace Kore */
@@ -42,10 +42,16 @@ using namespace Kore;
 MetaBlock::MetaBlock( const MetaBlock* superMetaBlock, const QMetaObject* mo )
     : _blockMetaObject( mo )
     , _superMetaBlock( superMetaBlock )
+    , _propertiesCache( K_NULL )
 {
     blockName( tr( "MetaBlock for %1" ).arg( mo->className() ) );
 }
 
+MetaBlock::~MetaBlock()
+{
+    delete _propertiesCache.load();
+}
+
 void MetaBlock::library( Library* lib )
 {
     Loadable::library( lib );
@@ -76,6 +82,62 @@ QMetaProperty MetaBlock::blockMetaProperty( kint property ) const
     return _blockMetaObject->property( property );
 }
 
+const QVector< MetaBlock::StoredProperty >& MetaBlock::storedProperties() const
+{
+    return createPropertiesCache()->properties;
+}
+
+const MetaBlock::StoredProperty* MetaBlock::storedProperty( kint idx ) const
+{
+    const PropertiesCache* cache = createPropertiesCache();
+    const kint position = cache->positions.value( idx, -1 );
+    return ( position < 0 ) ? K_NULL : & cache->properties.at( position );
+}
+
+const MetaBlock::PropertiesCache* MetaBlock::createPropertiesCache() const
+{
+    const PropertiesCache* cache = _propertiesCache.loadAcquire();
+    if( K_NULL != cache )
+    {
+        return cache;
+    }
+
+    PropertiesCache* newCache = new PropertiesCache;
+    const kint propertyCount = _blockMetaObject->propertyCount();
+    newCache->positions.fill( -1, propertyCount );
+
+    // 1 because QObject has the name property that is not serializable...
+    for( kint i = 1; i < propertyCount; ++i )
+    {
+        // Retrieve the property through the virtual, allowing its
+        // replacement by client code.
+        QMetaProperty prop = blockMetaProperty( i );
+        if( ! prop.isValid() )
+        {
+            continue;
+        }
+
+        StoredProperty stored;
+        stored.property = prop;
+        stored.type = ( static_cast< int >( prop.type() ) < QMetaType::User )
+                            ? prop.type()
+                            : prop.userType();
+
+        newCache->positions[ i ] = newCache->properties.size();
+        newCache->properties.append( stored );
+    }
+
+    // Several threads may race here (parallel serialization), only one cache
+    // is kept.
+    if( _propertiesCache.testAndSetOrdered( K_NULL, newCache ) )
+    {
+        return newCache;
+    }
+
+    delete newCache;
+    return _propertiesCache.loadAcquire();
+}
+
 void MetaBlock::clearExtensions()
 {
     QList< BlockExtension* > extensions = _extensions.values();
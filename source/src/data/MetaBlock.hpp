@@ -29,6 +29,7 @@
 
 #include <plugin/Loadable.hpp>
 
+#include <QtCore/QAtomicPointer>
 #include <QtCore/QMetaClassInfo>
 #include <QtCore/QMetaObject>
 #include <QtCore/QMetaProperty>
@@ -47,12 +48,27 @@ class KoreExport MetaBlock : public Kore::plugin::Loadable
     friend class Block;
     friend class BlockExtension;
 
+public:
+    /*!
+     * @brief A block property that may be serialized.
+     */
+    struct StoredProperty
+    {
+        /// The property, as returned by blockMetaProperty().
+        QMetaProperty   property;
+        /// Its resolved type id, QMetaType::UnknownType if the type was not
+        /// registered when the cache was created.
+        int             type;
+    };
+
 protected:
     MetaBlock( const MetaBlock* superMetaBlock, const QMetaObject* mo );
 
     virtual void library( Kore::data::Library* lib );
 
 public:
+    virtual ~MetaBlock();
+
     virtual bool canUnload() const = K_VIRTUAL;
 
     virtual Block* createBlock() const = K_VIRTUAL;
@@ -65,6 +81,21 @@ public:
 
     virtual QMetaProperty blockMetaProperty( kint blockMetaProperty ) const;
 
+    /*!
+     * @brief Valid block properties, except QObject's objectName, in
+     *        property index order.
+     *
+     * The list is computed once, the first time it is needed or when a
+     * block of this type is optimized, through blockMetaProperty(): later
+     * replacements of the properties are not taken into account.
+     */
+    const QVector< StoredProperty >& storedProperties() const;
+    /*!
+     * @brief The stored property with the given property index.
+     * @return K_NULL if the property is not part of storedProperties().
+     */
+    const StoredProperty* storedProperty( kint propertyIdx ) const;
+
     virtual QVariant blockProperty( int propertyIdx ) const = K_VIRTUAL;
     QVariant blockSetting( const QString& setting,
                            const QVariant& defaultValue ) const;
@@ -86,13 +117,22 @@ protected:
     void unregisterBlockExtension( BlockExtension* extension );
 
 private:
-    void createPropertiesCache() const;
+    struct PropertiesCache
+    {
+        QVector< StoredProperty >   properties;
+        // Position in properties for each property index, -1 if none.
+        QVector< kint >             positions;
+    };
+
+    const PropertiesCache* createPropertiesCache() const;
     void clearExtensions();
 
 private:
     const QMetaObject*  _blockMetaObject;
     const MetaBlock*    _superMetaBlock;
 
+    mutable QAtomicPointer< const PropertiesCache > _propertiesCache;
+
     QMultiHash< QString, BlockExtension* > _extensions;
 };
 
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <memory/BlockArena.hpp>
+using namespace Kore::memory;
+
+#include <KoreApplication.hpp>
+using namespace Kore;
+
+#include <QtCore/QThreadStorage>
+
+#include <new>
+
+// In front of each allocation, holds its arena. Keeps the blocks aligned.
+#define ARENA_HEADER_SIZE   16
+#define ARENA_ALIGNMENT     16
+
+namespace {
+
+struct CurrentArena
+{
+    CurrentArena() : arena( K_NULL ) {}
+
+    BlockArena* arena;
+};
+
+Q_GLOBAL_STATIC( QThreadStorage< CurrentArena >, currentArena )
+
+}
+
+BlockArena::Scope::Scope( BlockArena* arena )
+{
+    CurrentArena& current = currentArena()->localData();
+    _previous = current.arena;
+    current.arena = arena;
+}
+
+BlockArena::Scope::~Scope()
+{
+    currentArena()->localData().arena = _previous;
+}
+
+BlockArena::BlockArena( ksize slabSize, const MemoryManager* manager )
+    : _manager( ( K_NULL != manager )
+                ? manager
+                : KoreApplication::Instance()->memoryManager() )
+    , _slabSize( _K_NEXT_ALIGNED_VALUE( slabSize, ARENA_ALIGNMENT ) )
+    , _cursor( K_NULL )
+    , _end( K_NULL )
+    , _refs( 1 )
+    , _used( 0 )
+    , _reserved( 0 )
+{
+}
+
+BlockArena::~BlockArena()
+{
+    for( kint i = 0; i < _slabs.size(); ++i )
+    {
+        _manager->mFree_a( _slabs.at( i ) );
+    }
+}
+
+void BlockArena::release()
+{
+    unref();
+}
+
+ksize BlockArena::usedBytes() const
+{
+    return _used;
+}
+
+ksize BlockArena::reservedBytes() const
+{
+    return _reserved;
+}
+
+kint BlockArena::slabsCount() const
+{
+    return _slabs.size();
+}
+
+void* BlockArena::Allocate( ksize size )
+{
+    // Blocks may still be deleted after the thread storage, never allocated
+    QThreadStorage< CurrentArena >* storage = currentArena();
+    BlockArena* arena = ( K_NULL != storage && storage->hasLocalData() )
+            ? storage->localData().arena
+            : K_NULL;
+
+    kbyte* data = K_NULL;
+    if( K_NULL != arena )
+    {
+        data = static_cast< kbyte* >(
+                    arena->allocate( size + ARENA_HEADER_SIZE ) );
+    }
+
+    // Out of slabs, fall back to the heap
+    if( K_NULL == data )
+    {
+        arena = K_NULL;
+        data = static_cast< kbyte* >(
+                    ::operator new( size + ARENA_HEADER_SIZE ) );
+    }
+
+    *reinterpret_cast< BlockArena** >( data ) = arena;
+
+    return data + ARENA_HEADER_SIZE;
+}
+
+void BlockArena::Free( void* ptr )
+{
+    if( K_NULL == ptr )
+    {
+        return;
+    }
+
+    kbyte* data = static_cast< kbyte* >( ptr ) - ARENA_HEADER_SIZE;
+    BlockArena* arena = *reinterpret_cast< BlockArena** >( data );
+    if( K_NULL == arena )
+    {
+        ::operator delete( data );
+    }
+    else
+    {
+        arena->unref();
+    }
+}
+
+BlockArena* BlockArena::Of( const void* ptr )
+{
+    const kbyte* data = static_cast< const kbyte* >( ptr )
+            - ARENA_HEADER_SIZE;
+    return *reinterpret_cast< BlockArena* const* >( data );
+}
+
+void* BlockArena::allocate( ksize size )
+{
+    size = _K_NEXT_ALIGNED_VALUE( size, ARENA_ALIGNMENT );
+
+    kbyte* ptr;
+    if( size > _slabSize )
+    {
+        // A slab of its own, the free space of the current one is kept
+        ptr = static_cast< kbyte* >( _manager->mAlloc_a( size,
+                                                         ARENA_ALIGNMENT ) );
+        if( K_NULL == ptr )
+        {
+            return K_NULL;
+        }
+        _slabs.append( ptr );
+        _reserved += size;
+    }
+    else
+    {
+        if( static_cast< ksize >( _end - _cursor ) < size )
+        {
+            kbyte* slab = static_cast< kbyte* >(
+                        _manager->mAlloc_a( _slabSize, ARENA_ALIGNMENT ) );
+            if( K_NULL == slab )
+            {
+                return K_NULL;
+            }
+            _slabs.append( slab );
+            _reserved += _slabSize;
+            _cursor = slab;
+            _end = slab + _slabSize;
+        }
+
+        ptr = _cursor;
+        _cursor += size;
+    }
+
+    _used += size;
+    _refs.ref();
+
+    return ptr;
+}
+
+void BlockArena::unref()
+{
+    if( ! _refs.deref() )
+    {
+        delete this;
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <memory/MemoryManager.hpp>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QVector>
+
+namespace Kore { namespace memory {
+
+/*!
+ * @brief Slabs the blocks of a whole tree are carved from.
+ *
+ * Blocks are allocated from the arena made current on their thread by a
+ * Scope, the others from the heap, see Kore::data::Block::operator new. The
+ * slabs are obtained from the memory manager, blocks are not freed one by
+ * one: the arena keeps a reference per block and releases all its slabs at
+ * once when the last block is deleted and the owner called release().
+ *
+ * The private data Qt allocates for each QObject still comes from the heap.
+ */
+class KoreExport BlockArena {
+
+public:
+    /*!
+     * @brief Make an arena current on the calling thread for its lifetime,
+     *        restoring the previous one on destruction.
+     */
+    class KoreExport Scope {
+
+    public:
+        Scope( BlockArena* arena );
+        ~Scope();
+
+    private:
+        BlockArena* _previous;
+    };
+
+public:
+    /*!
+     * @param slabSize  Larger allocations get a slab of their own.
+     * @param manager   The memory manager of the application by default.
+     */
+    BlockArena( ksize slabSize = 256 * _K_1KB,
+                const MemoryManager* manager = K_NULL );
+
+    /*!
+     * @brief Give up the reference of the owner, the arena is deleted along
+     *        with the last of its blocks.
+     */
+    void release();
+
+    /*!
+     * @brief Memory handed to the blocks, slabs obtained from the manager,
+     *        and their count. Not synchronized with the allocating thread.
+     */
+    ksize usedBytes() const;
+    ksize reservedBytes() const;
+    kint slabsCount() const;
+
+    static void* Allocate( ksize size );
+    static void Free( void* ptr );
+
+    /*!
+     * @brief The arena of a block allocated by Allocate(), K_NULL if it was
+     *        allocated from the heap.
+     */
+    static BlockArena* Of( const void* ptr );
+
+private:
+    ~BlockArena();
+
+    void* allocate( ksize size );
+    void unref();
+
+private:
+    const MemoryManager*    _manager;
+    ksize                   _slabSize;
+    QVector< kbyte* >       _slabs;
+    kbyte*                  _cursor;        //!< Free space of the last slab
+    kbyte*                  _end;
+    QAtomicInt              _refs;          //!< Owner and blocks
+    ksize                   _used;
+    ksize                   _reserved;
+};
+
+}}
@@ -37,8 +37,13 @@
 #   error You must define K_TASKLET_TYPE before including <TaskletMacros.hpp> !
 #endif
 
+// Tasklets may derive from another tasklet type
+#ifndef K_TASKLET_SUPER_TYPE
+#   define K_TASKLET_SUPER_TYPE Kore::parallel::Tasklet
+#endif
+
 #define K_BLOCK_BASE_META_TYPE  Kore::parallel::MetaTasklet
-#define K_BLOCK_SUPER_TYPE      Kore::parallel::Tasklet
+#define K_BLOCK_SUPER_TYPE      K_TASKLET_SUPER_TYPE
 #define K_BLOCK_TYPE            K_TASKLET_TYPE
 #define K_BLOCK_ALLOCABLE       // A Tasklet is always instantiable
 #include <data/BlockMacros.hpp>
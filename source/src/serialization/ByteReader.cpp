@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QIODevice>
+
+#include <climits>
+#include <cstring>
+
+#include "ByteReader.hpp"
+
+using namespace Kore::serialization;
+
+#define READ_TIMEOUT_MS     30000
+
+ByteReader::ByteReader( const char* data, qint64 size )
+    : _begin( data )
+    , _current( data )
+    , _end( data + size )
+    , _error( false )
+    , _device( K_NULL )
+    , _windowSize( 0 )
+    , _windowPos( 0 )
+{
+}
+
+ByteReader::ByteReader( QIODevice* device, qint64 window )
+    : _begin( K_NULL )
+    , _current( K_NULL )
+    , _end( K_NULL )
+    , _error( false )
+    , _device( device )
+    , _windowSize( window )
+    , _windowPos( device->isSequential() ? 0 : device->pos() )
+{
+}
+
+qint64 ByteReader::size() const
+{
+    if( K_NULL == _device )
+    {
+        return _end - _begin;
+    }
+    return _device->isSequential() ? -1 : _device->size();
+}
+
+kbool ByteReader::isSequential() const
+{
+    return ( K_NULL != _device ) && _device->isSequential();
+}
+
+kbool ByteReader::seek( qint64 pos )
+{
+    if( K_NULL == _device )
+    {
+        if( ( pos < 0 ) || ( pos > ( _end - _begin ) ) )
+        {
+            _error = true;
+            return false;
+        }
+        _current = _begin + pos;
+        return true;
+    }
+
+    // Moving within the window does not need the device
+    if( ( pos >= _windowPos ) && ( pos <= _windowPos + ( _end - _begin ) ) )
+    {
+        _current = _begin + ( pos - _windowPos );
+        return true;
+    }
+
+    const qint64 current = this->pos();
+
+    if( _device->isSequential() )
+    {
+        if( pos < current )
+        {
+            // No way back
+            _error = true;
+            return false;
+        }
+
+        // Consume the data up to the requested position
+        qint64 toSkip = pos - current;
+        while( toSkip > 0 )
+        {
+            if( ( _current == _end ) && ! fill( 1 ) )
+            {
+                return false;
+            }
+            const qint64 available = _end - _current;
+            const qint64 step = K_MIN( toSkip, available );
+            _current += step;
+            toSkip -= step;
+        }
+        return true;
+    }
+
+    // Random access device, move it and drop the window
+    if( ! _device->seek( pos ) )
+    {
+        _error = true;
+        return false;
+    }
+
+    _windowPos = pos;
+    _begin = _current = _end = _window.constData();
+
+    return true;
+}
+
+qint64 ByteReader::read( char* data, qint64 maxSize )
+{
+    qint64 total = 0;
+    while( total < maxSize )
+    {
+        if( ( _current == _end ) && ! require( 1 ) )
+        {
+            break;
+        }
+        const qint64 available = _end - _current;
+        const qint64 bytes = K_MIN( maxSize - total, available );
+        memcpy( data + total, _current, bytes );
+        _current += bytes;
+        total += bytes;
+    }
+    return total;
+}
+
+qint64 ByteReader::bytesAvailable() const
+{
+    const qint64 buffered = _end - _current;
+    return ( K_NULL == _device ) ? buffered
+                                 : buffered + _device->bytesAvailable();
+}
+
+kbool ByteReader::fill( qint64 bytes )
+{
+    if( ( K_NULL == _device ) || ( bytes > INT_MAX ) )
+    {
+        _error = true;
+        return false;
+    }
+
+    // Keep the bytes not consumed yet at the front of the window
+    const qint64 consumed = _current - _begin;
+    const qint64 remaining = _end - _current;
+    const qint64 capacity = K_MAX( bytes, _windowSize );
+
+    if( _window.size() < capacity )
+    {
+        _window.resize( static_cast< int >( capacity ) );
+    }
+
+    char* data = _window.data();
+    if( remaining > 0 )
+    {
+        memmove( data, data + consumed, remaining );
+    }
+    _windowPos += consumed;
+
+    qint64 filled = remaining;
+    while( filled < bytes )
+    {
+        const qint64 read = _device->read( data + filled,
+                                           _window.size() - filled );
+        if( read < 0 )
+        {
+            break;
+        }
+        if( ( 0 == read ) && ! _device->waitForReadyRead( READ_TIMEOUT_MS ) )
+        {
+            // End of the data
+            break;
+        }
+        filled += read;
+    }
+
+    _begin = data;
+    _current = data;
+    _end = data + filled;
+
+    if( filled < bytes )
+    {
+        _error = true;
+        return false;
+    }
+
+    return true;
+}
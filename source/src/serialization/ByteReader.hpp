@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_ByteReader_hpp_
+#define _Kore_serialization_ByteReader_hpp_
+
+#include <QtCore/QByteArray>
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+class QIODevice;
+
+namespace Kore { namespace serialization {
+
+/*!
+ * @brief A cursor decoding the Kore binary format.
+ *
+ * The reader understands the primitives used by the serializers (big endian
+ * words as written by QDataStream, variable length integers and QDataStream
+ * byte arrays) and decodes them without any intermediate QDataStream.
+ *
+ * The data either comes from a memory area, typically a memory mapped file,
+ * or from a device. In the latter case the reader pulls the data by chunks
+ * into an internal window and keeps track of the position on its own, which
+ * makes it usable on sequential devices as long as it only moves forward.
+ *
+ * All accesses are bounds checked: reading past the end of the data puts the
+ * reader in an error state, in which every read returns zero.
+ */
+class KoreExport ByteReader
+{
+public:
+    /*!
+     * @brief Read from memory.
+     */
+    ByteReader( const char* data, qint64 size );
+
+    /*!
+     * @brief Read from a device, starting at its current position.
+     *
+     * @param device    The device to read from, must be open.
+     * @param window    Size of the chunks read from the device. The bytes
+     *                  already decoded stay in the window until the next
+     *                  chunk is read.
+     */
+    ByteReader( QIODevice* device, qint64 window = 64 * _K_1KB );
+
+    /*!
+     * @brief Position in the stream.
+     *
+     * This is the absolute position for memory and random access devices,
+     * the number of bytes consumed since construction for sequential devices.
+     */
+    inline qint64 pos() const;
+
+    /*!
+     * @brief Size of the stream, -1 for sequential devices.
+     */
+    qint64 size() const;
+
+    inline kbool hasError() const;
+
+    /*!
+     * @brief Whether the reader can move backward.
+     */
+    kbool isSequential() const;
+
+    /*!
+     * @brief Move to the given position.
+     *
+     * Moving within the window is free. Otherwise, sequential devices can
+     * only move forward, the data in between is consumed.
+     */
+    kbool seek( qint64 pos );
+    inline kbool skip( qint64 bytes );
+
+    inline quint8 readUInt8();
+    inline quint16 readUInt16();
+    inline quint32 readUInt32();
+    inline quint64 readUInt64();
+
+    /*!
+     * @brief Decode the next 32 bits word without consuming it.
+     */
+    inline quint32 peekUInt32();
+
+    /*!
+     * @brief Decode an unsigned integer written by WriteVariableLength32.
+     */
+    inline quint32 readVariableLength32();
+
+    /*!
+     * @brief Read a QByteArray as serialized by QDataStream.
+     *
+     * No copy is made, the returned pointer refers to the reader's memory and
+     * is only valid until the next read.
+     *
+     * @param[ out ] data   Start of the bytes, K_NULL for a null byte array.
+     * @param[ out ] size   Number of bytes.
+     * @return true on success, false otherwise.
+     */
+    inline kbool readByteArray( const char** data, quint32* size );
+
+    /*!
+     * @brief Read the next size bytes, without copy.
+     *
+     * The returned pointer refers to the reader's memory and is only valid
+     * until the next read. The window grows as needed in device mode.
+     */
+    inline kbool readBytes( const char** data, qint64 size );
+
+    /*!
+     * @brief Copy maxSize bytes to data, or less at the end of the stream.
+     * @return the number of bytes actually copied.
+     */
+    qint64 read( char* data, qint64 maxSize );
+
+    /*!
+     * @brief Number of bytes that can be read without blocking.
+     */
+    qint64 bytesAvailable() const;
+
+private:
+    inline kbool require( qint64 bytes );
+    kbool fill( qint64 bytes );
+
+private:
+    const char* _begin;
+    const char* _current;
+    const char* _end;
+    kbool       _error;
+
+    // Device mode
+    QIODevice*  _device;
+    QByteArray  _window;
+    qint64      _windowSize;
+    qint64      _windowPos;     //!< Stream position of _begin
+};
+
+} /* serialization */ } /* Kore */
+
+#include "ByteReader.inl"
+
+#endif // _Kore_serialization_ByteReader_hpp_
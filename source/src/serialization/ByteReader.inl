@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QtEndian>
+
+inline qint64 Kore::serialization::ByteReader::pos() const
+{
+    return _windowPos + ( _current - _begin );
+}
+
+inline kbool Kore::serialization::ByteReader::hasError() const
+{
+    return _error;
+}
+
+inline kbool Kore::serialization::ByteReader::skip( qint64 bytes )
+{
+    return seek( pos() + bytes );
+}
+
+inline kbool Kore::serialization::ByteReader::require( qint64 bytes )
+{
+    if( _error )
+    {
+        return false;
+    }
+    // Fast path, the data is already there. Otherwise pull it from the
+    // device, if any.
+    return ( ( _end - _current ) >= bytes ) || fill( bytes );
+}
+
+inline quint8 Kore::serialization::ByteReader::readUInt8()
+{
+    if( ! require( 1 ) )
+    {
+        return 0;
+    }
+    return static_cast< quint8 >( *( _current++ ) );
+}
+
+inline quint16 Kore::serialization::ByteReader::readUInt16()
+{
+    if( ! require( 2 ) )
+    {
+        return 0;
+    }
+    const quint16 value = qFromBigEndian< quint16 >(
+                reinterpret_cast< const uchar* >( _current ) );
+    _current += 2;
+    return value;
+}
+
+inline quint32 Kore::serialization::ByteReader::readUInt32()
+{
+    if( ! require( 4 ) )
+    {
+        return 0;
+    }
+    const quint32 value = qFromBigEndian< quint32 >(
+                reinterpret_cast< const uchar* >( _current ) );
+    _current += 4;
+    return value;
+}
+
+inline quint64 Kore::serialization::ByteReader::readUInt64()
+{
+    if( ! require( 8 ) )
+    {
+        return 0;
+    }
+    const quint64 value = qFromBigEndian< quint64 >(
+                reinterpret_cast< const uchar* >( _current ) );
+    _current += 8;
+    return value;
+}
+
+inline quint32 Kore::serialization::ByteReader::peekUInt32()
+{
+    if( ! require( 4 ) )
+    {
+        return 0;
+    }
+    return qFromBigEndian< quint32 >(
+                reinterpret_cast< const uchar* >( _current ) );
+}
+
+inline quint32 Kore::serialization::ByteReader::readVariableLength32()
+{
+    // Fast path, the longest encoding is in the window: decode the raw bytes
+    // without checking the bounds for each of them.
+    if( ! _error && ( _end - _current >= 5 ) )
+    {
+        const uchar* data = reinterpret_cast< const uchar* >( _current );
+        quint32 result = data[ 0 ] & 0x7f;
+        int length = 1;
+        while( ( data[ length - 1 ] & 0x80 ) && ( length < 5 ) )
+        {
+            result |= static_cast< quint32 >( data[ length ] & 0x7f )
+                            << ( 7 * length );
+            ++length;
+        }
+
+        if( data[ length - 1 ] & 0x80 )
+        {
+            // Malformed value
+            _error = true;
+            return 0;
+        }
+
+        _current += length;
+        return result;
+    }
+
+    quint32 result = 0x0;
+    int offset = 0;
+
+    // At most 5 bytes for a 32 bits value.
+    for( ; offset < 35; offset += 7 )
+    {
+        const quint8 val = readUInt8();
+        result |= ( static_cast< quint32 >( val & 0x7f ) << offset );
+        if( ! ( val & 0x80 ) )
+        {
+            return result;
+        }
+    }
+
+    // Malformed value
+    _error = true;
+    return 0;
+}
+
+inline kbool Kore::serialization::ByteReader::readByteArray( const char** data,
+                                                             quint32* size )
+{
+    const quint32 length = readUInt32();
+
+    if( 0xffffffff == length )
+    {
+        // Null byte array
+        *data = K_NULL;
+        *size = 0;
+        return ! _error;
+    }
+
+    if( ! require( length ) )
+    {
+        return false;
+    }
+
+    *data = _current;
+    *size = length;
+    _current += length;
+
+    return true;
+}
+
+inline kbool Kore::serialization::ByteReader::readBytes( const char** data,
+                                                         qint64 size )
+{
+    if( ! require( size ) )
+    {
+        return false;
+    }
+
+    *data = _current;
+    _current += size;
+
+    return true;
+}
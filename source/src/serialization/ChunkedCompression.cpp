@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QDataStream>
+#include <QtCore/QThread>
+#include <QtCore/QtEndian>
+
+#include <QtConcurrent/QtConcurrent>
+
+#include <cstring>
+
+#include "ChunkedCompression.hpp"
+
+using namespace Kore::serialization;
+
+#define CHUNKED_MAGIC           ( K_FOURCC( 'K', 'C', 'M', 'P' ) )
+#define CHUNKED_VERSION         1
+#define CHUNKED_INDEX_TAG       ( K_FOURCC( 'K', 'C', 'I', 'X' ) )
+
+// Magic, version and chunk size
+#define CHUNKED_HEADER_SIZE     ( 4 + 1 + 4 )
+// Chunks count, uncompressed size and tag
+#define CHUNKED_TRAILER_SIZE    ( 4 + 8 + 4 )
+
+namespace {
+
+QByteArray CompressChunk( const QByteArray& data, int level )
+{
+    return qCompress( data, level );
+}
+
+QByteArray DecompressChunk( const QByteArray& data )
+{
+    return qUncompress( data );
+}
+
+}
+
+ChunkedCompressor::ChunkedCompressor( QIODevice* device,
+                                      qint64 chunkSize,
+                                      int level )
+    : _device( device )
+    , _chunkSize( qMax( chunkSize, qint64( _K_1KB ) ) )
+    , _level( level )
+    , _error( false )
+    , _written( 0 )
+    , _size( 0 )
+    , _maxPending( 2 * qMax( QThread::idealThreadCount(), 1 ) )
+{
+}
+
+ChunkedCompressor::~ChunkedCompressor()
+{
+    close();
+}
+
+bool ChunkedCompressor::open( OpenMode mode )
+{
+    if( ( mode & ReadOnly ) || ! ( mode & WriteOnly ) )
+    {
+        return false;
+    }
+
+    _error = false;
+    _written = CHUNKED_HEADER_SIZE;
+    _size = 0;
+    _offsets.clear();
+    _chunk.clear();
+    _chunk.reserve( _chunkSize );
+
+    QDataStream stream( _device );
+    stream.setVersion( QDataStream::Qt_5_1 );
+    stream << static_cast< quint32 >( CHUNKED_MAGIC );
+    stream << static_cast< quint8 >( CHUNKED_VERSION );
+    stream << static_cast< quint32 >( _chunkSize );
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        _error = true;
+        return false;
+    }
+
+    return QIODevice::open( mode | Unbuffered );
+}
+
+void ChunkedCompressor::close()
+{
+    if( ! isOpen() )
+    {
+        return;
+    }
+
+    // The last chunk may be partial
+    if( ! _chunk.isEmpty() )
+    {
+        submitChunk();
+    }
+    while( ! _pending.isEmpty() )
+    {
+        writeChunk( _pending.dequeue().result() );
+    }
+
+    // Index
+    QDataStream stream( _device );
+    stream.setVersion( QDataStream::Qt_5_1 );
+    for( int i = 0; i < _offsets.size(); ++i )
+    {
+        stream << _offsets.at( i );
+    }
+    stream << static_cast< quint32 >( _offsets.size() );
+    stream << static_cast< quint64 >( _size );
+    stream << static_cast< quint32 >( CHUNKED_INDEX_TAG );
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        _error = true;
+    }
+
+    QIODevice::close();
+}
+
+bool ChunkedCompressor::isSequential() const
+{
+    return true;
+}
+
+kbool ChunkedCompressor::hasError() const
+{
+    return _error;
+}
+
+qint64 ChunkedCompressor::readData( char*, qint64 )
+{
+    return -1;
+}
+
+qint64 ChunkedCompressor::writeData( const char* data, qint64 size )
+{
+    if( _error )
+    {
+        return -1;
+    }
+
+    qint64 written = 0;
+    while( written < size )
+    {
+        const qint64 bytes = qMin( size - written,
+                                   _chunkSize - _chunk.size() );
+        _chunk.append( data + written, bytes );
+        written += bytes;
+
+        if( _chunk.size() == _chunkSize )
+        {
+            submitChunk();
+        }
+    }
+
+    _size += size;
+
+    return _error ? -1 : size;
+}
+
+void ChunkedCompressor::submitChunk()
+{
+    // Bound the memory used by the chunks in flight
+    if( _pending.size() >= _maxPending )
+    {
+        writeChunk( _pending.dequeue().result() );
+    }
+
+    _pending.enqueue( QtConcurrent::run( CompressChunk, _chunk, _level ) );
+
+    _chunk = QByteArray();
+    _chunk.reserve( _chunkSize );
+}
+
+void ChunkedCompressor::writeChunk( const QByteArray& compressed )
+{
+    if( _error )
+    {
+        return;
+    }
+
+    _offsets.append( _written );
+    _written += sizeof( quint32 ) + compressed.size();
+
+    QDataStream stream( _device );
+    stream.setVersion( QDataStream::Qt_5_1 );
+    stream << static_cast< quint32 >( compressed.size() );
+    if( ( QDataStream::Ok != stream.status() ) ||
+        ( _device->write( compressed ) != compressed.size() ) )
+    {
+        _error = true;
+    }
+}
+
+ChunkedDecompressor::ChunkedDecompressor( QIODevice* device )
+    : _device( device )
+    , _containerPos( 0 )
+    , _containerEnd( 0 )
+    , _chunkSize( 0 )
+    , _size( 0 )
+    , _current( -1 )
+    , _ahead( -1 )
+{
+}
+
+ChunkedDecompressor::~ChunkedDecompressor()
+{
+    // Do not leave a decompression running on our data
+    _aheadChunk.waitForFinished();
+}
+
+kbool ChunkedDecompressor::IsCompressed( QIODevice* device )
+{
+    char magic[ sizeof( quint32 ) ];
+    if( device->peek( magic, sizeof( magic ) ) != sizeof( magic ) )
+    {
+        return false;
+    }
+    return CHUNKED_MAGIC ==
+           qFromBigEndian< quint32 >( reinterpret_cast< uchar* >( magic ) );
+}
+
+bool ChunkedDecompressor::open( OpenMode mode )
+{
+    if( ( mode & WriteOnly ) || ! ( mode & ReadOnly ) ||
+        _device->isSequential() )
+    {
+        return false;
+    }
+
+    _containerPos = _device->pos();
+    _containerEnd = _device->size();
+
+    QDataStream stream( _device );
+    stream.setVersion( QDataStream::Qt_5_1 );
+
+    // Header
+    quint32 magic;
+    quint8 version;
+    quint32 chunkSize;
+    stream >> magic >> version >> chunkSize;
+    if( ( QDataStream::Ok != stream.status() ) ||
+        ( CHUNKED_MAGIC != magic ) || ( CHUNKED_VERSION != version ) ||
+        ( 0 == chunkSize ) )
+    {
+        return false;
+    }
+    _chunkSize = chunkSize;
+
+    // Trailer
+    const qint64 trailerPos = _containerEnd - CHUNKED_TRAILER_SIZE;
+    if( ( trailerPos < _containerPos + CHUNKED_HEADER_SIZE ) ||
+        ! _device->seek( trailerPos ) )
+    {
+        return false;
+    }
+
+    quint32 chunksCount;
+    quint64 size;
+    quint32 tag;
+    stream >> chunksCount >> size >> tag;
+    if( ( QDataStream::Ok != stream.status() ) ||
+        ( CHUNKED_INDEX_TAG != tag ) ||
+        ( size > quint64( chunksCount ) * _chunkSize ) )
+    {
+        return false;
+    }
+    _size = size;
+
+    // Index
+    const qint64 indexPos = trailerPos - qint64( chunksCount ) * 8;
+    if( ( indexPos < _containerPos + CHUNKED_HEADER_SIZE ) ||
+        ! _device->seek( indexPos ) )
+    {
+        return false;
+    }
+
+    _offsets.resize( chunksCount );
+    for( quint32 i = 0; i < chunksCount; ++i )
+    {
+        stream >> _offsets[ i ];
+    }
+    if( QDataStream::Ok != stream.status() )
+    {
+        return false;
+    }
+
+    _current = -1;
+    _ahead = -1;
+
+    return QIODevice::open( ReadOnly | Unbuffered );
+}
+
+bool ChunkedDecompressor::isSequential() const
+{
+    return false;
+}
+
+qint64 ChunkedDecompressor::size() const
+{
+    return _size;
+}
+
+qint64 ChunkedDecompressor::containerEnd() const
+{
+    return _containerEnd;
+}
+
+qint64 ChunkedDecompressor::readData( char* data, qint64 maxSize )
+{
+    qint64 pos = QIODevice::pos();
+    qint64 read = 0;
+
+    while( ( read < maxSize ) && ( pos < _size ) )
+    {
+        const int index = static_cast< int >( pos / _chunkSize );
+        if( ( index != _current ) && ! loadChunk( index ) )
+        {
+            return ( 0 == read ) ? -1 : read;
+        }
+
+        const qint64 offset = pos - qint64( index ) * _chunkSize;
+        const qint64 bytes = qMin( maxSize - read, _chunk.size() - offset );
+        if( bytes <= 0 )
+        {
+            // Truncated chunk
+            return ( 0 == read ) ? -1 : read;
+        }
+
+        memcpy( data + read, _chunk.constData() + offset, bytes );
+        read += bytes;
+        pos += bytes;
+    }
+
+    return read;
+}
+
+qint64 ChunkedDecompressor::writeData( const char*, qint64 )
+{
+    return -1;
+}
+
+kbool ChunkedDecompressor::readChunk( int index, QByteArray* compressed )
+{
+    if( ! _device->seek( _containerPos + _offsets.at( index ) ) )
+    {
+        return false;
+    }
+
+    char sizeBytes[ sizeof( quint32 ) ];
+    if( _device->read( sizeBytes, sizeof( sizeBytes ) ) != sizeof( sizeBytes ) )
+    {
+        return false;
+    }
+    const quint32 size =
+        qFromBigEndian< quint32 >( reinterpret_cast< uchar* >( sizeBytes ) );
+
+    *compressed = _device->read( size );
+    return compressed->size() == static_cast< int >( size );
+}
+
+kbool ChunkedDecompressor::loadChunk( int index )
+{
+    if( ( index < 0 ) || ( index >= _offsets.size() ) )
+    {
+        return false;
+    }
+
+    if( index == _ahead )
+    {
+        _chunk = _aheadChunk.result();
+    }
+    else
+    {
+        // Drop a useless read-ahead
+        _aheadChunk.waitForFinished();
+
+        QByteArray compressed;
+        if( ! readChunk( index, & compressed ) )
+        {
+            return false;
+        }
+        _chunk = qUncompress( compressed );
+    }
+    _current = index;
+    _ahead = -1;
+
+    // Read the next chunk, the device is only used by this thread, and let
+    // the thread pool decompress it meanwhile.
+    QByteArray next;
+    if( ( index + 1 < _offsets.size() ) && readChunk( index + 1, & next ) )
+    {
+        _aheadChunk = QtConcurrent::run( DecompressChunk, next );
+        _ahead = index + 1;
+    }
+
+    // Chunks are all full but the last one
+    return ( index + 1 == _offsets.size() ) ||
+           ( _chunk.size() == _chunkSize );
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_ChunkedCompression_hpp_
+#define _Kore_serialization_ChunkedCompression_hpp_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFuture>
+#include <QtCore/QIODevice>
+#include <QtCore/QQueue>
+#include <QtCore/QVector>
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+namespace Kore { namespace serialization {
+
+/*
+ * Chunked compression container.
+ *
+ * The data is cut into chunks of a fixed uncompressed size, compressed
+ * independently with qCompress. An index of the chunks is written at the
+ * end, so that any uncompressed position can be reached by decompressing a
+ * single chunk:
+ *
+ *  u32 magic 'KCMP', u8 version, u32 chunk size
+ *  for each chunk: u32 compressed size, compressed data
+ *  for each chunk: u64 offset of the chunk from the beginning of the container
+ *  u32 chunks count, u64 uncompressed size, u32 tag 'KCIX'
+ *
+ * The container must end its device.
+ */
+
+/*!
+ * @brief Write only device compressing the data into a chunked container.
+ *
+ * Full chunks are compressed by the global thread pool while the next ones
+ * are filled, and written in order. The container is completed by close().
+ */
+class KoreExport ChunkedCompressor : public QIODevice
+{
+public:
+    /*!
+     * @param device    The device to write to, from its current position.
+     * @param chunkSize Uncompressed size of a chunk.
+     * @param level     Compression level, as for qCompress.
+     */
+    ChunkedCompressor( QIODevice* device,
+                       qint64 chunkSize = 256 * _K_1KB,
+                       int level = -1 );
+    virtual ~ChunkedCompressor();
+
+    /*!
+     * @brief Open in WriteOnly mode, writing the container header.
+     */
+    virtual bool open( OpenMode mode );
+    /*!
+     * @brief Write the remaining chunks and the index.
+     */
+    virtual void close();
+
+    virtual bool isSequential() const;
+
+    /*!
+     * @brief Whether writing to the underlying device failed.
+     */
+    kbool hasError() const;
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize );
+    virtual qint64 writeData( const char* data, qint64 size );
+
+private:
+    void submitChunk();
+    void writeChunk( const QByteArray& compressed );
+
+private:
+    QIODevice*                  _device;
+    qint64                      _chunkSize;
+    int                         _level;
+    kbool                       _error;
+
+    qint64                      _written;       //!< In the container
+    qint64                      _size;          //!< Uncompressed
+    QByteArray                  _chunk;         //!< Being filled
+    QQueue< QFuture< QByteArray > > _pending;   //!< Being compressed
+    int                         _maxPending;
+    QVector< quint64 >          _offsets;       //!< Of the written chunks
+};
+
+/*!
+ * @brief Random access read only device over a chunked container.
+ *
+ * Chunks are decompressed on demand, the following chunk is decompressed
+ * ahead by the global thread pool.
+ */
+class KoreExport ChunkedDecompressor : public QIODevice
+{
+public:
+    /*!
+     * @param device    The device to read from, at the beginning of the
+     *                  container. It must support random access.
+     */
+    ChunkedDecompressor( QIODevice* device );
+    virtual ~ChunkedDecompressor();
+
+    /*!
+     * @brief Whether the device holds a chunked container at its current
+     *        position.
+     */
+    static kbool IsCompressed( QIODevice* device );
+
+    /*!
+     * @brief Open in ReadOnly mode, reading the index of the container.
+     * @return false if the container is invalid.
+     */
+    virtual bool open( OpenMode mode );
+
+    virtual bool isSequential() const;
+    virtual qint64 size() const;
+
+    /*!
+     * @brief Position right after the container in the underlying device.
+     */
+    qint64 containerEnd() const;
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize );
+    virtual qint64 writeData( const char* data, qint64 size );
+
+private:
+    kbool readChunk( int index, QByteArray* compressed );
+    kbool loadChunk( int index );
+
+private:
+    QIODevice*                  _device;
+    qint64                      _containerPos;
+    qint64                      _containerEnd;
+    qint64                      _chunkSize;
+    qint64                      _size;          //!< Uncompressed
+    QVector< quint64 >          _offsets;
+
+    int                         _current;       //!< Index of _chunk
+    QByteArray                  _chunk;
+    int                         _ahead;         //!< Index of _aheadChunk
+    QFuture< QByteArray >       _aheadChunk;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_ChunkedCompression_hpp_
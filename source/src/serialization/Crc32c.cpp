@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QGlobalStatic>
+
+#include <cstring>
+
+#include "Crc32c.hpp"
+
+#include <system/CPU.hpp>
+
+using namespace Kore::serialization;
+
+// Reversed Castagnoli polynomial
+#define CRC32C_POLYNOMIAL           0x82F63B78
+
+namespace {
+
+struct Crc32cTable
+{
+    Crc32cTable()
+    {
+        for( quint32 i = 0; i < 256; ++i )
+        {
+            quint32 crc = i;
+            for( int bit = 0; bit < 8; ++bit )
+            {
+                crc = ( crc & 1 ) ? ( ( crc >> 1 ) ^ CRC32C_POLYNOMIAL )
+                                  : ( crc >> 1 );
+            }
+            values[ i ] = crc;
+        }
+    }
+
+    quint32 values[ 256 ];
+};
+
+Q_GLOBAL_STATIC( Crc32cTable, crc32cTable )
+
+quint32 SoftwareCrc32c( quint32 crc, const uchar* data, qint64 size )
+{
+    const quint32* table = crc32cTable()->values;
+    for( ; size > 0; --size, ++data )
+    {
+        crc = table[ ( crc ^ *data ) & 0xFF ] ^ ( crc >> 8 );
+    }
+    return crc;
+}
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#   define HARDWARE_CRC32C
+
+// The instruction is emitted directly, the code needs no -msse4.2
+quint32 HardwareCrc32c( quint32 crc, const uchar* data, qint64 size )
+{
+#   if defined( __x86_64__ )
+    quint64 crc64 = crc;
+    for( ; size >= 8; size -= 8, data += 8 )
+    {
+        quint64 word;
+        memcpy( & word, data, sizeof( word ) );
+        asm( "crc32q %1, %0" : "+r" ( crc64 ) : "rm" ( word ) );
+    }
+    crc = static_cast< quint32 >( crc64 );
+#   endif
+
+    for( ; size >= 4; size -= 4, data += 4 )
+    {
+        quint32 word;
+        memcpy( & word, data, sizeof( word ) );
+        asm( "crc32l %1, %0" : "+r" ( crc ) : "rm" ( word ) );
+    }
+
+    for( ; size > 0; --size, ++data )
+    {
+        asm( "crc32b %1, %0" : "+r" ( crc ) : "rm" ( *data ) );
+    }
+
+    return crc;
+}
+
+#elif defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+#   define HARDWARE_CRC32C
+#   include <nmmintrin.h>
+
+quint32 HardwareCrc32c( quint32 crc, const uchar* data, qint64 size )
+{
+#   if defined( _M_X64 )
+    quint64 crc64 = crc;
+    for( ; size >= 8; size -= 8, data += 8 )
+    {
+        quint64 word;
+        memcpy( & word, data, sizeof( word ) );
+        crc64 = _mm_crc32_u64( crc64, word );
+    }
+    crc = static_cast< quint32 >( crc64 );
+#   endif
+
+    for( ; size >= 4; size -= 4, data += 4 )
+    {
+        quint32 word;
+        memcpy( & word, data, sizeof( word ) );
+        crc = _mm_crc32_u32( crc, word );
+    }
+
+    for( ; size > 0; --size, ++data )
+    {
+        crc = _mm_crc32_u8( crc, *data );
+    }
+
+    return crc;
+}
+
+#endif
+
+}
+
+quint32 Crc32c::Compute( const char* data, qint64 size, quint32 crc )
+{
+    const uchar* bytes = reinterpret_cast< const uchar* >( data );
+
+    crc = ~crc;
+#ifdef HARDWARE_CRC32C
+    if( IsAccelerated() )
+    {
+        return ~HardwareCrc32c( crc, bytes, size );
+    }
+#endif
+    return ~SoftwareCrc32c( crc, bytes, size );
+}
+
+kbool Crc32c::IsAccelerated()
+{
+#ifdef HARDWARE_CRC32C
+    static const kbool accelerated = Kore::system::CPU().isSSE42Enabled();
+    return accelerated;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_Crc32c_hpp_
+#define _Kore_serialization_Crc32c_hpp_
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+namespace Kore { namespace serialization {
+
+/*!
+ * @brief CRC-32C (Castagnoli) checksums, as used in the block frames.
+ *
+ * The checksum is computed with the SSE4.2 crc32 instruction when the CPU
+ * supports it, see Kore::system::CPU::isSSE42Enabled(), and with a lookup
+ * table otherwise. Both give the same results.
+ */
+class KoreExport Crc32c
+{
+public:
+    /*!
+     * @brief Checksum of the data.
+     *
+     * @param crc   Checksum of the preceding data, to compute the checksum of
+     *              a sequence of buffers.
+     */
+    static quint32 Compute( const char* data, qint64 size, quint32 crc = 0 );
+
+    /*!
+     * @brief Whether the checksums are computed by the CPU.
+     */
+    static kbool IsAccelerated();
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_Crc32c_hpp_
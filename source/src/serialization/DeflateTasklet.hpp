@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_DeflateTasklet_hpp_
+#define _Kore_serialization_DeflateTasklet_hpp_
+
+#include "SerializerTasklet.hpp"
+
+namespace Kore { namespace serialization {
+
+/*!
+ * @brief Deflate a tree to the device, see SerializerTasklet.
+ *
+ * The tree is read by the thread running the tasklet. The output is a
+ * snapshot of the tree as it was when the tasklet started, provided that the
+ * tree is not modified nor deleted until the tasklet ended: the tasklet does
+ * not lock it. Lazily inflated trees must be loaded beforehand, libraries can
+ * not be loaded by another thread. To keep editing the tree meanwhile, deflate
+ * a copy, or a checkpoint of a Journal.
+ *
+ * The total of the progress is the size of the tree. The output is not
+ * usable if the tasklet did not complete.
+ */
+class KoreExport DeflateTasklet : public SerializerTasklet
+{
+    Q_OBJECT
+    K_TASKLET
+
+public:
+    DeflateTasklet();
+
+    inline const Kore::data::Block* tree() const { return _tree; }
+    void setTree( const Kore::data::Block* tree );
+
+protected:
+    virtual int process( TreeSerializerMonitor* monitor );
+
+private:
+    const Kore::data::Block* _tree;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_DeflateTasklet_hpp_
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "InflateFilter.hpp"
+
+#include <data/MetaBlock.hpp>
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+
+InflateFilter::InflateFilter()
+    : _maxDepth( -1 )
+{
+}
+
+InflateFilter::~InflateFilter()
+{
+}
+
+const QList< const MetaBlock* >& InflateFilter::metaBlocks() const
+{
+    return _metaBlocks;
+}
+
+void InflateFilter::addMetaBlock( const MetaBlock* mb )
+{
+    if( ( K_NULL != mb ) && ! _metaBlocks.contains( mb ) )
+    {
+        _metaBlocks.append( mb );
+    }
+}
+
+kint InflateFilter::maxDepth() const
+{
+    return _maxDepth;
+}
+
+void InflateFilter::setMaxDepth( kint depth )
+{
+    _maxDepth = depth;
+}
+
+InflateFilter::Decision InflateFilter::accept( const MetaBlock* mb,
+                                               const QList< kint >& path ) const
+{
+    Q_UNUSED( mb );
+    Q_UNUSED( path );
+
+    return Accept;
+}
+
+InflateFilter::Decision InflateFilter::decide( const MetaBlock* mb,
+                                               const QList< kint >& path ) const
+{
+    if( ( _maxDepth >= 0 ) && ( path.size() > _maxDepth ) )
+    {
+        return RejectSubtree;
+    }
+
+    if( K_NULL == mb )
+    {
+        return Reject;
+    }
+
+    if( ! _metaBlocks.isEmpty() )
+    {
+        // Look for an allowed type among the ancestors of the block's type
+        const MetaBlock* allowed = mb;
+        while( ( K_NULL != allowed ) && ! _metaBlocks.contains( allowed ) )
+        {
+            allowed = allowed->superMetaBlock();
+        }
+
+        if( K_NULL == allowed )
+        {
+            return Reject;
+        }
+    }
+
+    return accept( mb, path );
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_InflateFilter_hpp_
+#define _Kore_serialization_InflateFilter_hpp_
+
+#include <QtCore/QList>
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+namespace Kore {
+
+namespace data { class MetaBlock; }
+
+namespace serialization {
+
+/*!
+ * @brief Selection of the blocks inflated by KoreSerializer::inflateFiltered().
+ *
+ * A block is accepted when its type is one of the allowed types, or inherits
+ * from one of them, when it is not deeper than the max depth, and when
+ * accept() agrees. Rejected blocks are skipped without being instantiated.
+ */
+class KoreExport InflateFilter
+{
+public:
+    enum Decision
+    {
+        /// Inflate the block.
+        Accept,
+        /// Skip the block, its children are filtered in turn.
+        Reject,
+        /// Skip the block along with its whole subtree.
+        RejectSubtree
+    };
+
+public:
+    InflateFilter();
+    virtual ~InflateFilter();
+
+    /*!
+     * @brief Allowed block types, any type if empty.
+     */
+    const QList< const Kore::data::MetaBlock* >& metaBlocks() const;
+    void addMetaBlock( const Kore::data::MetaBlock* mb );
+
+    /*!
+     * @brief Depth of the deepest blocks inflated, the root being at depth 0.
+     *
+     * Deeper subtrees are skipped at once. -1, the default, means no limit.
+     */
+    kint maxDepth() const;
+    void setMaxDepth( kint depth );
+
+    /*!
+     * @brief Decide on a block of an allowed type, within the max depth.
+     *
+     * The default implementation accepts all of them.
+     *
+     * @param path  Index of the block in the children of each of its
+     *              ancestors in the serialized tree, from the root.
+     */
+    virtual Decision accept( const Kore::data::MetaBlock* mb,
+                             const QList< kint >& path ) const;
+
+    /*!
+     * @brief Decide on a block, K_NULL if its type is not known.
+     *
+     * Blocks of unknown types are rejected, their children are filtered.
+     */
+    Decision decide( const Kore::data::MetaBlock* mb,
+                     const QList< kint >& path ) const;
+
+private:
+    QList< const Kore::data::MetaBlock* >   _metaBlocks;
+    kint                                    _maxDepth;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_InflateFilter_hpp_
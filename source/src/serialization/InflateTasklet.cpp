@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QThread>
+
+#include "InflateTasklet.hpp"
+
+#include <data/Block.hpp>
+
+#include <KoreModule.hpp>
+
+#define K_TASKLET_SUPER_TYPE Kore::serialization::SerializerTasklet
+#define K_TASKLET_TYPE Kore::serialization::InflateTasklet
+#include <parallel/TaskletMacros.hpp>
+K_TASKLET_IMPLEMENTATION
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+
+InflateTasklet::InflateTasklet()
+    : _tree( K_NULL )
+{
+}
+
+InflateTasklet::~InflateTasklet()
+{
+    delete _tree;
+}
+
+Block* InflateTasklet::takeTree()
+{
+    Block* tree = _tree;
+    _tree = K_NULL;
+    return tree;
+}
+
+int InflateTasklet::process( TreeSerializerMonitor* monitor )
+{
+    if( K_NULL == device() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    delete _tree;
+    _tree = K_NULL;
+
+    Block* tree = K_NULL;
+    const int err = serializer().inflate( device(), & tree, monitor );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // Blocks are QObjects, give the tree to the thread of the tasklet
+    tree->moveToThread( thread() );
+    _tree = tree;
+
+    return TreeSerializer::NoError;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_InflateTasklet_hpp_
+#define _Kore_serialization_InflateTasklet_hpp_
+
+#include "SerializerTasklet.hpp"
+
+namespace Kore { namespace serialization {
+
+/*!
+ * @brief Inflate a tree from the device, see SerializerTasklet.
+ *
+ * The tree is built by the thread running the tasklet, then handed to the
+ * thread of the tasklet. The total of the progress is the blocks count of the
+ * metadata, it is not known in the streaming layout. A canceled or failed
+ * inflate frees everything it built.
+ */
+class KoreExport InflateTasklet : public SerializerTasklet
+{
+    Q_OBJECT
+    K_TASKLET
+
+public:
+    InflateTasklet();
+    virtual ~InflateTasklet();
+
+    /*!
+     * @brief The inflated tree, owned by the tasklet. K_NULL until the tasklet
+     *        completed.
+     */
+    inline Kore::data::Block* tree() const { return _tree; }
+
+    /*!
+     * @brief Take the ownership of the inflated tree.
+     */
+    Kore::data::Block* takeTree();
+
+protected:
+    virtual int process( TreeSerializerMonitor* monitor );
+
+private:
+    Kore::data::Block* _tree;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_InflateTasklet_hpp_
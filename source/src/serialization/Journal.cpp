@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QFileDevice>
+#include <QtCore/QStack>
+#include <QtCore/QtEndian>
+#include <QtCore/QVarLengthArray>
+
+#include <QtConcurrent/QtConcurrent>
+
+#if defined( Q_OS_WIN )
+#   include <io.h>
+#else
+#   include <unistd.h>
+#endif
+
+#include "ByteReader.hpp"
+#include "Journal.hpp"
+
+#include <data/Block.hpp>
+#include <data/Library.hpp>
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+
+#define JOURNAL_MAGIC               ( K_FOURCC( 'K', 'J', 'N', 'L' ) )
+#define JOURNAL_VERSION             1
+#define JOURNAL_HEADER_SIZE         5
+
+// Record kinds
+#define JOURNAL_PROPERTIES          0x1
+#define JOURNAL_ADD                 0x2
+#define JOURNAL_REMOVE              0x3
+#define JOURNAL_MOVE                0x4
+#define JOURNAL_SWAP                0x5
+#define JOURNAL_CLEAR               0x6
+
+namespace {
+
+void WriteVariableLength32( QDataStream& stream, quint32 value )
+{
+    quint32 lVal;
+    quint8 val;
+
+    for( lVal = value; lVal > 0x7f; lVal >>= 7 )
+    {
+        val = ( ( lVal & 0x7f ) | 0x80 );
+        stream << val;
+    }
+    val = lVal & 0x7f;
+    stream << val;
+}
+
+/*
+ * Write the checkpoint, and make sure it reached the disk when it is a file.
+ */
+int WriteCheckpoint( QIODevice* device, QByteArray data, int err )
+{
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    if( device->write( data ) != data.size() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    QFileDevice* file = qobject_cast< QFileDevice* >( device );
+    if( K_NULL == file )
+    {
+        return TreeSerializer::NoError;
+    }
+
+    if( ! file->flush() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+#if defined( Q_OS_WIN )
+    const kbool synced = ( 0 == _commit( file->handle() ) );
+#else
+    const kbool synced = ( 0 == fsync( file->handle() ) );
+#endif
+
+    return synced ? TreeSerializer::NoError : TreeSerializer::IOError;
+}
+
+/*
+ * Follow the path of a record from the root, K_NULL if there is no such
+ * block.
+ */
+Block* ReadPath( ByteReader& reader, Block* tree )
+{
+    Block* b = tree;
+
+    const quint32 depth = reader.readVariableLength32();
+    for( quint32 i = 0; ( K_NULL != b ) && ( i < depth ); ++i )
+    {
+        const quint32 index = reader.readVariableLength32();
+
+        Library* lib = b->isLibrary() ? static_cast< Library* >( b )
+                                      : K_NULL;
+        b = ( ( K_NULL != lib ) &&
+              ( index < static_cast< quint32 >( lib->size() ) ) )
+                ? lib->at( index )
+                : K_NULL;
+    }
+
+    return reader.hasError() ? K_NULL : b;
+}
+
+int ReplayRecord( const QByteArray& record,
+                  Block* tree,
+                  TreeSerializerMonitor* monitor,
+                  const KoreSerializer& serializer )
+{
+    ByteReader reader( record.constData(), record.size() );
+
+    // Properties and subtrees are read by the serializer
+    QBuffer data;
+    data.setData( record );
+    data.open( QIODevice::ReadOnly );
+
+    const quint8 kind = reader.readUInt8();
+    Block* b = ReadPath( reader, tree );
+    if( K_NULL == b )
+    {
+        return reader.hasError() ? TreeSerializer::InvalidData
+                                 : TreeSerializer::BlockNotFound;
+    }
+
+    if( JOURNAL_PROPERTIES == kind )
+    {
+        data.seek( reader.pos() );
+        return serializer.inflateProperties( & data, b, monitor );
+    }
+
+    if( ! b->isLibrary() )
+    {
+        return TreeSerializer::BlockNotFound;
+    }
+
+    Library* lib = static_cast< Library* >( b );
+    if( JOURNAL_CLEAR == kind )
+    {
+        lib->clear();
+        return TreeSerializer::NoError;
+    }
+
+    const quint32 size = static_cast< quint32 >( lib->size() );
+
+    const quint32 first = reader.readVariableLength32();
+    const quint32 second = ( ( JOURNAL_MOVE == kind ) ||
+                             ( JOURNAL_SWAP == kind ) )
+                                ? reader.readVariableLength32()
+                                : 0;
+    if( reader.hasError() )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    switch( kind )
+    {
+    case JOURNAL_ADD:
+    {
+        if( first > size )
+        {
+            return TreeSerializer::BlockNotFound;
+        }
+
+        data.seek( reader.pos() );
+        Block* added = K_NULL;
+        const int err = serializer.inflate( & data, & added, monitor );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        lib->insertBlock( added, first );
+        return TreeSerializer::NoError;
+    }
+    case JOURNAL_REMOVE:
+    {
+        if( first >= size )
+        {
+            return TreeSerializer::BlockNotFound;
+        }
+
+        Block* removed = lib->at( first );
+        lib->removeBlock( removed );
+        if( ! removed->checkFlag( Block::Static ) )
+        {
+            delete removed;
+        }
+        return TreeSerializer::NoError;
+    }
+    case JOURNAL_MOVE:
+    case JOURNAL_SWAP:
+        if( ( first >= size ) || ( second >= size ) )
+        {
+            return TreeSerializer::BlockNotFound;
+        }
+
+        ( JOURNAL_MOVE == kind )
+            ? lib->moveBlock( lib->at( first ), second )
+            : lib->swapBlocks( lib->at( first ), lib->at( second ) );
+        return TreeSerializer::NoError;
+    default:
+        return TreeSerializer::InvalidData;
+    }
+}
+
+} // namespace
+
+Journal::Journal( const KoreSerializer& serializer )
+    : _serializer( serializer )
+    , _recordSerializer( KoreSerializer::Streamable )
+    , _tree( K_NULL )
+    , _log( K_NULL )
+    , _logFile( K_NULL )
+    , _error( TreeSerializer::NoError )
+    , _recordDevice( & _record )
+    , _recordStream( & _recordDevice )
+{
+    _recordDevice.open( QIODevice::WriteOnly );
+    _recordStream.setVersion( QDataStream::Qt_5_1 );
+}
+
+Journal::~Journal()
+{
+    detach();
+}
+
+int Journal::attach( Block* tree, QIODevice* log )
+{
+    detach();
+
+    _error = startLog( log );
+    if( TreeSerializer::NoError != _error )
+    {
+        return _error;
+    }
+
+    _tree = tree;
+    watch( tree );
+
+    return TreeSerializer::NoError;
+}
+
+void Journal::detach()
+{
+    if( K_NULL != _tree )
+    {
+        unwatch( _tree );
+    }
+
+    _tree = K_NULL;
+    _log = K_NULL;
+    _logFile = K_NULL;
+}
+
+QFuture< int > Journal::checkpoint( QIODevice* checkpoint, QIODevice* log )
+{
+    int err = ( K_NULL == _tree ) ? TreeSerializer::UnsupportedOperation
+                                  : _error;
+
+    // Deflate to memory now, the tree may be edited while the data is written
+    QByteArray data;
+    if( TreeSerializer::NoError == err )
+    {
+        QBuffer buffer( & data );
+        buffer.open( QIODevice::WriteOnly );
+        err = _serializer.deflate( & buffer, _tree, K_NULL );
+    }
+
+    if( TreeSerializer::NoError == err )
+    {
+        // The next edits are relative to the checkpoint
+        _error = startLog( log );
+        err = _error;
+    }
+
+    return QtConcurrent::run( WriteCheckpoint, checkpoint, data, err );
+}
+
+int Journal::Replay( QIODevice* checkpoint,
+                     QIODevice* log,
+                     Block** tree,
+                     TreeSerializerMonitor* monitor,
+                     const KoreSerializer& serializer )
+{
+    Block* root = K_NULL;
+    int err = serializer.inflate( checkpoint, & root, monitor );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // An empty log has no header, nor records
+    const QByteArray header = log->read( JOURNAL_HEADER_SIZE );
+    ByteReader headerReader( header.constData(), header.size() );
+    if( ! header.isEmpty() &&
+        ( ( JOURNAL_MAGIC != headerReader.readUInt32() ) ||
+          ( JOURNAL_VERSION != headerReader.readUInt8() ) ||
+          headerReader.hasError() ) )
+    {
+        err = TreeSerializer::InvalidData;
+    }
+
+    while( ( TreeSerializer::NoError == err ) && ! log->atEnd() )
+    {
+        // A truncated record was being written when the process stopped, the
+        // edit was not complete.
+        uchar size[ sizeof( quint32 ) ];
+        const qint64 sizeSize = sizeof( size );
+        if( log->read( reinterpret_cast< char* >( size ), sizeSize )
+                != sizeSize )
+        {
+            break;
+        }
+
+        const qint64 recordSize = qFromBigEndian< quint32 >( size );
+        const QByteArray record = log->read( recordSize );
+        if( record.size() != recordSize )
+        {
+            break;
+        }
+
+        err = ReplayRecord( record, root, monitor, serializer );
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        delete root;
+        return err;
+    }
+
+    *tree = root;
+
+    return TreeSerializer::NoError;
+}
+
+void Journal::blockChanged()
+{
+    const Block* block = static_cast< const Block* >( sender() );
+
+    if( beginRecord( JOURNAL_PROPERTIES, block ) )
+    {
+        _error = _serializer.deflateProperties( & _recordDevice, block,
+                                                K_NULL );
+        endRecord();
+    }
+}
+
+void Journal::blockAdded( kint index )
+{
+    Library* lib = static_cast< Library* >( sender() );
+    Block* added = lib->at( index );
+
+    watch( added );
+
+    // Loaded children were in the tree already
+    if( lib->checkFlag( Library::Loading ) )
+    {
+        return;
+    }
+
+    if( beginRecord( JOURNAL_ADD, lib ) )
+    {
+        WriteVariableLength32( _recordStream, index );
+        _error = _recordSerializer.deflate( & _recordDevice, added, K_NULL );
+        endRecord();
+    }
+}
+
+void Journal::removingBlock( kint index )
+{
+    Library* lib = static_cast< Library* >( sender() );
+
+    unwatch( lib->at( index ) );
+
+    // Unloaded children remain in the tree
+    if( lib->checkFlag( Library::Loading ) )
+    {
+        return;
+    }
+
+    if( beginRecord( JOURNAL_REMOVE, lib ) )
+    {
+        WriteVariableLength32( _recordStream, index );
+        endRecord();
+    }
+}
+
+void Journal::clearing()
+{
+    Library* lib = static_cast< Library* >( sender() );
+
+    // Loaded libraries are cleared child by child, see removingBlock(). An
+    // unloaded one is cleared at once, it is empty when clearing() is emitted.
+    if( lib->checkFlag( Library::Loading ) || ! lib->isEmpty() )
+    {
+        return;
+    }
+
+    if( beginRecord( JOURNAL_CLEAR, lib ) )
+    {
+        endRecord();
+    }
+}
+
+void Journal::blockMoved( kint from, kint to )
+{
+    if( beginRecord( JOURNAL_MOVE, static_cast< Block* >( sender() ) ) )
+    {
+        WriteVariableLength32( _recordStream, from );
+        WriteVariableLength32( _recordStream, to );
+        endRecord();
+    }
+}
+
+void Journal::blocksSwapped( kint index1, kint index2 )
+{
+    if( beginRecord( JOURNAL_SWAP, static_cast< Block* >( sender() ) ) )
+    {
+        WriteVariableLength32( _recordStream, index1 );
+        WriteVariableLength32( _recordStream, index2 );
+        endRecord();
+    }
+}
+
+void Journal::watch( Block* block )
+{
+    QStack< Block* > blocks;
+    blocks.push( block );
+
+    while( ! blocks.empty() )
+    {
+        Block* b = blocks.pop();
+
+        // A block added while its library is loaded may be watched already
+        connect( b, &Block::blockChanged, this, &Journal::blockChanged,
+                 Qt::UniqueConnection );
+
+        if( ! b->isLibrary() )
+        {
+            continue;
+        }
+
+        Library* lib = static_cast< Library* >( b );
+        connect( lib, &Library::blockAdded, this, &Journal::blockAdded,
+                 Qt::UniqueConnection );
+        connect( lib, &Library::removingBlock,
+                 this, &Journal::removingBlock, Qt::UniqueConnection );
+        connect( lib, &Library::clearing, this, &Journal::clearing,
+                 Qt::UniqueConnection );
+        connect( lib, &Library::blockMoved, this, &Journal::blockMoved,
+                 Qt::UniqueConnection );
+        connect( lib, &Library::blocksSwapped,
+                 this, &Journal::blocksSwapped, Qt::UniqueConnection );
+
+        // The children are watched when the library is loaded, by
+        // blockAdded()
+        if( ! lib->isLoaded() )
+        {
+            continue;
+        }
+
+        for( kint i = 0; i < lib->size(); ++i )
+        {
+            blocks.push( lib->at( i ) );
+        }
+    }
+}
+
+void Journal::unwatch( Block* block )
+{
+    QStack< Block* > blocks;
+    blocks.push( block );
+
+    while( ! blocks.empty() )
+    {
+        Block* b = blocks.pop();
+        disconnect( b, K_NULL, this, K_NULL );
+
+        // Libraries not loaded have no children to unwatch
+        if( b->isLibrary() && static_cast< Library* >( b )->isLoaded() )
+        {
+            Library* lib = static_cast< Library* >( b );
+            for( kint i = 0; i < lib->size(); ++i )
+            {
+                blocks.push( lib->at( i ) );
+            }
+        }
+    }
+}
+
+int Journal::startLog( QIODevice* log )
+{
+    _log = log;
+    _logFile = qobject_cast< QFileDevice* >( log );
+
+    QDataStream stream( log );
+    stream.setVersion( QDataStream::Qt_5_1 );
+    stream << static_cast< quint32 >( JOURNAL_MAGIC );
+    stream << static_cast< quint8 >( JOURNAL_VERSION );
+
+    if( ( QDataStream::Ok != stream.status() ) ||
+        ( ( K_NULL != _logFile ) && ! _logFile->flush() ) )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+kbool Journal::beginRecord( quint8 kind, const Block* block )
+{
+    if( ( K_NULL == _tree ) || ( TreeSerializer::NoError != _error ) )
+    {
+        return false;
+    }
+
+    // Indices from the block up to the root
+    QVarLengthArray< quint32, 16 > path;
+    for( const Block* b = block; b != _tree; b = b->library() )
+    {
+        if( K_NULL == b )
+        {
+            // Not in the tree
+            return false;
+        }
+        path.append( b->index() );
+    }
+
+    // Blank size, completed by endRecord()
+    _recordDevice.seek( 0 );
+    _recordStream << quint32( 0 ) << kind;
+
+    WriteVariableLength32( _recordStream, path.size() );
+    for( int i = path.size() - 1; i >= 0; --i )
+    {
+        WriteVariableLength32( _recordStream, path.at( i ) );
+    }
+
+    return true;
+}
+
+void Journal::endRecord()
+{
+    if( TreeSerializer::NoError != _error )
+    {
+        return;
+    }
+
+    // The record buffer is never truncated, only its beginning is used
+    const qint64 size = _recordDevice.pos();
+    qToBigEndian< quint32 >( static_cast< quint32 >( size - sizeof( quint32 ) ),
+                             reinterpret_cast< uchar* >( _record.data() ) );
+
+    // A single write, so that a crash can only truncate the last record
+    if( ( _log->write( _record.constData(), size ) != size ) ||
+        ( ( K_NULL != _logFile ) && ! _logFile->flush() ) )
+    {
+        _error = TreeSerializer::IOError;
+    }
+}
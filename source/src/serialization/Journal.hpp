@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_Journal_hpp_
+#define _Kore_serialization_Journal_hpp_
+
+#include <QtCore/QBuffer>
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QFuture>
+#include <QtCore/QIODevice>
+#include <QtCore/QObject>
+
+#include "KoreSerializer.hpp"
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+class QFileDevice;
+
+namespace Kore {
+
+namespace data { class Block; class Library; }
+
+namespace serialization {
+
+/*
+ * Journal.
+ *
+ * Every edit of the tree is appended to the log as a record, the blocks being
+ * located by their path of indices from the root:
+ *
+ *  u32 magic 'KJNL', u8 version
+ *  for each record: u32 size, u8 kind, varint depth, varint indices, data
+ *
+ *  Properties: the properties, see KoreSerializer::deflateProperties()
+ *  Add:        varint index, the added subtree in the streaming layout
+ *  Remove:     varint index
+ *  Move:       varint from, varint to
+ *  Swap:       varint index1, varint index2
+ *  Clear:      nothing, the library was not loaded
+ *
+ * A record truncated by a crash ends the log.
+ */
+
+/*!
+ * @brief Append-only log of the edits made to a tree.
+ *
+ * The journal watches the blocks of the tree: property changes are reported
+ * by Block::markDirty(), structural edits by the libraries signals. Each edit
+ * is appended to the log right away with a single write, the log being
+ * flushed when it is a file. The tree is rebuilt by Replay() from the last
+ * checkpoint and its log.
+ *
+ * The indices in the log are the positions of the blocks in their library,
+ * all the blocks of the tree should be serializable. The libraries of a
+ * lazily inflated tree are watched as they are loaded: loading or unloading
+ * them is not an edit, see Library::Loading.
+ */
+class KoreExport Journal : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*!
+     * @param serializer    Serializer of the checkpoints.
+     */
+    Journal( const KoreSerializer& serializer = KoreSerializer() );
+    virtual ~Journal();
+
+    /*!
+     * @brief Start logging the edits of the tree.
+     *
+     * The tree must match the last checkpoint, and must not be deleted
+     * before detach() is called.
+     *
+     * @param log   The device to append the records to, from its current
+     *              position.
+     */
+    int attach( Kore::data::Block* tree, QIODevice* log );
+
+    /*!
+     * @brief Stop logging.
+     */
+    void detach();
+
+    inline Kore::data::Block* tree() const { return _tree; }
+
+    /*!
+     * @brief The first error met while logging, the following edits are not
+     *        logged then.
+     */
+    inline int error() const { return _error; }
+
+    /*!
+     * @brief Write a checkpoint and continue logging in a new log.
+     *
+     * The tree is deflated to memory right away, then written to the device
+     * by the global thread pool, so that the tree can be edited meanwhile.
+     * A file is synced to the disk before the future finishes. The new log
+     * starts right away: the previous checkpoint and its log must be kept
+     * until the result of the future is NoError, a failed checkpoint leaves
+     * them the only way to replay the edits.
+     *
+     * @param checkpoint    The device to write the checkpoint to.
+     * @param log           The log of the edits made after the checkpoint.
+     */
+    QFuture< int > checkpoint( QIODevice* checkpoint, QIODevice* log );
+
+    /*!
+     * @brief Rebuild a tree from a checkpoint and its log.
+     */
+    static int Replay( QIODevice* checkpoint,
+                       QIODevice* log,
+                       Kore::data::Block** tree,
+                       TreeSerializerMonitor* monitor,
+                       const KoreSerializer& serializer = KoreSerializer() );
+
+private slots:
+    void blockChanged();
+    void blockAdded( kint index );
+    void removingBlock( kint index );
+    void clearing();
+    void blockMoved( kint from, kint to );
+    void blocksSwapped( kint index1, kint index2 );
+
+private:
+    void watch( Kore::data::Block* block );
+    void unwatch( Kore::data::Block* block );
+
+    int startLog( QIODevice* log );
+    kbool beginRecord( quint8 kind, const Kore::data::Block* block );
+    void endRecord();
+
+private:
+    KoreSerializer          _serializer;
+    KoreSerializer          _recordSerializer;  //!< Added subtrees
+
+    Kore::data::Block*      _tree;
+    QIODevice*              _log;
+    QFileDevice*            _logFile;           //!< K_NULL if not a file
+    int                     _error;
+
+    QByteArray              _record;            //!< Being written
+    QBuffer                 _recordDevice;
+    QDataStream             _recordStream;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_Journal_hpp_
@@ -25,134 +25,127 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <QtCore/QBuffer>
-#include <QtCore/QDataStream>
-#include <QtCore/QList>
-#include <QtCore/QMap>
 #include <QtCore/QMetaObject>
+#include <QtCore/QtEndian>
 #include <QtCore/QStack>
-#include <QtCore/QStringList>
-#include <QtCore/QVector>
 
+#include "Crc32c.hpp"
 #include "KoreSerializer.hpp"
+#include "KoreSerializerPrivate.hpp"
+#include "PropertyCodecs.hpp"
+#include "WriteBehind.hpp"
 
 #include <KoreEngine.hpp>
 
 #include <data/Block.hpp>
+#include <data/Library.hpp>
+#include <data/LibraryLoader.hpp>
 #include <data/MetaBlock.hpp>
 
+#include <memory/BlockArena.hpp>
+
 #include <plugin/Module.hpp>
 
 using namespace Kore;
 using namespace Kore::data;
+using namespace Kore::memory;
 using namespace Kore::plugin;
 using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+#define END_OF_STREAM               ( K_FOURCC( 'K', 'E', 'N', 'D' ) )
 
-#define CREATE_STREAM( name, device ) \
-    QDataStream name( device );\
-    name.setVersion( QDataStream::Qt_5_1 )
+// Streaming layout
+#define STREAM_MAGIC                ( K_FOURCC( 'K', 'S', 'T', 'M' ) )
+#define STREAM_VERSION              1
+// Records found in place of a block type
+#define STREAM_METABLOCK_RECORD     0x7FFFFFFF
+#define STREAM_END_RECORD           0x7FFFFFFE
 
-#define LIBRARY_HAS_CHILDREN_FLAG   0x80000000
-#define LIBRARY_HAS_CHILREN_MASK    0x7FFFFFFF
+// Shorter runs of leaf blocks are written block by block
+#define COLUMNS_MIN_RUN             8
 
-#define END_OF_STREAM               ( K_FOURCC( 'K', 'E', 'N', 'D' ) )
+// Blocks between two progress reports
+#define PROGRESS_INTERVAL           64
 
 namespace {
 
-void WriteVariableLength32( QDataStream& stream, quint32 value )
+int WriteMetaData( Context& ctx )
 {
-    quint32 lVal;
-    quint8 val;
+    // Build the metadata in memory first, the device position can not be used
+    // to compute its size on sequential devices.
+    QByteArray metaData;
+    QBuffer metaDataDevice( & metaData );
+    metaDataDevice.open( QIODevice::WriteOnly );
 
-    for( lVal = value; lVal > 0x7f; lVal >>= 7 )
+    CREATE_STREAM( metaDataStream, & metaDataDevice );
+
+    // Write the metablocks metadata
+    WriteVariableLength32( metaDataStream, ctx.metaBlocksList.size() );
+    for( int i = 0; i < ctx.metaBlocksList.size(); ++i )
     {
-        val = ( ( lVal & 0x7f ) | 0x80 );
-        stream << val;
+        metaDataStream <<
+            ctx.metaBlocksList.at( i )->blockClassName().toLatin1();
+        // TODO: Add version and compatibility version
     }
-    val = lVal & 0x7f;
-    stream << val;
-}
-
-quint32 ReadVariableLength32( QDataStream& stream )
-{
-    quint32 result = 0x0;
-    quint8 val;
 
-    int offset = 0;
+    // Write the number of serialized blocks
+    WriteVariableLength32( metaDataStream, ctx.blocksCount );
 
-    for( stream >> val; val & 0x80; stream >> val )
+    // Write the string table last, readers not knowing it stop before
+    if( K_NULL != ctx.strings )
     {
-        result |= ( ( val & 0x7f ) << offset );
-        offset += 7;
+        const QVector< QString >& strings = ctx.strings->strings;
+        WriteVariableLength32( metaDataStream, strings.size() );
+        for( int i = 0; i < strings.size(); ++i )
+        {
+            metaDataStream << strings.at( i ).toUtf8();
+        }
     }
 
-    result |= ( ( val & 0x7f ) << offset );
+    CREATE_STREAM( stream, ctx.device );
 
-    return result;
-}
+    stream.writeRawData( metaData.constData(), metaData.size() );
 
-struct Context
-{
-    Context( QByteArray* buf, QIODevice* dev, TreeSerializerMonitor* mon )
-        : buffer( buf )
-        , device( dev )
-        , monitor( mon )
-        , blocksCount( 0 )
-    { /* NOTHING */ }
+    // Write the size of the metadata
+    stream << static_cast< quint32 >( metaData.size() );
 
-    QByteArray* buffer;
+    // Write the end of stream tag
+    stream << static_cast< quint32 >( END_OF_STREAM );
+
+    if( ( QDataStream::Ok != metaDataStream.status() ) ||
+        ( QDataStream::Ok != stream.status() ) )
+    {
+        return TreeSerializer::IOError;
+    }
 
-    QIODevice* device;
-    TreeSerializerMonitor* monitor;
+    return TreeSerializer::NoError;
+}
 
-    quint32 blocksCount;
+int WriteStreamHeader( Context& ctx )
+{
+    CREATE_STREAM( stream, ctx.device );
 
-    QStringList metaBlocksNames;
-    QList< const MetaBlock* > metaBlocksList;
-    QMap< const MetaBlock*, quint32 > metaBlocks;
+    stream << static_cast< quint32 >( STREAM_MAGIC );
+    stream << static_cast< quint8 >( STREAM_VERSION );
 
-    quint32 getMetaBlockIndex( const MetaBlock* mb )
+    if( QDataStream::Ok != stream.status() )
     {
-        quint32 index = metaBlocks.value( mb, 0xffffffff );
-        if( 0xffffffff == index )
-        {
-            index = metaBlocksList.size();
-            metaBlocksList.append( mb );
-            metaBlocks.insert( mb, index );
-        }
-        return index;
+        return TreeSerializer::IOError;
     }
 
-    const MetaBlock* getMetaBlock( quint32 index )
-    {
-        return metaBlocksList.value( index, K_NULL );
-    }
-};
+    return TreeSerializer::NoError;
+}
 
-int WriteMetaData( Context& ctx )
+int WriteStreamEnd( Context& ctx )
 {
-    // Store the position
-    const qint64 startPos = ctx.device->pos();
-
     CREATE_STREAM( stream, ctx.device );
 
-    // Write the metablocks metadata
-    WriteVariableLength32( stream, ctx.metaBlocksList.size() );
-    for( int i = 0; i < ctx.metaBlocksList.size(); ++i )
-    {
-        stream << ctx.metaBlocksList.at( i )->blockClassName().toLatin1();
-        // TODO: Add version and compatibility version
-    }
+    stream << static_cast< quint32 >( STREAM_END_RECORD );
 
     // Write the number of serialized blocks
     WriteVariableLength32( stream, ctx.blocksCount );
 
-    // Write the size of the metadata
-    stream << static_cast< quint32 >( ctx.device->pos() - startPos );
-
-    // Write the end of stream tag
-    stream << static_cast< quint32 >( END_OF_STREAM );
-
     if( QDataStream::Ok != stream.status() )
     {
         return TreeSerializer::IOError;
@@ -161,82 +154,192 @@ int WriteMetaData( Context& ctx )
     return TreeSerializer::NoError;
 }
 
-int ReadMetaData( Context& ctx )
+int AddMetaBlockName( Context& ctx, const QString& blockClassStr )
 {
-    // Store the initial position in the device
-    const quint64 startPos = ctx.device->pos();
+    ctx.metaBlocksNames.append( blockClassStr );
 
-    CREATE_STREAM( stream, ctx.device );
+    const MetaBlock* mb = KoreEngine::GetMetaBlock( blockClassStr );
 
-    // Go read the metadata size
-    if( ! ctx.device->seek( ctx.device->size() - sizeof( quint32 ) ) )
+    if( ( K_NULL == mb ) &&
+        ( K_NULL != ctx.monitor ) &&
+        ( ! ctx.monitor->event( TreeSerializer::UnknownBlockType,
+                                blockClassStr ) ) )
     {
-        return TreeSerializer::SeekFailed;
+        return TreeSerializer::UnknownBlockType;
     }
 
-    // Read the end of stream tag
-    quint32 endOfStreamTag;
-    stream >> endOfStreamTag;
-    if( END_OF_STREAM != endOfStreamTag )
-    {
-        return TreeSerializer::InvalidData;
-    }
+    // Store in the list (even if NULL)
+    ctx.metaBlocksList.append( mb );
 
-    if( ! ctx.device->seek( ctx.device->size() - ( 2 * sizeof( quint32 ) ) ) )
-    {
-        return TreeSerializer::SeekFailed;
-    }
+    return TreeSerializer::NoError;
+}
 
-    // Read the metadata size
-    quint32 metaDataSize;
-    stream >> metaDataSize;
+/*
+ * Decode a property value as written by WriteBlockProperties into data, an
+ * instance of the given meta type, for properties that can not use a codec.
+ * Common types are decoded inline, the others go through QMetaType::load.
+ */
+kbool ReadValue( Context& ctx, int type, void* data )
+{
+    ByteReader& reader = *( ctx.reader );
 
-    // Go at the beginning of the metadata
-    if( ! ctx.device->seek(
-            ctx.device->size() - ( 2 * sizeof( quint32 ) ) - metaDataSize ) )
+    switch( type )
     {
-        return TreeSerializer::SeekFailed;
+    case QMetaType::Bool:
+        *static_cast< bool* >( data ) = ( 0 != reader.readUInt8() );
+        break;
+    case QMetaType::Char:
+        *static_cast< char* >( data ) = static_cast< char >(
+                                            reader.readUInt8() );
+        break;
+    case QMetaType::SChar:
+        *static_cast< signed char* >( data ) = static_cast< signed char >(
+                                                   reader.readUInt8() );
+        break;
+    case QMetaType::UChar:
+        *static_cast< uchar* >( data ) = reader.readUInt8();
+        break;
+    case QMetaType::Short:
+        *static_cast< short* >( data ) = static_cast< short >(
+                                             reader.readUInt16() );
+        break;
+    case QMetaType::UShort:
+        *static_cast< ushort* >( data ) = reader.readUInt16();
+        break;
+    case QMetaType::Int:
+        *static_cast< int* >( data ) = static_cast< qint32 >(
+                                           reader.readUInt32() );
+        break;
+    case QMetaType::UInt:
+        *static_cast< uint* >( data ) = reader.readUInt32();
+        break;
+    case QMetaType::LongLong:
+        *static_cast< qlonglong* >( data ) = static_cast< qint64 >(
+                                                 reader.readUInt64() );
+        break;
+    case QMetaType::ULongLong:
+        *static_cast< qulonglong* >( data ) = reader.readUInt64();
+        break;
+    case QMetaType::Double:
+    case QMetaType::Float:
+        {
+            // QDataStream writes both in double precision
+            const quint64 bits = reader.readUInt64();
+            double value;
+            memcpy( & value, & bits, sizeof( value ) );
+            if( QMetaType::Double == type )
+            {
+                *static_cast< double* >( data ) = value;
+            }
+            else
+            {
+                *static_cast< float* >( data ) = static_cast< float >( value );
+            }
+        }
+        break;
+    case QMetaType::QChar:
+        *static_cast< QChar* >( data ) = QChar( reader.readUInt16() );
+        break;
+    case QMetaType::QString:
+        // Strings are stored as UTF-8 byte arrays
+        {
+            const char* utf8;
+            quint32 size;
+            if( ! reader.readByteArray( & utf8, & size ) )
+            {
+                return false;
+            }
+            *static_cast< QString* >( data ) =
+                    QString::fromUtf8( utf8, size );
+        }
+        break;
+    case QMetaType::QByteArray:
+        {
+            const char* bytes;
+            quint32 size;
+            if( ! reader.readByteArray( & bytes, & size ) )
+            {
+                return false;
+            }
+            *static_cast< QByteArray* >( data ) =
+                    ( K_NULL == bytes ) ? QByteArray()
+                                        : QByteArray( bytes, size );
+        }
+        break;
+    default:
+        // Read through the shared value stream, it pulls the bytes from the
+        // reader.
+        if( ! QMetaType::load( *( ctx.valueStream ), type, data ) ||
+            ( QDataStream::Ok != ctx.valueStream->status() ) )
+        {
+            return false;
+        }
+        break;
     }
 
-    // Metablocks
-    quint32 metaBlocksCount = ReadVariableLength32( stream );
-    // Reserve the space for the blocks (OK since indices are integers)
-    ctx.metaBlocksNames.reserve( metaBlocksCount );
-    ctx.metaBlocksList.reserve( metaBlocksCount );
+    return ! reader.hasError();
+}
 
-    for( quint32 i = 0; i < metaBlocksCount; ++i )
-    {
-        QByteArray blockClass;
-        stream >> blockClass;
+struct LibContext
+{
+    Library* lib;
+    int childrenNb;
+};
 
-        QString blockClassStr = QString::fromLatin1( blockClass,
-                                                     blockClass.size() );
+void AppendRun( QVector< const Block* >& run, QVector< DeflateItem >* items )
+{
+    if( run.size() >= COLUMNS_MIN_RUN )
+    {
+        const DeflateItem item = { K_NULL, run };
+        items->append( item );
+    }
+    else
+    {
+        for( int i = 0; i < run.size(); ++i )
+        {
+            const DeflateItem item = { run.at( i ), QVector< const Block* >() };
+            items->append( item );
+        }
+    }
+    run.clear();
+}
 
-        ctx.metaBlocksNames.append( blockClassStr );
+} // namespace
 
-        const MetaBlock* mb = KoreEngine::GetMetaBlock( blockClassStr );
+namespace Kore { namespace serialization { namespace internal {
 
-        if( ( K_NULL == mb ) &&
-            ( K_NULL != ctx.monitor ) &&
-            ( ! ctx.monitor->event( TreeSerializer::UnknownBlockType,
-                                    blockClassStr ) ) )
-        {
-            return TreeSerializer::UnknownBlockType;
-        }
+void WriteVariableLength32( QDataStream& stream, quint32 value )
+{
+    quint32 lVal;
+    quint8 val;
 
-        // Store in the list (even if NULL)
-        ctx.metaBlocksList.append( mb );
+    for( lVal = value; lVal > 0x7f; lVal >>= 7 )
+    {
+        val = ( ( lVal & 0x7f ) | 0x80 );
+        stream << val;
     }
+    val = lVal & 0x7f;
+    stream << val;
+}
 
-    // Read the number of serialized blocks
-    ctx.blocksCount = ReadVariableLength32( stream );
-
-    // Restore to the initial position
-    if( ! ctx.device->seek( startPos ) )
+/*
+ * In the streaming layout, declare the type of a block right before the first
+ * block using it. The declarations are implicitly indexed in order.
+ */
+int WriteStreamMetaBlock( Context& ctx, const MetaBlock* mb )
+{
+    if( ctx.metaBlocks.contains( mb ) )
     {
-        return TreeSerializer::SeekFailed;
+        return TreeSerializer::NoError;
     }
 
+    ctx.getMetaBlockIndex( mb );
+
+    CREATE_STREAM( stream, ctx.device );
+
+    stream << static_cast< quint32 >( STREAM_METABLOCK_RECORD );
+    stream << mb->blockClassName().toLatin1();
+
     if( QDataStream::Ok != stream.status() )
     {
         return TreeSerializer::IOError;
@@ -245,218 +348,187 @@ int ReadMetaData( Context& ctx )
     return TreeSerializer::NoError;
 }
 
-int WriteBlockProperties( Context& ctx, const Block* block )
+/*
+ * Write a property of the block, preceded by its index if withIndex. NULL
+ * values are not written unless ctx.allProperties, *written tells whether the
+ * value was.
+ */
+int WriteProperty( Context& ctx,
+                   QDataStream& stream,
+                   const Block* block,
+                   const MetaBlock::StoredProperty& stored,
+                   kbool withIndex,
+                   kbool* written )
 {
-    const qint64 startPos = ctx.device->pos();
+    const QMetaObject* mo = block->metaObject();
+    const QMetaProperty& prop = stored.property;
 
-    CREATE_STREAM( stream, ctx.device );
+    *written = false;
 
-    // Write a blank properties count
-    // Using quint16 -> 65535 possible properties... should be enough or a
-    // single block !
-    stream << quint16( 0 );
+    // Check if the property should be stored for this very block
+    if( ! ctx.allProperties && ! prop.isStored( block ) )
+    {
+        return TreeSerializer::NoError;
+    }
 
-    quint16 propertiesCount = 0;
+    // Retrieve the property type
+    const int propType = StoredPropertyType( stored );
 
-    const QMetaObject* mo = block->metaObject();
+    // Check if the property's type is properly registered
+    if( QMetaType::UnknownType == propType )
+    {
+        if( ( K_NULL != ctx.monitor ) &&
+            ! ctx.monitor->event( TreeSerializer::UnknownCustomType,
+                                  QString( "%1 @ %2" )
+                                    .arg( mo->className() )
+                                    .arg( prop.name() ) ) )
+        {
+            return TreeSerializer::UnknownCustomType;
+        }
+        else
+        {
+            // Default bahavior, or the user wants to skip this property
+            return TreeSerializer::NoError;
+        }
+    }
 
-    // 1 because QObject has the name property that is not serializable...
-    for( int i = 1; i < mo->propertyCount(); ++i )
+    const int propertyIdx = prop.propertyIndex();
+
+    // Strings are references into the string table, if requested
+    if( ( K_NULL != ctx.strings ) && ( QMetaType::QString == propType ) )
     {
-        // Retrieve the property from the MetaBlock, allowing on the fly
-        // replacement by client code.
-        QMetaProperty prop = block->metaBlock()->blockMetaProperty( i );
+        QString value;
+        PropertyCodecs::ReadProperty( block, propertyIdx, & value );
 
-        // Check if the property is valid and should be stored
-        if( ( ! prop.isValid() ) || ( ! prop.isStored( block ) ) )
+        // Do not serialize NULL values, the table has no NULL string
+        if( value.isNull() )
         {
-            continue;
+            return TreeSerializer::NoError;
         }
 
-        // Retrieve the property type
-        const int propType =
-            ( static_cast< int >( prop.type() ) < QMetaType::User )
-                ? prop.type()
-                : prop.userType();
-
-        // Check if the property's type is properly registered
-        if( QMetaType::UnknownType == propType )
+        if( withIndex )
         {
-            if( ( K_NULL != ctx.monitor ) &&
-                ! ctx.monitor->event( TreeSerializer::UnknownCustomType,
-                                      QString( "%1 @ %2" )
-                                        .arg( mo->className() )
-                                        .arg( prop.name() ) ) )
-            {
-                return TreeSerializer::UnknownCustomType;
-            }
-            else
-            {
-                // Default bahavior, or the user wants to skip this property
-                continue;
-            }
+            WriteVariableLength32( stream, propertyIdx );
         }
+        WriteVariableLength32( stream, ctx.strings->index( value ) );
 
-        // Retrieve the value
-        QVariant variant = prop.read( block );
+        *written = true;
+        return TreeSerializer::NoError;
+    }
 
-        // Do not serialize NULL variants (useless?)
-        if( variant.isNull() )
+    // Types with a codec go straight from the getter to the stream
+    const PropertyCodec* codec = PropertyCodecs::Find( propType );
+    if( K_NULL != codec )
+    {
+        // Do not serialize NULL values
+        if( ! ctx.allProperties &&
+            ( K_NULL != codec->isNull ) &&
+            codec->isNull( block, propertyIdx ) )
         {
-            continue;
+            return TreeSerializer::NoError;
         }
 
-        // Write the property index
-        WriteVariableLength32( stream, prop.propertyIndex() );
+        if( withIndex )
+        {
+            WriteVariableLength32( stream, propertyIdx );
+        }
 
-        // Write the data
-        switch( propType )
-        {
-        case QMetaType::QString:
-            // For strings, encode to an UTF-8 QByteArray to save space.
-            stream << variant.toString().toUtf8();
-            break;
-        default:
-            // Write the data
-            if( ! QMetaType::save( stream, propType, variant.constData() ) )
+        if( ! codec->encode( stream, block, propertyIdx ) )
+        {
+            if( K_NULL != ctx.monitor )
             {
-                if( K_NULL != ctx.monitor )
-                {
-                    ctx.monitor->event( TreeSerializer::MetaTypeSaveFailed,
-                                        QLatin1String( prop.typeName() ) );
-                }
-                qDebug( "PropertyWriteFailed !" );
-                return TreeSerializer::MetaTypeSaveFailed;
+                ctx.monitor->event( TreeSerializer::MetaTypeSaveFailed,
+                                    QLatin1String( prop.typeName() ) );
             }
-            break;
+            return TreeSerializer::MetaTypeSaveFailed;
         }
 
-        // Increment the count of serialized properties
-        ++propertiesCount;
+        *written = true;
+        return TreeSerializer::NoError;
     }
 
-    // Save the end position
-    const qint64 endPos = ctx.device->pos();
+    // Otherwise retrieve the value
+    QVariant variant = prop.read( block );
 
-    // Go back to the beginning
-    if( ! ctx.device->seek( startPos ) )
+    // Do not serialize NULL variants (useless?)
+    if( ! ctx.allProperties && variant.isNull() )
     {
-        return TreeSerializer::SeekFailed;
+        return TreeSerializer::NoError;
     }
 
-    // Write the actual properties size
-    stream << propertiesCount;
-
-    // Move back to the end
-    if( ! ctx.device->seek( endPos ) )
+    // Write a default value if the property could not be read
+    if( ! variant.isValid() )
     {
-        return TreeSerializer::SeekFailed;
+        variant = QVariant( propType, K_NULL );
     }
 
-    if( QDataStream::Ok != stream.status() )
+    // Write the property index
+    if( withIndex )
     {
-        return TreeSerializer::IOError;
+        WriteVariableLength32( stream, propertyIdx );
     }
 
-    return TreeSerializer::NoError;
-}
-
-int ReadBlockProperties( Context& ctx, Block* block )
-{
-    CREATE_STREAM( stream, ctx.device );
-
-    const QMetaObject* mo = block->metaObject();
-
-    // Retrieve the number of properties
-    quint16 propertiesCount;
-    stream >> propertiesCount;
-
-    for	( quint16 i = 0; i < propertiesCount; ++i )
+    // Write the data
+    switch( propType )
     {
-        // Retrieve the index of the property
-        quint32 propertyIdx = ReadVariableLength32( stream );
-
-        // Retrieve the property from the Metablock
-        QMetaProperty prop = block->metaBlock()->blockMetaProperty( propertyIdx );
-        if( ! prop.isValid() )
+    case QMetaType::QString:
+        // For strings, encode to an UTF-8 QByteArray to save space.
+        stream << variant.toString().toUtf8();
+        break;
+    default:
+        // Write the data
+        if( ! QMetaType::save( stream, propType, variant.constData() ) )
         {
-            // Notify the user
             if( K_NULL != ctx.monitor )
             {
-                ctx.monitor->event( TreeSerializer::InvalidBlockProperty,
-                                    QString( "%1 @ %2" )
-                                        .arg( mo->className() )
-                                        .arg( propertyIdx ) );
+                ctx.monitor->event( TreeSerializer::MetaTypeSaveFailed,
+                                    QLatin1String( prop.typeName() ) );
             }
-            // And fail!
-            return TreeSerializer::InvalidBlockProperty;
+            qDebug( "PropertyWriteFailed !" );
+            return TreeSerializer::MetaTypeSaveFailed;
         }
+        break;
+    }
 
-        // Retrieve the property's type
-        const int propType =
-            ( static_cast< int >( prop.type() ) < QMetaType::User )
-                ? prop.type()
-                : prop.userType();
+    *written = true;
+    return TreeSerializer::NoError;
+}
 
-        // Check if the type is properly registered
-        if( QMetaType::UnknownType == propType )
-        {
-            // Notify the user
-            if( K_NULL != ctx.monitor )
-            {
-                ctx.monitor->event( TreeSerializer::UnknownCustomType,
-                                    QString( "%1 @ %2" )
-                                        .arg( mo->className() )
-                                        .arg( prop.name() ) );
-            }
-            // And fail!
-            return TreeSerializer::UnknownCustomType;
-        }
+/*
+ * Write the properties of the block to the stream, whose device is the
+ * scratch device of the context.
+ */
+int WriteBlockProperties( Context& ctx,
+                          QDataStream& stream,
+                          const Block* block )
+{
+    const qint64 startPos = stream.device()->pos();
+
+    // Write a blank properties count
+    // Using quint16 -> 65535 possible properties... should be enough or a
+    // single block !
+    stream << quint16( 0 );
 
-        // Create a variant with the proper type
-        QVariant variant( propType, K_NULL );
+    quint16 propertiesCount = 0;
+
+    // Walk the properties cached by the MetaBlock, already checked and typed
+    const QVector< MetaBlock::StoredProperty >& properties =
+            block->metaBlock()->storedProperties();
 
-        switch( propType )
+    for( int i = 0; i < properties.size(); ++i )
+    {
+        kbool written;
+        int err = WriteProperty( ctx, stream, block, properties.at( i ),
+                                 true, & written );
+        if( TreeSerializer::NoError != err )
         {
-        case QMetaType::QString:
-            // For strings parse an UTF-8 buffer
-            {
-                QByteArray utf8;
-                stream >> utf8;
-                variant = QString::fromUtf8( utf8, utf8.size() );
-            }
-            break;
-        default:
-            // Read the data
-            if( ! QMetaType::load( stream, propType, variant.data() ) )
-            {
-                ctx.monitor->event( TreeSerializer::MetaTypeLoadFailed,
-                                    QString( "%1 @ %2" )
-                                        .arg( mo->className() )
-                                        .arg( prop.name() ) );
-                return TreeSerializer::MetaTypeLoadFailed;
-            }
-            break;
+            return err;
         }
 
-        // Finally, set the property on the block
-        if( ! prop.write( block, variant ) )
+        // Increment the count of serialized properties
+        if( written )
         {
-            if( ( K_NULL != ctx.monitor ) &&
-                ! ctx.monitor->event( TreeSerializer::BlockSetPropertyFailed,
-                                      QString( "%1 @ %2" )
-                                            .arg( mo->className() )
-                                            .arg( prop.name() ) ) )
-            {
-                return TreeSerializer::BlockSetPropertyFailed;
-            }
-            else
-            {
-                qWarning( "Failed to set property %s of type %s on Block %s",
-                          prop.name(),
-                          prop.typeName(),
-                          mo->className() );
-            }
+            ++propertiesCount;
         }
     }
 
@@ -465,379 +537,901 @@ int ReadBlockProperties( Context& ctx, Block* block )
         return TreeSerializer::IOError;
     }
 
+    // Write the actual properties count, in memory
+    qToBigEndian< quint16 >(
+            propertiesCount,
+            reinterpret_cast< uchar* >( ctx.buffer->data() + startPos ) );
+
     return TreeSerializer::NoError;
 }
 
-int DeflateBlockRandomAccess( Context& ctx, const Block* block, int childrenNb )
+int ResolveBlockProperty( Context& ctx,
+                          const Block* block,
+                          quint32 propertyIdx,
+                          QMetaProperty* property,
+                          int* type )
 {
-    // Store the position at the beginning of this block
-    const qint64 startPos = ctx.device->pos();
-
-    CREATE_STREAM( stream, ctx.device );
+    const QMetaObject* mo = block->metaObject();
 
-    // Write a blank block header
-    // Type
-    stream << quint32( 0 );
-    // Length
-    stream << quint32( 0 );
-    // Library size
-    if( block->isLibrary() )
+    // Retrieve the property from the Metablock cache
+    const MetaBlock::StoredProperty* stored =
+            block->metaBlock()->storedProperty( propertyIdx );
+    if( K_NULL == stored )
     {
-        stream << quint32( 0 );
+        // Notify the user
+        if( K_NULL != ctx.monitor )
+        {
+            ctx.monitor->event( TreeSerializer::InvalidBlockProperty,
+                                QString( "%1 @ %2" )
+                                    .arg( mo->className() )
+                                    .arg( propertyIdx ) );
+        }
+        // And fail!
+        return TreeSerializer::InvalidBlockProperty;
     }
 
-    // Write the block properties
-    int err = WriteBlockProperties( ctx, block );
-    if( TreeSerializer::NoError != err )
-    {
-        return err;
-    }
+    const QMetaProperty& prop = stored->property;
 
-    // Store the position at the end of this block
-    const qint64 endPos = ctx.device->pos();
+    // Retrieve the property's type
+    const int propType = StoredPropertyType( *stored );
 
-    // Go back to the header position
-    if( ! ctx.device->seek( startPos ) )
+    // Check if the type is properly registered
+    if( QMetaType::UnknownType == propType )
     {
-        return TreeSerializer::SeekFailed;
+        // Notify the user
+        if( K_NULL != ctx.monitor )
+        {
+            ctx.monitor->event( TreeSerializer::UnknownCustomType,
+                                QString( "%1 @ %2" )
+                                    .arg( mo->className() )
+                                    .arg( prop.name() ) );
+        }
+        // And fail!
+        return TreeSerializer::UnknownCustomType;
     }
 
-    // Write the final complete header
-    if( 0 != childrenNb )
-    {
-        // Type
-        quint32 type = ctx.getMetaBlockIndex( block->metaBlock() );
-        // Add the library flag !
-        stream << static_cast< quint32 >( type | LIBRARY_HAS_CHILDREN_FLAG );
-        // Length including header
-        stream << static_cast< quint32 >( endPos - startPos );
-        // Library size
-        stream << childrenNb;
-    }
-    else
-    {
-        // Type
-        stream << ctx.getMetaBlockIndex( block->metaBlock() );
-        // Length including header
-        stream << static_cast< quint32 >( endPos - startPos );
-    }
-
-    // Go back to the end position
-    if( ! ctx.device->seek( endPos ) )
-    {
-        return TreeSerializer::SeekFailed;
-    }
+    *property = prop;
+    *type = propType;
 
-    // Increment the blocks count
-    ++( ctx.blocksCount );
+    return TreeSerializer::NoError;
+}
 
-    if( QDataStream::Ok != stream.status() )
+int SetBlockProperty( Context& ctx,
+                      Block* block,
+                      const QMetaProperty& prop,
+                      const QVariant& variant )
+{
+    if( ! prop.write( block, variant ) )
     {
-        return TreeSerializer::IOError;
+        const QMetaObject* mo = block->metaObject();
+        if( ( K_NULL != ctx.monitor ) &&
+            ! ctx.monitor->event( TreeSerializer::BlockSetPropertyFailed,
+                                  QString( "%1 @ %2" )
+                                        .arg( mo->className() )
+                                        .arg( prop.name() ) ) )
+        {
+            return TreeSerializer::BlockSetPropertyFailed;
+        }
+        else
+        {
+            qWarning( "Failed to set property %s of type %s on Block %s",
+                      prop.name(),
+                      prop.typeName(),
+                      mo->className() );
+        }
     }
 
     return TreeSerializer::NoError;
 }
 
-int DeflateBlock( Context& ctx, const Block* block, int childrenNb )
+/*
+ * Account for processed blocks and bytes. They are reported to the monitor by
+ * batches, or right away if flush, and each report polls it for cancellation.
+ */
+int Advance( Context& ctx, quint32 blocks, qint64 bytes, kbool flush )
 {
-    if( ctx.device->isSequential() )
+    if( K_NULL == ctx.progress )
     {
-        // Save the actual device
-        QIODevice* device = ctx.device;
+        return TreeSerializer::NoError;
+    }
 
-        // Create a temporary random access memory device
-        QBuffer memDevice( ctx.buffer );
+    ctx.pendingBlocks += blocks;
+    ctx.pendingBytes += bytes;
+    if( ! flush && ( ctx.pendingBlocks < PROGRESS_INTERVAL ) )
+    {
+        return TreeSerializer::NoError;
+    }
 
-        // Set it as the context device
-        ctx.device = & memDevice;
+    const kbool keepGoing = ctx.progress->advance( ctx.monitor,
+                                                   ctx.pendingBlocks,
+                                                   ctx.pendingBytes );
+    ctx.pendingBlocks = 0;
+    ctx.pendingBytes = 0;
 
-        // Do the block serialization in random access mode
-        int err = DeflateBlockRandomAccess( ctx, block, childrenNb );
+    return keepGoing ? TreeSerializer::NoError : TreeSerializer::Canceled;
+}
 
-        // Restore the device
-        ctx.device = device;
+/*
+ * Write the checksum of a block frame staged in memory, in the room left for
+ * it at its end. The length of the frame must be set.
+ */
+void SealFrame( char* frame )
+{
+    const qint64 size = ( BLOCK_LENGTH_MASK & qFromBigEndian< quint32 >(
+                              reinterpret_cast< const uchar* >( frame + 4 ) ) )
+            - BLOCK_CHECKSUM_SIZE;
+    qToBigEndian< quint32 >( Crc32c::Compute( frame, size ),
+                             reinterpret_cast< uchar* >( frame + size ) );
+}
 
-        // Handle error...
+/*
+ * Deflate a single block. The block is staged in the scratch buffer, where its
+ * header and properties count are completed, then written with a single call:
+ * the device is never seeked, and only sees appends.
+ */
+int DeflateBlock( Context& ctx, const Block* block, int childrenNb )
+{
+    if( ctx.streamed )
+    {
+        int err = WriteStreamMetaBlock( ctx, block->metaBlock() );
         if( TreeSerializer::NoError != err )
         {
             return err;
         }
+    }
 
-        // Write the raw data
-        ctx.device->write( memDevice.data(), memDevice.size() );
+    QBuffer* scratch = ctx.scratchDevice();
+    scratch->seek( 0 );
+
+    CREATE_STREAM( stream, scratch );
+
+    // Header, with a blank length. Libraries always carry their children
+    // count, even if it is 0.
+    const quint32 type = ctx.getMetaBlockIndex( block->metaBlock() );
+    if( block->isLibrary() )
+    {
+        // Add the library flag !
+        stream << static_cast< quint32 >( type | LIBRARY_HAS_CHILDREN_FLAG );
+        stream << quint32( 0 );
+        stream << static_cast< quint32 >( childrenNb );
     }
     else
     {
-        int err = DeflateBlockRandomAccess( ctx, block, childrenNb );
-        // Handle error...
-        if( TreeSerializer::NoError != err )
-        {
-            return err;
-        }
+        stream << type;
+        stream << quint32( 0 );
     }
 
-    return TreeSerializer::NoError;
-}
-
-int InflateBlock( Context& ctx, Block** block, int* childrenNb )
-{
-    const qint64 startPos = ctx.device->pos();
-
-    CREATE_STREAM( stream, ctx.device );
+    // Write the block properties
+    int err = WriteBlockProperties( ctx, stream, block );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
 
-    quint32 type;
-    quint32 length;
+    // Room for the checksum
+    if( ctx.checksums )
+    {
+        stream << quint32( 0 );
+    }
 
-    stream >> type;
-    stream >> length;
+    // The scratch buffer is never truncated, only its beginning is used
+    const qint64 length = scratch->pos();
+    char* data = ctx.buffer->data();
 
-    if( LIBRARY_HAS_CHILDREN_FLAG & type )
+    // Length including header
+    qToBigEndian< quint32 >( static_cast< quint32 >( length ) |
+                                 ( ctx.checksums ? BLOCK_CHECKSUM_FLAG : 0 ),
+                             reinterpret_cast< uchar* >( data + 4 ) );
+    if( ctx.checksums )
     {
-        // Retrieve the number of child nodes
-        quint32 childrenCount;
-        stream >> childrenCount;
-
-        *childrenNb = childrenCount;
+        SealFrame( data );
+    }
 
-        // Cleanup the type
-        type = LIBRARY_HAS_CHILREN_MASK & type;
+    if( ctx.device->write( data, length ) != length )
+    {
+        return TreeSerializer::IOError;
     }
-    else
+
+    if( K_NULL != ctx.toc )
     {
-        *childrenNb = 0;
+        const TocBlock tocBlock = { ctx.tocPos, childrenNb };
+        ctx.toc->append( tocBlock );
+        ctx.tocPos += length;
     }
 
+    // Increment the blocks count
+    ++( ctx.blocksCount );
+
+    return Advance( ctx, 1, length );
+}
+
+/*
+ * Create an instance of the block of the given type.
+ * On success, *block is K_NULL if the block could not be created but the user
+ * asked to continue anyway: the caller must then skip the block's data.
+ */
+int InstantiateBlock( Context& ctx, quint32 type, Block** block )
+{
     // Retrieve the block meta type
     const MetaBlock* mb = ctx.getMetaBlock( type );
 
+    // Store a NULL pointer for the caller
+    *block = K_NULL;
+
     if( ( K_NULL == mb ) )
     {
         // We did not find the corresponding block
         if( ( K_NULL != ctx.monitor ) &&
             ! ctx.monitor->event( TreeSerializer::UnknownBlockType,
-                                  ctx.metaBlocksNames.at( type ) ) )
+                                  ctx.metaBlocksNames.value( type ) ) )
         {
             // Abort
             return TreeSerializer::UnknownBlockType;
         }
-        else
-        {
-            // The user wants to continue anyway...
 
-            // Store a NULL pointer for the caller
-            *block = K_NULL;
-
-            // Skip the block's data
-            if( ! ctx.device->seek( startPos + length ) )
-            {
-                return TreeSerializer::SeekFailed;
-            }
-
-            return TreeSerializer::NoError;
-        }
+        // The user wants to continue anyway...
+        return TreeSerializer::NoError;
     }
 
     // Try to create an instance of that block...
     *block = mb->createBlock();
 
-    if( K_NULL == ( *block ) )
+    if( ( K_NULL == ( *block ) ) &&
+        ( K_NULL != ctx.monitor ) &&
+        ! ctx.monitor->event( TreeSerializer::BlockInstantiationFailed,
+                              mb->blockClassName() ) )
     {
-        if( ( K_NULL != ctx.monitor ) &&
-            ! ctx.monitor->event( TreeSerializer::BlockInstantiationFailed,
-                                  mb->blockClassName() ) )
-        {
-            // Abort
-            return TreeSerializer::BlockInstantiationFailed;
-        }
-        else
-        {
-            // The user wants to continue anyway...
+        // Abort
+        return TreeSerializer::BlockInstantiationFailed;
+    }
 
-            // Store a NULL pointer for the caller
-            *block = K_NULL;
+    return TreeSerializer::NoError;
+}
 
-            // Skip the block's data
-            if( ! ctx.device->seek( startPos + length ) )
-            {
-                return TreeSerializer::SeekFailed;
-            }
+/*
+ * Read the footer metadata. The position where it begins is stored in
+ * metaDataPos, if not K_NULL.
+ */
+int ReadMetaData( Context& ctx, qint64* metaDataPos )
+{
+    ByteReader& reader = *( ctx.reader );
 
-            return TreeSerializer::NoError;
-        }
+    // Store the initial position
+    const qint64 startPos = reader.pos();
+
+    const qint64 size = reader.size();
+    if( size < static_cast< qint64 >( 2 * sizeof( quint32 ) ) )
+    {
+        return TreeSerializer::InvalidData;
     }
 
-    int err = ReadBlockProperties( ctx, *block );
-    if( TreeSerializer::NoError != err )
+    // Read the end of stream tag
+    reader.seek( size - sizeof( quint32 ) );
+    if( END_OF_STREAM != reader.readUInt32() )
     {
-        delete ( *block );
-        *block = K_NULL;
-        return err;
+        return TreeSerializer::InvalidData;
     }
 
-    if( QDataStream::Ok != stream.status() )
+    // Read the metadata size
+    reader.seek( size - ( 2 * sizeof( quint32 ) ) );
+    const quint32 metaDataSize = reader.readUInt32();
+
+    // Go at the beginning of the metadata
+    const qint64 metaDataStart =
+            size - ( 2 * sizeof( quint32 ) ) - metaDataSize;
+    if( ! reader.seek( metaDataStart ) )
     {
-        return TreeSerializer::IOError;
+        return TreeSerializer::InvalidData;
     }
 
-    return TreeSerializer::NoError;
-}
+    if( K_NULL != metaDataPos )
+    {
+        *metaDataPos = metaDataStart;
+    }
 
-int SkipBlock( Context& ctx, int* childrenNb )
-{
-    const qint64 startPos = ctx.device->pos();
+    // Metablocks
+    const quint32 metaBlocksCount = reader.readVariableLength32();
+    if( reader.hasError() || ( metaBlocksCount > metaDataSize ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
 
-    CREATE_STREAM( stream, ctx.device );
+    // Reserve the space for the blocks (OK since indices are integers)
+    ctx.metaBlocksNames.reserve( metaBlocksCount );
+    ctx.metaBlocksList.reserve( metaBlocksCount );
 
-    quint32 type;
-    quint32 length;
+    for( quint32 i = 0; i < metaBlocksCount; ++i )
+    {
+        const char* blockClass;
+        quint32 blockClassSize;
+        if( ! reader.readByteArray( & blockClass, & blockClassSize ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        int err = AddMetaBlockName(
+                    ctx, QString::fromLatin1( blockClass, blockClassSize ) );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
 
-    stream >> type;
-    stream >> length;
+    // Read the number of serialized blocks
+    ctx.blocksCount = reader.readVariableLength32();
 
-    if( LIBRARY_HAS_CHILDREN_FLAG & type )
+    // The string table, if any, ends the metadata
+    if( reader.pos() < metaDataStart + metaDataSize )
     {
-        // Retrieve the number of child nodes
-        quint32 childrenCount;
-        stream >> childrenCount;
+        const quint32 stringsCount = reader.readVariableLength32();
+        if( reader.hasError() || ( stringsCount > metaDataSize ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        // Each string is decoded once, the properties share it
+        ctx.sharedStrings.reserve( stringsCount );
+        for( quint32 i = 0; i < stringsCount; ++i )
+        {
+            const char* utf8;
+            quint32 utf8Size;
+            if( ! reader.readByteArray( & utf8, & utf8Size ) )
+            {
+                return TreeSerializer::InvalidData;
+            }
+            ctx.sharedStrings.append( QString::fromUtf8( utf8, utf8Size ) );
+        }
 
-        *childrenNb = childrenCount;
+        ctx.hasStringTable = true;
     }
 
-    // Skip the block data
-    if( ! ctx.device->seek( startPos + length ) )
+    if( reader.hasError() )
     {
-        return TreeSerializer::SeekFailed;
+        return TreeSerializer::InvalidData;
     }
 
-    if( QDataStream::Ok != stream.status() )
+    // Restore to the initial position
+    if( ! reader.seek( startPos ) )
     {
-        return TreeSerializer::IOError;
+        return TreeSerializer::SeekFailed;
     }
 
     return TreeSerializer::NoError;
 }
 
-} // namespace
-
-int KoreSerializer::deflate( QIODevice* device,
-                             const Block* block,
-                             TreeSerializerMonitor* monitor ) const
+/*
+ * Read the streaming layout header, if any. *streamed tells whether it was
+ * found, the reader is left untouched otherwise.
+ */
+int ReadStreamHeader( Context& ctx, kbool* streamed )
 {
-    int err;
+    ByteReader& reader = *( ctx.reader );
 
-    // Pre allocate 2KB of memory for the buffer
-    QByteArray buffer( 2048, 0x00 );
+    *streamed = ( STREAM_MAGIC == reader.peekUInt32() );
+    if( ! ( *streamed ) )
+    {
+        return TreeSerializer::NoError;
+    }
 
-    // Create a context
-    Context ctx( &buffer, device, monitor );
+    reader.skip( sizeof( quint32 ) );
+    if( STREAM_VERSION != reader.readUInt8() )
+    {
+        return TreeSerializer::InvalidData;
+    }
 
-    // Do a pre-order visit of the tree without recursion as recursion
-    // on big "deep" datasets could lead to a stack overflow.
+    return reader.hasError() ? TreeSerializer::InvalidData
+                             : TreeSerializer::NoError;
+}
 
-    // We need that stack to avoid recursion
-    QStack< const Block* > blocks;
+/*
+ * Read the block type declarations preceding a block in the streaming layout.
+ */
+int ReadStreamMetaBlocks( Context& ctx )
+{
+    ByteReader& reader = *( ctx.reader );
 
-    const Block* b = block;
-    while( ( ! blocks.empty() ) || ( K_NULL != b ) )
+    while( STREAM_METABLOCK_RECORD == reader.peekUInt32() )
     {
-        if( K_NULL != b )
-        {
-            // Count the number of children to be serialized
-            int childrenNb = 0;
-
-            if( b->isLibrary() )
-            {
-                const Library* lib = static_cast< const Library* >( b );
-                for( int i = 0; i < lib->size(); ++i )
-                {
-                    // Stack 'em in reverse order to serialize them in proper
-                    // order
-                    const Block* child = lib->at( lib->size() - i - 1 );
-                    if( child->checkFlag( Block::Serializable ) )
-                    {
-                        // Increment the count of serialized children
-                        ++ childrenNb;
-                        blocks.push( child );
-                    }
-                }
-            }
+        reader.skip( sizeof( quint32 ) );
 
-            err = DeflateBlock( ctx, b, childrenNb );
-            if( NoError != err )
-            {
-                return err;
-            }
+        const char* blockClass;
+        quint32 blockClassSize;
+        if( ! reader.readByteArray( & blockClass, & blockClassSize ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
 
-            b = blocks.empty() ? K_NULL : blocks.pop();
+        if( ctx.metaBlocksKnown )
+        {
+            continue;
         }
-        else
+
+        int err = AddMetaBlockName(
+                    ctx, QString::fromLatin1( blockClass, blockClassSize ) );
+        if( TreeSerializer::NoError != err )
         {
-            b = blocks.pop();
+            return err;
         }
     }
 
-    // Write the meta data in the file, at the end.
-    err = WriteMetaData( ctx );
-    if( NoError != err )
+    return reader.hasError() ? TreeSerializer::InvalidData
+                             : TreeSerializer::NoError;
+}
+
+int ReadStreamEnd( Context& ctx )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    if( STREAM_END_RECORD != reader.readUInt32() )
     {
-        return err;
+        return TreeSerializer::InvalidData;
     }
 
-    return NoError;
+    // Read the number of serialized blocks
+    ctx.blocksCount = reader.readVariableLength32();
+
+    return reader.hasError() ? TreeSerializer::InvalidData
+                             : TreeSerializer::NoError;
 }
 
-namespace
+TreeReader::TreeReader( QIODevice* device, kbool mapped, qint64 window )
+    : _device( device )
+    , _mapped( mapped )
+    , _window( window )
+    , _decompressor( K_NULL )
+    , _mapping( K_NULL )
+    , _reader( K_NULL )
+    , _readerDevice( K_NULL )
+    , _valueStream( K_NULL )
 {
-    struct LibContext
-    {
-        Library* lib;
-        int childrenNb;
-    };
 }
 
-int KoreSerializer::inflate( QIODevice* device,
-                             Block** block,
-                             TreeSerializerMonitor* monitor ) const
+TreeReader::~TreeReader()
 {
-    int err;
-    Block* root = K_NULL;
-    QStack< LibContext > libs;
-    Context ctx( K_NULL, device, monitor );
+    delete _valueStream;
+    delete _readerDevice;
+    delete _reader;
+    delete _mapping;
+    delete _decompressor;
+}
 
-    if( device->isSequential() )
+int TreeReader::open( kbool randomAccess )
+{
+    QIODevice* device = _device;
+    kbool mapped = _mapped;
+    if( ChunkedDecompressor::IsCompressed( device ) )
     {
-        err = RequiresRandomAccess;
-        goto cleanup;
+        if( device->isSequential() )
+        {
+            return TreeSerializer::RequiresRandomAccess;
+        }
+
+        _decompressor = new ChunkedDecompressor( device );
+        if( ! _decompressor->open( QIODevice::ReadOnly ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        device = _decompressor;
+        mapped = false;
     }
 
-    err = ReadMetaData( ctx );
-    if( NoError != err )
+    _mapping = new DeviceMapping( mapped ? device : K_NULL );
+    if( _mapping->isValid() )
     {
-        goto cleanup;
+        _reader = new ByteReader( _mapping->data(), _mapping->size() );
+        _reader->seek( device->pos() );
     }
-
-    // First, inflate the "ROOT" element
-    int childrenNb;
-    err = InflateBlock( ctx, & root, & childrenNb );
-    if( NoError != err )
+    else
     {
-        goto cleanup;
+        _reader = new ByteReader( device, _window );
     }
 
-    if( K_NULL == root )
+    if( randomAccess && _reader->isSequential() )
     {
-        qWarning( "Could not inflate root Block" );
-        return UnknownRootBlockType;
+        return TreeSerializer::RequiresRandomAccess;
     }
 
-    if( 0 != childrenNb )
+    _readerDevice = new ReaderDevice( _reader );
+    _valueStream = new QDataStream( _readerDevice );
+    _valueStream->setVersion( QDataStream::Qt_5_1 );
+
+    return TreeSerializer::NoError;
+}
+
+void TreeReader::attach( Context& ctx, kbool progress )
+{
+    ctx.reader = _reader;
+    ctx.valueStream = _valueStream;
+
+    if( progress && ( K_NULL != ctx.monitor ) )
     {
-        LibContext libCtx = { static_cast< Library* >( root ), childrenNb };
-        libs.push( libCtx );
+        _progress.bytesTotal = _reader->isSequential()
+                ? 0
+                : _reader->size() - _reader->pos();
+        ctx.progress = & _progress;
     }
+}
 
-    while( ! libs.empty() )
+int TreeReader::readHeader( Context& ctx )
+{
+    int err = ReadStreamHeader( ctx, & ctx.streamed );
+    if( ( TreeSerializer::NoError != err ) || ctx.streamed )
+    {
+        return err;
+    }
+
+    if( _reader->isSequential() )
+    {
+        return TreeSerializer::RequiresRandomAccess;
+    }
+
+    err = ReadMetaData( ctx );
+    if( TreeSerializer::NoError == err )
+    {
+        _progress.blocksTotal = ctx.blocksCount;
+    }
+
+    return err;
+}
+
+void TreeReader::leave()
+{
+    if( K_NULL != _decompressor )
+    {
+        _device->seek( _decompressor->containerEnd() );
+    }
+    else if( ! _reader->isSequential() )
+    {
+        _device->seek( _reader->pos() );
+    }
+}
+
+/*
+ * Read the value of a property of the block and set it.
+ */
+int ReadProperty( Context& ctx,
+                  Block* block,
+                  const QMetaProperty& prop,
+                  int propType )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    // Strings refer to the table, sharing its data
+    if( ctx.hasStringTable && ( QMetaType::QString == propType ) )
+    {
+        const quint32 stringIdx = reader.readVariableLength32();
+        if( reader.hasError() ||
+            ( stringIdx >= static_cast< quint32 >(
+                                ctx.sharedStrings.size() ) ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        if( prop.isWritable() )
+        {
+            QString value = ctx.sharedStrings.at( stringIdx );
+            PropertyCodecs::WriteProperty( block, prop.propertyIndex(),
+                                           & value );
+        }
+        return TreeSerializer::NoError;
+    }
+
+    // Types with a codec go straight from the reader to the setter
+    const PropertyCodec* codec =
+            prop.isWritable() ? PropertyCodecs::Find( propType ) : K_NULL;
+
+    // Otherwise, create a variant with the proper type and decode in place
+    QVariant variant;
+    if( K_NULL == codec )
+    {
+        variant = QVariant( propType, K_NULL );
+    }
+
+    const kbool decoded =
+            ( K_NULL != codec )
+                ? codec->decode( reader, block, prop.propertyIndex() )
+                : ReadValue( ctx, propType, variant.data() );
+    if( ! decoded )
+    {
+        if( K_NULL != ctx.monitor )
+        {
+            ctx.monitor->event( TreeSerializer::MetaTypeLoadFailed,
+                                QString( "%1 @ %2" )
+                                    .arg( block->metaObject()->className() )
+                                    .arg( prop.name() ) );
+        }
+        return TreeSerializer::MetaTypeLoadFailed;
+    }
+
+    if( K_NULL != codec )
+    {
+        return TreeSerializer::NoError;
+    }
+
+    // Finally, set the property on the block
+    return SetBlockProperty( ctx, block, prop, variant );
+}
+
+int ReadBlockProperties( Context& ctx, Block* block )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    // Retrieve the number of properties
+    const quint16 propertiesCount = reader.readUInt16();
+
+    for	( quint16 i = 0; i < propertiesCount; ++i )
+    {
+        // Retrieve the index of the property
+        const quint32 propertyIdx = reader.readVariableLength32();
+
+        QMetaProperty prop;
+        int propType;
+        int err = ResolveBlockProperty( ctx, block, propertyIdx,
+                                        & prop, & propType );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        err = ReadProperty( ctx, block, prop, propType );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    if( reader.hasError() )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Read a block header. The length covers the header and the properties of
+ * the block, but not its children.
+ */
+kbool ReadBlockHeader( ByteReader& reader,
+                       quint32* type,
+                       quint32* length,
+                       int* childrenNb,
+                       kbool* checksummed )
+{
+    *type = reader.readUInt32();
+    *length = reader.readUInt32();
+
+    // The length counts the checksum, if any
+    if( K_NULL != checksummed )
+    {
+        *checksummed = ( 0 != ( BLOCK_CHECKSUM_FLAG & ( *length ) ) );
+    }
+    *length &= BLOCK_LENGTH_MASK;
+
+    if( LIBRARY_HAS_CHILDREN_FLAG & ( *type ) )
+    {
+        // Retrieve the number of child nodes
+        *childrenNb = static_cast< int >( reader.readUInt32() );
+
+        // Cleanup the type
+        *type = LIBRARY_HAS_CHILREN_MASK & ( *type );
+    }
+    else
+    {
+        *childrenNb = 0;
+    }
+
+    return ! reader.hasError();
+}
+
+/*
+ * Check the checksum of the block frame at the current position, if it has
+ * one. The reader is left at the beginning of the frame. *checked tells
+ * whether there was a checksum.
+ */
+int VerifyFrame( ByteReader& reader, kbool* checked )
+{
+    const qint64 pos = reader.pos();
+
+    const char* header;
+    if( ! reader.readBytes( & header, 2 * sizeof( quint32 ) ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    const quint32 length = qFromBigEndian< quint32 >(
+                reinterpret_cast< const uchar* >( header + 4 ) );
+    const kbool checksummed = ( 0 != ( BLOCK_CHECKSUM_FLAG & length ) );
+    if( K_NULL != checked )
+    {
+        *checked = checksummed;
+    }
+
+    if( ! reader.seek( pos ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    if( ! checksummed )
+    {
+        return TreeSerializer::NoError;
+    }
+
+    // The frame and its checksum are read at once: reading more could move
+    // the window, and the frame is still in the window to seek back
+    const qint64 size = ( BLOCK_LENGTH_MASK & length ) - BLOCK_CHECKSUM_SIZE;
+    const char* frame;
+    if( ( size < 0 ) ||
+        ! reader.readBytes( & frame, size + BLOCK_CHECKSUM_SIZE ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    const quint32 crc = qFromBigEndian< quint32 >(
+                reinterpret_cast< const uchar* >( frame + size ) );
+    if( ! reader.seek( pos ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    return ( Crc32c::Compute( frame, size ) == crc )
+            ? TreeSerializer::NoError
+            : TreeSerializer::ChecksumMismatch;
+}
+
+/*
+ * Inflate a block, without its children. A run of blocks is appended to the
+ * parent straight away, *block is then K_NULL and *childrenNb 0.
+ */
+int InflateBlock( Context& ctx,
+                  Block** block,
+                  int* childrenNb,
+                  Library* parent )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    *block = K_NULL;
+
+    if( ctx.streamed )
+    {
+        int err = ReadStreamMetaBlocks( ctx );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    // Frames with a checksum are checked before being decoded
+    {
+        int err = VerifyFrame( reader );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    const qint64 startPos = reader.pos();
+
+    quint32 type;
+    quint32 length;
+
+    if( ! ReadBlockHeader( reader, & type, & length, childrenNb ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    quint32 blocksNb = 1;
+    if( COLUMNS_RECORD == type )
+    {
+        if( K_NULL == parent )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        QVector< Block* > blocks;
+        int err = InflateColumns( ctx, & blocks );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        for( int i = 0; i < blocks.size(); ++i )
+        {
+            parent->addBlock( blocks.at( i ) );
+        }
+        blocksNb = blocks.size();
+    }
+    else
+    {
+        int err = InstantiateBlock( ctx, type, block );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        if( K_NULL != ( *block ) )
+        {
+            err = ReadBlockProperties( ctx, *block );
+            if( TreeSerializer::NoError != err )
+            {
+                delete ( *block );
+                *block = K_NULL;
+                return err;
+            }
+        }
+    }
+
+    // Move to the end of the block, whatever was actually decoded
+    const int err = reader.seek( startPos + length )
+            ? Advance( ctx, blocksNb, length )
+            : TreeSerializer::InvalidData;
+    if( TreeSerializer::NoError != err )
+    {
+        // Callers only free the blocks they were given
+        delete ( *block );
+        *block = K_NULL;
+    }
+
+    return err;
+}
+
+int SkipBlock( Context& ctx, int* childrenNb )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    if( ctx.streamed )
+    {
+        // Declarations must be read even for skipped blocks, the next ones
+        // may use them.
+        int err = ReadStreamMetaBlocks( ctx );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    const qint64 startPos = reader.pos();
+
+    quint32 type;
+    quint32 length;
+
+    if( ! ReadBlockHeader( reader, & type, & length, childrenNb ) ||
+        ! reader.seek( startPos + length ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Inflate the tree starting at the reader position. *tree is K_NULL if the
+ * root block could not be instantiated but the user asked to continue: the
+ * whole tree is skipped then.
+ */
+int InflateTree( Context& ctx, Block** tree )
+{
+    QStack< LibContext > libs;
+
+    *tree = K_NULL;
+
+    // First, inflate the "ROOT" element
+    Block* root;
+    int childrenNb;
+    int err = InflateBlock( ctx, & root, & childrenNb );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    if( 0 != childrenNb )
+    {
+        LibContext libCtx = { static_cast< Library* >( root ), childrenNb };
+        libs.push( libCtx );
+    }
+
+    while( ! libs.empty() )
     {
         // We could not load an unknown Block but the user did not request
         // cancellation of the inflate operation, we must get rid of the full
@@ -848,6 +1442,7 @@ int KoreSerializer::inflate( QIODevice* device,
             err = SkipBlock( ctx, & childrenNb );
             if( TreeSerializer::NoError != err )
             {
+                delete root;
                 return err;
             }
 
@@ -867,10 +1462,11 @@ int KoreSerializer::inflate( QIODevice* device,
         else
         {
             Block* b;
-            err = InflateBlock( ctx, & b, & childrenNb );
-            if( NoError != err )
+            err = InflateBlock( ctx, & b, & childrenNb, libs.top().lib );
+            if( TreeSerializer::NoError != err )
             {
-                goto cleanup;
+                delete root;
+                return err;
             }
 
             // Add that block to the library which is at the top of the stack
@@ -901,8 +1497,638 @@ int KoreSerializer::inflate( QIODevice* device,
         }
     }
 
-    // Store the result tree in the client's variable
-    *block = root;
+    *tree = root;
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Move the reader past the tree starting at its position.
+ */
+int SkipTree( Context& ctx )
+{
+    int remaining = 1;
+    while( remaining > 0 )
+    {
+        int childrenNb;
+        int err = SkipBlock( ctx, & childrenNb );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+        remaining += childrenNb - 1;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Skip the children of a block, whose header was read.
+ */
+int SkipChildren( Context& ctx, int childrenNb )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    const qint64 startPos = reader.pos();
+    quint32 blocksNb = 0;
+    while( childrenNb > 0 )
+    {
+        int nb;
+        int err = SkipBlock( ctx, & nb );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+        childrenNb += nb - 1;
+        ++blocksNb;
+    }
+
+    return Advance( ctx, blocksNb, reader.pos() - startPos );
+}
+
+/*
+ * The items to deflate for the serialized children of the block, in order.
+ * Their count is the children count of the library.
+ */
+void CollectChildren( const Context& ctx,
+                      const Block* block,
+                      QVector< DeflateItem >* items )
+{
+    items->clear();
+    if( ! block->isLibrary() )
+    {
+        return;
+    }
+
+    const Library* lib = static_cast< const Library* >( block );
+    QVector< const Block* > run;
+    for( int i = 0; i < lib->size(); ++i )
+    {
+        const Block* child = lib->at( i );
+        if( ! child->checkFlag( Block::Serializable ) )
+        {
+            continue;
+        }
+
+        // Leaf blocks are gathered in runs of the same type
+        const kbool leaf = ctx.columns && ! child->isLibrary();
+        if( ! run.isEmpty() &&
+            ( ! leaf || ( run.first()->metaBlock() != child->metaBlock() ) ) )
+        {
+            AppendRun( run, items );
+        }
+
+        if( leaf )
+        {
+            run.append( child );
+        }
+        else
+        {
+            const DeflateItem item = { child, QVector< const Block* >() };
+            items->append( item );
+        }
+    }
+    AppendRun( run, items );
+}
+
+/*
+ * Deflate the tree in pre-order. The position of the header of every block
+ * or run written is appended to positions, if not K_NULL.
+ */
+int DeflateTree( Context& ctx,
+                 const Block* block,
+                 QVector< qint64 >* positions )
+{
+    // Do a pre-order visit of the tree without recursion as recursion
+    // on big "deep" datasets could lead to a stack overflow.
+
+    // We need that stack to avoid recursion
+    QStack< DeflateItem > items;
+    QVector< DeflateItem > children;
+
+    const DeflateItem root = { block, QVector< const Block* >() };
+    items.push( root );
+
+    while( ! items.empty() )
+    {
+        const DeflateItem item = items.pop();
+
+        if( K_NULL != positions )
+        {
+            positions->append( ctx.device->pos() );
+        }
+
+        int err;
+        if( K_NULL == item.block )
+        {
+            err = DeflateColumns( ctx, item.run );
+        }
+        else
+        {
+            CollectChildren( ctx, item.block, & children );
+            err = DeflateBlock( ctx, item.block, children.size() );
+
+            // Stack 'em in reverse order to serialize them in proper order
+            for( int i = children.size() - 1; i >= 0; --i )
+            {
+                items.push( children.at( i ) );
+            }
+        }
+
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Whether the libraries of the tree are all loaded. Libraries not loaded are
+ * not visited.
+ */
+kbool IsLoaded( const Block* root )
+{
+    QStack< const Block* > blocks;
+    blocks.push( root );
+    while( ! blocks.empty() )
+    {
+        const Block* b = blocks.pop();
+        if( ! b->isLibrary() )
+        {
+            continue;
+        }
+
+        const Library* lib = static_cast< const Library* >( b );
+        if( ! lib->isLoaded() )
+        {
+            return false;
+        }
+        for( kint i = 0; i < lib->size(); ++i )
+        {
+            blocks.push( lib->at( i ) );
+        }
+    }
+
+    return true;
+}
+
+/*
+ * The children of a library that are deflated, in order.
+ */
+QList< Block* > SerializedChildren( Library* lib )
+{
+    QList< Block* > children;
+    children.reserve( lib->size() );
+    for( kint i = 0; i < lib->size(); ++i )
+    {
+        Block* child = lib->at( i );
+        if( child->checkFlag( Block::Serializable ) )
+        {
+            children.append( child );
+        }
+    }
+    return children;
+}
+
+} /* internal */ } /* serialization */ } /* Kore */
+
+KoreSerializer::KoreSerializer( kuint options )
+    : _options( options )
+    , _lazyBudget( 0 )
+    , _parallelDepth( 1 )
+    , _compressionChunkSize( 256 * _K_1KB )
+    , _readWindow( _K_1MB )
+    , _writeBehindBufferSize( _K_1MB )
+    , _writeBehindBuffers( 2 )
+{
+}
+
+kuint KoreSerializer::options() const
+{
+    return _options;
+}
+
+void KoreSerializer::setOptions( kuint options )
+{
+    _options = options;
+}
+
+kint KoreSerializer::lazyBudget() const
+{
+    return _lazyBudget;
+}
+
+void KoreSerializer::setLazyBudget( kint blocks )
+{
+    _lazyBudget = blocks;
+}
+
+kint KoreSerializer::parallelDepth() const
+{
+    return _parallelDepth;
+}
+
+void KoreSerializer::setParallelDepth( kint depth )
+{
+    _parallelDepth = K_MAX( depth, 1 );
+}
+
+kint KoreSerializer::compressionChunkSize() const
+{
+    return _compressionChunkSize;
+}
+
+void KoreSerializer::setCompressionChunkSize( kint bytes )
+{
+    _compressionChunkSize = K_MAX( bytes, _K_1KB );
+}
+
+kint KoreSerializer::readWindow() const
+{
+    return _readWindow;
+}
+
+void KoreSerializer::setReadWindow( kint bytes )
+{
+    _readWindow = K_MAX( bytes, 4 * _K_1KB );
+}
+
+kint KoreSerializer::writeBehindBufferSize() const
+{
+    return _writeBehindBufferSize;
+}
+
+void KoreSerializer::setWriteBehindBufferSize( kint bytes )
+{
+    _writeBehindBufferSize = K_MAX( bytes, 4 * _K_1KB );
+}
+
+kint KoreSerializer::writeBehindBuffers() const
+{
+    return _writeBehindBuffers;
+}
+
+void KoreSerializer::setWriteBehindBuffers( kint count )
+{
+    _writeBehindBuffers = K_MAX( count, 2 );
+}
+
+int KoreSerializer::deflate( QIODevice* device,
+                             const Block* block,
+                             TreeSerializerMonitor* monitor ) const
+{
+    int err;
+
+    // The writer thread is the last step before the device
+    if( _options & WriteBehind )
+    {
+        WriteBehindDevice writer( device, _writeBehindBufferSize,
+                                  _writeBehindBuffers );
+        if( ! writer.open( QIODevice::WriteOnly ) )
+        {
+            return IOError;
+        }
+
+        KoreSerializer serializer( *this );
+        serializer._options &= ~WriteBehind;
+        err = serializer.deflate( & writer, block, monitor );
+
+        writer.close();
+
+        return ( ( NoError == err ) && writer.hasError() ) ? IOError : err;
+    }
+
+    if( _options & Compressed )
+    {
+        ChunkedCompressor compressor( device, _compressionChunkSize );
+        if( ! compressor.open( QIODevice::WriteOnly ) )
+        {
+            return IOError;
+        }
+
+        // Deflate as usual, through the compressor
+        KoreSerializer serializer( *this );
+        serializer._options &= ~Compressed;
+        err = serializer.deflate( & compressor, block, monitor );
+
+        compressor.close();
+
+        return ( ( NoError == err ) && compressor.hasError() ) ? IOError
+                                                               : err;
+    }
+
+    // Pre allocate 2KB of memory for the buffer
+    QByteArray buffer;
+    buffer.reserve( 2048 );
+
+    // Create a context
+    Context ctx( &buffer, device, monitor );
+    ctx.streamed = ( 0 != ( _options & Streamable ) );
+
+    if( ctx.streamed )
+    {
+        err = WriteStreamHeader( ctx );
+        if( NoError != err )
+        {
+            return err;
+        }
+    }
+
+    // The table of contents needs the footer metadata
+    QVector< TocBlock > toc;
+    if( ( _options & Indexed ) && ! ctx.streamed )
+    {
+        ctx.toc = & toc;
+    }
+
+    // So does the string table
+    StringTable strings;
+    if( ( _options & SharedStrings ) && ! ctx.streamed )
+    {
+        ctx.strings = & strings;
+    }
+
+    // Runs would hide their blocks from the table of contents
+    ctx.columns = ( 0 != ( _options & Columnar ) ) && ( K_NULL == ctx.toc );
+    ctx.checksums = ( 0 != ( _options & Checksummed ) );
+
+    // The size of the output is not known, the number of blocks is unless
+    // counting them would load a lazily inflated tree entirely
+    Progress progress;
+    if( K_NULL != monitor )
+    {
+        if( ! block->isLibrary() )
+        {
+            progress.blocksTotal = 1;
+        }
+        else if( IsLoaded( block ) )
+        {
+            progress.blocksTotal =
+                    static_cast< const Library* >( block )->totalSize() + 1;
+        }
+        ctx.progress = & progress;
+    }
+
+    err = ( _options & Parallel )
+                ? DeflateParallel( ctx, block, _parallelDepth )
+                : DeflateTree( ctx, block, K_NULL );
+    if( NoError == err )
+    {
+        err = Advance( ctx, 0, 0, true );
+    }
+    if( NoError != err )
+    {
+        return err;
+    }
+
+    if( K_NULL != ctx.toc )
+    {
+        err = WriteToc( ctx );
+        if( NoError != err )
+        {
+            return err;
+        }
+    }
+
+    // The hashes are computed once the blocks are written, from the tree
+    if( ( _options & Hashed ) && ! ctx.streamed )
+    {
+        err = WriteHashes( ctx, block );
+        if( NoError != err )
+        {
+            return err;
+        }
+    }
+
+    // Close the stream, or write the meta data in the file, at the end.
+    err = ctx.streamed ? WriteStreamEnd( ctx ) : WriteMetaData( ctx );
+    if( NoError != err )
+    {
+        return err;
+    }
+
+    return NoError;
+}
+
+int KoreSerializer::deflateProperties( QIODevice* device,
+                                      const Block* block,
+                                      TreeSerializerMonitor* monitor ) const
+{
+    QByteArray buffer;
+    Context ctx( &buffer, device, monitor );
+
+    // They replace the properties of a block, NULL values included
+    ctx.allProperties = true;
+
+    QBuffer* scratch = ctx.scratchDevice();
+    CREATE_STREAM( stream, scratch );
+
+    const int err = WriteBlockProperties( ctx, stream, block );
+    if( NoError != err )
+    {
+        return err;
+    }
+
+    const qint64 length = scratch->pos();
+    return ( device->write( buffer.constData(), length ) == length ) ? NoError
+                                                                     : IOError;
+}
+
+int KoreSerializer::inflateProperties( QIODevice* device,
+                                      Block* block,
+                                      TreeSerializerMonitor* monitor ) const
+{
+    ByteReader reader( device );
+    ReaderDevice readerDevice( & reader );
+    CREATE_STREAM( valueStream, & readerDevice );
+
+    Context ctx( K_NULL, device, monitor );
+    ctx.reader = & reader;
+    ctx.valueStream = & valueStream;
+
+    const int err = ReadBlockProperties( ctx, block );
+    if( NoError != err )
+    {
+        return err;
+    }
+
+    if( ! reader.isSequential() )
+    {
+        device->seek( reader.pos() );
+    }
+
+    return NoError;
+}
+
+int KoreSerializer::patch( QIODevice* base,
+                           QIODevice* delta,
+                           QIODevice* output,
+                           TreeSerializerMonitor* monitor ) const
+{
+    return compact( base, QList< QIODevice* >() << delta, output, monitor );
+}
+
+int KoreSerializer::compact( QIODevice* base,
+                             const QList< QIODevice* >& deltas,
+                             QIODevice* output,
+                             TreeSerializerMonitor* monitor ) const
+{
+    Block* tree = K_NULL;
+    int err = inflate( base, & tree, monitor );
+    if( NoError != err )
+    {
+        return err;
+    }
+
+    for( int i = 0; ( NoError == err ) && ( i < deltas.size() ); ++i )
+    {
+        err = applyDelta( deltas.at( i ), tree, monitor );
+    }
+
+    if( NoError == err )
+    {
+        err = deflate( output, tree, monitor );
+    }
+
+    delete tree;
+
+    return err;
+}
+
+int KoreSerializer::inflate( QIODevice* device,
+                             Block** block,
+                             TreeSerializerMonitor* monitor ) const
+{
+    int err;
+    Block* root = K_NULL;
+    Context ctx( K_NULL, device, monitor );
+
+    if( _options & Arena )
+    {
+        // The arena lives as long as the blocks allocated from it
+        BlockArena* arena = new BlockArena();
+        BlockArena::Scope scope( arena );
+
+        KoreSerializer serializer( *this );
+        serializer.setOptions( _options & ~Arena );
+        err = serializer.inflate( device, block, monitor );
+
+        arena->release();
+        return err;
+    }
+
+    // The lazy and parallel inflates read compressed trees from their
+    // uncompressed view as a device
+    if( ( _options & ( Lazy | Parallel ) ) &&
+        ChunkedDecompressor::IsCompressed( device ) )
+    {
+        if( device->isSequential() )
+        {
+            return RequiresRandomAccess;
+        }
+
+        ChunkedDecompressor decompressor( device );
+        if( ! decompressor.open( QIODevice::ReadOnly ) )
+        {
+            return InvalidData;
+        }
+
+        err = inflate( & decompressor, block, monitor );
+        if( NoError == err )
+        {
+            device->seek( decompressor.containerEnd() );
+        }
+
+        return err;
+    }
+
+    if( _options & Lazy )
+    {
+        LazyLoader* loader = new LazyLoader( device, _lazyBudget );
+        if( loader->isValid() )
+        {
+            qint64 endPos = 0;
+            err = loader->inflate( device->pos(), monitor, & root, & endPos );
+
+            // The loader is owned by the libraries it serves, if any
+            if( ! loader->isUsed() )
+            {
+                delete loader;
+            }
+
+            if( NoError == err )
+            {
+                root->markClean();
+                *block = root;
+                device->seek( endPos );
+            }
+
+            return err;
+        }
+
+        // Not a file nor a buffer, inflate everything
+        delete loader;
+    }
+
+    if( _options & Parallel )
+    {
+        return InflateParallel( device, block, monitor, _parallelDepth );
+    }
+
+    // Memory mapped mode: decode straight from the memory view of the device,
+    // otherwise read the device by chunks.
+    TreeReader treeReader( device, 0 != ( _options & MemoryMapped ),
+                           _readWindow );
+    err = treeReader.open( false );
+    if( NoError != err )
+    {
+        goto cleanup;
+    }
+    treeReader.attach( ctx );
+
+    // Look for the streaming layout, it does not need random access
+    err = treeReader.readHeader( ctx );
+    if( NoError != err )
+    {
+        goto cleanup;
+    }
+
+    err = InflateTree( ctx, & root );
+    if( NoError == err )
+    {
+        err = Advance( ctx, 0, 0, true );
+    }
+    if( NoError != err )
+    {
+        goto cleanup;
+    }
+
+    if( K_NULL == root )
+    {
+        qWarning( "Could not inflate root Block" );
+        err = UnknownRootBlockType;
+        goto cleanup;
+    }
+
+    if( ctx.streamed )
+    {
+        err = ReadStreamEnd( ctx );
+        if( NoError != err )
+        {
+            goto cleanup;
+        }
+    }
+
+    // The inflated tree is the last snapshot
+    root->markClean();
+
+    // Store the result tree in the client's variable
+    *block = root;
+
+    // Leave the device right after the tree
+    treeReader.leave();
 
     // Set the error to none
     err = NoError;
@@ -28,13 +28,174 @@
 #ifndef _Kore_serialization_KoreSerializer_hpp_
 #define _Kore_serialization_KoreSerializer_hpp_
 
+#include "InflateFilter.hpp"
 #include "TreeSerializer.hpp"
 
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+
+#include <KoreTypes.hpp>
+
 namespace Kore { namespace serialization {
 
 class KoreExport KoreSerializer : public TreeSerializer
 {
 public:
+    /*!
+     * @enum    Options.
+     *
+     * Options altering the way trees are deflated and inflated.
+     */
+    enum Options
+    {
+        /// Inflate from a memory mapping of the device when it is a file or a
+        /// buffer, decoding the blocks straight from memory. Other devices
+        /// are read by chunks.
+        MemoryMapped =  0x1 << 0,
+
+        /// Deflate in the streaming layout: a small header comes first and
+        /// the block types are declared right before the first block using
+        /// them, instead of in a footer. The result can be inflated from a
+        /// sequential device (socket, pipe, ...). Inflate recognizes both
+        /// layouts by itself.
+        Streamable =    0x1 << 1,
+
+        /// Inflate the root block only: the children of a library are
+        /// instantiated when it is first accessed, see LibraryLoader. Only
+        /// files and buffers can be inflated lazily, the file must not be
+        /// modified as long as the tree is not fully loaded. Other devices
+        /// are inflated completely.
+        Lazy =          0x1 << 2,
+
+        /// Process the subtrees found at the parallel depth on worker
+        /// threads, see setParallelDepth().
+        /// Inflate: the inflated tree belongs to the calling thread. Devices
+        /// that can not be mapped are read entirely first.
+        /// Deflate: each subtree is written to memory first, the output is
+        /// the same as without the option. Lazily inflated trees must be
+        /// loaded beforehand, libraries can not be loaded by worker threads.
+        Parallel =      0x1 << 3,
+
+        /// Deflate a table of contents of the blocks along with the footer
+        /// metadata, giving the offset and the length of each subtree. It
+        /// allows inflating a single block or subtree with inflateAt().
+        /// Ignored in the streaming layout, which has no footer.
+        Indexed =       0x1 << 4,
+
+        /// Deflate into a chunked compression container, see
+        /// ChunkedCompressor and setCompressionChunkSize(). Chunks are
+        /// compressed in parallel, and decompressed on demand with read-ahead
+        /// on inflate, so that seeks and inflateAt() remain cheap. Inflate
+        /// recognizes compressed trees by itself when the device is at the
+        /// beginning of the container, they require random access.
+        Compressed =    0x1 << 5,
+
+        /// Deflate the QString properties as references into a table of the
+        /// distinct strings, written with the footer metadata. Inflated
+        /// strings share the data of their table entry. With Parallel, the
+        /// order of the table depends on the workers. Ignored in the
+        /// streaming layout.
+        SharedStrings = 0x1 << 6,
+
+        /// Deflate runs of consecutive leaf blocks of the same type column by
+        /// column rather than block by block: the values of a property are
+        /// stored together, and 32 bits integers as deltas from the previous
+        /// block. A run takes the place of a single child in its library.
+        /// Ignored with Indexed, whose table has an entry per block.
+        Columnar =      0x1 << 7,
+
+        /// Deflate the content hashes of each block and of its subtree along
+        /// with the footer metadata, see hash() and changedBlocks(). Ignored
+        /// in the streaming layout.
+        Hashed =        0x1 << 8,
+
+        /// Inflate the blocks from the slabs of an arena of their own, see
+        /// Kore::memory::BlockArena: the tree is loaded without an allocation
+        /// per block, and its memory is released at once when its last block
+        /// is deleted. The libraries loaded later with Lazy, and the blocks
+        /// instantiated by worker threads with Parallel, come from the heap.
+        Arena =         0x1 << 9,
+
+        /// Deflate a CRC-32C of each block frame at its end, see verify().
+        /// Inflating checks the frames that have one and fails with
+        /// ChecksumMismatch. The checksum is flagged in the frame length:
+        /// checksummed files need a reader that knows the flag, older ones
+        /// fail on them. The checksum uses the SSE4.2 instruction when the
+        /// CPU has it.
+        Checksummed =   0x1 << 10,
+
+        /// Deflate through a WriteBehindDevice: the device is written by a
+        /// thread of its own while the next data is serialized, see
+        /// setWriteBehindBufferSize(). The device must support being written
+        /// from another thread.
+        WriteBehind =   0x1 << 11
+    };
+
+public:
+    KoreSerializer( kuint options = 0 );
+
+    kuint options() const;
+    void setOptions( kuint options );
+
+    /*!
+     * @brief Memory budget of lazily inflated trees, in blocks.
+     *
+     * When the loaded libraries hold more blocks than the budget, the least
+     * recently loaded ones are unloaded, whether they were accessed since or
+     * not. Pointers to their blocks become invalid. Libraries whose children
+     * or descendants were modified are never unloaded. 0, the default, means
+     * no limit.
+     */
+    kint lazyBudget() const;
+    void setLazyBudget( kint blocks );
+
+    /*!
+     * @brief Depth of the subtrees processed by worker threads.
+     *
+     * 1, the default, processes each child library of the root on its own
+     * thread. Deeper levels give smaller and more numerous tasks.
+     */
+    kint parallelDepth() const;
+    void setParallelDepth( kint depth );
+
+    /*!
+     * @brief Uncompressed size of the chunks of compressed trees, in bytes.
+     *
+     * Smaller chunks make random accesses cheaper, bigger ones compress
+     * better. The default is 256KB.
+     */
+    kint compressionChunkSize() const;
+    void setCompressionChunkSize( kint bytes );
+
+    /*!
+     * @brief Size of the read-ahead window of inflate, in bytes.
+     *
+     * Devices that are not memory mapped are read by chunks of that size, the
+     * blocks being decoded from memory. Moving within the window, to skip a
+     * block or to come back to it, does not access the device. The default is
+     * 1MB. Sequential devices lose the data read ahead of the tree.
+     */
+    kint readWindow() const;
+    void setReadWindow( kint bytes );
+
+    /*!
+     * @brief Size of the buffers of WriteBehind, in bytes.
+     *
+     * Each write to the device is one buffer. The default is 1MB.
+     */
+    kint writeBehindBufferSize() const;
+    void setWriteBehindBufferSize( kint bytes );
+
+    /*!
+     * @brief Number of buffers of WriteBehind, the one being filled included.
+     *
+     * Serializing waits for the device when they are all in use. The
+     * default, 2, is double buffering; more buffers absorb the variations of
+     * the device latency.
+     */
+    kint writeBehindBuffers() const;
+    void setWriteBehindBuffers( kint count );
+
     virtual int deflate( QIODevice* device,
                          const Kore::data::Block* block,
                          TreeSerializerMonitor* monitor ) const;
@@ -43,6 +204,235 @@ public:
                          Kore::data::Block** block,
                          TreeSerializerMonitor* monitor ) const;
 
+    /*!
+     * @brief Inflate a single block of a tree deflated with Indexed.
+     *
+     * The device is seeked straight to the block, the rest of the tree is not
+     * read. It must support random access, and hold the tree up to its end.
+     *
+     * @param ordinal   Rank of the block in a pre-order walk, 0 for the root.
+     * @param subtree   Inflate the children of the block as well, otherwise
+     *                  a library is inflated empty.
+     * @return NotIndexed if the tree has no table of contents, BlockNotFound
+     *         if there is no such block.
+     */
+    int inflateAt( QIODevice* device,
+                   quint32 ordinal,
+                   kbool subtree,
+                   Kore::data::Block** block,
+                   TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Inflate a single block of a tree deflated with Indexed.
+     *
+     * @param path  Index of the block in the children of each of its
+     *              ancestors, from the root. An empty path is the root.
+     */
+    int inflateAt( QIODevice* device,
+                   const QList< kint >& path,
+                   kbool subtree,
+                   Kore::data::Block** block,
+                   TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Inflate the blocks accepted by the filter only.
+     *
+     * Rejected blocks are skipped through their length, without being
+     * instantiated. The root is always inflated, the accepted blocks are
+     * added to their nearest accepted ancestor. The Lazy and Parallel options
+     * are ignored.
+     */
+    int inflateFiltered( QIODevice* device,
+                         const InflateFilter& filter,
+                         Kore::data::Block** block,
+                         TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Inflate the blocks accepted by the filter to a flat list.
+     *
+     * The root is filtered like the other blocks. The blocks are listed in
+     * pre-order, without their children: accepted libraries are empty. The
+     * caller owns them.
+     */
+    int inflateFiltered( QIODevice* device,
+                         const InflateFilter& filter,
+                         QList< Kore::data::Block* >* blocks,
+                         TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Reload a tree in place from a deflated tree.
+     *
+     * The serialized tree is read alongside the live one: a block whose
+     * position among the serialized children and MetaBlock match a block
+     * read is kept, only its properties that differ being set, and
+     * blockChanged() emitted if any. The other blocks are replaced by the
+     * subtrees read, the children left over are removed. Pointers and
+     * connections to the kept blocks remain valid. Each block read is
+     * instantiated to be compared, one at a time. The tree is marked clean on
+     * success, and left partially merged on error.
+     *
+     * @return UnsupportedOperation if the roots have different types.
+     */
+    int inflateInto( QIODevice* device,
+                     Kore::data::Block* block,
+                     TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Check the checksums of a deflated tree, without inflating it.
+     *
+     * The block frames are walked, and the number of blocks compared to the
+     * one recorded. The device is left after the tree on success.
+     *
+     * @return ChecksumMismatch on the first corrupted frame, NotChecksummed
+     * if the tree was not deflated with Checksummed.
+     */
+    int verify( QIODevice* device, TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Content hash of a subtree, empty if it can not be serialized.
+     *
+     * Equal trees have equal hashes: the hash covers the type and the
+     * serialized properties of each block, and the order of the children,
+     * whatever the options. The hashes are cached on the blocks and only
+     * computed again along the paths that changed since, see
+     * Kore::data::Block::hashCache().
+     */
+    static QByteArray hash( const Kore::data::Block* block );
+
+    /*!
+     * @brief Compare a tree with the hashes of a tree deflated with Hashed,
+     *        without inflating it.
+     *
+     * Only the subtrees whose hashes differ are visited. A block is listed
+     * when its type or properties changed, or when children were added or
+     * removed, in which case its children are not compared.
+     *
+     * @param paths Path of each changed block in pre-order, made of indices
+     *              among the serialized children as in inflateAt(). Empty if
+     *              the trees are equal.
+     * @return NotHashed if the tree was not deflated with Hashed.
+     */
+    int changedBlocks( QIODevice* device,
+                       const Kore::data::Block* block,
+                       QList< QList< kint > >* paths,
+                       TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Deflate the properties of a single block, without its header
+     *        nor its children.
+     *
+     * All the stored properties are written, NULL values and the ones whose
+     * STORED attribute is false included, so that inflateProperties() sets
+     * every one of them.
+     */
+    int deflateProperties( QIODevice* device,
+                           const Kore::data::Block* block,
+                           TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Set the properties written by deflateProperties() on a block of
+     *        the same type.
+     */
+    int inflateProperties( QIODevice* device,
+                           Kore::data::Block* block,
+                           TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Deflate the changes made to a tree since its last snapshot.
+     *
+     * The last snapshot is the tree as inflated, as of the last delta, or as
+     * of the last call to Block::markClean(), typically after deflate(). Only
+     * the blocks marked dirty and the children lists of the libraries whose
+     * children changed are written, added subtrees in full. The tree is
+     * marked clean on success. The options are ignored.
+     *
+     * \sa Kore::data::Block::markDirty
+     */
+    int deflateDelta( QIODevice* device,
+                      Kore::data::Block* block,
+                      TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Apply a delta to the snapshot it was deflated from.
+     *
+     * @return BlockNotFound if the tree does not match the delta, it is then
+     *         left partially updated.
+     */
+    int applyDelta( QIODevice* device,
+                    Kore::data::Block* block,
+                    TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Fold a chain of deltas into a new snapshot.
+     *
+     * The base tree is inflated, the deltas are applied in order, then the
+     * resulting tree is deflated to output.
+     */
+    int compact( QIODevice* base,
+                 const QList< QIODevice* >& deltas,
+                 QIODevice* output,
+                 TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Deflate the differences between two deflated trees as a delta.
+     *
+     * The trees are compared from their serialized form, block by block:
+     * identical subtrees are recognized by their content hashes, see hash(),
+     * wherever they moved in their library. Only the blocks of the target
+     * whose properties changed, and the added subtrees, are instantiated to
+     * be written. The delta is applied to the base tree in memory with
+     * applyDelta(), or to the base tree deflated with patch().
+     *
+     * Both devices must support random access and be positioned at the
+     * beginning of their tree.
+     *
+     * @return UnsupportedOperation if the roots have different types.
+     */
+    int diff( QIODevice* base,
+              QIODevice* target,
+              QIODevice* delta,
+              TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Apply a delta to a deflated tree, deflating the result to
+     *        output with the options of the serializer.
+     */
+    int patch( QIODevice* base,
+               QIODevice* delta,
+               QIODevice* output,
+               TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Split a deflated tree into chunks at subtree boundaries.
+     *
+     * Subtrees of at most chunkSize bytes are kept whole, the header and
+     * properties of the larger ones go in chunks of their own, between the
+     * chunks of their children. Consecutive small siblings are grouped, a
+     * group ending after a sibling chosen from its content only, so that an
+     * edit does not move the boundaries of the unchanged siblings. The
+     * chunks of a subtree are the same from one version of the tree to the
+     * next as long as its types keep their indices, see SnapshotStore.
+     *
+     * The device must support random access and be positioned at the
+     * beginning of the tree, which is read until the end of the device.
+     *
+     * @param boundaries    Offsets from the beginning of the tree where each
+     *                      chunk ends, in ascending order. The last one is
+     *                      the size of the tree.
+     * @return UnsupportedOperation if the tree is compressed.
+     */
+    int split( QIODevice* device,
+               kint chunkSize,
+               QList< qint64 >* boundaries ) const;
+
+private:
+    kuint   _options;
+    kint    _lazyBudget;
+    kint    _parallelDepth;
+    kint    _compressionChunkSize;
+    kint    _readWindow;
+    kint    _writeBehindBufferSize;
+    kint    _writeBehindBuffers;
 };
 
 } /* serialization */ } /* Kore */
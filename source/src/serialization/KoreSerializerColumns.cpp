@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QtEndian>
+
+#include "KoreSerializerPrivate.hpp"
+#include "PropertyCodecs.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+// Column encodings
+#define COLUMN_VALUES               0x0
+#define COLUMN_DELTA32              0x1
+
+namespace {
+
+inline quint32 ZigZag32( quint32 value )
+{
+    return ( value << 1 ) ^
+           static_cast< quint32 >( static_cast< qint32 >( value ) >> 31 );
+}
+
+inline quint32 UnZigZag32( quint32 value )
+{
+    return ( value >> 1 ) ^ ( 0 - ( value & 1 ) );
+}
+
+} // namespace
+
+namespace Kore { namespace serialization { namespace internal {
+
+/*
+ * Deflate a run of leaf blocks of the same type, column by column. Each column
+ * holds a property: a bitmap of the blocks it is written for, then their
+ * values. 32 bits integers are written as zigzag deltas from the previous
+ * value, so that sequences and repeated values take a byte.
+ *
+ *  u32 COLUMNS_RECORD, u32 length, u32 type, u32 blocks count
+ *  u16 columns count
+ *  for each column: varint property index, u8 encoding, bitmap, values
+ */
+int DeflateColumns( Context& ctx, const QVector< const Block* >& run )
+{
+    const MetaBlock* mb = run.first()->metaBlock();
+
+    if( ctx.streamed )
+    {
+        int err = WriteStreamMetaBlock( ctx, mb );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    QBuffer* scratch = ctx.scratchDevice();
+    scratch->seek( 0 );
+
+    CREATE_STREAM( stream, scratch );
+
+    const int blocksNb = run.size();
+
+    // Header, with a blank length and columns count
+    stream << static_cast< quint32 >( COLUMNS_RECORD );
+    stream << quint32( 0 );
+    stream << ctx.getMetaBlockIndex( mb );
+    stream << static_cast< quint32 >( blocksNb );
+
+    const qint64 columnsCountPos = scratch->pos();
+    stream << quint16( 0 );
+    quint16 columnsCount = 0;
+
+    const QByteArray emptyBitmap( ( blocksNb + 7 ) / 8, '\0' );
+
+    const QVector< MetaBlock::StoredProperty >& properties =
+            mb->storedProperties();
+    for( int p = 0; p < properties.size(); ++p )
+    {
+        const MetaBlock::StoredProperty& stored = properties.at( p );
+        const int propertyIdx = stored.property.propertyIndex();
+        const int propType = StoredPropertyType( stored );
+        const quint8 encoding = ( ( QMetaType::Int == propType ) ||
+                                  ( QMetaType::UInt == propType ) )
+                ? COLUMN_DELTA32
+                : COLUMN_VALUES;
+
+        const qint64 columnPos = scratch->pos();
+        WriteVariableLength32( stream, propertyIdx );
+        stream << encoding;
+        const qint64 bitmapPos = scratch->pos();
+        stream.writeRawData( emptyBitmap.constData(), emptyBitmap.size() );
+
+        int valuesNb = 0;
+        quint32 previous = 0;
+        for( int i = 0; i < blocksNb; ++i )
+        {
+            const Block* block = run.at( i );
+
+            kbool written = false;
+            if( COLUMN_DELTA32 == encoding )
+            {
+                if( stored.property.isStored( block ) )
+                {
+                    quint32 value;
+                    PropertyCodecs::ReadProperty( block, propertyIdx,
+                                                  & value );
+                    WriteVariableLength32( stream,
+                                           ZigZag32( value - previous ) );
+                    previous = value;
+                    written = true;
+                }
+            }
+            else
+            {
+                int err = WriteProperty( ctx, stream, block, stored,
+                                         false, & written );
+                if( TreeSerializer::NoError != err )
+                {
+                    return err;
+                }
+            }
+
+            if( written )
+            {
+                ctx.buffer->data()[ bitmapPos + ( i >> 3 ) ] |=
+                        static_cast< char >( 1 << ( i & 7 ) );
+                ++valuesNb;
+            }
+        }
+
+        if( 0 == valuesNb )
+        {
+            // No block has a value, drop the column
+            scratch->seek( columnPos );
+            continue;
+        }
+
+        ++columnsCount;
+    }
+
+    if( ctx.checksums )
+    {
+        stream << quint32( 0 );
+    }
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    const qint64 length = scratch->pos();
+    char* data = ctx.buffer->data();
+
+    qToBigEndian< quint32 >( static_cast< quint32 >( length ) |
+                                 ( ctx.checksums ? BLOCK_CHECKSUM_FLAG : 0 ),
+                             reinterpret_cast< uchar* >( data + 4 ) );
+    qToBigEndian< quint16 >( columnsCount,
+                             reinterpret_cast< uchar* >(
+                                    data + columnsCountPos ) );
+    if( ctx.checksums )
+    {
+        SealFrame( data );
+    }
+
+    if( ctx.device->write( data, length ) != length )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    ctx.blocksCount += blocksNb;
+
+    return Advance( ctx, blocksNb, length );
+}
+
+/*
+ * Inflate a run of blocks written as columns, whose header was read. The
+ * blocks are empty on error, or if the user chose to skip unknown blocks.
+ */
+int InflateColumns( Context& ctx, QVector< Block* >* blocks )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    const quint32 type = reader.readUInt32();
+    const quint32 blocksNb = reader.readUInt32();
+    const quint16 columnsCount = reader.readUInt16();
+    if( reader.hasError() ||
+        ( ( 0 == blocksNb ) && ( 0 != columnsCount ) ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    // Create the blocks first, the columns are then set on all of them
+    blocks->reserve( blocksNb );
+    for( quint32 i = 0; i < blocksNb; ++i )
+    {
+        Block* b;
+        int err = InstantiateBlock( ctx, type, & b );
+        if( ( TreeSerializer::NoError != err ) || ( K_NULL == b ) )
+        {
+            // The user may have chosen to skip the blocks of an unknown type
+            qDeleteAll( *blocks );
+            blocks->clear();
+            return err;
+        }
+        blocks->append( b );
+    }
+
+    int err = TreeSerializer::NoError;
+    QByteArray bitmap( ( blocksNb + 7 ) / 8, '\0' );
+    for( quint16 c = 0; ( TreeSerializer::NoError == err ) &&
+                        ( c < columnsCount ); ++c )
+    {
+        const quint32 propertyIdx = reader.readVariableLength32();
+        const quint8 encoding = reader.readUInt8();
+        if( reader.read( bitmap.data(), bitmap.size() ) != bitmap.size() )
+        {
+            err = TreeSerializer::InvalidData;
+            break;
+        }
+
+        QMetaProperty prop;
+        int propType;
+        err = ResolveBlockProperty( ctx, blocks->first(), propertyIdx,
+                                    & prop, & propType );
+        if( TreeSerializer::NoError != err )
+        {
+            break;
+        }
+
+        if( ( COLUMN_VALUES != encoding ) &&
+            ( ( COLUMN_DELTA32 != encoding ) ||
+              ( ( QMetaType::Int != propType ) &&
+                ( QMetaType::UInt != propType ) ) ) )
+        {
+            err = TreeSerializer::InvalidData;
+            break;
+        }
+
+        quint32 previous = 0;
+        for( quint32 i = 0; i < blocksNb; ++i )
+        {
+            if( ! ( bitmap.at( i >> 3 ) & ( 1 << ( i & 7 ) ) ) )
+            {
+                continue;
+            }
+
+            if( COLUMN_DELTA32 == encoding )
+            {
+                previous += UnZigZag32( reader.readVariableLength32() );
+                if( prop.isWritable() )
+                {
+                    quint32 value = previous;
+                    PropertyCodecs::WriteProperty( blocks->at( i ),
+                                                   prop.propertyIndex(),
+                                                   & value );
+                }
+            }
+            else
+            {
+                err = ReadProperty( ctx, blocks->at( i ), prop, propType );
+                if( TreeSerializer::NoError != err )
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    if( ( TreeSerializer::NoError == err ) && reader.hasError() )
+    {
+        err = TreeSerializer::InvalidData;
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        qDeleteAll( *blocks );
+        blocks->clear();
+        return err;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+} /* internal */ } /* serialization */ } /* Kore */
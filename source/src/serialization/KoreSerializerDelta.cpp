@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+/*
+ * Delta.
+ *
+ * A delta holds the changes made to a tree since its last snapshot, as a list
+ * of records in the pre-order of the current tree. A record locates a block by
+ * its path from the root, then holds its properties if they changed, and its
+ * new children list if it is a library whose children changed. A kept child is
+ * referenced by its rank in the base children list, an added one is deflated
+ * inline, in the streaming layout.
+ */
+
+namespace {
+
+int WriteDeltaRecord( Context& ctx,
+                      quint8 kind,
+                      const QVector< quint32 >& path,
+                      Block* block )
+{
+    QBuffer* scratch = ctx.scratchDevice();
+    scratch->seek( 0 );
+
+    CREATE_STREAM( stream, scratch );
+
+    stream << kind;
+    WriteVariableLength32( stream, path.size() );
+    for( int i = 0; i < path.size(); ++i )
+    {
+        WriteVariableLength32( stream, path.at( i ) );
+    }
+
+    // The properties replace those of the block, NULL values included
+    if( kind & DELTA_PROPERTIES )
+    {
+        ctx.allProperties = true;
+        int err = WriteBlockProperties( ctx, stream, block );
+        ctx.allProperties = false;
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    const qint64 length = scratch->pos();
+    if( ctx.device->write( ctx.buffer->constData(), length ) != length )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    if( ! ( kind & DELTA_CHILDREN ) )
+    {
+        return TreeSerializer::NoError;
+    }
+
+    const QList< Block* > children =
+            SerializedChildren( static_cast< Library* >( block ) );
+
+    CREATE_STREAM( out, ctx.device );
+
+    WriteVariableLength32( out, children.size() );
+    for( int i = 0; i < children.size(); ++i )
+    {
+        const Block* child = children.at( i );
+
+        // 0 for an added child, followed by its subtree
+        WriteVariableLength32( out, child->baseIndex() + 1 );
+        if( QDataStream::Ok != out.status() )
+        {
+            return TreeSerializer::IOError;
+        }
+
+        if( -1 == child->baseIndex() )
+        {
+            int err = DeflateTree( ctx, child, K_NULL );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+    }
+
+    return TreeSerializer::NoError;
+}
+
+struct DeltaBlock
+{
+    Block*              block;
+    QVector< quint32 >  path;
+};
+
+int DeflateDelta( Context& ctx, Block* root )
+{
+    CREATE_STREAM( stream, ctx.device );
+
+    stream << static_cast< quint32 >( DELTA_MAGIC );
+    stream << static_cast< quint8 >( DELTA_VERSION );
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    const kuint64 dirtyFlags = Block::Dirty | Block::DirtyDescendants |
+                               Library::ChildrenChanged;
+
+    // Only the dirty parts of the tree are visited, in pre-order
+    QStack< DeltaBlock > blocks;
+    DeltaBlock rootBlock = { root, QVector< quint32 >() };
+    blocks.push( rootBlock );
+
+    while( ! blocks.empty() )
+    {
+        const DeltaBlock current = blocks.pop();
+        Block* b = current.block;
+
+        Library* lib = b->isLibrary() ? static_cast< Library* >( b )
+                                      : K_NULL;
+        const kbool childrenChanged =
+                ( K_NULL != lib ) && lib->checkFlag( Library::ChildrenChanged );
+
+        const quint8 kind = ( b->isDirty() ? DELTA_PROPERTIES : 0 ) |
+                            ( childrenChanged ? DELTA_CHILDREN : 0 );
+        if( 0 != kind )
+        {
+            int err = WriteDeltaRecord( ctx, kind, current.path, b );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        if( ( K_NULL == lib ) ||
+            ! lib->checkFlag( Block::DirtyDescendants |
+                              Library::ChildrenChanged ) )
+        {
+            continue;
+        }
+
+        // Stack the dirty children in reverse order, added ones were written
+        // entirely with the children list.
+        const QList< Block* > children = SerializedChildren( lib );
+        for( int i = children.size() - 1; i >= 0; --i )
+        {
+            Block* child = children.at( i );
+            if( child->checkFlag( dirtyFlags ) &&
+                ! ( childrenChanged && ( -1 == child->baseIndex() ) ) )
+            {
+                DeltaBlock childBlock = { child, current.path };
+                childBlock.path.append( i );
+                blocks.push( childBlock );
+            }
+        }
+    }
+
+    stream << static_cast< quint8 >( DELTA_END );
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Replace the children of the library by the list read from the delta.
+ */
+int ApplyDeltaChildren( Context& ctx, Library* lib )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    const QList< Block* > base = SerializedChildren( lib );
+    QVector< kbool > kept( base.size(), false );
+
+    QList< Block* > children;
+    QList< Block* > added;
+
+    const quint32 childrenNb = reader.readVariableLength32();
+    if( reader.hasError() )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    int err = TreeSerializer::NoError;
+    for( quint32 i = 0; i < childrenNb; ++i )
+    {
+        const quint32 tag = reader.readVariableLength32();
+        if( reader.hasError() )
+        {
+            err = TreeSerializer::InvalidData;
+            break;
+        }
+
+        if( 0 == tag )
+        {
+            Block* child;
+            err = InflateTree( ctx, & child );
+            if( TreeSerializer::NoError != err )
+            {
+                break;
+            }
+
+            // K_NULL if the user chose to skip an unknown block
+            if( K_NULL != child )
+            {
+                added.append( child );
+                children.append( child );
+            }
+            continue;
+        }
+
+        const quint32 baseIndex = tag - 1;
+        if( ( baseIndex >= static_cast< quint32 >( base.size() ) ) ||
+            kept.at( baseIndex ) )
+        {
+            err = TreeSerializer::InvalidData;
+            break;
+        }
+
+        kept[ baseIndex ] = true;
+        children.append( base.at( baseIndex ) );
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        qDeleteAll( added );
+        return err;
+    }
+
+    for( int i = 0; i < base.size(); ++i )
+    {
+        Block* b = base.at( i );
+        lib->removeBlock( b );
+        if( ! kept.at( i ) && ! b->checkFlag( Block::Static ) )
+        {
+            delete b;
+        }
+    }
+
+    for( int i = 0; i < children.size(); ++i )
+    {
+        lib->addBlock( children.at( i ) );
+    }
+
+    return TreeSerializer::NoError;
+}
+
+int ApplyDelta( Context& ctx, Block* root )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    if( ( DELTA_MAGIC != reader.readUInt32() ) ||
+        ( DELTA_VERSION != reader.readUInt8() ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    for( quint8 kind = reader.readUInt8();
+         DELTA_END != kind;
+         kind = reader.readUInt8() )
+    {
+        if( 0 != ( kind & ~( DELTA_PROPERTIES | DELTA_CHILDREN ) ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        // Follow the path in the tree as modified by the previous records
+        Block* b = root;
+        const quint32 depth = reader.readVariableLength32();
+        for( quint32 i = 0; i < depth; ++i )
+        {
+            const quint32 index = reader.readVariableLength32();
+            if( reader.hasError() )
+            {
+                return TreeSerializer::InvalidData;
+            }
+
+            const QList< Block* > children =
+                    b->isLibrary()
+                        ? SerializedChildren( static_cast< Library* >( b ) )
+                        : QList< Block* >();
+            if( index >= static_cast< quint32 >( children.size() ) )
+            {
+                return TreeSerializer::BlockNotFound;
+            }
+            b = children.at( index );
+        }
+
+        if( reader.hasError() )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        int err;
+        if( kind & DELTA_PROPERTIES )
+        {
+            err = ReadBlockProperties( ctx, b );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        if( kind & DELTA_CHILDREN )
+        {
+            if( ! b->isLibrary() )
+            {
+                return TreeSerializer::BlockNotFound;
+            }
+
+            err = ApplyDeltaChildren( ctx, static_cast< Library* >( b ) );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+    }
+
+    return reader.hasError() ? TreeSerializer::InvalidData
+                             : TreeSerializer::NoError;
+}
+
+} // namespace
+
+int KoreSerializer::deflateDelta( QIODevice* device,
+                                  Block* block,
+                                  TreeSerializerMonitor* monitor ) const
+{
+    QByteArray buffer;
+    buffer.reserve( 2048 );
+
+    // Added subtrees declare their types inline
+    Context ctx( &buffer, device, monitor );
+    ctx.streamed = true;
+
+    const int err = DeflateDelta( ctx, block );
+    if( NoError == err )
+    {
+        block->markClean();
+    }
+
+    return err;
+}
+
+int KoreSerializer::applyDelta( QIODevice* device,
+                                Block* block,
+                                TreeSerializerMonitor* monitor ) const
+{
+    ByteReader reader( device );
+    ReaderDevice readerDevice( & reader );
+    CREATE_STREAM( valueStream, & readerDevice );
+
+    Context ctx( K_NULL, device, monitor );
+    ctx.reader = & reader;
+    ctx.valueStream = & valueStream;
+    ctx.streamed = true;
+
+    const int err = ApplyDelta( ctx, block );
+    if( NoError != err )
+    {
+        return err;
+    }
+
+    // The tree matches the snapshot the delta was deflated from
+    block->markClean();
+
+    if( ! reader.isSequential() )
+    {
+        device->seek( reader.pos() );
+    }
+
+    return NoError;
+}
@@ -0,0 +1,629 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QPair>
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+/*
+ * Diff.
+ *
+ * Two deflated trees are compared from their serialized form, without
+ * instantiating their blocks: the properties of a block are hashed straight
+ * from the file, then the subtrees as for the content hashes. The blocks of
+ * columnar runs, and the ones of trees with a string table, are decoded to be
+ * hashed in their plain form. The children of a library are matched by equal
+ * subtree hashes first, then in order when their types match. The differences
+ * are deflated as a delta, added subtrees being inflated from the target.
+ */
+
+namespace {
+
+struct DiffNode
+{
+    qint64 pos;             //!< Of the header, or of the run
+    qint64 propertiesPos;   //!< -1 for the blocks of a run
+    quint32 length;         //!< Header and properties
+    QString type;
+    Block* block;           //!< Decoded block of a run, K_NULL otherwise
+    QByteArray hash;        //!< Of the type and the properties
+    QByteArray subtreeHash;
+    QVector< int > children;
+};
+
+/*
+ * A deflated tree being compared, and the index of its blocks in pre-order.
+ */
+class DiffTree
+{
+public:
+    DiffTree( QIODevice* device,
+              kbool mapped,
+              qint64 window,
+              TreeSerializerMonitor* monitor )
+        : _treeReader( device, mapped, window )
+        , ctx( & _buffer, device, monitor )
+    {}
+
+    ~DiffTree()
+    {
+        for( int i = 0; i < nodes.size(); ++i )
+        {
+            delete nodes.at( i ).block;
+        }
+    }
+
+    int open();
+
+    // Properties of a block as deflateProperties() writes them
+    int writeProperties( QDataStream& stream, Context& out, int ordinal );
+
+    // Inflate the subtree of a block
+    int inflate( int ordinal, Block** tree );
+
+private:
+    int index();
+    int hashBlock( DiffNode* node, quint32 type );
+
+private:
+    TreeReader      _treeReader;
+    QByteArray      _buffer;
+
+public:
+    Context ctx;
+    QVector< DiffNode > nodes;
+};
+
+int DiffTree::open()
+{
+    // Compressed trees are compared from their uncompressed view
+    int err = _treeReader.open( true );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+    _treeReader.attach( ctx, false );
+
+    err = _treeReader.readHeader( ctx );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    err = index();
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // The inline declarations are all known now, blocks can be read again
+    ctx.metaBlocksKnown = true;
+
+    // Subtree hashes, the children come after their parent
+    for( int i = nodes.size() - 1; i >= 0; --i )
+    {
+        DiffNode& node = nodes[ i ];
+        QCryptographicHash subtreeHash( QCryptographicHash::Sha1 );
+        subtreeHash.addData( node.hash );
+        for( int c = 0; c < node.children.size(); ++c )
+        {
+            const DiffNode& child = nodes.at( node.children.at( c ) );
+            subtreeHash.addData( child.subtreeHash );
+        }
+        node.subtreeHash = subtreeHash.result();
+    }
+
+    return TreeSerializer::NoError;
+}
+
+int DiffTree::index()
+{
+    ByteReader& reader = *( ctx.reader );
+
+    QStack< QPair< int, int > > opened;     // Ordinal, remaining children
+    do
+    {
+        if( ctx.streamed )
+        {
+            int err = ReadStreamMetaBlocks( ctx );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        const qint64 pos = reader.pos();
+        quint32 type;
+        quint32 length;
+        int childrenNb;
+        kbool checksummed;
+        if( ! ReadBlockHeader( reader, & type, & length, & childrenNb,
+                               & checksummed ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        // The properties stop before the checksum
+        const quint32 framed = checksummed
+                ? length - BLOCK_CHECKSUM_SIZE
+                : length;
+
+        const int parent = opened.empty() ? -1 : opened.top().first;
+        if( -1 != parent )
+        {
+            --( opened.top().second );
+        }
+
+        if( COLUMNS_RECORD == type )
+        {
+            if( -1 == parent )
+            {
+                return TreeSerializer::InvalidData;
+            }
+
+            // Empty if the user chose to skip an unknown type
+            QVector< Block* > blocks;
+            int err = InflateColumns( ctx, & blocks );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+
+            // The nodes own the blocks from now on
+            for( int i = 0; i < blocks.size(); ++i )
+            {
+                DiffNode node = { pos, -1, length,
+                                  blocks.at( i )->metaBlock()->blockClassName(),
+                                  blocks.at( i ), QByteArray(), QByteArray(),
+                                  QVector< int >() };
+                nodes[ parent ].children.append( nodes.size() );
+                nodes.append( node );
+            }
+
+            for( int i = nodes.size() - blocks.size(); i < nodes.size(); ++i )
+            {
+                err = BlockHash( ctx, nodes.at( i ).block, & nodes[ i ].hash );
+                if( TreeSerializer::NoError != err )
+                {
+                    return err;
+                }
+            }
+        }
+        else
+        {
+            DiffNode node = { pos, reader.pos(), framed,
+                              ctx.metaBlocksNames.value( type ), K_NULL,
+                              QByteArray(), QByteArray(), QVector< int >() };
+            int err = hashBlock( & node, type );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+
+            if( -1 != parent )
+            {
+                nodes[ parent ].children.append( nodes.size() );
+            }
+            nodes.append( node );
+
+            if( 0 != childrenNb )
+            {
+                opened.push( qMakePair( nodes.size() - 1, childrenNb ) );
+            }
+        }
+
+        if( ! reader.seek( pos + length ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        while( ! opened.empty() && ( 0 == opened.top().second ) )
+        {
+            opened.pop();
+        }
+    }
+    while( ! opened.empty() );
+
+    return TreeSerializer::NoError;
+}
+
+int DiffTree::hashBlock( DiffNode* node, quint32 type )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    // Strings are references into the table, decode them
+    if( ctx.hasStringTable && ( K_NULL != ctx.getMetaBlock( type ) ) )
+    {
+        Block* block;
+        int childrenNb;
+        int err = reader.seek( node->pos )
+                ? InflateBlock( ctx, & block, & childrenNb )
+                : TreeSerializer::InvalidData;
+        if( ( TreeSerializer::NoError == err ) && ( K_NULL != block ) )
+        {
+            err = BlockHash( ctx, block, & node->hash );
+            delete block;
+            return err;
+        }
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    const qint64 size = node->pos + node->length - node->propertiesPos;
+    if( ( size < 0 ) || ! reader.seek( node->propertiesPos ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    QByteArray properties( size, Qt::Uninitialized );
+    if( reader.read( properties.data(), size ) != size )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    QCryptographicHash blockHash( QCryptographicHash::Sha1 );
+    blockHash.addData( node->type.toLatin1() );
+    blockHash.addData( "", 1 );
+    blockHash.addData( properties );
+    node->hash = blockHash.result();
+
+    return TreeSerializer::NoError;
+}
+
+int DiffTree::writeProperties( QDataStream& stream, Context& out, int ordinal )
+{
+    ByteReader& reader = *( ctx.reader );
+    const DiffNode& node = nodes.at( ordinal );
+
+    if( K_NULL != node.block )
+    {
+        return WriteBlockProperties( out, stream, node.block );
+    }
+
+    // The block is decoded, the values it does not store are written too
+    Block* block;
+    int childrenNb;
+    int err = reader.seek( node.pos )
+            ? InflateBlock( ctx, & block, & childrenNb )
+            : TreeSerializer::InvalidData;
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+    if( K_NULL != block )
+    {
+        err = WriteBlockProperties( out, stream, block );
+        delete block;
+        return err;
+    }
+
+    // The user chose to skip an unknown type, copy its properties as they are
+    // when they do not use the string table
+    if( ctx.hasStringTable )
+    {
+        return TreeSerializer::UnknownBlockType;
+    }
+
+    const qint64 size = node.pos + node.length - node.propertiesPos;
+    QByteArray properties( size, Qt::Uninitialized );
+    if( ! reader.seek( node.propertiesPos ) ||
+        ( reader.read( properties.data(), size ) != size ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    stream.writeRawData( properties.constData(), size );
+    return ( QDataStream::Ok == stream.status() )
+            ? TreeSerializer::NoError
+            : TreeSerializer::IOError;
+}
+
+int DiffTree::inflate( int ordinal, Block** tree )
+{
+    const DiffNode& node = nodes.at( ordinal );
+
+    *tree = K_NULL;
+
+    if( K_NULL != node.block )
+    {
+        // Blocks of a run are leaves, the index keeps its instance
+        return TreeSerializer::UnsupportedOperation;
+    }
+
+    int err = ctx.reader->seek( node.pos ) ? InflateTree( ctx, tree )
+                                           : TreeSerializer::InvalidData;
+    if( ( TreeSerializer::NoError == err ) && ( K_NULL == *tree ) )
+    {
+        err = TreeSerializer::UnknownBlockType;
+    }
+
+    return err;
+}
+
+/*
+ * Write a delta record for a block of the target, see WriteDeltaRecord().
+ * mapping gives the base index of each child, -1 for the added ones.
+ */
+int WriteDiffRecord( Context& ctx,
+                     DiffTree& target,
+                     int ordinal,
+                     quint8 kind,
+                     const QVector< quint32 >& path,
+                     const QVector< int >& mapping )
+{
+    QBuffer* scratch = ctx.scratchDevice();
+    scratch->seek( 0 );
+
+    CREATE_STREAM( stream, scratch );
+
+    stream << kind;
+    WriteVariableLength32( stream, path.size() );
+    for( int i = 0; i < path.size(); ++i )
+    {
+        WriteVariableLength32( stream, path.at( i ) );
+    }
+
+    // The properties replace those of the block, NULL values included
+    if( kind & DELTA_PROPERTIES )
+    {
+        ctx.allProperties = true;
+        int err = target.writeProperties( stream, ctx, ordinal );
+        ctx.allProperties = false;
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    const qint64 length = scratch->pos();
+    if( ctx.device->write( ctx.buffer->constData(), length ) != length )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    if( ! ( kind & DELTA_CHILDREN ) )
+    {
+        return TreeSerializer::NoError;
+    }
+
+    CREATE_STREAM( out, ctx.device );
+
+    const QVector< int >& children = target.nodes.at( ordinal ).children;
+    WriteVariableLength32( out, children.size() );
+    for( int i = 0; i < children.size(); ++i )
+    {
+        // 0 for an added child, followed by its subtree
+        WriteVariableLength32( out, mapping.at( i ) + 1 );
+        if( QDataStream::Ok != out.status() )
+        {
+            return TreeSerializer::IOError;
+        }
+
+        if( -1 != mapping.at( i ) )
+        {
+            continue;
+        }
+
+        const Block* run = target.nodes.at( children.at( i ) ).block;
+        Block* subtree = K_NULL;
+        int err = ( K_NULL != run )
+                ? TreeSerializer::NoError
+                : target.inflate( children.at( i ), & subtree );
+        if( TreeSerializer::NoError == err )
+        {
+            err = DeflateTree( ctx, ( K_NULL != run ) ? run : subtree,
+                               K_NULL );
+        }
+        delete subtree;
+
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    return TreeSerializer::NoError;
+}
+
+struct DiffPair
+{
+    int base;
+    int target;
+    QVector< quint32 > path;    //!< In the target tree
+};
+
+int Diff( DiffTree& base, DiffTree& target, Context& ctx )
+{
+    if( base.nodes.first().type != target.nodes.first().type )
+    {
+        // The root of a tree can not be replaced by a delta
+        return TreeSerializer::UnsupportedOperation;
+    }
+
+    CREATE_STREAM( stream, ctx.device );
+
+    stream << static_cast< quint32 >( DELTA_MAGIC );
+    stream << static_cast< quint8 >( DELTA_VERSION );
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    // Records in the pre-order of the target tree, as deflateDelta() does
+    QStack< DiffPair > pairs;
+    DiffPair rootPair = { 0, 0, QVector< quint32 >() };
+    pairs.push( rootPair );
+
+    while( ! pairs.empty() )
+    {
+        const DiffPair pair = pairs.pop();
+        const DiffNode& baseNode = base.nodes.at( pair.base );
+        const DiffNode& targetNode = target.nodes.at( pair.target );
+
+        if( baseNode.subtreeHash == targetNode.subtreeHash )
+        {
+            continue;
+        }
+
+        const QVector< int >& baseChildren = baseNode.children;
+        const QVector< int >& targetChildren = targetNode.children;
+
+        // Unchanged subtrees first, wherever they moved
+        QHash< QByteArray, QList< int > > unchanged;
+        for( int i = 0; i < baseChildren.size(); ++i )
+        {
+            unchanged[ base.nodes.at( baseChildren.at( i ) ).subtreeHash ]
+                    .append( i );
+        }
+
+        QVector< int > mapping( targetChildren.size(), -1 );
+        QVector< kbool > used( baseChildren.size(), false );
+        for( int i = 0; i < targetChildren.size(); ++i )
+        {
+            QHash< QByteArray, QList< int > >::iterator it = unchanged.find(
+                    target.nodes.at( targetChildren.at( i ) ).subtreeHash );
+            if( ( unchanged.end() != it ) && ! it.value().isEmpty() )
+            {
+                mapping[ i ] = it.value().takeFirst();
+                used[ mapping.at( i ) ] = true;
+            }
+        }
+
+        // Then the changed ones, in order, when their types match
+        int next = 0;
+        for( int i = 0; i < targetChildren.size(); ++i )
+        {
+            if( -1 != mapping.at( i ) )
+            {
+                continue;
+            }
+
+            while( ( next < baseChildren.size() ) && used.at( next ) )
+            {
+                ++next;
+            }
+            if( ( next < baseChildren.size() ) &&
+                ( base.nodes.at( baseChildren.at( next ) ).type ==
+                  target.nodes.at( targetChildren.at( i ) ).type ) )
+            {
+                mapping[ i ] = next;
+                used[ next ] = true;
+            }
+        }
+
+        kbool childrenChanged = ( baseChildren.size() != mapping.size() );
+        for( int i = 0; ! childrenChanged && ( i < mapping.size() ); ++i )
+        {
+            childrenChanged = ( i != mapping.at( i ) );
+        }
+
+        const quint8 kind =
+                ( ( baseNode.hash != targetNode.hash ) ? DELTA_PROPERTIES
+                                                       : 0 ) |
+                ( childrenChanged ? DELTA_CHILDREN : 0 );
+        if( 0 != kind )
+        {
+            int err = WriteDiffRecord( ctx, target, pair.target, kind,
+                                       pair.path, mapping );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        // Compare the matched children, the added ones were written entirely
+        for( int i = targetChildren.size() - 1; i >= 0; --i )
+        {
+            if( -1 != mapping.at( i ) )
+            {
+                DiffPair child = { baseChildren.at( mapping.at( i ) ),
+                                   targetChildren.at( i ),
+                                   pair.path };
+                child.path.append( i );
+                pairs.push( child );
+            }
+        }
+    }
+
+    stream << static_cast< quint8 >( DELTA_END );
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+int Diff( QIODevice* base,
+          QIODevice* target,
+          QIODevice* delta,
+          kbool mapped,
+          qint64 window,
+          TreeSerializerMonitor* monitor )
+{
+    DiffTree baseTree( base, mapped, window, monitor );
+    int err = baseTree.open();
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    DiffTree targetTree( target, mapped, window, monitor );
+    err = targetTree.open();
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // Added subtrees declare their types inline
+    QByteArray buffer;
+    Context ctx( & buffer, delta, monitor );
+    ctx.streamed = true;
+
+    return Diff( baseTree, targetTree, ctx );
+}
+
+} // namespace
+
+int KoreSerializer::diff( QIODevice* base,
+                          QIODevice* target,
+                          QIODevice* delta,
+                          TreeSerializerMonitor* monitor ) const
+{
+    return Diff( base, target, delta, 0 != ( _options & MemoryMapped ),
+                 _readWindow, monitor );
+}
@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+/*
+ * Filtered inflate.
+ *
+ * Only the blocks accepted by the filter are instantiated, the other ones are
+ * skipped through the length of their header. Accepted blocks are either added
+ * to their nearest accepted ancestor, the root being always accepted, or
+ * collected unattached in a flat list.
+ */
+
+namespace {
+
+struct FilterLevel
+{
+    Library* lib;       //!< Receives the accepted children, K_NULL in a list
+    int childrenNb;     //!< Serialized children left
+    kint next;          //!< Index of the next child in the whole tree
+};
+
+/*
+ * Filter a run of blocks written as columns, whose header was read. The run
+ * is inflated only if one of its blocks is accepted, the other ones are then
+ * deleted straight away. *count is the number of blocks of the run.
+ */
+int FilterColumns( Context& ctx,
+                   const InflateFilter& filter,
+                   QList< kint >& path,
+                   Library* lib,
+                   QList< Block* >* found,
+                   quint32* count )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    // Peek the type and the size of the run
+    const qint64 columnsPos = reader.pos();
+    const quint32 type = reader.readUInt32();
+    const quint32 blocksNb = reader.readUInt32();
+    if( reader.hasError() || path.isEmpty() )
+    {
+        // A run is never the root
+        return TreeSerializer::InvalidData;
+    }
+
+    *count = blocksNb;
+
+    const MetaBlock* mb = ctx.getMetaBlock( type );
+    const kint first = path.last();
+    QVector< kbool > accepted( blocksNb );
+    kbool any = false;
+    for( quint32 i = 0; i < blocksNb; ++i )
+    {
+        path.last() = first + static_cast< kint >( i );
+        accepted[ i ] = ( InflateFilter::Accept == filter.decide( mb, path ) );
+        any = any || accepted.at( i );
+    }
+    path.last() = first;
+
+    if( ! any )
+    {
+        return TreeSerializer::NoError;
+    }
+
+    if( ! reader.seek( columnsPos ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    QVector< Block* > blocks;
+    int err = InflateColumns( ctx, & blocks );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    for( int i = 0; i < blocks.size(); ++i )
+    {
+        Block* b = blocks.at( i );
+        if( ! accepted.at( i ) )
+        {
+            delete b;
+        }
+        else if( K_NULL != lib )
+        {
+            lib->addBlock( b );
+        }
+        else
+        {
+            found->append( b );
+        }
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Inflate the blocks of the tree starting at the reader position that the
+ * filter accepts. With a tree, the root is always inflated and the accepted
+ * blocks are added to their nearest accepted ancestor. Otherwise, the root is
+ * filtered too and the accepted blocks are appended to the list, unattached.
+ */
+int InflateFiltered( Context& ctx,
+                     const InflateFilter& filter,
+                     Block** tree,
+                     QList< Block* >* blocks )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    QStack< FilterLevel > levels;
+    QList< kint > path;
+    QList< Block* > found;
+
+    // The root is the only child of a level without a library
+    FilterLevel top = { K_NULL, 1, 0 };
+    levels.push( top );
+
+    int err = TreeSerializer::NoError;
+    while( ! levels.isEmpty() )
+    {
+        FilterLevel& level = levels.top();
+        if( levels.size() > 1 )
+        {
+            path.last() = level.next;
+        }
+
+        if( ctx.streamed )
+        {
+            err = ReadStreamMetaBlocks( ctx );
+            if( TreeSerializer::NoError != err )
+            {
+                break;
+            }
+        }
+
+        // Peek the header to decide without instantiating the block
+        const qint64 startPos = reader.pos();
+        quint32 type;
+        quint32 length;
+        int childrenNb;
+        if( ! ReadBlockHeader( reader, & type, & length, & childrenNb ) )
+        {
+            err = TreeSerializer::InvalidData;
+            break;
+        }
+
+        Library* lib = level.lib;
+        Block* b = K_NULL;
+        InflateFilter::Decision decision = InflateFilter::Reject;
+        quint32 blocksNb = 1;
+        if( COLUMNS_RECORD == type )
+        {
+            err = FilterColumns( ctx, filter, path, lib, & found, & blocksNb );
+            if( ( TreeSerializer::NoError == err ) &&
+                ! reader.seek( startPos + length ) )
+            {
+                err = TreeSerializer::InvalidData;
+            }
+            if( TreeSerializer::NoError == err )
+            {
+                err = Advance( ctx, blocksNb, length );
+            }
+        }
+        else
+        {
+            decision = ( ( K_NULL != tree ) && ( 1 == levels.size() ) )
+                    ? InflateFilter::Accept
+                    : filter.decide( ctx.getMetaBlock( type ), path );
+
+            if( InflateFilter::Accept == decision )
+            {
+                err = reader.seek( startPos )
+                        ? InflateBlock( ctx, & b, & childrenNb )
+                        : TreeSerializer::InvalidData;
+            }
+            else
+            {
+                err = reader.seek( startPos + length )
+                        ? Advance( ctx, 1, length )
+                        : TreeSerializer::InvalidData;
+            }
+        }
+        if( TreeSerializer::NoError != err )
+        {
+            break;
+        }
+
+        level.next += blocksNb;
+        --level.childrenNb;
+
+        // With a tree, only the root has no library
+        if( ( K_NULL != tree ) && ( K_NULL == lib ) && ( K_NULL == b ) )
+        {
+            err = TreeSerializer::UnknownRootBlockType;
+            break;
+        }
+
+        // The block could be accepted but not instantiated, with the consent
+        // of the monitor: it is rejected then.
+        if( K_NULL != b )
+        {
+            if( K_NULL != lib )
+            {
+                lib->addBlock( b );
+            }
+            else
+            {
+                found.append( b );
+            }
+        }
+
+        if( 0 != childrenNb )
+        {
+            if( ( InflateFilter::RejectSubtree == decision ) ||
+                ( ( filter.maxDepth() >= 0 ) &&
+                  ( path.size() >= filter.maxDepth() ) ) )
+            {
+                err = SkipChildren( ctx, childrenNb );
+                if( TreeSerializer::NoError != err )
+                {
+                    break;
+                }
+            }
+            else
+            {
+                // The children of a rejected block go to its nearest accepted
+                // ancestor
+                FilterLevel child = { lib, childrenNb, 0 };
+                if( ( K_NULL != tree ) && ( K_NULL != b ) )
+                {
+                    child.lib = static_cast< Library* >( b );
+                }
+                levels.push( child );
+                path.append( 0 );
+            }
+        }
+
+        while( ! levels.isEmpty() && ( 0 == levels.top().childrenNb ) )
+        {
+            levels.pop();
+            if( ! path.isEmpty() )
+            {
+                path.removeLast();
+            }
+        }
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        // With a tree, the root holds all the accepted blocks
+        qDeleteAll( found );
+        return err;
+    }
+
+    if( K_NULL != tree )
+    {
+        *tree = found.first();
+    }
+    else
+    {
+        *blocks = found;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Filtered inflate of the tree starting at the device position, either to a
+ * pruned tree or to a list of blocks, see InflateFiltered().
+ */
+int InflateFiltered( QIODevice* device,
+                     kbool mapped,
+                     qint64 window,
+                     const InflateFilter& filter,
+                     Block** tree,
+                     QList< Block* >* blocks,
+                     TreeSerializerMonitor* monitor )
+{
+    TreeReader treeReader( device, mapped, window );
+    int err = treeReader.open( false );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    Context ctx( K_NULL, device, monitor );
+    treeReader.attach( ctx );
+
+    err = treeReader.readHeader( ctx );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    Block* root = K_NULL;
+    QList< Block* > found;
+    err = InflateFiltered( ctx, filter,
+                           ( K_NULL != tree ) ? & root : K_NULL,
+                           & found );
+    if( TreeSerializer::NoError == err )
+    {
+        err = Advance( ctx, 0, 0, true );
+    }
+    if( ( TreeSerializer::NoError == err ) && ctx.streamed )
+    {
+        err = ReadStreamEnd( ctx );
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        delete root;
+        qDeleteAll( found );
+        return err;
+    }
+
+    // The inflated blocks are the last snapshot
+    if( K_NULL != tree )
+    {
+        root->markClean();
+        *tree = root;
+    }
+    else
+    {
+        for( int i = 0; i < found.size(); ++i )
+        {
+            found.at( i )->markClean();
+        }
+        *blocks = found;
+    }
+
+    treeReader.leave();
+
+    return TreeSerializer::NoError;
+}
+
+} // namespace
+
+int KoreSerializer::inflateFiltered( QIODevice* device,
+                                     const InflateFilter& filter,
+                                     Block** block,
+                                     TreeSerializerMonitor* monitor ) const
+{
+    return InflateFiltered( device, 0 != ( _options & MemoryMapped ),
+                            _readWindow, filter, block, K_NULL, monitor );
+}
+
+int KoreSerializer::inflateFiltered( QIODevice* device,
+                                     const InflateFilter& filter,
+                                     QList< Block* >* blocks,
+                                     TreeSerializerMonitor* monitor ) const
+{
+    return InflateFiltered( device, 0 != ( _options & MemoryMapped ),
+                            _readWindow, filter, K_NULL, blocks, monitor );
+}
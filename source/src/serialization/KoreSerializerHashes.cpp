@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QtEndian>
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+/*
+ * Content hashes.
+ *
+ * The hash of a block is the SHA-1 of its type name and of its properties as
+ * written by deflateProperties(), the hash of its subtree the SHA-1 of the
+ * hash of the block followed by the subtree hashes of its serialized
+ * children. Both are cached on the block, see Block::hashCache().
+ */
+
+namespace {
+
+struct HashFrame
+{
+    const Block* block;
+    QByteArray data;    //!< Block hash, then the subtree hashes of children
+    kint next;          //!< Next child to visit
+};
+
+/*
+ * Hashes of a block and of its subtree, from the caches when valid. Only the
+ * subtrees that changed since they were last hashed are visited.
+ */
+int SubtreeHashes( Context& ctx, const Block* root, QByteArray* hashes )
+{
+    if( ! root->hashCache().isEmpty() )
+    {
+        *hashes = root->hashCache();
+        return TreeSerializer::NoError;
+    }
+
+    QStack< HashFrame > frames;
+
+    HashFrame rootFrame = { root, QByteArray(), 0 };
+    int err = BlockHash( ctx, root, & rootFrame.data );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+    frames.push( rootFrame );
+
+    for( ;; )
+    {
+        HashFrame& frame = frames.top();
+
+        // Look for the next serialized child
+        const Block* child = K_NULL;
+        if( frame.block->isLibrary() )
+        {
+            const Library* lib = static_cast< const Library* >( frame.block );
+            while( ( K_NULL == child ) && ( frame.next < lib->size() ) )
+            {
+                const Block* b = lib->at( frame.next++ );
+                if( b->checkFlag( Block::Serializable ) )
+                {
+                    child = b;
+                }
+            }
+        }
+
+        if( K_NULL != child )
+        {
+            if( ! child->hashCache().isEmpty() )
+            {
+                frame.data.append( child->hashCache().mid( HASH_SIZE ) );
+                continue;
+            }
+
+            HashFrame childFrame = { child, QByteArray(), 0 };
+            err = BlockHash( ctx, child, & childFrame.data );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+            frames.push( childFrame );
+            continue;
+        }
+
+        // All the children are hashed, so is the subtree
+        QByteArray blockHashes = frame.data.left( HASH_SIZE );
+        blockHashes.append( QCryptographicHash::hash(
+                                frame.data, QCryptographicHash::Sha1 ) );
+        frame.block->setHashCache( blockHashes );
+        frames.pop();
+
+        if( frames.empty() )
+        {
+            *hashes = blockHashes;
+            return TreeSerializer::NoError;
+        }
+        frames.top().data.append( blockHashes.mid( HASH_SIZE ) );
+    }
+}
+
+struct ComparedBlock
+{
+    quint32 ordinal;        //!< Of the block in the hash table
+    const Block* block;
+    QList< kint > path;
+};
+
+/*
+ * Compare a tree with the hashes of a tree deflated with Hashed, descending
+ * only in the subtrees whose hashes differ.
+ */
+int ChangedBlocks( QIODevice* device,
+                   kbool mapped,
+                   qint64 window,
+                   const Block* block,
+                   QList< QList< kint > >* paths,
+                   TreeSerializerMonitor* monitor )
+{
+    TreeReader treeReader( device, mapped, window );
+    int err = treeReader.open( true );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+    ByteReader& reader = treeReader.reader();
+
+    // The buffer is used to hash the blocks in memory
+    QByteArray buffer;
+    Context ctx( & buffer, device, monitor );
+    treeReader.attach( ctx, false );
+
+    // The streaming layout has no footer, hence no hashes. The device may be
+    // anywhere in a tree with a footer, found from the end.
+    if( reader.size() - reader.pos() >= qint64( sizeof( quint32 ) ) )
+    {
+        err = ReadStreamHeader( ctx, & ctx.streamed );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+        if( ctx.streamed )
+        {
+            return TreeSerializer::NotHashed;
+        }
+    }
+
+    qint64 metaDataPos;
+    err = ReadMetaData( ctx, & metaDataPos );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    HashTable hashes( & reader );
+    err = hashes.open( metaDataPos );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    QList< QList< kint > > changed;
+    QStack< ComparedBlock > pending;
+    ComparedBlock root = { 0, block, QList< kint >() };
+    pending.push( root );
+    while( ! pending.empty() )
+    {
+        const ComparedBlock compared = pending.pop();
+
+        HashEntry entry;
+        if( ! hashes.entry( compared.ordinal, & entry ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        QByteArray blockHashes;
+        err = SubtreeHashes( ctx, compared.block, & blockHashes );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        if( blockHashes.mid( HASH_SIZE ) == entry.subtree )
+        {
+            continue;
+        }
+
+        // Children of the block in the table, one subtree after the other
+        QList< quint32 > ordinals;
+        quint32 ordinal = compared.ordinal + 1;
+        while( ordinal - compared.ordinal < entry.blocksNb )
+        {
+            HashEntry child;
+            if( ! hashes.entry( ordinal, & child ) || ( 0 == child.blocksNb ) )
+            {
+                return TreeSerializer::InvalidData;
+            }
+            ordinals.append( ordinal );
+            ordinal += child.blocksNb;
+        }
+
+        QList< const Block* > children;
+        if( compared.block->isLibrary() )
+        {
+            const Library* lib =
+                    static_cast< const Library* >( compared.block );
+            for( kint i = 0; i < lib->size(); ++i )
+            {
+                if( lib->at( i )->checkFlag( Block::Serializable ) )
+                {
+                    children.append( lib->at( i ) );
+                }
+            }
+        }
+
+        // The block changed itself, or children were added or removed
+        if( ( blockHashes.left( HASH_SIZE ) != entry.block ) ||
+            ( ordinals.size() != children.size() ) )
+        {
+            changed.append( compared.path );
+        }
+
+        if( ordinals.size() == children.size() )
+        {
+            // Compare the children pairwise, in order
+            for( int i = children.size() - 1; i >= 0; --i )
+            {
+                ComparedBlock child = { ordinals.at( i ),
+                                        children.at( i ),
+                                        compared.path };
+                child.path.append( i );
+                pending.push( child );
+            }
+        }
+    }
+
+    *paths = changed;
+
+    return TreeSerializer::NoError;
+}
+
+} // namespace
+
+namespace Kore { namespace serialization { namespace internal {
+
+/*
+ * Hash of the type and of the properties of a single block.
+ */
+int BlockHash( Context& ctx, const Block* block, QByteArray* hash )
+{
+    QBuffer* scratch = ctx.scratchDevice();
+    scratch->seek( 0 );
+
+    CREATE_STREAM( stream, scratch );
+
+    const int err = WriteBlockProperties( ctx, stream, block );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    QCryptographicHash blockHash( QCryptographicHash::Sha1 );
+    blockHash.addData( block->metaBlock()->blockClassName().toLatin1() );
+    blockHash.addData( "", 1 );
+    blockHash.addData( ctx.buffer->constData(), scratch->pos() );
+    *hash = blockHash.result();
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Write the hashes of the serialized blocks in pre-order: the hash of the
+ * block, the hash of its subtree and the blocks count of the subtree. The
+ * entries have a fixed size, their count and a tag follow.
+ */
+int WriteHashes( Context& ctx, const Block* root )
+{
+    // Hashed as by KoreSerializer::hash(), whatever the deflate options: the
+    // string indices of a shared strings table are not the strings
+    QByteArray buffer;
+    Context hashCtx( & buffer, K_NULL, K_NULL );
+
+    QByteArray hashes;
+    int err = SubtreeHashes( hashCtx, root, & hashes );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // The blocks in the order they were deflated
+    QVector< const Block* > blocks;
+    QVector< int > childrenNbs;
+    QStack< const Block* > pending;
+    pending.push( root );
+    while( ! pending.empty() )
+    {
+        const Block* b = pending.pop();
+        int childrenNb = 0;
+        if( b->isLibrary() )
+        {
+            const Library* lib = static_cast< const Library* >( b );
+            for( kint i = lib->size() - 1; i >= 0; --i )
+            {
+                if( lib->at( i )->checkFlag( Block::Serializable ) )
+                {
+                    pending.push( lib->at( i ) );
+                    ++childrenNb;
+                }
+            }
+        }
+        blocks.append( b );
+        childrenNbs.append( childrenNb );
+    }
+
+    // Subtree sizes, from the last block: the subtrees of the children of a
+    // block are on top of the stack when it is reached.
+    const int blocksNb = blocks.size();
+    QVector< quint32 > counts( blocksNb );
+    QStack< quint32 > subtrees;
+    for( int i = blocksNb - 1; i >= 0; --i )
+    {
+        quint32 count = 1;
+        for( int c = 0; c < childrenNbs.at( i ); ++c )
+        {
+            count += subtrees.pop();
+        }
+        subtrees.push( count );
+        counts[ i ] = count;
+    }
+
+    QByteArray entries( blocksNb * HASH_ENTRY_SIZE + 2 * sizeof( quint32 ),
+                        Qt::Uninitialized );
+    char* entry = entries.data();
+    for( int i = 0; i < blocksNb; ++i )
+    {
+        // The subtree was hashed, so were its blocks
+        memcpy( entry, blocks.at( i )->hashCache().constData(),
+                2 * HASH_SIZE );
+        qToBigEndian< quint32 >( counts.at( i ),
+                                 reinterpret_cast< uchar* >(
+                                     entry + 2 * HASH_SIZE ) );
+        entry += HASH_ENTRY_SIZE;
+    }
+    qToBigEndian< quint32 >( blocksNb, reinterpret_cast< uchar* >( entry ) );
+    qToBigEndian< quint32 >( HASHES_TAG,
+                             reinterpret_cast< uchar* >( entry + 4 ) );
+
+    if( ctx.device->write( entries ) != entries.size() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+} /* internal */ } /* serialization */ } /* Kore */
+
+QByteArray KoreSerializer::hash( const Block* block )
+{
+    QByteArray buffer;
+    Context ctx( & buffer, K_NULL, K_NULL );
+
+    QByteArray hashes;
+    if( NoError != SubtreeHashes( ctx, block, & hashes ) )
+    {
+        return QByteArray();
+    }
+
+    return hashes.mid( HASH_SIZE );
+}
+
+int KoreSerializer::changedBlocks( QIODevice* device,
+                                   const Block* block,
+                                   QList< QList< kint > >* paths,
+                                   TreeSerializerMonitor* monitor ) const
+{
+    return ChangedBlocks( device, 0 != ( _options & MemoryMapped ),
+                          _readWindow, block, paths, monitor );
+}
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QPair>
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+namespace Kore { namespace serialization { namespace internal {
+
+LazyLoader::LazyLoader( QIODevice* device, kint budget )
+    : _mapping( K_NULL )
+    , _reader( K_NULL )
+    , _readerDevice( K_NULL )
+    , _valueStream( K_NULL )
+    , _toc( K_NULL )
+    , _ctx( K_NULL, K_NULL, K_NULL )
+    , _loadedBlocks( 0 )
+    , _budget( budget )
+{
+    const char* data = K_NULL;
+    qint64 size = 0;
+
+    // The data must remain available as long as the tree, do not rely on the
+    // client's device.
+    QBuffer* buffer = qobject_cast< QBuffer* >( device );
+    QFile* file = qobject_cast< QFile* >( device );
+    if( K_NULL != buffer )
+    {
+        _buffer = buffer->data();
+        data = _buffer.constData();
+        size = _buffer.size();
+    }
+    else if( ( K_NULL != file ) && ! file->fileName().isEmpty() )
+    {
+        _file.setFileName( file->fileName() );
+        if( _file.open( QIODevice::ReadOnly ) )
+        {
+            _mapping = new DeviceMapping( & _file );
+            data = _mapping->data();
+            size = _mapping->size();
+        }
+    }
+
+    if( K_NULL == data )
+    {
+        return;
+    }
+
+    _reader = new ByteReader( data, size );
+    _readerDevice = new ReaderDevice( _reader );
+    _valueStream = new QDataStream( _readerDevice );
+    _valueStream->setVersion( QDataStream::Qt_5_1 );
+
+    _ctx.reader = _reader;
+    _ctx.valueStream = _valueStream;
+}
+
+LazyLoader::~LazyLoader()
+{
+    delete _toc;
+    delete _valueStream;
+    delete _readerDevice;
+    delete _reader;
+    delete _mapping;
+}
+
+int LazyLoader::inflate( qint64 pos,
+                         TreeSerializerMonitor* monitor,
+                         Block** root,
+                         qint64* endPos )
+{
+    _ctx.monitor = monitor;
+    _reader->seek( pos );
+
+    *root = K_NULL;
+
+    qint64 metaDataPos = 0;
+    int err = ReadStreamHeader( _ctx, & _ctx.streamed );
+    if( ( TreeSerializer::NoError == err ) && ! _ctx.streamed )
+    {
+        err = ReadMetaData( _ctx, & metaDataPos );
+    }
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    const qint64 rootPos = _reader->pos();
+
+    // Only the root is inflated
+    int childrenNb;
+    err = InflateBlock( _ctx, root, & childrenNb );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    if( K_NULL == ( *root ) )
+    {
+        qWarning( "Could not inflate root Block" );
+        return TreeSerializer::UnknownRootBlockType;
+    }
+
+    const qint64 childrenPos = _reader->pos();
+
+    if( _ctx.streamed )
+    {
+        // Walk the rest of the tree without instantiating anything, this
+        // collects the block types declared inline.
+        err = indexSubtrees( rootPos, childrenNb );
+        if( TreeSerializer::NoError == err )
+        {
+            err = ReadStreamEnd( _ctx );
+        }
+        *endPos = _reader->pos();
+    }
+    else
+    {
+        // The subtrees are found when loaded, with the table of contents if
+        // any. The tree ends right before it, the hashes or the metadata.
+        _toc = new Toc( _reader );
+        err = _toc->open( metaDataPos, _ctx.blocksCount );
+        if( TreeSerializer::NoError == err )
+        {
+            *endPos = _toc->treeEnd();
+        }
+        else if( TreeSerializer::NotIndexed == err )
+        {
+            delete _toc;
+            _toc = K_NULL;
+            err = TreeSerializer::NoError;
+
+            HashTable hashes( _reader );
+            *endPos = ( TreeSerializer::NoError == hashes.open( metaDataPos ) )
+                      ? hashes.pos()
+                      : metaDataPos;
+        }
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        delete ( *root );
+        *root = K_NULL;
+        return err;
+    }
+
+    // The monitor is not available anymore when loading
+    _ctx.monitor = K_NULL;
+    _ctx.metaBlocksKnown = true;
+
+    if( 0 != childrenNb )
+    {
+        attach( static_cast< Library* >( *root ), childrenPos, childrenNb, 0 );
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Walk the children of the library block at pos, the reader being right after
+ * its header, and record where the subtrees of the nested libraries end.
+ */
+int LazyLoader::indexSubtrees( qint64 pos, int childrenNb )
+{
+    // Libraries being walked: position and number of children left
+    QStack< QPair< qint64, int > > libs;
+
+    if( 0 != childrenNb )
+    {
+        libs.push( qMakePair( pos, childrenNb ) );
+    }
+
+    while( ! libs.empty() )
+    {
+        int err = TreeSerializer::NoError;
+        if( _ctx.streamed )
+        {
+            err = ReadStreamMetaBlocks( _ctx );
+        }
+
+        const qint64 blockPos = _reader->pos();
+
+        int nb = 0;
+        if( TreeSerializer::NoError == err )
+        {
+            err = SkipBlock( _ctx, & nb );
+        }
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        --libs.top().second;
+
+        if( 0 != nb )
+        {
+            libs.push( qMakePair( blockPos, nb ) );
+        }
+
+        // Record where the complete subtrees end
+        while( ( ! libs.empty() ) && ( 0 == libs.top().second ) )
+        {
+            _subtreesEnd.insert( libs.top().first, _reader->pos() );
+            libs.pop();
+        }
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Jump over the children of the library block at pos, the reader being right
+ * after its header. Without a table of contents, the first load walks the
+ * subtree once, the nested libraries then find their ends recorded.
+ */
+int LazyLoader::skipChildren( qint64 pos,
+                              quint32 ordinal,
+                              int childrenNb,
+                              quint32* blocksNb )
+{
+    qint64 end;
+    if( K_NULL != _toc )
+    {
+        TocEntry entry;
+        if( ! _toc->entry( ordinal, & entry ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+        end = _toc->treePos() + entry.offset + entry.length;
+        *blocksNb = entry.blocksNb;
+    }
+    else
+    {
+        if( ! _subtreesEnd.contains( pos ) )
+        {
+            int err = indexSubtrees( pos, childrenNb );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+        end = _subtreesEnd.value( pos );
+    }
+
+    return _reader->seek( end ) ? TreeSerializer::NoError
+                                : TreeSerializer::InvalidData;
+}
+
+void LazyLoader::attach( Library* library,
+                         qint64 childrenPos,
+                         int childrenNb,
+                         quint32 ordinal )
+{
+    Entry entry = { childrenPos, childrenNb, ordinal, false, _loaded.end() };
+    _libraries.insert( library, entry );
+    library->setLoader( this );
+}
+
+kbool LazyLoader::load( Library* library )
+{
+    QHash< Library*, Entry >::iterator it = _libraries.find( library );
+    if( _libraries.end() == it )
+    {
+        return false;
+    }
+
+    // attach() below invalidates the iterator
+    const qint64 childrenPos = it->childrenPos;
+    const int childrenCount = it->childrenNb;
+
+    if( ! _reader->seek( childrenPos ) )
+    {
+        return false;
+    }
+
+    // Ordinal of the child in the table of contents, if any
+    quint32 ordinal = it->ordinal + 1;
+
+    for( int i = 0; i < childrenCount; ++i )
+    {
+        // Pass over the type declarations, they are already known
+        int err = TreeSerializer::NoError;
+        if( _ctx.streamed )
+        {
+            err = ReadStreamMetaBlocks( _ctx );
+        }
+
+        const qint64 pos = _reader->pos();
+
+        Block* b = K_NULL;
+        int childrenNb = 0;
+        if( TreeSerializer::NoError == err )
+        {
+            err = InflateBlock( _ctx, & b, & childrenNb, library );
+        }
+        if( TreeSerializer::NoError != err )
+        {
+            return false;
+        }
+
+        quint32 blocksNb = 1;
+        if( 0 != childrenNb )
+        {
+            if( K_NULL != b )
+            {
+                attach( static_cast< Library* >( b ),
+                        _reader->pos(),
+                        childrenNb,
+                        ordinal );
+            }
+
+            // Jump over the subtree
+            err = skipChildren( pos, ordinal, childrenNb, & blocksNb );
+            if( TreeSerializer::NoError != err )
+            {
+                delete b;
+                return false;
+            }
+        }
+        ordinal += blocksNb;
+
+        if( K_NULL != b )
+        {
+            library->addBlock( b );
+        }
+    }
+
+    it = _libraries.find( library );
+    it->unloadable = true;
+    it->lru = _loaded.insert( _loaded.end(), library );
+    _loadedBlocks += it->childrenNb;
+
+    unloadColdLibraries( library );
+
+    return true;
+}
+
+void LazyLoader::unloadColdLibraries( Library* loaded )
+{
+    if( _budget <= 0 )
+    {
+        return;
+    }
+
+    QLinkedList< Library* >::iterator candidate = _loaded.begin();
+    while( ( _loadedBlocks > _budget ) && ( _loaded.end() != candidate ) )
+    {
+        Library* library = *candidate;
+
+        // Never unload the library just loaded, nor its ancestors
+        kbool isInUse = false;
+        for( Library* l = loaded; K_NULL != l; l = l->library() )
+        {
+            if( l == library )
+            {
+                isInUse = true;
+                break;
+            }
+        }
+
+        if( isInUse )
+        {
+            ++candidate;
+            continue;
+        }
+
+        Entry& entry = _libraries[ library ];
+        entry.unloadable = false;
+        entry.lru = _loaded.end();
+        _loadedBlocks -= entry.childrenNb;
+        candidate = _loaded.erase( candidate );
+
+        // Unloading would lose the changes made to the properties of the
+        // descendants: as for the changes of the children, see modified(),
+        // the library is never unloaded again. Its flags may be cleared by a
+        // snapshot, the loader would still load the old properties.
+        if( library->hasDirtyDescendants() )
+        {
+            continue;
+        }
+
+        // This deletes the loaded descendants as well, which removes them
+        // from the list: start over.
+        library->unload();
+        candidate = _loaded.begin();
+    }
+}
+
+void LazyLoader::modified( Library* library )
+{
+    // Unloading any ancestor would now lose the modification
+    for( Library* parent = library->library();
+         K_NULL != parent;
+         parent = parent->library() )
+    {
+        QHash< Library*, Entry >::iterator it = _libraries.find( parent );
+        if( ( _libraries.end() != it ) && it->unloadable )
+        {
+            _loadedBlocks -= it->childrenNb;
+            _loaded.erase( it->lru );
+            // Still attached, but never unloaded again
+            it->unloadable = false;
+            it->lru = _loaded.end();
+        }
+    }
+
+    release( library );
+}
+
+void LazyLoader::release( Library* library )
+{
+    QHash< Library*, Entry >::iterator it = _libraries.find( library );
+    if( _libraries.end() == it )
+    {
+        return;
+    }
+
+    if( it->unloadable )
+    {
+        _loadedBlocks -= it->childrenNb;
+        _loaded.erase( it->lru );
+    }
+    _libraries.erase( it );
+
+    if( _libraries.isEmpty() )
+    {
+        delete this;
+    }
+}
+
+} /* internal */ } /* serialization */ } /* Kore */
@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+namespace {
+
+/*
+ * Set the properties of block that differ from those of source, a block of
+ * the same type. Values are compared as they are serialized.
+ */
+int MergeProperties( Context& ctx, Block* block, const Block* source )
+{
+    const QVector< MetaBlock::StoredProperty >& properties =
+            block->metaBlock()->storedProperties();
+
+    QBuffer* scratch = ctx.scratchDevice();
+    CREATE_STREAM( stream, scratch );
+
+    kbool changed = false;
+    for( int i = 0; i < properties.size(); ++i )
+    {
+        const MetaBlock::StoredProperty& stored = properties.at( i );
+
+        kbool written;
+        scratch->seek( 0 );
+        int err = WriteProperty( ctx, stream, block, stored, false,
+                                 & written );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+        const QByteArray value = ctx.buffer->left( scratch->pos() );
+
+        scratch->seek( 0 );
+        err = WriteProperty( ctx, stream, source, stored, false, & written );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        if( ( value.size() == scratch->pos() ) &&
+            ( 0 == memcmp( value.constData(), ctx.buffer->constData(),
+                           value.size() ) ) )
+        {
+            continue;
+        }
+
+        err = SetBlockProperty( ctx, block, stored.property,
+                                stored.property.read( source ) );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+        changed = true;
+    }
+
+    if( QDataStream::Ok != stream.status() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    if( changed )
+    {
+        block->markDirty();
+    }
+
+    return TreeSerializer::NoError;
+}
+
+void RemoveChildren( Library* lib, const QList< Block* >& children, int from )
+{
+    for( int i = from; i < children.size(); ++i )
+    {
+        Block* b = children.at( i );
+        lib->removeBlock( b );
+        if( ! b->checkFlag( Block::Static ) )
+        {
+            delete b;
+        }
+    }
+}
+
+struct MergeLevel
+{
+    Library* lib;
+    QList< Block* > children;   //!< Serialized children before the merge
+    int childrenNb;             //!< Serialized children left to read
+    int next;                   //!< Next child to match
+};
+
+/*
+ * Put a block read from the device at the next position of the level. The
+ * live block found there is kept if it has the same type, taking the
+ * properties of the read one, and replaced otherwise. *merged is the block
+ * in the tree at that position, *reused whether it was there already.
+ */
+int MergeChild( Context& ctx,
+                MergeLevel& level,
+                Block* read,
+                Block** merged,
+                kbool* reused )
+{
+    Block* live = ( level.next < level.children.size() )
+            ? level.children.at( level.next++ )
+            : K_NULL;
+
+    *reused = ( K_NULL != live ) && ( live->metaBlock() == read->metaBlock() );
+    if( *reused )
+    {
+        *merged = live;
+        const int err = MergeProperties( ctx, live, read );
+        delete read;
+        return err;
+    }
+
+    *merged = read;
+    if( K_NULL == live )
+    {
+        level.lib->addBlock( read );
+    }
+    else
+    {
+        level.lib->insertBlock( read, live->index() );
+        RemoveChildren( level.lib, QList< Block* >() << live, 0 );
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Merge the tree read from the device into a live tree, see
+ * KoreSerializer::inflateInto().
+ */
+int Merge( Context& ctx, Block* root )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    Block* read;
+    int childrenNb;
+    int err = InflateBlock( ctx, & read, & childrenNb );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    if( K_NULL == read )
+    {
+        return TreeSerializer::UnknownRootBlockType;
+    }
+
+    if( read->metaBlock() != root->metaBlock() )
+    {
+        delete read;
+        return TreeSerializer::UnsupportedOperation;
+    }
+
+    err = MergeProperties( ctx, root, read );
+    delete read;
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    QStack< MergeLevel > levels;
+    if( root->isLibrary() )
+    {
+        Library* lib = static_cast< Library* >( root );
+        MergeLevel level = { lib, SerializedChildren( lib ), childrenNb, 0 };
+        levels.push( level );
+    }
+
+    while( ! levels.empty() )
+    {
+        MergeLevel& level = levels.top();
+        if( 0 == level.childrenNb )
+        {
+            // Live children the tree read no longer has
+            RemoveChildren( level.lib, level.children, level.next );
+            levels.pop();
+            continue;
+        }
+        --level.childrenNb;
+
+        if( ctx.streamed )
+        {
+            err = ReadStreamMetaBlocks( ctx );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        if( COLUMNS_RECORD == reader.peekUInt32() )
+        {
+            const qint64 startPos = reader.pos();
+            quint32 type;
+            quint32 length;
+            if( ! ReadBlockHeader( reader, & type, & length, & childrenNb ) )
+            {
+                return TreeSerializer::InvalidData;
+            }
+
+            // Empty if the user chose to skip an unknown type
+            QVector< Block* > blocks;
+            err = InflateColumns( ctx, & blocks );
+            for( int i = 0;
+                 ( TreeSerializer::NoError == err ) && ( i < blocks.size() );
+                 ++i )
+            {
+                Block* merged;
+                kbool reused;
+                err = MergeChild( ctx, level, blocks.at( i ), & merged,
+                                  & reused );
+                blocks[ i ] = K_NULL;
+
+                // Blocks of a run are leaves
+                if( reused && merged->isLibrary() )
+                {
+                    Library* lib = static_cast< Library* >( merged );
+                    RemoveChildren( lib, SerializedChildren( lib ), 0 );
+                }
+            }
+            qDeleteAll( blocks );
+
+            if( TreeSerializer::NoError == err )
+            {
+                err = reader.seek( startPos + length )
+                        ? Advance( ctx, blocks.size(), length )
+                        : TreeSerializer::InvalidData;
+            }
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+            continue;
+        }
+
+        err = InflateBlock( ctx, & read, & childrenNb );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        if( K_NULL == read )
+        {
+            // The user chose to skip an unknown type, and its subtree
+            err = SkipChildren( ctx, childrenNb );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+            continue;
+        }
+
+        Block* merged;
+        kbool reused;
+        err = MergeChild( ctx, level, read, & merged, & reused );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        if( merged->isLibrary() )
+        {
+            // The children of a new library are all new
+            Library* lib = static_cast< Library* >( merged );
+            MergeLevel child = { lib,
+                                 reused ? SerializedChildren( lib )
+                                        : QList< Block* >(),
+                                 childrenNb, 0 };
+            levels.push( child );
+        }
+    }
+
+    return TreeSerializer::NoError;
+}
+
+int Merge( QIODevice* device,
+           kbool mapped,
+           qint64 window,
+           Block* tree,
+           TreeSerializerMonitor* monitor )
+{
+    TreeReader treeReader( device, mapped, window );
+    int err = treeReader.open( false );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // Properties are compared in the scratch buffer
+    QByteArray buffer;
+    Context ctx( & buffer, device, monitor );
+    treeReader.attach( ctx );
+
+    err = treeReader.readHeader( ctx );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    err = Merge( ctx, tree );
+    if( TreeSerializer::NoError == err )
+    {
+        err = Advance( ctx, 0, 0, true );
+    }
+    if( ( TreeSerializer::NoError == err ) && ctx.streamed )
+    {
+        err = ReadStreamEnd( ctx );
+    }
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // The tree is the last snapshot
+    tree->markClean();
+
+    treeReader.leave();
+
+    return TreeSerializer::NoError;
+}
+
+} // namespace
+
+int KoreSerializer::inflateInto( QIODevice* device,
+                                 Block* block,
+                                 TreeSerializerMonitor* monitor ) const
+{
+    return Merge( device, 0 != ( _options & MemoryMapped ), _readWindow,
+                  block, monitor );
+}
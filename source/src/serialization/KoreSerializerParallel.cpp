@@ -0,0 +1,667 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QtEndian>
+#include <QtCore/QPair>
+#include <QtCore/QStack>
+#include <QtCore/QThread>
+
+#include <QtConcurrent/QtConcurrent>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+/*
+ * Parallel inflate.
+ *
+ * The blocks above the parallel depth are inflated by the calling thread. The
+ * subtrees found at that depth are skipped and inflated by worker threads,
+ * each one with its own reader over the shared memory view of the data. They
+ * are grafted in order once done.
+ */
+
+/*
+ * Parallel deflate.
+ *
+ * The blocks above the parallel depth are deflated by the calling thread. The
+ * subtrees found at that depth are deflated by worker threads into their own
+ * memory buffers, with their own block type indices. The buffers are written
+ * in order, once the indices are translated: the result is the same as a
+ * serial deflate.
+ */
+
+namespace {
+
+/*
+ * Serialize the calls to the client's monitor, which is not expected to be
+ * thread safe.
+ */
+class ConcurrentMonitor : public TreeSerializerMonitor
+{
+public:
+    ConcurrentMonitor( TreeSerializerMonitor* monitor )
+        : _monitor( monitor )
+    { /* NOTHING */ }
+
+    virtual bool shouldStopProcess()
+    {
+        QMutexLocker locker( & _mutex );
+        return _monitor->shouldStopProcess();
+    }
+
+    virtual bool event( int errorCode, const QString& message )
+    {
+        QMutexLocker locker( & _mutex );
+        return _monitor->event( errorCode, message );
+    }
+
+    virtual void progress( qint64 min, qint64 progress, qint64 max )
+    {
+        QMutexLocker locker( & _mutex );
+        _monitor->progress( min, progress, max );
+    }
+
+    virtual void bytesProgress( qint64 bytes, qint64 total )
+    {
+        QMutexLocker locker( & _mutex );
+        _monitor->bytesProgress( bytes, total );
+    }
+
+private:
+    QMutex                  _mutex;
+    TreeSerializerMonitor*  _monitor;
+};
+
+struct SubtreeJob
+{
+    // Input
+    const char*                 data;
+    qint64                      size;
+    qint64                      pos;
+    kbool                       streamed;
+    QStringList                 metaBlocksNames;
+    QList< const MetaBlock* >   metaBlocksList;
+    kbool                       hasStringTable;
+    QVector< QString >          sharedStrings;
+    TreeSerializerMonitor*      monitor;
+    Progress*                   progress;
+    QThread*                    thread;     //!< Thread to hand the tree to
+
+    // Output
+    Block*                      tree;
+
+    // Destination
+    Library*                    parent;
+    int                         index;
+};
+
+int InflateSubtree( SubtreeJob* job )
+{
+    ByteReader reader( job->data, job->size );
+    reader.seek( job->pos );
+    ReaderDevice readerDevice( & reader );
+    CREATE_STREAM( valueStream, & readerDevice );
+
+    Context ctx( K_NULL, K_NULL, job->monitor );
+    ctx.reader = & reader;
+    ctx.valueStream = & valueStream;
+    ctx.streamed = job->streamed;
+    ctx.metaBlocksKnown = true;
+    ctx.metaBlocksNames = job->metaBlocksNames;
+    ctx.metaBlocksList = job->metaBlocksList;
+    ctx.hasStringTable = job->hasStringTable;
+    ctx.sharedStrings = job->sharedStrings;
+    ctx.progress = job->progress;
+
+    int err = InflateTree( ctx, & job->tree );
+    if( TreeSerializer::NoError == err )
+    {
+        err = Advance( ctx, 0, 0, true );
+    }
+
+    // Blocks are QObjects, they belong to the thread that created them. Give
+    // the tree to the caller's thread so that it can be grafted.
+    if( K_NULL != job->tree )
+    {
+        job->tree->moveToThread( job->thread );
+    }
+
+    return err;
+}
+
+struct SpineContext
+{
+    Library* lib;
+    int childrenNb;
+    int nextIndex;  //!< Index of the next child, workers' subtrees included
+};
+
+struct DeflateJob
+{
+    // Input
+    const Block*                tree;
+    StringTable*                strings;
+    kbool                       columns;
+    kbool                       checksums;
+    TreeSerializerMonitor*      monitor;
+    Progress*                   progress;
+
+    // Output
+    QByteArray                  data;
+    QVector< qint64 >           positions;      //!< Blocks headers
+    QList< const MetaBlock* >   metaBlocksList; //!< Local block types
+    quint32                     blocksCount;
+};
+
+int DeflateSubtree( DeflateJob* job )
+{
+    QByteArray buffer;
+    buffer.reserve( 2048 );
+
+    QBuffer device( & job->data );
+    device.open( QIODevice::ReadWrite );
+
+    Context ctx( & buffer, & device, job->monitor );
+    ctx.strings = job->strings;
+    ctx.columns = job->columns;
+    ctx.checksums = job->checksums;
+    ctx.progress = job->progress;
+
+    int err = DeflateTree( ctx, job->tree, & job->positions );
+    if( TreeSerializer::NoError == err )
+    {
+        err = Advance( ctx, 0, 0, true );
+    }
+
+    job->metaBlocksList = ctx.metaBlocksList;
+    job->blocksCount = ctx.blocksCount;
+
+    return err;
+}
+
+/*
+ * Write a subtree deflated by a worker. The block types are given their
+ * global index in order of first use, as a serial deflate does, and declared
+ * inline in the streaming layout.
+ */
+int WriteSubtree( Context& ctx, DeflateJob* job )
+{
+    char* data = job->data.data();
+    qint64 written = 0;
+
+    for( int i = 0; i < job->positions.size(); ++i )
+    {
+        const qint64 pos = job->positions.at( i );
+        uchar* header = reinterpret_cast< uchar* >( data + pos );
+        quint32 type = qFromBigEndian< quint32 >( header );
+
+        // The type of a run follows its length
+        if( COLUMNS_RECORD == type )
+        {
+            header += 8;
+            type = qFromBigEndian< quint32 >( header );
+        }
+        const MetaBlock* mb = job->metaBlocksList.at(
+                                    type & LIBRARY_HAS_CHILREN_MASK );
+
+        if( ctx.streamed && ! ctx.metaBlocks.contains( mb ) )
+        {
+            // Write up to the block, and declare its type first
+            if( ctx.device->write( data + written, pos - written ) !=
+                    pos - written )
+            {
+                return TreeSerializer::IOError;
+            }
+            written = pos;
+
+            int err = WriteStreamMetaBlock( ctx, mb );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        const quint32 index = ctx.getMetaBlockIndex( mb );
+        qToBigEndian< quint32 >( index | ( type & LIBRARY_HAS_CHILDREN_FLAG ),
+                                 header );
+
+        // The checksum covers the type
+        if( BLOCK_CHECKSUM_FLAG & qFromBigEndian< quint32 >(
+                reinterpret_cast< const uchar* >( data + pos + 4 ) ) )
+        {
+            SealFrame( data + pos );
+        }
+
+        if( K_NULL != ctx.toc )
+        {
+            // Libraries carry their children count after the length
+            const int childrenNb = ( type & LIBRARY_HAS_CHILDREN_FLAG )
+                    ? qFromBigEndian< quint32 >( header + 8 )
+                    : 0;
+            const TocBlock tocBlock = { ctx.tocPos + pos, childrenNb };
+            ctx.toc->append( tocBlock );
+        }
+    }
+
+    const qint64 size = job->data.size();
+    if( ctx.device->write( data + written, size - written ) != size - written )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    ctx.tocPos += size;
+    ctx.blocksCount += job->blocksCount;
+
+    return TreeSerializer::NoError;
+}
+
+struct DeflateSegment
+{
+    const Block*            block;      //!< Written by the calling thread
+    int                     childrenNb;
+    QVector< const Block* > run;        //!< Or a run, if block is K_NULL
+    DeflateJob*             job;        //!< Or a subtree, written by a worker
+};
+
+} // namespace
+
+namespace Kore { namespace serialization { namespace internal {
+
+int InflateParallel( QIODevice* device,
+                     Block** block,
+                     TreeSerializerMonitor* monitor,
+                     int depth )
+{
+    // The workers need random access to the data: map the device, or read
+    // everything left.
+    DeviceMapping mapping( device );
+    QByteArray content;
+    const qint64 devicePos = device->isSequential() ? 0 : device->pos();
+    if( ! mapping.isValid() )
+    {
+        content = device->readAll();
+    }
+
+    const char* data = mapping.isValid() ? mapping.data() : content.constData();
+    const qint64 size = mapping.isValid() ? mapping.size() : content.size();
+    const qint64 startPos = mapping.isValid() ? devicePos : 0;
+
+    ByteReader reader( data, size );
+    reader.seek( startPos );
+    ReaderDevice readerDevice( & reader );
+    CREATE_STREAM( valueStream, & readerDevice );
+
+    ConcurrentMonitor concurrentMonitor( monitor );
+
+    Context ctx( K_NULL, device, monitor ? & concurrentMonitor : K_NULL );
+    ctx.reader = & reader;
+    ctx.valueStream = & valueStream;
+
+    Progress progress;
+    progress.bytesTotal = size - startPos;
+    if( K_NULL != monitor )
+    {
+        ctx.progress = & progress;
+    }
+
+    QList< SubtreeJob* > jobs;
+    QList< QFuture< int > > futures;
+    QStack< SpineContext > libs;
+    QHash< Library*, int > missing;
+    Block* root = K_NULL;
+    int childrenNb;
+
+    int err = ReadStreamHeader( ctx, & ctx.streamed );
+    if( TreeSerializer::NoError != err )
+    {
+        goto cleanup;
+    }
+
+    if( ctx.streamed )
+    {
+        // The workers need all the block types up front, collect the inline
+        // declarations.
+        const qint64 treePos = reader.pos();
+        err = SkipTree( ctx );
+        if( TreeSerializer::NoError != err )
+        {
+            goto cleanup;
+        }
+        reader.seek( treePos );
+        ctx.metaBlocksKnown = true;
+    }
+    else
+    {
+        err = ReadMetaData( ctx );
+        if( TreeSerializer::NoError != err )
+        {
+            goto cleanup;
+        }
+        progress.blocksTotal = ctx.blocksCount;
+    }
+
+    err = InflateBlock( ctx, & root, & childrenNb );
+    if( TreeSerializer::NoError != err )
+    {
+        goto cleanup;
+    }
+
+    if( K_NULL == root )
+    {
+        qWarning( "Could not inflate root Block" );
+        err = TreeSerializer::UnknownRootBlockType;
+        goto cleanup;
+    }
+
+    if( 0 != childrenNb )
+    {
+        SpineContext libCtx = { static_cast< Library* >( root ),
+                                childrenNb,
+                                0 };
+        libs.push( libCtx );
+    }
+
+    while( ! libs.empty() )
+    {
+        SpineContext& top = libs.top();
+
+        // Skip the children of the blocks that could not be instantiated
+        if( K_NULL == top.lib )
+        {
+            err = SkipBlock( ctx, & childrenNb );
+            if( TreeSerializer::NoError != err )
+            {
+                goto cleanup;
+            }
+
+            top.childrenNb += childrenNb - 1;
+            if( 0 == top.childrenNb )
+            {
+                libs.pop();
+            }
+            continue;
+        }
+
+        if( ctx.streamed )
+        {
+            err = ReadStreamMetaBlocks( ctx );
+            if( TreeSerializer::NoError != err )
+            {
+                goto cleanup;
+            }
+        }
+
+        const qint64 pos = reader.pos();
+
+        // Have a look at the header first
+        quint32 type;
+        quint32 length;
+        if( ! ReadBlockHeader( reader, & type, & length, & childrenNb ) ||
+            ! reader.seek( pos ) )
+        {
+            err = TreeSerializer::InvalidData;
+            goto cleanup;
+        }
+
+        Block* b = K_NULL;
+        if( ( libs.size() >= depth ) && ( 0 != childrenNb ) )
+        {
+            // A subtree at the parallel depth, hand it to a worker
+            SubtreeJob* job = new SubtreeJob;
+            job->data = data;
+            job->size = size;
+            job->pos = pos;
+            job->streamed = ctx.streamed;
+            job->metaBlocksNames = ctx.metaBlocksNames;
+            job->metaBlocksList = ctx.metaBlocksList;
+            job->hasStringTable = ctx.hasStringTable;
+            job->sharedStrings = ctx.sharedStrings;
+            job->monitor = ctx.monitor;
+            job->progress = ctx.progress;
+            job->thread = QThread::currentThread();
+            job->tree = K_NULL;
+            job->parent = top.lib;
+            job->index = top.nextIndex++;
+
+            jobs.append( job );
+            futures.append( QtConcurrent::run( InflateSubtree, job ) );
+
+            err = SkipTree( ctx );
+            if( TreeSerializer::NoError != err )
+            {
+                goto cleanup;
+            }
+
+            childrenNb = 0;
+        }
+        else
+        {
+            // A run of blocks is added to the library by InflateBlock
+            const int libSize = top.lib->size();
+            err = InflateBlock( ctx, & b, & childrenNb, top.lib );
+            if( TreeSerializer::NoError != err )
+            {
+                goto cleanup;
+            }
+
+            if( K_NULL != b )
+            {
+                top.lib->addBlock( b );
+            }
+            top.nextIndex += top.lib->size() - libSize;
+        }
+
+        --top.childrenNb;
+        if( 0 == top.childrenNb )
+        {
+            libs.pop();
+        }
+
+        // Put this block at the top of the stack if it is a library, it is
+        // NULL if it could not be instantiated.
+        if( 0 != childrenNb )
+        {
+            SpineContext libCtx = { static_cast< Library* >( b ),
+                                    childrenNb,
+                                    0 };
+            libs.push( libCtx );
+        }
+    }
+
+    if( ctx.streamed )
+    {
+        err = ReadStreamEnd( ctx );
+    }
+
+    if( TreeSerializer::NoError == err )
+    {
+        err = Advance( ctx, 0, 0, true );
+    }
+
+cleanup:
+    // Wait for all the workers, even on error, and graft the subtrees in order
+    for( int i = 0; i < jobs.size(); ++i )
+    {
+        SubtreeJob* job = jobs.at( i );
+        const int jobErr = futures.at( i ).result();
+
+        if( ( TreeSerializer::NoError == err ) &&
+            ( TreeSerializer::NoError != jobErr ) )
+        {
+            err = jobErr;
+        }
+
+        if( ( TreeSerializer::NoError != err ) || ( K_NULL == job->tree ) )
+        {
+            // The subtree could not be instantiated, the next siblings move
+            delete job->tree;
+            ++missing[ job->parent ];
+        }
+        else
+        {
+            const int index = job->index - missing.value( job->parent );
+            job->parent->insertBlock( job->tree, index );
+        }
+
+        delete job;
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        delete root;
+        return err;
+    }
+
+    // Leave the device right after the tree
+    if( mapping.isValid() )
+    {
+        device->seek( reader.pos() );
+    }
+    else if( ! device->isSequential() )
+    {
+        device->seek( devicePos + reader.pos() );
+    }
+
+    // The inflated tree is the last snapshot
+    root->markClean();
+    *block = root;
+
+    return TreeSerializer::NoError;
+}
+
+int DeflateParallel( Context& ctx, const Block* block, int depth )
+{
+    // The workers would load the libraries of a lazily inflated tree through
+    // the same loader, which may also unload the libraries of another worker
+    // to stay within its budget: such a tree is deflated by this thread.
+    if( ! IsLoaded( block ) )
+    {
+        return DeflateTree( ctx, block, K_NULL );
+    }
+
+    TreeSerializerMonitor* monitor = ctx.monitor;
+    ConcurrentMonitor concurrentMonitor( monitor );
+    if( K_NULL != monitor )
+    {
+        ctx.monitor = & concurrentMonitor;
+    }
+
+    // Walk the tree down to the parallel depth, in pre-order, and start the
+    // workers as soon as possible.
+    QList< DeflateSegment > segments;
+    QList< QFuture< int > > futures;
+    QStack< QPair< DeflateItem, int > > items;
+    QVector< DeflateItem > children;
+
+    const DeflateItem root = { block, QVector< const Block* >() };
+    items.push( qMakePair( root, 0 ) );
+    while( ! items.empty() )
+    {
+        const QPair< DeflateItem, int > current = items.pop();
+        const Block* b = current.first.block;
+
+        DeflateSegment segment = { b, 0, current.first.run, K_NULL };
+        if( K_NULL == b )
+        {
+            // A run is written by the calling thread
+            segments.append( segment );
+            continue;
+        }
+
+        CollectChildren( ctx, b, & children );
+        segment.childrenNb = children.size();
+
+        if( ( current.second >= depth ) && ! children.isEmpty() )
+        {
+            DeflateJob* job = new DeflateJob;
+            job->tree = b;
+            job->strings = ctx.strings;
+            job->columns = ctx.columns;
+            job->checksums = ctx.checksums;
+            job->monitor = ctx.monitor;
+            job->progress = ctx.progress;
+            job->blocksCount = 0;
+
+            segment.job = job;
+            futures.append( QtConcurrent::run( DeflateSubtree, job ) );
+        }
+        else
+        {
+            // Stack 'em in reverse order to serialize them in proper order
+            for( int i = children.size() - 1; i >= 0; --i )
+            {
+                items.push( qMakePair( children.at( i ),
+                                       current.second + 1 ) );
+            }
+        }
+
+        segments.append( segment );
+    }
+
+    // Write everything in order, waiting for the workers when needed. On
+    // error, still wait for all of them.
+    int err = TreeSerializer::NoError;
+    int jobIndex = 0;
+    for( int i = 0; i < segments.size(); ++i )
+    {
+        const DeflateSegment& segment = segments.at( i );
+        if( K_NULL == segment.job )
+        {
+            if( ( TreeSerializer::NoError == err ) &&
+                ( K_NULL == segment.block ) )
+            {
+                err = DeflateColumns( ctx, segment.run );
+            }
+            else if( TreeSerializer::NoError == err )
+            {
+                err = DeflateBlock( ctx, segment.block, segment.childrenNb );
+            }
+        }
+        else
+        {
+            const int jobErr = futures.at( jobIndex++ ).result();
+            if( TreeSerializer::NoError == err )
+            {
+                err = jobErr;
+            }
+            if( TreeSerializer::NoError == err )
+            {
+                err = WriteSubtree( ctx, segment.job );
+            }
+            delete segment.job;
+        }
+    }
+
+    ctx.monitor = monitor;
+
+    return err;
+}
+
+} /* internal */ } /* serialization */ } /* Kore */
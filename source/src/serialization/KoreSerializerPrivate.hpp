@@ -0,0 +1,817 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_KoreSerializerPrivate_hpp_
+#define _Kore_serialization_KoreSerializerPrivate_hpp_
+
+#include <QtCore/QBuffer>
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+#include <QtCore/QFileDevice>
+#include <QtCore/QHash>
+#include <QtCore/QLinkedList>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QMetaProperty>
+#include <QtCore/QMutex>
+#include <QtCore/QStringList>
+#include <QtCore/QVariant>
+#include <QtCore/QVector>
+
+#include "ByteReader.hpp"
+#include "ChunkedCompression.hpp"
+#include "KoreSerializer.hpp"
+
+#include <data/Block.hpp>
+#include <data/Library.hpp>
+#include <data/LibraryLoader.hpp>
+#include <data/MetaBlock.hpp>
+
+/*
+ * Internals of KoreSerializer, shared by the translation units of its
+ * features. Not part of the API.
+ */
+
+#define CREATE_STREAM( name, device ) \
+    QDataStream name( device );\
+    name.setVersion( QDataStream::Qt_5_1 )
+
+#define LIBRARY_HAS_CHILDREN_FLAG   0x80000000
+#define LIBRARY_HAS_CHILREN_MASK    0x7FFFFFFF
+
+// Frames with a checksum have this flag in their length, which counts the
+// CRC-32C of the frame appended to it.
+#define BLOCK_CHECKSUM_FLAG         0x80000000
+#define BLOCK_LENGTH_MASK           0x7FFFFFFF
+#define BLOCK_CHECKSUM_SIZE         4
+
+// Content hashes, between the table of contents and the footer metadata
+#define HASHES_TAG                  ( K_FOURCC( 'K', 'H', 'S', 'H' ) )
+// SHA-1
+#define HASH_SIZE                   20
+// Block hash, subtree hash, subtree blocks count (u32)
+#define HASH_ENTRY_SIZE             ( 2 * HASH_SIZE + 4 )
+
+// Delta of a tree since its last snapshot
+#define DELTA_MAGIC                 ( K_FOURCC( 'K', 'D', 'L', 'T' ) )
+#define DELTA_VERSION               1
+// Record kinds, 0 closes the delta
+#define DELTA_END                   0x0
+#define DELTA_PROPERTIES            0x1
+#define DELTA_CHILDREN              0x2
+
+// Run of leaf blocks of the same type, written column by column. It stands in
+// the type slot of a block header, and counts as a single child.
+#define COLUMNS_RECORD              0x7FFFFFFD
+
+namespace Kore { namespace serialization { namespace internal {
+
+using data::Block;
+using data::Library;
+using data::LibraryLoader;
+using data::MetaBlock;
+
+// The distinct strings of the deflated properties, in order of first use.
+// The workers of a parallel deflate share it.
+struct StringTable
+{
+    quint32 index( const QString& value )
+    {
+        QMutexLocker locker( & mutex );
+
+        QHash< QString, quint32 >::const_iterator it =
+                indices.constFind( value );
+        if( it != indices.constEnd() )
+        {
+            return it.value();
+        }
+
+        const quint32 idx = strings.size();
+        strings.append( value );
+        indices.insert( value, idx );
+        return idx;
+    }
+
+    QMutex                      mutex;
+    QHash< QString, quint32 >   indices;
+    QVector< QString >          strings;
+};
+
+// Progress of a whole deflate or inflate, the workers of a parallel one share
+// it. Totals are 0 when not known.
+struct Progress
+{
+    Progress()
+        : blocks( 0 )
+        , blocksTotal( 0 )
+        , bytes( 0 )
+        , bytesTotal( 0 )
+    { /* NOTHING */ }
+
+    // Report the processed blocks and bytes, false if the monitor asks to stop
+    kbool advance( TreeSerializerMonitor* monitor,
+                   qint64 newBlocks,
+                   qint64 newBytes )
+    {
+        QMutexLocker locker( & mutex );
+
+        blocks += newBlocks;
+        bytes += newBytes;
+
+        // Totals are estimates, never go past them
+        monitor->progress( 0, blocks,
+                           ( 0 != blocksTotal ) ? qMax( blocks, blocksTotal )
+                                                : 0 );
+        monitor->bytesProgress( bytes,
+                                ( 0 != bytesTotal ) ? qMax( bytes, bytesTotal )
+                                                    : 0 );
+
+        return ! monitor->shouldStopProcess();
+    }
+
+    QMutex  mutex;
+    qint64  blocks;
+    qint64  blocksTotal;
+    qint64  bytes;
+    qint64  bytesTotal;
+};
+
+// A block of the table of contents, while deflating
+struct TocBlock
+{
+    quint64 offset;     //!< From the beginning of the tree
+    int     childrenNb;
+};
+
+struct Context
+{
+    Context( QByteArray* buf, QIODevice* dev, TreeSerializerMonitor* mon )
+        : buffer( buf )
+        , device( dev )
+        , monitor( mon )
+        , reader( K_NULL )
+        , valueStream( K_NULL )
+        , streamed( false )
+        , metaBlocksKnown( false )
+        , blocksCount( 0 )
+        , toc( K_NULL )
+        , tocPos( 0 )
+        , strings( K_NULL )
+        , hasStringTable( false )
+        , columns( false )
+        , checksums( false )
+        , allProperties( false )
+        , progress( K_NULL )
+        , pendingBlocks( 0 )
+        , pendingBytes( 0 )
+        , scratch( K_NULL )
+    { /* NOTHING */ }
+
+    ~Context()
+    {
+        delete scratch;
+    }
+
+    QByteArray* buffer;
+
+    QIODevice* device;
+    TreeSerializerMonitor* monitor;
+
+    // Inflate only
+    ByteReader* reader;
+    QDataStream* valueStream;
+
+    // Streaming layout
+    kbool streamed;
+    kbool metaBlocksKnown;  //!< The inline declarations were already read
+
+    quint32 blocksCount;
+
+    // Table of contents, deflate only, K_NULL if not requested
+    QVector< TocBlock >* toc;
+    quint64 tocPos;         //!< Offset of the next block in the tree
+
+    // String table, deflate only, K_NULL if not requested
+    StringTable* strings;
+
+    // Inflate only: strings are references into the table of the metadata
+    kbool hasStringTable;
+    QVector< QString > sharedStrings;
+
+    // Deflate only: runs of leaf blocks are written as columns
+    kbool columns;
+
+    // Deflate only: the block frames end with a checksum
+    kbool checksums;
+
+    // Deflate only: the NULL and not stored values are written too, for the
+    // properties to replace those of an existing block
+    kbool allProperties;
+
+    // Progress, K_NULL if there is no monitor. Blocks and bytes are reported
+    // by batches.
+    Progress* progress;
+    quint32 pendingBlocks;
+    qint64 pendingBytes;
+
+    QStringList metaBlocksNames;
+    QList< const MetaBlock* > metaBlocksList;
+    QMap< const MetaBlock*, quint32 > metaBlocks;
+
+    quint32 getMetaBlockIndex( const MetaBlock* mb )
+    {
+        quint32 index = metaBlocks.value( mb, 0xffffffff );
+        if( 0xffffffff == index )
+        {
+            index = metaBlocksList.size();
+            metaBlocksList.append( mb );
+            metaBlocks.insert( mb, index );
+        }
+        return index;
+    }
+
+    const MetaBlock* getMetaBlock( quint32 index )
+    {
+        return metaBlocksList.value( index, K_NULL );
+    }
+
+    // Deflate only: memory device on buffer where blocks are staged. It is
+    // rewound for each block, so the buffer only grows to the biggest one.
+    QBuffer* scratchDevice()
+    {
+        if( K_NULL == scratch )
+        {
+            scratch = new QBuffer( buffer );
+            scratch->open( QIODevice::WriteOnly );
+        }
+        return scratch;
+    }
+
+private:
+    Q_DISABLE_COPY( Context )
+
+    QBuffer* scratch;
+};
+
+/*
+ * The resolved type of a stored property. The cached type is unknown if the
+ * type was registered after the properties cache creation, try again then.
+ */
+inline int StoredPropertyType( const MetaBlock::StoredProperty& stored )
+{
+    return ( QMetaType::UnknownType != stored.type )
+                ? stored.type
+                : stored.property.userType();
+}
+
+/*
+ * Deflate.
+ */
+
+void WriteVariableLength32( QDataStream& stream, quint32 value );
+int WriteStreamMetaBlock( Context& ctx, const MetaBlock* mb );
+int WriteProperty( Context& ctx,
+                   QDataStream& stream,
+                   const Block* block,
+                   const MetaBlock::StoredProperty& stored,
+                   kbool withIndex,
+                   kbool* written );
+int WriteBlockProperties( Context& ctx,
+                          QDataStream& stream,
+                          const Block* block );
+int Advance( Context& ctx, quint32 blocks, qint64 bytes, kbool flush = false );
+void SealFrame( char* frame );
+int DeflateBlock( Context& ctx, const Block* block, int childrenNb );
+
+/*
+ * A child to deflate: a block along with its subtree, or a run of leaf blocks
+ * written as columns.
+ */
+struct DeflateItem
+{
+    const Block*            block;  //!< K_NULL for a run
+    QVector< const Block* > run;
+};
+
+void CollectChildren( const Context& ctx,
+                      const Block* block,
+                      QVector< DeflateItem >* items );
+int DeflateTree( Context& ctx,
+                 const Block* block,
+                 QVector< qint64 >* positions );
+kbool IsLoaded( const Block* root );
+QList< Block* > SerializedChildren( Library* lib );
+
+/*
+ * Inflate.
+ *
+ * The functions below decode the stream through a ByteReader, either straight
+ * from a memory view of the device or from the device itself, read by chunks.
+ * There is no per-block QDataStream.
+ */
+
+/*
+ * Read only device over a ByteReader. It is used for the few property types
+ * that can only be decoded by QMetaType::load, so that a single QDataStream
+ * is created for the whole inflate operation.
+ */
+class ReaderDevice : public QIODevice
+{
+public:
+    ReaderDevice( ByteReader* reader )
+        : _reader( reader )
+    {
+        open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+    }
+
+    virtual bool isSequential() const
+    {
+        return true;
+    }
+
+    virtual qint64 bytesAvailable() const
+    {
+        return _reader->bytesAvailable() + QIODevice::bytesAvailable();
+    }
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize )
+    {
+        return _reader->read( data, maxSize );
+    }
+
+    virtual qint64 writeData( const char*, qint64 )
+    {
+        return -1;
+    }
+
+private:
+    ByteReader* _reader;
+};
+
+/*
+ * Memory view of a device: the content of a QBuffer, or a memory mapping of
+ * a file.
+ */
+class DeviceMapping
+{
+public:
+    DeviceMapping( QIODevice* device )
+        : _file( K_NULL )
+        , _mapping( K_NULL )
+        , _data( K_NULL )
+        , _size( 0 )
+    {
+        QBuffer* buffer = qobject_cast< QBuffer* >( device );
+        if( K_NULL != buffer )
+        {
+            _data = buffer->data().constData();
+            _size = buffer->data().size();
+            return;
+        }
+
+        QFileDevice* file = qobject_cast< QFileDevice* >( device );
+        if( ( K_NULL != file ) && ( file->size() > 0 ) )
+        {
+            _mapping = file->map( 0, file->size() );
+            if( K_NULL != _mapping )
+            {
+                _file = file;
+                _data = reinterpret_cast< const char* >( _mapping );
+                _size = file->size();
+            }
+        }
+    }
+
+    ~DeviceMapping()
+    {
+        if( K_NULL != _file )
+        {
+            _file->unmap( _mapping );
+        }
+    }
+
+    bool isValid() const { return K_NULL != _data; }
+    const char* data() const { return _data; }
+    qint64 size() const { return _size; }
+
+private:
+    QFileDevice*    _file;
+    uchar*          _mapping;
+    const char*     _data;
+    qint64          _size;
+};
+
+/*
+ * Reader of a deflated tree from the current position of a device: through
+ * the memory view of the device when mapped is set and it can be mapped, by
+ * windows otherwise. A compressed tree is read from its uncompressed view.
+ */
+class TreeReader
+{
+public:
+    TreeReader( QIODevice* device, kbool mapped, qint64 window );
+    ~TreeReader();
+
+    // Set the reader up. Compressed trees, and the trees read with
+    // randomAccess set, need a device that is not sequential.
+    int open( kbool randomAccess );
+
+    ByteReader& reader()
+    {
+        return *_reader;
+    }
+
+    // Read the tree through the context, which reports the bytes read to its
+    // monitor, if any, when progress is set.
+    void attach( Context& ctx, kbool progress = true );
+
+    // Read the stream header of the tree, or the metadata at its end which
+    // needs random access.
+    int readHeader( Context& ctx );
+
+    // Leave the device right after the tree. Sequential devices can not move
+    // back, the data read ahead is lost.
+    void leave();
+
+private:
+    Q_DISABLE_COPY( TreeReader )
+
+    QIODevice*              _device;
+    kbool                   _mapped;
+    qint64                  _window;
+
+    ChunkedDecompressor*    _decompressor;
+    DeviceMapping*          _mapping;
+    ByteReader*             _reader;
+    ReaderDevice*           _readerDevice;
+    QDataStream*            _valueStream;
+    Progress                _progress;
+};
+
+int ResolveBlockProperty( Context& ctx,
+                          const Block* block,
+                          quint32 propertyIdx,
+                          QMetaProperty* property,
+                          int* type );
+int SetBlockProperty( Context& ctx,
+                      Block* block,
+                      const QMetaProperty& prop,
+                      const QVariant& variant );
+int InstantiateBlock( Context& ctx, quint32 type, Block** block );
+int ReadMetaData( Context& ctx, qint64* metaDataPos = K_NULL );
+int ReadStreamHeader( Context& ctx, kbool* streamed );
+int ReadStreamMetaBlocks( Context& ctx );
+int ReadStreamEnd( Context& ctx );
+int ReadProperty( Context& ctx,
+                  Block* block,
+                  const QMetaProperty& prop,
+                  int propType );
+int ReadBlockProperties( Context& ctx, Block* block );
+kbool ReadBlockHeader( ByteReader& reader,
+                       quint32* type,
+                       quint32* length,
+                       int* childrenNb,
+                       kbool* checksummed = K_NULL );
+int VerifyFrame( ByteReader& reader, kbool* checked = K_NULL );
+int InflateBlock( Context& ctx,
+                  Block** block,
+                  int* childrenNb,
+                  Library* parent = K_NULL );
+int SkipBlock( Context& ctx, int* childrenNb );
+int InflateTree( Context& ctx, Block** tree );
+int SkipTree( Context& ctx );
+int SkipChildren( Context& ctx, int childrenNb );
+
+/*
+ * Features, see KoreSerializer*.cpp.
+ */
+
+// Columnar encoding
+int DeflateColumns( Context& ctx, const QVector< const Block* >& run );
+int InflateColumns( Context& ctx, QVector< Block* >* blocks );
+
+// Content hashes
+struct HashEntry
+{
+    QByteArray block;       //!< Hash of the block itself
+    QByteArray subtree;     //!< Hash of the whole subtree
+    quint32 blocksNb;       //!< In the whole subtree
+};
+
+/*
+ * Hashes of the blocks, right before the metadata.
+ */
+class HashTable
+{
+public:
+    HashTable( ByteReader* reader )
+        : _reader( reader )
+        , _entriesPos( 0 )
+        , _blocksNb( 0 )
+    {}
+
+    // Locate the table, right before the metadata starting at metaDataPos.
+    int open( qint64 metaDataPos )
+    {
+        const qint64 trailerPos = metaDataPos - 2 * sizeof( quint32 );
+        if( ( trailerPos < 0 ) || ! _reader->seek( trailerPos ) )
+        {
+            return TreeSerializer::NotHashed;
+        }
+
+        const quint32 blocksNb = _reader->readUInt32();
+        if( _reader->hasError() || ( HASHES_TAG != _reader->readUInt32() ) )
+        {
+            return TreeSerializer::NotHashed;
+        }
+
+        _entriesPos = trailerPos - qint64( blocksNb ) * HASH_ENTRY_SIZE;
+        if( ( 0 == blocksNb ) || ( _entriesPos < 0 ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+        _blocksNb = blocksNb;
+
+        return TreeSerializer::NoError;
+    }
+
+    kbool entry( quint32 ordinal, HashEntry* entry )
+    {
+        const qint64 entryPos =
+                _entriesPos + qint64( ordinal ) * HASH_ENTRY_SIZE;
+        if( ( ordinal >= _blocksNb ) || ! _reader->seek( entryPos ) )
+        {
+            return false;
+        }
+
+        entry->block.resize( HASH_SIZE );
+        entry->subtree.resize( HASH_SIZE );
+        if( ( _reader->read( entry->block.data(), HASH_SIZE ) != HASH_SIZE ) ||
+            ( _reader->read( entry->subtree.data(), HASH_SIZE ) !=
+              HASH_SIZE ) )
+        {
+            return false;
+        }
+        entry->blocksNb = _reader->readUInt32();
+
+        return ! _reader->hasError();
+    }
+
+    // Beginning of the table
+    qint64 pos() const
+    {
+        return _entriesPos;
+    }
+
+private:
+    ByteReader* _reader;
+    qint64      _entriesPos;
+    quint32     _blocksNb;
+};
+
+int BlockHash( Context& ctx, const Block* block, QByteArray* hash );
+int WriteHashes( Context& ctx, const Block* root );
+
+// Table of contents
+int WriteToc( Context& ctx );
+
+struct TocEntry
+{
+    quint64 offset;     //!< From the beginning of the tree
+    quint64 length;     //!< Of the whole subtree
+    quint32 blocksNb;   //!< In the whole subtree
+};
+
+/*
+ * Table of contents of a deflated tree, right before its hashes, if any.
+ */
+class Toc
+{
+public:
+    Toc( ByteReader* reader )
+        : _reader( reader )
+        , _entriesPos( 0 )
+        , _treePos( 0 )
+        , _blocksNb( 0 )
+    {}
+
+    // Locate the table, right before the metadata starting at metaDataPos,
+    // or before the hashes if any.
+    int open( qint64 metaDataPos, quint32 blocksNb )
+    {
+        HashTable hashes( _reader );
+        const qint64 tocEnd =
+                ( TreeSerializer::NoError == hashes.open( metaDataPos ) )
+                ? hashes.pos()
+                : metaDataPos;
+        const qint64 entriesSize = qint64( blocksNb ) * TOC_ENTRY_SIZE;
+
+        _entriesPos = tocEnd - sizeof( quint32 ) - entriesSize;
+        if( ( 0 == blocksNb ) || ( _entriesPos < 0 ) ||
+            ! _reader->seek( tocEnd - sizeof( quint32 ) ) ||
+            ( TOC_TAG != _reader->readUInt32() ) )
+        {
+            return TreeSerializer::NotIndexed;
+        }
+        _blocksNb = blocksNb;
+
+        // The root subtree is the whole tree, right before the table
+        TocEntry root;
+        if( ! entry( 0, & root ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+        _treePos = _entriesPos - root.length;
+
+        return ( _treePos < 0 ) ? TreeSerializer::InvalidData
+                                : TreeSerializer::NoError;
+    }
+
+    kbool entry( quint32 ordinal, TocEntry* entry )
+    {
+        const qint64 entryPos =
+                _entriesPos + qint64( ordinal ) * TOC_ENTRY_SIZE;
+        if( ( ordinal >= _blocksNb ) || ! _reader->seek( entryPos ) )
+        {
+            return false;
+        }
+
+        entry->offset = _reader->readUInt64();
+        entry->length = _reader->readUInt64();
+        entry->blocksNb = _reader->readUInt32();
+
+        return ! _reader->hasError();
+    }
+
+    // Ordinal of the block at the given path, from the root
+    int find( const QList< kint >& path, quint32* ordinal )
+    {
+        quint32 current = 0;
+        for( int i = 0; i < path.size(); ++i )
+        {
+            // The children count is only found in the block header
+            TocEntry parent;
+            if( ! entry( current, & parent ) ||
+                ! _reader->seek( _treePos + parent.offset ) )
+            {
+                return TreeSerializer::InvalidData;
+            }
+
+            quint32 type;
+            quint32 length;
+            int childrenNb;
+            if( ! ReadBlockHeader( *_reader, & type, & length, & childrenNb ) )
+            {
+                return TreeSerializer::InvalidData;
+            }
+
+            const kint index = path.at( i );
+            if( ( index < 0 ) || ( index >= childrenNb ) )
+            {
+                return TreeSerializer::BlockNotFound;
+            }
+
+            // Jump from a child to the next one
+            current += 1;
+            for( kint j = 0; j < index; ++j )
+            {
+                TocEntry child;
+                if( ! entry( current, & child ) )
+                {
+                    return TreeSerializer::InvalidData;
+                }
+                current += child.blocksNb;
+            }
+        }
+
+        *ordinal = current;
+        return TreeSerializer::NoError;
+    }
+
+    qint64 treePos() const
+    {
+        return _treePos;
+    }
+
+    // End of the tree, right before the table
+    qint64 treeEnd() const
+    {
+        return _entriesPos;
+    }
+
+private:
+    ByteReader* _reader;
+    qint64      _entriesPos;
+    qint64      _treePos;
+    quint32     _blocksNb;
+};
+
+// Parallel inflate and deflate
+int InflateParallel( QIODevice* device,
+                     Block** block,
+                     TreeSerializerMonitor* monitor,
+                     int depth );
+int DeflateParallel( Context& ctx, const Block* block, int depth );
+
+/*
+ * Loader of the libraries of a lazily inflated tree.
+ *
+ * It keeps a memory view of the serialized data, a shared copy of a buffer
+ * content or a read only mapping of the file, which it opens again, and the
+ * position of the children of every library it serves. The mapping is shared:
+ * the file must not be written while the tree is in use. It deletes itself
+ * once all these libraries are deleted or modified.
+ *
+ * Loaded libraries are unloaded again, least recently loaded first, when the
+ * number of blocks they hold goes over the budget. Accessing a loaded library
+ * does not make it more recent, that would cost on every access.
+ */
+class LazyLoader : public LibraryLoader
+{
+public:
+    LazyLoader( QIODevice* device, kint budget );
+    virtual ~LazyLoader();
+
+    kbool isValid() const { return K_NULL != _reader; }
+    kbool isUsed() const { return ! _libraries.isEmpty(); }
+
+    /*
+     * Inflate the root block, its children are loaded on demand.
+     */
+    int inflate( qint64 pos,
+                 TreeSerializerMonitor* monitor,
+                 Block** root,
+                 qint64* endPos );
+
+    virtual kbool load( Library* library );
+    virtual void modified( Library* library );
+    virtual void release( Library* library );
+
+private:
+    int indexSubtrees( qint64 pos, int childrenNb );
+    int skipChildren( qint64 pos,
+                      quint32 ordinal,
+                      int childrenNb,
+                      quint32* blocksNb );
+    void attach( Library* library,
+                 qint64 childrenPos,
+                 int childrenNb,
+                 quint32 ordinal );
+    void unloadColdLibraries( Library* loaded );
+
+private:
+    struct Entry
+    {
+        qint64  childrenPos;
+        int     childrenNb;
+        quint32 ordinal;        //!< In the table of contents, if any
+        kbool   unloadable;     //!< Loaded, and listed in _loaded
+        QLinkedList< Library* >::iterator lru;
+    };
+
+    // Data
+    QByteArray      _buffer;
+    QFile           _file;
+    DeviceMapping*  _mapping;
+    ByteReader*     _reader;
+    ReaderDevice*   _readerDevice;
+    QDataStream*    _valueStream;
+    Toc*            _toc;
+    Context         _ctx;
+
+    QHash< qint64, qint64 >     _subtreesEnd;   //!< Block position -> end
+    QHash< Library*, Entry >    _libraries;
+    QLinkedList< Library* >     _loaded;        //!< Loaded first, first
+    kint                        _loadedBlocks;
+    kint                        _budget;
+};
+
+} /* internal */ } /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_KoreSerializerPrivate_hpp_
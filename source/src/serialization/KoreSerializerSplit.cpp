@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QPair>
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+// A group of small siblings ends after one whose checksum has these bits
+// clear, see Split().
+#define SPLIT_GROUP_MASK            0xF
+
+namespace {
+
+struct SplitNode
+{
+    qint64 start;           //!< Of the inline declarations before the header
+    qint64 childrenPos;     //!< End of the header and properties
+    qint64 end;             //!< Of the subtree
+    QVector< int > children;
+};
+
+/*
+ * Index the extent of the blocks of a tree in pre-order, a run of columns
+ * counting as a single leaf.
+ */
+int IndexSplitNodes( Context& ctx, QVector< SplitNode >* nodes )
+{
+    ByteReader& reader = *( ctx.reader );
+
+    QStack< QPair< int, int > > opened;     // Ordinal, remaining children
+    do
+    {
+        const qint64 start = reader.pos();
+        if( ctx.streamed )
+        {
+            int err = ReadStreamMetaBlocks( ctx );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        const qint64 pos = reader.pos();
+        quint32 type;
+        quint32 length;
+        int childrenNb;
+        if( ! ReadBlockHeader( reader, & type, & length, & childrenNb ) ||
+            ! reader.seek( pos + length ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        if( ! opened.empty() )
+        {
+            ( *nodes )[ opened.top().first ].children.append( nodes->size() );
+            --( opened.top().second );
+        }
+
+        SplitNode node = { start, reader.pos(), reader.pos(),
+                           QVector< int >() };
+        nodes->append( node );
+
+        if( 0 != childrenNb )
+        {
+            opened.push( qMakePair( nodes->size() - 1, childrenNb ) );
+        }
+
+        while( ! opened.empty() && ( 0 == opened.top().second ) )
+        {
+            ( *nodes )[ opened.top().first ].end = reader.pos();
+            opened.pop();
+        }
+    }
+    while( ! opened.empty() );
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Whether a group of small siblings ends after the given one. It depends on
+ * the content of the sibling only, so that the groups after an edit are cut
+ * at the same places as before.
+ */
+kbool IsGroupEnd( ByteReader& reader, qint64 pos, qint64 size )
+{
+    QByteArray bytes( size, Qt::Uninitialized );
+    if( ! reader.seek( pos ) ||
+        ( reader.read( bytes.data(), bytes.size() ) != bytes.size() ) )
+    {
+        return false;
+    }
+
+    return 0 == ( qChecksum( bytes.constData(), bytes.size() )
+                  & SPLIT_GROUP_MASK );
+}
+
+inline void Cut( QList< qint64 >* boundaries, qint64 pos )
+{
+    if( boundaries->isEmpty() ? ( pos > 0 ) : ( pos > boundaries->last() ) )
+    {
+        boundaries->append( pos );
+    }
+}
+
+struct SplitFrame
+{
+    int node;
+    int child;              //!< Next one
+    qint64 group;           //!< Size of the open group of small siblings
+};
+
+int Split( QIODevice* device,
+           kbool mapped,
+           qint64 window,
+           kint chunkSize,
+           QList< qint64 >* boundaries )
+{
+    if( ChunkedDecompressor::IsCompressed( device ) )
+    {
+        return TreeSerializer::UnsupportedOperation;
+    }
+
+    TreeReader treeReader( device, mapped, window );
+    int err = treeReader.open( true );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+    ByteReader& reader = treeReader.reader();
+
+    QByteArray buffer;
+    Context ctx( & buffer, device, K_NULL );
+    treeReader.attach( ctx );
+    // Declarations are skipped
+    ctx.metaBlocksKnown = true;
+
+    const qint64 origin = reader.pos();
+    err = ReadStreamHeader( ctx, & ctx.streamed );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    QVector< SplitNode > nodes;
+    err = IndexSplitNodes( ctx, & nodes );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // The stream header goes with the root, positions are made relative to
+    // the beginning of the tree.
+    nodes[ 0 ].start = origin;
+    for( int i = 0; i < nodes.size(); ++i )
+    {
+        SplitNode& node = nodes[ i ];
+        node.start -= origin;
+        node.childrenPos -= origin;
+        node.end -= origin;
+    }
+
+    boundaries->clear();
+
+    // The spine of a large subtree goes in chunks of its own, between the
+    // chunks of its children.
+    QStack< SplitFrame > frames;
+    if( nodes.first().end > chunkSize )
+    {
+        Cut( boundaries, nodes.first().childrenPos );
+        SplitFrame root = { 0, 0, 0 };
+        frames.push( root );
+    }
+
+    while( ! frames.empty() )
+    {
+        SplitFrame& frame = frames.top();
+        const SplitNode& node = nodes.at( frame.node );
+        if( node.children.size() == frame.child )
+        {
+            Cut( boundaries, node.end );
+            frames.pop();
+            continue;
+        }
+
+        const int ordinal = node.children.at( frame.child++ );
+        const SplitNode& child = nodes.at( ordinal );
+        const qint64 size = child.end - child.start;
+
+        if( size > chunkSize )
+        {
+            Cut( boundaries, child.start );
+            Cut( boundaries, child.childrenPos );
+            frame.group = 0;
+
+            SplitFrame childFrame = { ordinal, 0, 0 };
+            frames.push( childFrame );
+            continue;
+        }
+
+        if( frame.group + size > chunkSize )
+        {
+            frame.group = 0;
+        }
+
+        if( 0 == frame.group )
+        {
+            Cut( boundaries, child.start );
+        }
+        frame.group += size;
+
+        if( IsGroupEnd( reader, origin + child.start, size ) )
+        {
+            Cut( boundaries, child.end );
+            frame.group = 0;
+        }
+    }
+
+    // The rest of the device, stream end or footer
+    Cut( boundaries, nodes.first().end );
+    Cut( boundaries, reader.size() - origin );
+
+    return TreeSerializer::NoError;
+}
+
+} // namespace
+
+int KoreSerializer::split( QIODevice* device,
+                           kint chunkSize,
+                           QList< qint64 >* boundaries ) const
+{
+    return Split( device, 0 != ( _options & MemoryMapped ), _readWindow,
+                  chunkSize, boundaries );
+}
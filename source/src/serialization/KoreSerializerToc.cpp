@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QtEndian>
+#include <QtCore/QPair>
+#include <QtCore/QStack>
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+namespace {
+
+/*
+ * Inflate the block found at the given path, or at the given ordinal if path is
+ * K_NULL, seeking straight to it through the table of contents.
+ */
+int InflateAt( QIODevice* device,
+               kbool mapped,
+               qint64 window,
+               const QList< kint >* path,
+               quint32 ordinal,
+               kbool subtree,
+               Block** block,
+               TreeSerializerMonitor* monitor )
+{
+    *block = K_NULL;
+
+    TreeReader treeReader( device, mapped, window );
+    int err = treeReader.open( true );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+    ByteReader& reader = treeReader.reader();
+
+    Context ctx( K_NULL, device, monitor );
+    treeReader.attach( ctx, false );
+
+    // The streaming layout has no footer, hence no table of contents. The
+    // device may be anywhere in a tree with a footer, found from the end.
+    if( reader.size() - reader.pos() >= qint64( sizeof( quint32 ) ) )
+    {
+        err = ReadStreamHeader( ctx, & ctx.streamed );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+        if( ctx.streamed )
+        {
+            return TreeSerializer::NotIndexed;
+        }
+    }
+
+    qint64 metaDataPos;
+    err = ReadMetaData( ctx, & metaDataPos );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    Toc toc( & reader );
+    err = toc.open( metaDataPos, ctx.blocksCount );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    if( K_NULL != path )
+    {
+        err = toc.find( *path, & ordinal );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    TocEntry entry;
+    if( ordinal >= ctx.blocksCount )
+    {
+        return TreeSerializer::BlockNotFound;
+    }
+    if( ! toc.entry( ordinal, & entry ) ||
+        ! reader.seek( toc.treePos() + entry.offset ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    Block* root = K_NULL;
+    if( subtree )
+    {
+        err = InflateTree( ctx, & root );
+    }
+    else
+    {
+        // Libraries are inflated without their children
+        int childrenNb;
+        err = InflateBlock( ctx, & root, & childrenNb );
+    }
+
+    if( TreeSerializer::NoError != err )
+    {
+        delete root;
+        return err;
+    }
+
+    if( K_NULL == root )
+    {
+        return TreeSerializer::UnknownRootBlockType;
+    }
+
+    // The inflated tree is the last snapshot
+    root->markClean();
+    *block = root;
+
+    return TreeSerializer::NoError;
+}
+
+} // namespace
+
+namespace Kore { namespace serialization { namespace internal {
+
+/*
+ * Write the table of contents: for each block in pre-order, the offset of the
+ * block and the length and blocks count of its subtree, followed by a tag.
+ * The entries have a fixed size, so that any of them can be read directly.
+ */
+int WriteToc( Context& ctx )
+{
+    const QVector< TocBlock >& toc = *( ctx.toc );
+    const int blocksNb = toc.size();
+
+    // Find the end of each subtree: it is the beginning of the first block
+    // found after the last child of the subtree root.
+    QVector< quint64 > ends( blocksNb );
+    QVector< quint32 > counts( blocksNb );
+
+    QStack< QPair< int, int > > opened;     // Ordinal, remaining children
+    for( int i = 0; i <= blocksNb; ++i )
+    {
+        const quint64 offset = ( i < blocksNb ) ? toc.at( i ).offset
+                                                : ctx.tocPos;
+
+        // Close the complete subtrees, all of them at the end
+        while( ( ! opened.empty() ) &&
+               ( ( 0 == opened.top().second ) || ( i == blocksNb ) ) )
+        {
+            const int ordinal = opened.pop().first;
+            ends[ ordinal ] = offset;
+            counts[ ordinal ] = i - ordinal;
+        }
+
+        if( i < blocksNb )
+        {
+            if( ! opened.empty() )
+            {
+                --( opened.top().second );
+            }
+            opened.push( qMakePair( i, toc.at( i ).childrenNb ) );
+        }
+    }
+
+    QByteArray entries( blocksNb * TOC_ENTRY_SIZE + sizeof( quint32 ),
+                        Qt::Uninitialized );
+    uchar* entry = reinterpret_cast< uchar* >( entries.data() );
+    for( int i = 0; i < blocksNb; ++i )
+    {
+        const quint64 offset = toc.at( i ).offset;
+        qToBigEndian< quint64 >( offset, entry );
+        qToBigEndian< quint64 >( ends.at( i ) - offset, entry + 8 );
+        qToBigEndian< quint32 >( counts.at( i ), entry + 16 );
+        entry += TOC_ENTRY_SIZE;
+    }
+    qToBigEndian< quint32 >( TOC_TAG, entry );
+
+    if( ctx.device->write( entries ) != entries.size() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+} /* internal */ } /* serialization */ } /* Kore */
+
+int KoreSerializer::inflateAt( QIODevice* device,
+                               quint32 ordinal,
+                               kbool subtree,
+                               Block** block,
+                               TreeSerializerMonitor* monitor ) const
+{
+    return InflateAt( device, 0 != ( _options & MemoryMapped ), _readWindow,
+                      K_NULL, ordinal, subtree, block, monitor );
+}
+
+int KoreSerializer::inflateAt( QIODevice* device,
+                               const QList< kint >& path,
+                               kbool subtree,
+                               Block** block,
+                               TreeSerializerMonitor* monitor ) const
+{
+    return InflateAt( device, 0 != ( _options & MemoryMapped ), _readWindow,
+                      & path, 0, subtree, block, monitor );
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "KoreSerializerPrivate.hpp"
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+using namespace Kore::serialization::internal;
+
+namespace {
+
+/*
+ * Check the checksums of a deflated tree. Its frames are walked in pre-order,
+ * no block is instantiated. The number of blocks found is compared to the
+ * one recorded in the metadata or at the end of the stream.
+ */
+
+int Verify( QIODevice* device,
+            kbool mapped,
+            qint64 window,
+            TreeSerializerMonitor* monitor )
+{
+    TreeReader treeReader( device, mapped, window );
+    int err = treeReader.open( false );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+    ByteReader& reader = treeReader.reader();
+
+    Context ctx( K_NULL, device, monitor );
+    treeReader.attach( ctx );
+
+    err = treeReader.readHeader( ctx );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    // The types are not needed to walk the frames
+    ctx.metaBlocksKnown = true;
+
+    quint32 blocksNb = 0;
+    kbool allChecked = true;
+    int remaining = 1;
+    while( remaining > 0 )
+    {
+        if( ctx.streamed )
+        {
+            err = ReadStreamMetaBlocks( ctx );
+            if( TreeSerializer::NoError != err )
+            {
+                return err;
+            }
+        }
+
+        kbool checked;
+        err = VerifyFrame( reader, & checked );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+        allChecked = allChecked && checked;
+
+        const qint64 pos = reader.pos();
+        quint32 type;
+        quint32 length;
+        int childrenNb;
+        if( ! ReadBlockHeader( reader, & type, & length, & childrenNb ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        // A run counts all its blocks
+        quint32 count = 1;
+        if( COLUMNS_RECORD == type )
+        {
+            reader.skip( sizeof( quint32 ) );
+            count = reader.readUInt32();
+        }
+
+        if( reader.hasError() || ! reader.seek( pos + length ) )
+        {
+            return TreeSerializer::InvalidData;
+        }
+
+        remaining += childrenNb - 1;
+        blocksNb += count;
+
+        err = Advance( ctx, count, length );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+    }
+
+    err = Advance( ctx, 0, 0, true );
+    if( ( TreeSerializer::NoError == err ) && ctx.streamed )
+    {
+        err = ReadStreamEnd( ctx );
+    }
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    if( blocksNb != ctx.blocksCount )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    treeReader.leave();
+
+    return allChecked ? TreeSerializer::NoError
+                      : TreeSerializer::NotChecksummed;
+}
+
+} // namespace
+
+int KoreSerializer::verify( QIODevice* device,
+                            TreeSerializerMonitor* monitor ) const
+{
+    return Verify( device, 0 != ( _options & MemoryMapped ), _readWindow,
+                   monitor );
+}
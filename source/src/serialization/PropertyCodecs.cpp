@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QByteArray>
+#include <QtCore/QChar>
+#include <QtCore/QMetaObject>
+#include <QtCore/QMetaType>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include <cstring>
+
+#include "ByteReader.hpp"
+#include "PropertyCodecs.hpp"
+
+using namespace Kore::serialization;
+
+namespace {
+
+// Null values, as defined by QVariant::isNull
+template< typename T >
+inline kbool IsNullValue( const T& )
+{
+    return false;
+}
+
+inline kbool IsNullValue( const QChar& value )
+{
+    return value.isNull();
+}
+
+inline kbool IsNullValue( const QString& value )
+{
+    return value.isNull();
+}
+
+inline kbool IsNullValue( const QByteArray& value )
+{
+    return value.isNull();
+}
+
+// Encoding, matching QMetaType::save
+template< typename T >
+inline void EncodeValue( QDataStream& stream, const T& value )
+{
+    stream << value;
+}
+
+inline void EncodeValue( QDataStream& stream, const char& value )
+{
+    // Chars are saved as signed chars, not promoted to int
+    stream << static_cast< signed char >( value );
+}
+
+inline void EncodeValue( QDataStream& stream, const QString& value )
+{
+    // For strings, encode to an UTF-8 QByteArray to save space.
+    stream << value.toUtf8();
+}
+
+// Decoding
+inline void DecodeValue( ByteReader& reader, bool* value )
+{
+    *value = ( 0 != reader.readUInt8() );
+}
+
+inline void DecodeValue( ByteReader& reader, char* value )
+{
+    *value = static_cast< char >( reader.readUInt8() );
+}
+
+inline void DecodeValue( ByteReader& reader, signed char* value )
+{
+    *value = static_cast< signed char >( reader.readUInt8() );
+}
+
+inline void DecodeValue( ByteReader& reader, uchar* value )
+{
+    *value = reader.readUInt8();
+}
+
+inline void DecodeValue( ByteReader& reader, short* value )
+{
+    *value = static_cast< short >( reader.readUInt16() );
+}
+
+inline void DecodeValue( ByteReader& reader, ushort* value )
+{
+    *value = reader.readUInt16();
+}
+
+inline void DecodeValue( ByteReader& reader, int* value )
+{
+    *value = static_cast< qint32 >( reader.readUInt32() );
+}
+
+inline void DecodeValue( ByteReader& reader, uint* value )
+{
+    *value = reader.readUInt32();
+}
+
+inline void DecodeValue( ByteReader& reader, qlonglong* value )
+{
+    *value = static_cast< qint64 >( reader.readUInt64() );
+}
+
+inline void DecodeValue( ByteReader& reader, qulonglong* value )
+{
+    *value = reader.readUInt64();
+}
+
+inline void DecodeValue( ByteReader& reader, double* value )
+{
+    const quint64 bits = reader.readUInt64();
+    memcpy( value, & bits, sizeof( *value ) );
+}
+
+inline void DecodeValue( ByteReader& reader, float* value )
+{
+    // QDataStream writes floats in double precision
+    double d;
+    DecodeValue( reader, & d );
+    *value = static_cast< float >( d );
+}
+
+inline void DecodeValue( ByteReader& reader, QChar* value )
+{
+    *value = QChar( reader.readUInt16() );
+}
+
+inline void DecodeValue( ByteReader& reader, QString* value )
+{
+    // Strings are stored as UTF-8 byte arrays
+    const char* utf8;
+    quint32 size;
+    if( reader.readByteArray( & utf8, & size ) )
+    {
+        *value = QString::fromUtf8( utf8, size );
+    }
+}
+
+inline void DecodeValue( ByteReader& reader, QByteArray* value )
+{
+    const char* bytes;
+    quint32 size;
+    if( reader.readByteArray( & bytes, & size ) )
+    {
+        *value = ( K_NULL == bytes ) ? QByteArray()
+                                     : QByteArray( bytes, size );
+    }
+}
+
+// Codec functions
+template< typename T >
+kbool IsNull( const QObject* object, int propertyIdx )
+{
+    T value = T();
+    PropertyCodecs::ReadProperty( object, propertyIdx, & value );
+    return IsNullValue( value );
+}
+
+template< typename T >
+kbool Encode( QDataStream& stream, const QObject* object, int propertyIdx )
+{
+    T value = T();
+    PropertyCodecs::ReadProperty( object, propertyIdx, & value );
+    EncodeValue( stream, value );
+    return QDataStream::Ok == stream.status();
+}
+
+template< typename T >
+kbool Decode( ByteReader& reader, QObject* object, int propertyIdx )
+{
+    T value = T();
+    DecodeValue( reader, & value );
+    if( reader.hasError() )
+    {
+        return false;
+    }
+    PropertyCodecs::WriteProperty( object, propertyIdx, & value );
+    return true;
+}
+
+class Registry
+{
+public:
+    Registry()
+    {
+        add< bool >( QMetaType::Bool, false );
+        add< char >( QMetaType::Char, false );
+        add< signed char >( QMetaType::SChar, false );
+        add< uchar >( QMetaType::UChar, false );
+        add< short >( QMetaType::Short, false );
+        add< ushort >( QMetaType::UShort, false );
+        add< int >( QMetaType::Int, false );
+        add< uint >( QMetaType::UInt, false );
+        add< qlonglong >( QMetaType::LongLong, false );
+        add< qulonglong >( QMetaType::ULongLong, false );
+        add< double >( QMetaType::Double, false );
+        add< float >( QMetaType::Float, false );
+        add< QChar >( QMetaType::QChar, true );
+        add< QString >( QMetaType::QString, true );
+        add< QByteArray >( QMetaType::QByteArray, true );
+    }
+
+    void set( int type, const PropertyCodec& codec )
+    {
+        if( type >= codecs.size() )
+        {
+            // New entries are zeroed, hence without codec
+            codecs.resize( type + 1 );
+        }
+        codecs[ type ] = codec;
+    }
+
+    // Indexed by type id, encode is K_NULL for unregistered types
+    QVector< PropertyCodec > codecs;
+
+private:
+    template< typename T >
+    void add( int type, kbool nullable )
+    {
+        const PropertyCodec codec = { nullable ? & IsNull< T > : K_NULL,
+                                      & Encode< T >,
+                                      & Decode< T > };
+        set( type, codec );
+    }
+};
+
+Q_GLOBAL_STATIC( Registry, registry )
+
+}
+
+void PropertyCodecs::Register( int type,
+                               PropertyCodec::Encoder encode,
+                               PropertyCodec::Decoder decode,
+                               PropertyCodec::NullCheck isNull )
+{
+    if( type <= QMetaType::UnknownType )
+    {
+        return;
+    }
+
+    const PropertyCodec codec = { isNull, encode, decode };
+    registry()->set( type, codec );
+}
+
+void PropertyCodecs::Unregister( int type )
+{
+    if( ( type > QMetaType::UnknownType ) &&
+        ( type < registry()->codecs.size() ) )
+    {
+        const PropertyCodec none = { K_NULL, K_NULL, K_NULL };
+        registry()->codecs[ type ] = none;
+    }
+}
+
+const PropertyCodec* PropertyCodecs::Find( int type )
+{
+    const QVector< PropertyCodec >& codecs = registry()->codecs;
+    if( ( type <= QMetaType::UnknownType ) || ( type >= codecs.size() ) )
+    {
+        return K_NULL;
+    }
+
+    const PropertyCodec& codec = codecs.at( type );
+    return ( K_NULL != codec.encode ) ? & codec : K_NULL;
+}
+
+void PropertyCodecs::ReadProperty( const QObject* object,
+                                   int propertyIdx,
+                                   void* value )
+{
+    // Same arguments as QMetaProperty::read, without the variant
+    int status = -1;
+    void* argv[] = { value, K_NULL, & status };
+    QMetaObject::metacall( const_cast< QObject* >( object ),
+                           QMetaObject::ReadProperty,
+                           propertyIdx,
+                           argv );
+}
+
+void PropertyCodecs::WriteProperty( QObject* object,
+                                    int propertyIdx,
+                                    void* value )
+{
+    // Same arguments as QMetaProperty::write, without the variant
+    int status = -1;
+    int flags = 0;
+    void* argv[] = { value, K_NULL, & status, & flags };
+    QMetaObject::metacall( object,
+                           QMetaObject::WriteProperty,
+                           propertyIdx,
+                           argv );
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_PropertyCodecs_hpp_
+#define _Kore_serialization_PropertyCodecs_hpp_
+
+#include <QtCore/QDataStream>
+#include <QtCore/QObject>
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+namespace Kore { namespace serialization {
+
+class ByteReader;
+
+/*!
+ * @brief Encoding of the block properties of a given type.
+ *
+ * A codec reads a property straight from its getter into the output stream
+ * and decodes a value straight into its setter, without boxing it into a
+ * QVariant. Values must be encoded as QDataStream does, except for strings
+ * which are stored as UTF-8 byte arrays.
+ */
+struct PropertyCodec
+{
+    /// Whether the property of the object is null, null values are not
+    /// serialized.
+    typedef kbool ( *NullCheck )( const QObject* object, int propertyIdx );
+    /// Write the property of the object to the stream.
+    typedef kbool ( *Encoder )( QDataStream& stream,
+                                const QObject* object,
+                                int propertyIdx );
+    /// Decode a value from the reader and set it on the property.
+    typedef kbool ( *Decoder )( ByteReader& reader,
+                                QObject* object,
+                                int propertyIdx );
+
+    NullCheck   isNull;     //!< K_NULL if values are never null
+    Encoder     encode;
+    Decoder     decode;
+};
+
+/*!
+ * @brief Registry of the property codecs, keyed by type id.
+ *
+ * Codecs are provided for the primitive types and for QChar, QString and
+ * QByteArray. Properties of the other types go through QMetaType::save and
+ * QMetaType::load.
+ *
+ * The registry is not locked: codecs must be registered before any
+ * serialization takes place.
+ */
+class KoreExport PropertyCodecs
+{
+public:
+    /*!
+     * @brief Register the codec of the given type, replacing any previous one.
+     */
+    static void Register( int type,
+                          PropertyCodec::Encoder encode,
+                          PropertyCodec::Decoder decode,
+                          PropertyCodec::NullCheck isNull = K_NULL );
+    static void Unregister( int type );
+
+    /*!
+     * @return The codec of the type, K_NULL if there is none.
+     */
+    static const PropertyCodec* Find( int type );
+
+    /*!
+     * @brief Read a property into value, an instance of the property type.
+     *
+     * The property is accessed through the meta call generated by moc.
+     */
+    static void ReadProperty( const QObject* object,
+                              int propertyIdx,
+                              void* value );
+    /*!
+     * @brief Set a property from value, an instance of the property type.
+     */
+    static void WriteProperty( QObject* object,
+                               int propertyIdx,
+                               void* value );
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_PropertyCodecs_hpp_
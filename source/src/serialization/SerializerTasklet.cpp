@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QMutexLocker>
+
+#include "SerializerTasklet.hpp"
+
+#include <KoreModule.hpp>
+
+#define K_TASKLET_TYPE Kore::serialization::SerializerTasklet
+#include <parallel/TaskletMacros.hpp>
+K_TASKLET_IMPLEMENTATION
+
+using namespace Kore::parallel;
+using namespace Kore::serialization;
+
+/*
+ * Monitor of the serializer, forwarding to the tasklet. The serializer calls
+ * it from a single thread at a time.
+ */
+class SerializerTasklet::Monitor : public TreeSerializerMonitor
+{
+public:
+    Monitor( const SerializerTasklet* runner, SerializerTasklet* tasklet )
+        : _runner( runner )
+        , _tasklet( tasklet )
+    { /* NOTHING */ }
+
+    virtual bool shouldStopProcess()
+    {
+        return ! _runner->TaskletRunner::keepRunning( _tasklet );
+    }
+
+    virtual bool event( int errorCode, const QString& message )
+    {
+        // Go on, as the serializer does without a monitor
+        _runner->TaskletRunner::progress( _tasklet,
+                                          QString( "%1: %2" )
+                                            .arg( errorCode )
+                                            .arg( message ) );
+        return true;
+    }
+
+    virtual void progress( qint64 min, qint64 progress, qint64 max )
+    {
+        _runner->TaskletRunner::progress(
+                    _tasklet,
+                    static_cast< kuint64 >( progress - min ),
+                    static_cast< kuint64 >( qMax( max - min,
+                                                  Q_INT64_C( 0 ) ) ) );
+    }
+
+    virtual void bytesProgress( qint64 bytes, qint64 total )
+    {
+        QMutexLocker locker( & _tasklet->_bytesMutex );
+        _tasklet->_bytes = bytes;
+        _tasklet->_bytesTotal = total;
+    }
+
+private:
+    const SerializerTasklet*    _runner;
+    SerializerTasklet*          _tasklet;
+};
+
+SerializerTasklet::SerializerTasklet()
+    : _device( K_NULL )
+    , _error( TreeSerializer::NoError )
+    , _bytes( 0 )
+    , _bytesTotal( 0 )
+{
+    addFlags( Cancellable );
+}
+
+void SerializerTasklet::setSerializer( const KoreSerializer& serializer )
+{
+    _serializer = serializer;
+}
+
+void SerializerTasklet::setDevice( QIODevice* device )
+{
+    _device = device;
+}
+
+qint64 SerializerTasklet::bytesProcessed() const
+{
+    QMutexLocker locker( & _bytesMutex );
+    return _bytes;
+}
+
+qint64 SerializerTasklet::bytesTotal() const
+{
+    QMutexLocker locker( & _bytesMutex );
+    return _bytesTotal;
+}
+
+int SerializerTasklet::process( TreeSerializerMonitor* )
+{
+    qWarning( "The serializer tasklet %s has no implementation !",
+              qPrintable( objectClassName() ) );
+    return TreeSerializer::UnsupportedOperation;
+}
+
+void SerializerTasklet::run( Tasklet* tasklet ) const
+{
+    SerializerTasklet* serializerTasklet =
+            static_cast< SerializerTasklet* >( tasklet );
+
+    TaskletRunner::start( serializerTasklet );
+
+    {
+        QMutexLocker locker( & serializerTasklet->_bytesMutex );
+        serializerTasklet->_bytes = 0;
+        serializerTasklet->_bytesTotal = 0;
+    }
+
+    Monitor monitor( this, serializerTasklet );
+    serializerTasklet->_error = serializerTasklet->process( & monitor );
+
+    switch( serializerTasklet->_error )
+    {
+    case TreeSerializer::NoError:
+        TaskletRunner::complete( serializerTasklet );
+        break;
+    case TreeSerializer::Canceled:
+        TaskletRunner::cancel( serializerTasklet );
+        break;
+    default:
+        TaskletRunner::fail( serializerTasklet );
+        break;
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_SerializerTasklet_hpp_
+#define _Kore_serialization_SerializerTasklet_hpp_
+
+#include <QtCore/QIODevice>
+#include <QtCore/QMutex>
+
+#include <parallel/Tasklet.hpp>
+
+#include "KoreSerializer.hpp"
+
+namespace Kore { namespace serialization {
+
+/*!
+ * @brief Base of the tasklets running a serializer on a device.
+ *
+ * The tasklet is run through KoreEngine::RunTasklet(), asynchronously to keep
+ * the application responsive. It reports the blocks processed through the
+ * progress() signal, the total being 0 when it is not known, and the bytes
+ * processed through bytesProcessed(). The errors the serializer meets are
+ * reported as progress messages, the blocks or properties concerned are
+ * skipped.
+ *
+ * The tasklet can be canceled, the serializer polls it between blocks. It
+ * then ends with the Canceled state and error.
+ *
+ * The device must not be used until the tasklet ended.
+ */
+class KoreExport SerializerTasklet : public Kore::parallel::Tasklet
+{
+    Q_OBJECT
+    K_TASKLET
+
+public:
+    SerializerTasklet();
+
+    inline const KoreSerializer& serializer() const { return _serializer; }
+    void setSerializer( const KoreSerializer& serializer );
+
+    inline QIODevice* device() const { return _device; }
+    void setDevice( QIODevice* device );
+
+    /*!
+     * @brief The TreeSerializer::SerializationError the tasklet ended with.
+     */
+    inline int error() const { return _error; }
+
+    /*!
+     * @brief Bytes processed so far, and their total, 0 if not known.
+     */
+    qint64 bytesProcessed() const;
+    qint64 bytesTotal() const;
+
+protected:
+    /*!
+     * @brief Run the serializer, on the thread running the tasklet.
+     * @return a TreeSerializer::SerializationError.
+     */
+    virtual int process( TreeSerializerMonitor* monitor );
+
+    virtual void run( Kore::parallel::Tasklet* tasklet ) const;
+
+private:
+    class Monitor;
+
+    KoreSerializer  _serializer;
+    QIODevice*      _device;
+    volatile int    _error;
+
+    mutable QMutex  _bytesMutex;
+    qint64          _bytes;
+    qint64          _bytesTotal;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_SerializerTasklet_hpp_
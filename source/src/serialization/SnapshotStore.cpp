@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QBuffer>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+#include "ByteReader.hpp"
+#include "SnapshotStore.hpp"
+
+#include <data/Block.hpp>
+
+using namespace Kore::data;
+using namespace Kore::serialization;
+
+#define SNAPSHOT_MAGIC              ( K_FOURCC( 'K', 'S', 'N', 'P' ) )
+#define SNAPSHOT_VERSION            1
+
+#define OBJECTS_DIR                 "objects"
+#define SNAPSHOTS_DIR               "snapshots"
+
+// SHA-1
+#define CHUNK_HASH_SIZE             20
+
+#define DEFAULT_CHUNK_SIZE          ( 16 * _K_1KB )
+
+namespace {
+
+struct Chunk
+{
+    QByteArray hash;
+    quint32 size;
+};
+
+int ReadManifest( const QString& path, QVector< Chunk >* chunks )
+{
+    QFile file( path );
+    if( ! file.open( QIODevice::ReadOnly ) )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    const QByteArray data = file.readAll();
+    ByteReader reader( data.constData(), data.size() );
+    if( ( SNAPSHOT_MAGIC != reader.readUInt32() ) ||
+        ( SNAPSHOT_VERSION != reader.readUInt8() ) )
+    {
+        return TreeSerializer::InvalidData;
+    }
+
+    const quint32 count = reader.readUInt32();
+    for( quint32 i = 0; ( i < count ) && ! reader.hasError(); ++i )
+    {
+        Chunk chunk;
+        chunk.hash.resize( CHUNK_HASH_SIZE );
+        if( reader.read( chunk.hash.data(), CHUNK_HASH_SIZE )
+                != CHUNK_HASH_SIZE )
+        {
+            return TreeSerializer::InvalidData;
+        }
+        chunk.size = reader.readUInt32();
+        chunks->append( chunk );
+    }
+
+    return reader.hasError() ? TreeSerializer::InvalidData
+                             : TreeSerializer::NoError;
+}
+
+int WriteObject( const QString& path, const QByteArray& chunk )
+{
+    // Already stored by a previous snapshot
+    if( QFile::exists( path ) )
+    {
+        return TreeSerializer::NoError;
+    }
+
+    QSaveFile file( path );
+    if( ! QDir().mkpath( QFileInfo( path ).path() ) ||
+        ! file.open( QIODevice::WriteOnly ) ||
+        ( file.write( chunk ) != chunk.size() ) ||
+        ! file.commit() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+/*
+ * Sequential device reading the chunks of a snapshot one after the other,
+ * each one being checked against its hash when loaded.
+ */
+class ChunksDevice : public QIODevice
+{
+public:
+    ChunksDevice( const QStringList& paths, const QVector< Chunk >& chunks )
+        : _paths( paths )
+        , _chunks( chunks )
+        , _next( 0 )
+        , _chunkPos( 0 )
+        , _remaining( 0 )
+        , _error( TreeSerializer::NoError )
+    {
+        for( int i = 0; i < _chunks.size(); ++i )
+        {
+            _remaining += _chunks.at( i ).size;
+        }
+
+        open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+    }
+
+    virtual bool isSequential() const
+    {
+        return true;
+    }
+
+    virtual qint64 bytesAvailable() const
+    {
+        return _remaining + QIODevice::bytesAvailable();
+    }
+
+    inline int error() const { return _error; }
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize )
+    {
+        qint64 read = 0;
+        while( read < maxSize )
+        {
+            if( ( _chunkPos == _chunk.size() ) && ! loadNext() )
+            {
+                break;
+            }
+
+            const qint64 size = qMin( maxSize - read,
+                                      qint64( _chunk.size() - _chunkPos ) );
+            memcpy( data + read, _chunk.constData() + _chunkPos, size );
+            _chunkPos += size;
+            _remaining -= size;
+            read += size;
+        }
+
+        return ( TreeSerializer::NoError == _error ) ? read : -1;
+    }
+
+    virtual qint64 writeData( const char*, qint64 )
+    {
+        return -1;
+    }
+
+private:
+    kbool loadNext()
+    {
+        if( ( _chunks.size() == _next ) ||
+            ( TreeSerializer::NoError != _error ) )
+        {
+            return false;
+        }
+
+        QFile file( _paths.at( _next ) );
+        if( ! file.open( QIODevice::ReadOnly ) )
+        {
+            _error = TreeSerializer::IOError;
+            return false;
+        }
+
+        const Chunk& chunk = _chunks.at( _next++ );
+        _chunk = file.readAll();
+        _chunkPos = 0;
+
+        if( ( static_cast< quint32 >( _chunk.size() ) != chunk.size ) ||
+            ( QCryptographicHash::hash( _chunk, QCryptographicHash::Sha1 )
+                  != chunk.hash ) )
+        {
+            _error = TreeSerializer::InvalidData;
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    QStringList         _paths;
+    QVector< Chunk >    _chunks;
+    int                 _next;
+    QByteArray          _chunk;             //!< Being read
+    int                 _chunkPos;
+    qint64              _remaining;
+    int                 _error;
+};
+
+} // namespace
+
+SnapshotStore::SnapshotStore( const QString& path,
+                              const KoreSerializer& serializer )
+    : _path( path )
+    , _serializer( serializer )
+    , _chunkSize( DEFAULT_CHUNK_SIZE )
+{
+    _serializer.setOptions( ( serializer.options()
+                              | KoreSerializer::Streamable )
+                            & ~KoreSerializer::Compressed );
+}
+
+kint SnapshotStore::chunkSize() const
+{
+    return _chunkSize;
+}
+
+void SnapshotStore::setChunkSize( kint bytes )
+{
+    _chunkSize = bytes;
+}
+
+int SnapshotStore::save( const QString& name,
+                         const Block* tree,
+                         TreeSerializerMonitor* monitor )
+{
+    QBuffer buffer;
+    buffer.open( QIODevice::ReadWrite );
+
+    int err = _serializer.deflate( & buffer, tree, monitor );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    buffer.seek( 0 );
+    QList< qint64 > boundaries;
+    err = _serializer.split( & buffer, _chunkSize, & boundaries );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    if( ! QDir().mkpath( QDir( _path ).filePath( SNAPSHOTS_DIR ) ) )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    QByteArray manifest;
+    QDataStream stream( & manifest, QIODevice::WriteOnly );
+    stream << static_cast< quint32 >( SNAPSHOT_MAGIC );
+    stream << static_cast< quint8 >( SNAPSHOT_VERSION );
+    stream << static_cast< quint32 >( boundaries.size() );
+
+    const QByteArray& data = buffer.data();
+    qint64 start = 0;
+    for( int i = 0; i < boundaries.size(); ++i )
+    {
+        const qint64 end = boundaries.at( i );
+        const QByteArray chunk = QByteArray::fromRawData(
+                    data.constData() + start, end - start );
+        const QByteArray hash = QCryptographicHash::hash(
+                    chunk, QCryptographicHash::Sha1 );
+
+        err = WriteObject( objectPath( hash ), chunk );
+        if( TreeSerializer::NoError != err )
+        {
+            return err;
+        }
+
+        stream.writeRawData( hash.constData(), hash.size() );
+        stream << static_cast< quint32 >( chunk.size() );
+        start = end;
+    }
+
+    // The snapshot exists once its chunks are all stored
+    QSaveFile file( snapshotPath( name ) );
+    if( ! file.open( QIODevice::WriteOnly ) ||
+        ( file.write( manifest ) != manifest.size() ) ||
+        ! file.commit() )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    return TreeSerializer::NoError;
+}
+
+int SnapshotStore::restore( const QString& name,
+                            Block** tree,
+                            TreeSerializerMonitor* monitor ) const
+{
+    QVector< Chunk > chunks;
+    int err = ReadManifest( snapshotPath( name ), & chunks );
+    if( TreeSerializer::NoError != err )
+    {
+        return err;
+    }
+
+    QStringList paths;
+    for( int i = 0; i < chunks.size(); ++i )
+    {
+        paths.append( objectPath( chunks.at( i ).hash ) );
+    }
+
+    ChunksDevice device( paths, chunks );
+
+    err = _serializer.inflate( & device, tree, monitor );
+
+    // The inflate only sees the end of the data on a missing chunk
+    if( ( TreeSerializer::NoError != err ) &&
+        ( TreeSerializer::NoError != device.error() ) )
+    {
+        return device.error();
+    }
+
+    return err;
+}
+
+QStringList SnapshotStore::snapshots() const
+{
+    return QDir( QDir( _path ).filePath( SNAPSHOTS_DIR ) )
+            .entryList( QDir::Files, QDir::Name );
+}
+
+int SnapshotStore::remove( const QString& name )
+{
+    const QString path = snapshotPath( name );
+    if( QFile::exists( path ) && ! QFile::remove( path ) )
+    {
+        return TreeSerializer::IOError;
+    }
+
+    // Hashes of the chunks still referred to, in hexadecimal
+    QSet< QByteArray > used;
+    const QStringList names = snapshots();
+    for( int i = 0; i < names.size(); ++i )
+    {
+        QVector< Chunk > chunks;
+        int err = ReadManifest( snapshotPath( names.at( i ) ), & chunks );
+        if( TreeSerializer::NoError != err )
+        {
+            // A chunk of an unreadable snapshot could be removed
+            return err;
+        }
+
+        for( int c = 0; c < chunks.size(); ++c )
+        {
+            used.insert( chunks.at( c ).hash.toHex() );
+        }
+    }
+
+    QDirIterator it( QDir( _path ).filePath( OBJECTS_DIR ),
+                     QDir::Files,
+                     QDirIterator::Subdirectories );
+    while( it.hasNext() )
+    {
+        const QString path = it.next();
+        const QByteArray hex = ( it.fileInfo().dir().dirName()
+                                 + it.fileName() ).toLatin1();
+        if( ! used.contains( hex ) && ! QFile::remove( path ) )
+        {
+            return TreeSerializer::IOError;
+        }
+    }
+
+    return TreeSerializer::NoError;
+}
+
+QString SnapshotStore::objectPath( const QByteArray& hash ) const
+{
+    const QString hex = QString::fromLatin1( hash.toHex() );
+    return QDir( _path ).filePath(
+                QString( "%1/%2/%3" ).arg( QLatin1String( OBJECTS_DIR ),
+                                           hex.left( 2 ),
+                                           hex.mid( 2 ) ) );
+}
+
+QString SnapshotStore::snapshotPath( const QString& name ) const
+{
+    return QDir( _path ).filePath(
+                QString( "%1/%2" ).arg( QLatin1String( SNAPSHOTS_DIR ),
+                                        name ) );
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_SnapshotStore_hpp_
+#define _Kore_serialization_SnapshotStore_hpp_
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include "KoreSerializer.hpp"
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+namespace Kore {
+
+namespace data { class Block; }
+
+namespace serialization {
+
+/*
+ * Snapshot store.
+ *
+ * A directory holding:
+ *
+ *  objects/xx/yy...    a chunk of a deflated tree, named after the SHA-1 of
+ *                      its content in hexadecimal, xx being the first two
+ *                      digits
+ *  snapshots/<name>    the manifest of a snapshot:
+ *                      u32 magic 'KSNP', u8 version, u32 chunks count
+ *                      for each chunk: SHA-1 (20 bytes), u32 size
+ *
+ * The chunks concatenated in the order of the manifest give back the tree as
+ * it was deflated.
+ */
+
+/*!
+ * @brief Content addressed store of the successive snapshots of a tree.
+ *
+ * Each snapshot is deflated in the streaming layout, then split at subtree
+ * boundaries with KoreSerializer::split(). Every distinct chunk is stored
+ * once, a snapshot being a small manifest of its chunks: the store grows with
+ * the subtrees changed between snapshots rather than with their count. A
+ * snapshot is restored by streaming its chunks to the inflate of the
+ * serializer, as from any sequential device.
+ *
+ * In the streaming layout the types are numbered in the order they are first
+ * met: the chunks of a subtree are shared by two snapshots as long as no new
+ * type appears before it.
+ *
+ * The chunks are written before the manifest, and both are replaced
+ * atomically: an interrupted save leaves unreferenced chunks at worst, which
+ * the next remove() deletes. The store must not be used by several processes
+ * at once.
+ */
+class KoreExport SnapshotStore
+{
+public:
+    /*!
+     * @param path          Directory of the store, created by the first save.
+     * @param serializer    Serializer of the snapshots. Compressed is
+     *                      ignored, and the trees are always deflated in the
+     *                      streaming layout.
+     */
+    SnapshotStore( const QString& path,
+                   const KoreSerializer& serializer = KoreSerializer() );
+
+    inline const QString& path() const { return _path; }
+
+    /*!
+     * @brief Size above which a subtree is split into several chunks, see
+     *        KoreSerializer::split(). 16 KB by default.
+     */
+    kint chunkSize() const;
+    void setChunkSize( kint bytes );
+
+    /*!
+     * @brief Store a snapshot of the tree, replacing any snapshot of the same
+     *        name.
+     *
+     * @param name  A valid file name.
+     */
+    int save( const QString& name,
+              const Kore::data::Block* tree,
+              TreeSerializerMonitor* monitor );
+
+    /*!
+     * @brief Inflate a snapshot.
+     *
+     * @return IOError if the snapshot or one of its chunks does not exist,
+     *         InvalidData if a chunk does not match its hash.
+     */
+    int restore( const QString& name,
+                 Kore::data::Block** tree,
+                 TreeSerializerMonitor* monitor ) const;
+
+    /*!
+     * @brief Names of the stored snapshots, sorted.
+     */
+    QStringList snapshots() const;
+
+    /*!
+     * @brief Remove a snapshot, then the chunks no snapshot refers to.
+     */
+    int remove( const QString& name );
+
+private:
+    QString objectPath( const QByteArray& hash ) const;
+    QString snapshotPath( const QString& name ) const;
+
+private:
+    QString         _path;
+    KoreSerializer  _serializer;
+    kint            _chunkSize;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_SnapshotStore_hpp_
@@ -47,9 +47,23 @@ public:
 
     virtual bool event( int errorCode, const QString& message ) = K_VIRTUAL;
 
+    /*!
+     * Blocks processed so far. Reported by batches of blocks, max is 0 when
+     * the number of blocks is not known.
+     */
     virtual void progress( qint64 min,
                            qint64 progress,
                            qint64 max ) = K_VIRTUAL;
+
+    /*!
+     * Bytes processed so far, reported along with progress(). total is 0 when
+     * the size is not known.
+     */
+    virtual void bytesProgress( qint64 bytes, qint64 total )
+    {
+        Q_UNUSED( bytes );
+        Q_UNUSED( total );
+    }
 };
 
 class KoreExport TreeSerializer
@@ -75,6 +89,16 @@ public:
 
         InvalidBlockProperty,
 
+        NotIndexed,
+        BlockNotFound,
+
+        Canceled,
+
+        NotHashed,
+
+        ChecksumMismatch,
+        NotChecksummed,
+
         MAX_SERIALIZATION_ERROR
     };
 
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QFileDevice>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include "WriteBehind.hpp"
+
+using namespace Kore::serialization;
+
+class WriteBehindDevice::Writer : public QThread
+{
+public:
+    Writer( WriteBehindDevice* device ) : _device( device ) {}
+
+protected:
+    virtual void run()
+    {
+        _device->writeBuffers();
+    }
+
+private:
+    WriteBehindDevice* _device;
+};
+
+WriteBehindDevice::WriteBehindDevice( QIODevice* device,
+                                      qint64 bufferSize,
+                                      int buffersCount )
+    : _device( device )
+    , _bufferSize( qMax( bufferSize, qint64( 4 * _K_1KB ) ) )
+    , _buffersCount( qMax( buffersCount, 2 ) )
+    , _error( 0 )
+    , _writer( K_NULL )
+    , _inFlight( 0 )
+    , _closing( false )
+{
+}
+
+WriteBehindDevice::~WriteBehindDevice()
+{
+    close();
+}
+
+bool WriteBehindDevice::open( OpenMode mode )
+{
+    // A second writer thread would write the same device
+    if( isOpen() || ( mode & ReadOnly ) || ! ( mode & WriteOnly ) )
+    {
+        return false;
+    }
+
+    _error.store( 0 );
+    _closing = false;
+    _inFlight = 0;
+    _pending.clear();
+    _free.clear();
+    _buffer = QByteArray();
+    _buffer.reserve( _bufferSize );
+
+    _writer = new Writer( this );
+    _writer->start();
+
+    return QIODevice::open( mode | Unbuffered );
+}
+
+void WriteBehindDevice::close()
+{
+    if( ! isOpen() )
+    {
+        return;
+    }
+
+    // The last buffer may be partial
+    if( ! _buffer.isEmpty() )
+    {
+        submitBuffer();
+    }
+
+    {
+        QMutexLocker locker( & _mutex );
+        _closing = true;
+        _submitted.wakeOne();
+    }
+    _writer->wait();
+    delete _writer;
+    _writer = K_NULL;
+
+    _buffer = QByteArray();
+    _free.clear();
+
+    QIODevice::close();
+}
+
+bool WriteBehindDevice::isSequential() const
+{
+    return true;
+}
+
+kbool WriteBehindDevice::hasError() const
+{
+    return 0 != _error.load();
+}
+
+qint64 WriteBehindDevice::readData( char*, qint64 )
+{
+    return -1;
+}
+
+qint64 WriteBehindDevice::writeData( const char* data, qint64 size )
+{
+    if( hasError() )
+    {
+        return -1;
+    }
+
+    qint64 written = 0;
+    while( written < size )
+    {
+        const qint64 bytes = qMin( size - written,
+                                   _bufferSize - _buffer.size() );
+        _buffer.append( data + written, bytes );
+        written += bytes;
+
+        if( _buffer.size() == _bufferSize )
+        {
+            submitBuffer();
+        }
+    }
+
+    return hasError() ? -1 : size;
+}
+
+void WriteBehindDevice::submitBuffer()
+{
+    QMutexLocker locker( & _mutex );
+
+    // Wait for a buffer to be written if they are all in flight
+    while( _inFlight >= _buffersCount - 1 )
+    {
+        _written.wait( & _mutex );
+    }
+
+    _pending.enqueue( _buffer );
+    ++_inFlight;
+    _submitted.wakeOne();
+
+    // The writer holds the only reference to the buffer from now on
+    if( _free.isEmpty() )
+    {
+        _buffer = QByteArray();
+        _buffer.reserve( _bufferSize );
+    }
+    else
+    {
+        _buffer = _free.takeLast();
+    }
+}
+
+void WriteBehindDevice::writeBuffers()
+{
+    for( ;; )
+    {
+        QByteArray buffer;
+        {
+            QMutexLocker locker( & _mutex );
+            while( _pending.isEmpty() && ! _closing )
+            {
+                _submitted.wait( & _mutex );
+            }
+            if( _pending.isEmpty() )
+            {
+                break;
+            }
+            buffer = _pending.dequeue();
+        }
+
+        // Once an error occurred the buffers are only recycled
+        qint64 written = 0;
+        while( ! hasError() && ( written < buffer.size() ) )
+        {
+            const qint64 bytes = _device->write( buffer.constData() + written,
+                                                 buffer.size() - written );
+            if( bytes <= 0 )
+            {
+                _error.store( 1 );
+            }
+            written += bytes;
+        }
+
+        // Reserved buffers keep their memory when emptied
+        buffer.resize( 0 );
+
+        QMutexLocker locker( & _mutex );
+        _free.append( buffer );
+        buffer = QByteArray();
+        --_inFlight;
+        _written.wakeOne();
+    }
+
+    flushDevice();
+}
+
+void WriteBehindDevice::flushDevice()
+{
+    if( hasError() )
+    {
+        return;
+    }
+
+    // Files buffer the data, other devices may write it asynchronously
+    QFileDevice* file = qobject_cast< QFileDevice* >( _device );
+    if( K_NULL != file )
+    {
+        if( ! file->flush() )
+        {
+            _error.store( 1 );
+        }
+        return;
+    }
+
+    while( _device->bytesToWrite() > 0 )
+    {
+        if( ! _device->waitForBytesWritten( -1 ) )
+        {
+            _error.store( 1 );
+            return;
+        }
+    }
+}
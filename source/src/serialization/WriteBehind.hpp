@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _Kore_serialization_WriteBehind_hpp_
+#define _Kore_serialization_WriteBehind_hpp_
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QByteArray>
+#include <QtCore/QIODevice>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+#include <KoreMacros.hpp>
+#include <KoreTypes.hpp>
+
+namespace Kore { namespace serialization {
+
+/*!
+ * @brief Write only device handing the data over to a writer thread.
+ *
+ * The data is gathered in buffers of a fixed size. Full buffers are written
+ * to the underlying device by a dedicated thread while the next one is
+ * filled, so that producing the data and writing it overlap. The buffers in
+ * flight are bounded: writing blocks when they are all waiting for the
+ * device. Buffers are recycled, and everything is written by close().
+ *
+ * The underlying device must not be used until then, and must support being
+ * written from another thread, as files and buffers do but sockets do not.
+ */
+class KoreExport WriteBehindDevice : public QIODevice
+{
+public:
+    /*!
+     * @param device        The device to write to, from its current position.
+     * @param bufferSize    Size of a buffer.
+     * @param buffersCount  Number of buffers, the one being filled included.
+     *                      2, the minimum, is double buffering.
+     */
+    WriteBehindDevice( QIODevice* device,
+                       qint64 bufferSize = _K_1MB,
+                       int buffersCount = 2 );
+    virtual ~WriteBehindDevice();
+
+    /*!
+     * @brief Open in WriteOnly mode, starting the writer thread.
+     *
+     * Fails if the device is open already.
+     */
+    virtual bool open( OpenMode mode );
+    /*!
+     * @brief Write the remaining buffers, flush the underlying device and
+     *        stop the writer thread.
+     *
+     * hasError() tells afterwards whether all the data reached the device.
+     */
+    virtual void close();
+
+    virtual bool isSequential() const;
+
+    /*!
+     * @brief Whether writing to the underlying device failed.
+     */
+    kbool hasError() const;
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize );
+    virtual qint64 writeData( const char* data, qint64 size );
+
+private:
+    class Writer;
+    friend class Writer;
+
+    void submitBuffer();
+    void writeBuffers();
+    void flushDevice();
+
+private:
+    QIODevice*                  _device;
+    qint64                      _bufferSize;
+    int                         _buffersCount;
+    QAtomicInt                  _error;
+
+    QByteArray                  _buffer;        //!< Being filled
+    Writer*                     _writer;
+
+    // Shared with the writer thread
+    QMutex                      _mutex;
+    QWaitCondition              _submitted;
+    QWaitCondition              _written;
+    QQueue< QByteArray >        _pending;       //!< To be written
+    QVector< QByteArray >       _free;          //!< Written, to be reused
+    int                         _inFlight;      //!< Pending or being written
+    kbool                       _closing;
+};
+
+} /* serialization */ } /* Kore */
+
+#endif // _Kore_serialization_WriteBehind_hpp_
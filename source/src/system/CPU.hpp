@@ -74,6 +74,10 @@ public:
      * @brief Returns true if CPUs are SSE4 compliant, false otherwise.
      */
     kbool	isSSE4Enabled() const;
+    /*!
+     * @brief Returns true if CPUs are SSE4.2 compliant, false otherwise.
+     */
+    kbool	isSSE42Enabled() const;
     /*!
      * @brief Returns true if CPUs are 3DNow compliant, false otherwise.
      */
@@ -96,6 +100,7 @@ private:
     kbool	_SSE2;
     kbool	_SSE3;
     kbool	_SSE4;
+    kbool	_SSE42;
     kbool	_3DNow;
     kbool	_3DNow2;
     kchar	_vendorString[12+1];
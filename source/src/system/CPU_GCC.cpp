@@ -35,6 +35,7 @@ using namespace Kore::system;
 #define SSE3_SUPPORTED          0x00000001
 #define SSE3_EX_SUPPORTED       0x00000200
 #define SSE4_SUPPORTED          0x00080000
+#define SSE42_SUPPORTED         0x00100000
 #define AMD_3DNOW_SUPPORTED     0x80000000
 
 // AMD specific
@@ -72,6 +73,7 @@ void CPU::init()
     _SSE2 =	cpu_info & SSE2_SUPPORTED;
     _SSE3 = cpu_ssex & SSE3_SUPPORTED;
     _SSE4 = cpu_ssex & SSE4_SUPPORTED;
+    _SSE42 = cpu_ssex & SSE42_SUPPORTED;
     _3DNow = cpu_info & AMD_3DNOW_SUPPORTED;
 
     // Vendor string.
@@ -131,6 +133,11 @@ kbool CPU::isSSE4Enabled() const
     return _SSE4;
 }
 
+kbool CPU::isSSE42Enabled() const
+{
+    return _SSE42;
+}
+
 kbool CPU::is3DNowEnabled() const
 {
     return _3DNow;
@@ -35,6 +35,7 @@ using namespace Kore::system;
 #define SSE3_SUPPORTED          0x00000001
 #define SSE3_EX_SUPPORTED       0x00000200
 #define SSE4_SUPPORTED          0x00080000
+#define SSE42_SUPPORTED         0x00100000
 #define AMD_3DNOW_SUPPORTED     0x80000000
 
 // AMD specific
@@ -64,6 +65,7 @@ void CPU::init() {
     _SSE2 =     registers[ 3 ] & SSE2_SUPPORTED;
     _SSE3 =     registers[ 2 ] & SSE3_SUPPORTED;
     _SSE4 =     registers[ 2 ] & SSE4_SUPPORTED;
+    _SSE42 =    registers[ 2 ] & SSE42_SUPPORTED;
     _3DNow =    registers[ 3 ] & AMD_3DNOW_SUPPORTED;
 
     // Vendor string.
@@ -107,6 +109,11 @@ kbool CPU::isSSE4Enabled() const
     return _SSE4;
 }
 
+kbool CPU::isSSE42Enabled() const
+{
+    return _SSE42;
+}
+
 kbool CPU::is3DNowEnabled() const
 {
     return _3DNow;
@@ -50,6 +50,7 @@ int MyBlock1::leInt() const
 void MyBlock1::setLeInt( int i )
 {
     _leInt = i;
+    markDirty();
 }
 
 const QString& MyBlock1::laString() const
@@ -60,6 +61,7 @@ const QString& MyBlock1::laString() const
 void MyBlock1::setLaString( const QString& str )
 {
     _laString = str;
+    markDirty();
 }
 
 const MyCustomType& MyBlock1::leCustomType() const
@@ -75,4 +77,5 @@ MyCustomType& MyBlock1::leCustomType()
 void MyBlock1::setLeCustomType( const MyCustomType& type )
 {
     _leCustomType = type;
+    markDirty();
 }
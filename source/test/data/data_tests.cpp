@@ -55,6 +55,26 @@ TEST( BlockTest, MetaBlockMetaObject )
     EXPECT_TRUE( block.metaBlock() == MyBlock::StaticMetaBlock() );
 }
 
+TEST( BlockTest, MetaBlockStoredProperties )
+{
+    const MetaBlock* mb = MyBlock1::StaticMetaBlock();
+
+    // blockName, leInt, laString and leCustomType, not objectName
+    const QVector< MetaBlock::StoredProperty >& properties =
+            mb->storedProperties();
+    ASSERT_TRUE( properties.size() == 4 );
+    EXPECT_TRUE( & properties == & mb->storedProperties() );
+
+    const int leIntIdx = MyBlock1::staticMetaObject.indexOfProperty( "leInt" );
+    const MetaBlock::StoredProperty* leInt = mb->storedProperty( leIntIdx );
+    ASSERT_TRUE( K_NULL != leInt );
+    EXPECT_TRUE( leInt->property.propertyIndex() == leIntIdx );
+    EXPECT_TRUE( leInt->type == QMetaType::Int );
+
+    EXPECT_TRUE( K_NULL == mb->storedProperty( 0 ) );
+    EXPECT_TRUE( K_NULL == mb->storedProperty( 1000 ) );
+}
+
 TEST( BlockTest, FastInherits )
 {
     MyBlock block( Block::Static );
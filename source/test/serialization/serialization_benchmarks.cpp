@@ -0,0 +1,912 @@
+/*
+ * Copyright (c) 2013, Moving Pixel Labs (http://www.mp-labs.net)
+ * All rights reserved.
+
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *    * Neither the name of the Moving Pixel Labs nor the names of its
+ *      contributors may be used to endorse or promote products
+ *      derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL MOVING PIXEL LABS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCore/QBuffer>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QTemporaryFile>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined( __GLIBC__ )
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <gtest/gtest.h>
+
+#include <data/MetaBlock.hpp>
+#include <memory/BlockArena.hpp>
+#include <serialization/KoreSerializer.hpp>
+
+#include "../data/MyBlock1.hpp"
+#include "../data/MyBlock2.hpp"
+#include "../data/MyLibrary.hpp"
+
+using namespace DataTestModule;
+using namespace Kore::data;
+using namespace Kore::memory;
+using namespace Kore::serialization;
+
+/*
+ * Serialization benchmarks.
+ *
+ * These are disabled by default as they take a while (and quite some memory)
+ * to run, use --gtest_also_run_disabled_tests to run them.
+ *
+ * The throughput benchmarks write their results as JSON, to compare runs
+ * across commits: to serialization_benchmarks.json in the working directory,
+ * or to the file given by KORE_BENCHMARK_JSON. KORE_BENCHMARK_LABEL, a commit
+ * id for instance, is copied to the results. The allocations are counted at
+ * the malloc level and the seeks at the lseek level with glibc, the reads and
+ * writes are the system calls listed by /proc/self/io on Linux.
+ */
+
+namespace
+{
+
+// Allocations and seeks made by the process, see the hooks below
+QBasicAtomicInteger< qint64 > allocationsCount =
+        Q_BASIC_ATOMIC_INITIALIZER( 0 );
+QBasicAtomicInteger< qint64 > seeksCount =
+        Q_BASIC_ATOMIC_INITIALIZER( 0 );
+
+}
+
+#if defined( __GLIBC__ )
+
+// Count the allocations at the malloc level, which also sees the arrays of
+// the Qt containers and strings. The libraries are bound to these functions
+// too, as they are defined by the executable. A reallocation counts as one.
+extern "C"
+{
+
+void* __libc_malloc( size_t size );
+void* __libc_calloc( size_t nb, size_t size );
+void* __libc_realloc( void* p, size_t size );
+
+void* malloc( size_t size ) __THROW
+{
+    allocationsCount.fetchAndAddRelaxed( 1 );
+    return __libc_malloc( size );
+}
+
+void* calloc( size_t nb, size_t size ) __THROW
+{
+    allocationsCount.fetchAndAddRelaxed( 1 );
+    return __libc_calloc( nb, size );
+}
+
+void* realloc( void* p, size_t size ) __THROW
+{
+    allocationsCount.fetchAndAddRelaxed( 1 );
+    return __libc_realloc( p, size );
+}
+
+#if defined( __LP64__ )
+// Count the seek system calls, off_t being 64 bits either way
+off_t lseek( int fd, off_t offset, int whence ) __THROW
+{
+    seeksCount.fetchAndAddRelaxed( 1 );
+    return syscall( SYS_lseek, fd, offset, whence );
+}
+
+off64_t lseek64( int fd, off64_t offset, int whence ) __THROW
+{
+    seeksCount.fetchAndAddRelaxed( 1 );
+    return syscall( SYS_lseek, fd, offset, whence );
+}
+#define KORE_BENCHMARK_SEEKS
+#endif
+
+}
+
+#else
+
+// Count the allocations of operator new only, the libraries use it too,
+// except on Windows where each DLL has its own.
+void* operator new( std::size_t size )
+{
+    allocationsCount.fetchAndAddRelaxed( 1 );
+
+    void* p = std::malloc( ( 0 != size ) ? size : 1 );
+    if( K_NULL == p )
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[]( std::size_t size )
+{
+    return operator new( size );
+}
+
+void operator delete( void* p ) Q_DECL_NOTHROW
+{
+    std::free( p );
+}
+
+void operator delete[]( void* p ) Q_DECL_NOTHROW
+{
+    std::free( p );
+}
+
+#endif
+
+namespace
+{
+
+// Build a two levels tree of blocksNb MyBlock1 blocks.
+MyLibrary* CreateTree( int blocksNb )
+{
+    const int blocksPerLibrary = 1000;
+
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    MyLibrary* lib = K_NULL;
+
+    for( int i = 0; i < blocksNb; ++i )
+    {
+        if( 0 == ( i % blocksPerLibrary ) )
+        {
+            lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+            root->addBlock( lib );
+        }
+
+        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        block->setLeInt( i + 1 );
+        block->setLaString( QString( "Block %1" ).arg( i ) );
+        lib->addBlock( block );
+    }
+
+    return root;
+}
+
+// Inflate the file and return the elapsed time in ms.
+qint64 TimeInflate( QFile* file, kuint options, int blocksNb )
+{
+    KoreSerializer serializer( options );
+
+    file->seek( 0 );
+
+    QElapsedTimer timer;
+    timer.start();
+
+    Block* inflatedBlock = K_NULL;
+    int err = serializer.inflate( file, & inflatedBlock, K_NULL );
+
+    const qint64 elapsed = timer.elapsed();
+
+    EXPECT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( K_NULL != inflatedBlock );
+    if( K_NULL != inflatedBlock )
+    {
+        EXPECT_TRUE( inflatedBlock->to< Library >()->totalSize() ==
+                     blocksNb + ( blocksNb + 999 ) / 1000 );
+    }
+
+    delete inflatedBlock;
+
+    return elapsed;
+}
+
+void BenchmarkInflate( int blocksNb )
+{
+    QTemporaryFile file;
+    ASSERT_TRUE( file.open() );
+
+    // Serialize and get rid of the source tree right away
+    MyLibrary* tree = CreateTree( blocksNb );
+    KoreSerializer serializer;
+    int err = serializer.deflate( & file, tree, K_NULL );
+    delete tree;
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    const qint64 streamTime = TimeInflate( & file, 0, blocksNb );
+    const qint64 mappedTime =
+            TimeInflate( & file, KoreSerializer::MemoryMapped, blocksNb );
+
+    qDebug( "Inflate %d blocks (%lld bytes): stream %lld ms, "
+            "memory mapped %lld ms",
+            blocksNb, file.size(), streamTime, mappedTime );
+}
+
+// Inflate then delete the tree, with or without an arena.
+void TimeLoadUnload( QFile* file,
+                     kuint options,
+                     qint64* loadTime,
+                     qint64* unloadTime,
+                     BlockArena** arena )
+{
+    KoreSerializer serializer( options );
+    *arena = K_NULL;
+
+    file->seek( 0 );
+
+    QElapsedTimer timer;
+    timer.start();
+
+    Block* inflatedBlock = K_NULL;
+    int err = serializer.inflate( file, & inflatedBlock, K_NULL );
+    *loadTime = timer.elapsed();
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    *arena = BlockArena::Of( inflatedBlock );
+    if( K_NULL != *arena )
+    {
+        qDebug( "Arena: %d slabs, %llu bytes used out of %llu",
+                ( *arena )->slabsCount(),
+                static_cast< quint64 >( ( *arena )->usedBytes() ),
+                static_cast< quint64 >( ( *arena )->reservedBytes() ) );
+    }
+
+    timer.restart();
+    delete inflatedBlock;
+    *unloadTime = timer.elapsed();
+}
+
+void BenchmarkArena( int blocksNb )
+{
+    QTemporaryFile file;
+    ASSERT_TRUE( file.open() );
+
+    MyLibrary* tree = CreateTree( blocksNb );
+    KoreSerializer serializer;
+    int err = serializer.deflate( & file, tree, K_NULL );
+    delete tree;
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    qint64 heapLoad, heapUnload, arenaLoad, arenaUnload;
+    BlockArena* arena;
+    TimeLoadUnload( & file, KoreSerializer::MemoryMapped,
+                    & heapLoad, & heapUnload, & arena );
+    EXPECT_TRUE( K_NULL == arena );
+    TimeLoadUnload( & file,
+                    KoreSerializer::MemoryMapped | KoreSerializer::Arena,
+                    & arenaLoad, & arenaUnload, & arena );
+    EXPECT_TRUE( K_NULL != arena );
+
+    qDebug( "Load / unload %d blocks: heap %lld / %lld ms, "
+            "arena %lld / %lld ms",
+            blocksNb, heapLoad, heapUnload, arenaLoad, arenaUnload );
+}
+
+// Deflate the tree to a new file and return the elapsed time in ms.
+qint64 TimeDeflate( const Block* tree, kuint options )
+{
+    QTemporaryFile file;
+    EXPECT_TRUE( file.open() );
+
+    QElapsedTimer timer;
+    timer.start();
+
+    KoreSerializer serializer( options );
+    int err = serializer.deflate( & file, tree, K_NULL );
+    file.flush();
+
+    const qint64 elapsed = timer.elapsed();
+    EXPECT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    return elapsed;
+}
+
+void BenchmarkWriteBehind( int blocksNb )
+{
+    MyLibrary* tree = CreateTree( blocksNb );
+
+    const qint64 directTime = TimeDeflate( tree, 0 );
+    const qint64 writeBehindTime = TimeDeflate( tree,
+                                                KoreSerializer::WriteBehind );
+    const qint64 compressedTime = TimeDeflate( tree,
+                                               KoreSerializer::Compressed );
+    const qint64 compressedWriteBehindTime = TimeDeflate(
+                tree,
+                KoreSerializer::Compressed | KoreSerializer::WriteBehind );
+
+    delete tree;
+
+    qDebug( "Deflate %d blocks: direct %lld ms, write behind %lld ms, "
+            "compressed %lld ms, compressed write behind %lld ms",
+            blocksNb, directTime, writeBehindTime, compressedTime,
+            compressedWriteBehindTime );
+}
+
+// Resolve the stored properties of each block the way the serializer used to,
+// through the MetaBlock for each property, and return the elapsed time in ms.
+qint64 TimeUncachedProperties( const QList< Block* >& blocks, int* count )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    for( int b = 0; b < blocks.size(); ++b )
+    {
+        const Block* block = blocks.at( b );
+        const QMetaObject* mo = block->metaObject();
+        for( int i = 1; i < mo->propertyCount(); ++i )
+        {
+            QMetaProperty prop = block->metaBlock()->blockMetaProperty( i );
+            if( ( ! prop.isValid() ) || ( ! prop.isStored( block ) ) )
+            {
+                continue;
+            }
+
+            const int propType =
+                ( static_cast< int >( prop.type() ) < QMetaType::User )
+                    ? prop.type()
+                    : prop.userType();
+            if( QMetaType::UnknownType != propType )
+            {
+                ++( *count );
+            }
+        }
+    }
+
+    return timer.elapsed();
+}
+
+// Same thing through the properties cache of the MetaBlock.
+qint64 TimeCachedProperties( const QList< Block* >& blocks, int* count )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    for( int b = 0; b < blocks.size(); ++b )
+    {
+        const Block* block = blocks.at( b );
+        const QVector< MetaBlock::StoredProperty >& properties =
+                block->metaBlock()->storedProperties();
+        for( int i = 0; i < properties.size(); ++i )
+        {
+            const MetaBlock::StoredProperty& stored = properties.at( i );
+            if( stored.property.isStored( block ) &&
+                ( QMetaType::UnknownType != stored.type ) )
+            {
+                ++( *count );
+            }
+        }
+    }
+
+    return timer.elapsed();
+}
+
+void BenchmarkProperties( int blocksNb )
+{
+    MyLibrary* tree = CreateTree( blocksNb );
+
+    QList< Block* > blocks;
+    blocks.reserve( blocksNb );
+    for( int i = 0; i < tree->size(); ++i )
+    {
+        Library* lib = tree->at< Library >( i );
+        for( int j = 0; j < lib->size(); ++j )
+        {
+            blocks.append( lib->at( j ) );
+        }
+    }
+
+    int uncachedCount = 0;
+    int cachedCount = 0;
+    const qint64 uncachedTime = TimeUncachedProperties( blocks,
+                                                        & uncachedCount );
+    const qint64 cachedTime = TimeCachedProperties( blocks, & cachedCount );
+    EXPECT_TRUE( uncachedCount == cachedCount );
+
+    // Whole deflate, now using the cache
+    QBuffer device;
+    device.open( QIODevice::ReadWrite );
+
+    QElapsedTimer timer;
+    timer.start();
+    KoreSerializer serializer;
+    int err = serializer.deflate( & device, tree, K_NULL );
+    const qint64 deflateTime = timer.elapsed();
+    EXPECT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    delete tree;
+
+    qDebug( "Properties of %d blocks: uncached %lld ms, cached %lld ms "
+            "(deflate %lld ms)",
+            blocksNb, uncachedTime, cachedTime, deflateTime );
+}
+
+// Deletion is recursive, the deep trees stop there
+const int MaxDepth = 1000;
+
+enum TreeShape
+{
+    Wide,       //!< Leaves of the root
+    Deep,       //!< Nested libraries, each with a share of the leaves
+    Balanced,   //!< Complete tree of fanout 16
+    Mixed       //!< Complete tree of fanout 64, MyBlock1, MyBlock2 and
+                //!< empty MyLibrary leaves
+};
+
+const char* ShapeName( TreeShape shape )
+{
+    switch( shape )
+    {
+    case Wide:
+        return "wide";
+    case Deep:
+        return "deep";
+    case Balanced:
+        return "balanced";
+    default:
+        return "mixed";
+    }
+}
+
+Block* CreateLeaf( TreeShape shape, int i )
+{
+    if( ( Mixed == shape ) && ( 1 == ( i % 3 ) ) )
+    {
+        return K_BLOCK_CREATE_INSTANCE( MyBlock2 );
+    }
+    if( ( Mixed == shape ) && ( 2 == ( i % 3 ) ) )
+    {
+        return K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    }
+
+    MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block->setLeInt( i + 1 );
+    block->setLaString( QString( "Block %1" ).arg( i ) );
+    if( Mixed == shape )
+    {
+        MyCustomType custom;
+        custom.laString = QString( "Custom %1" ).arg( i );
+        custom.leInt32 = i;
+        block->setLeCustomType( custom );
+    }
+    return block;
+}
+
+// Build a tree of blocksNb blocks in total, the root included.
+MyLibrary* CreateShapedTree( TreeShape shape, int blocksNb )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+
+    if( Deep == shape )
+    {
+        const int leavesPerLevel = qMax( 10, blocksNb / MaxDepth );
+        MyLibrary* lib = root;
+        int depth = 1;
+        for( int i = 1; i < blocksNb; ++i )
+        {
+            if( ( 0 == ( i % ( leavesPerLevel + 1 ) ) ) &&
+                ( depth < MaxDepth ) )
+            {
+                MyLibrary* child = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+                lib->addBlock( child );
+                lib = child;
+                ++depth;
+            }
+            else
+            {
+                lib->addBlock( CreateLeaf( shape, i ) );
+            }
+        }
+        return root;
+    }
+
+    // Complete tree, in breadth first order: the parent of the block i is
+    // the block ( i - 1 ) / fanout
+    const int fanout = ( Wide == shape )
+            ? qMax( 1, blocksNb - 1 )
+            : ( ( Balanced == shape ) ? 16 : 64 );
+
+    QVector< Library* > libraries;
+    libraries.append( root );
+    for( int i = 1; i < blocksNb; ++i )
+    {
+        const kbool hasChildren = ( qint64( fanout ) * i + 1 < blocksNb );
+        Block* block = hasChildren
+                ? K_BLOCK_CREATE_INSTANCE( MyLibrary )
+                : CreateLeaf( shape, i );
+        libraries.at( ( i - 1 ) / fanout )->addBlock( block );
+        if( hasChildren )
+        {
+            libraries.append( block->to< Library >() );
+        }
+    }
+
+    return root;
+}
+
+// A pipe like device: it can not seek, data is read in the order it was
+// written.
+class SequentialDevice : public QIODevice
+{
+public:
+    SequentialDevice() : _readPos( 0 ) {}
+
+    virtual bool isSequential() const
+    {
+        return true;
+    }
+
+    virtual qint64 bytesAvailable() const
+    {
+        return ( _data.size() - _readPos ) + QIODevice::bytesAvailable();
+    }
+
+    virtual qint64 size() const
+    {
+        return _data.size();
+    }
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize )
+    {
+        const qint64 size = qMin( maxSize, qint64( _data.size() - _readPos ) );
+        memcpy( data, _data.constData() + _readPos, size );
+        _readPos += size;
+        return size;
+    }
+
+    virtual qint64 writeData( const char* data, qint64 size )
+    {
+        _data.append( data, size );
+        return size;
+    }
+
+private:
+    QByteArray  _data;
+    qint64      _readPos;
+};
+
+// Restart the measure of the peak resident memory, if the system allows it.
+void ResetPeakMemory()
+{
+#if defined( Q_OS_LINUX )
+    QFile clearRefs( "/proc/self/clear_refs" );
+    if( clearRefs.open( QIODevice::WriteOnly ) )
+    {
+        clearRefs.write( "5" );
+    }
+#endif
+}
+
+// Peak resident memory of the process in bytes, -1 if unknown.
+qint64 PeakMemory()
+{
+#if defined( Q_OS_LINUX )
+    QFile status( "/proc/self/status" );
+    if( ! status.open( QIODevice::ReadOnly ) )
+    {
+        return -1;
+    }
+
+    for( QByteArray line = status.readLine(); ! line.isEmpty();
+         line = status.readLine() )
+    {
+        if( line.startsWith( "VmHWM:" ) )
+        {
+            // In kB
+            return line.mid( 6 ).trimmed().split( ' ' ).first().toLongLong()
+                    * 1024;
+        }
+    }
+#endif
+    return -1;
+}
+
+// Read and write system calls made by the process so far, -1 if unknown. The
+// measure reads these from a file too, it adds a couple of reads.
+void SystemCalls( qint64* reads, qint64* writes )
+{
+    *reads = -1;
+    *writes = -1;
+
+#if defined( Q_OS_LINUX )
+    QFile io( "/proc/self/io" );
+    if( ! io.open( QIODevice::ReadOnly ) )
+    {
+        return;
+    }
+
+    for( QByteArray line = io.readLine(); ! line.isEmpty();
+         line = io.readLine() )
+    {
+        if( line.startsWith( "syscr:" ) )
+        {
+            *reads = line.mid( 6 ).trimmed().toLongLong();
+        }
+        else if( line.startsWith( "syscw:" ) )
+        {
+            *writes = line.mid( 6 ).trimmed().toLongLong();
+        }
+    }
+#endif
+}
+
+// Difference of two counters, null when unknown
+QJsonValue CountValue( qint64 start, qint64 end )
+{
+    if( ( start < 0 ) || ( end < 0 ) )
+    {
+        return QJsonValue();
+    }
+    return QJsonValue( double( end - start ) );
+}
+
+// Start of the measure of a deflate or an inflate
+struct Measure
+{
+    Measure()
+    {
+        ResetPeakMemory();
+        _allocations = allocationsCount.load();
+        _seeks = seeksCount.load();
+        SystemCalls( & _reads, & _writes );
+        _timer.start();
+    }
+
+    QJsonObject result( int blocksNb, qint64 bytes ) const
+    {
+        const qint64 ns = qMax( Q_INT64_C( 1 ), _timer.nsecsElapsed() );
+        const double seconds = ns / 1e9;
+
+        qint64 reads;
+        qint64 writes;
+        SystemCalls( & reads, & writes );
+
+        QJsonObject object;
+        object.insert( "ms", ns / 1e6 );
+        object.insert( "blocksPerSecond", blocksNb / seconds );
+        object.insert( "megabytesPerSecond", bytes / seconds / _K_1MB );
+#if defined( __GLIBC__ )
+        object.insert( "allocations",
+                       double( allocationsCount.load() - _allocations ) );
+#else
+        object.insert( "newCalls",
+                       double( allocationsCount.load() - _allocations ) );
+#endif
+
+        // System calls, null when unknown
+        object.insert( "reads", CountValue( _reads, reads ) );
+        object.insert( "writes", CountValue( _writes, writes ) );
+#if defined( KORE_BENCHMARK_SEEKS )
+        object.insert( "seeks", double( seeksCount.load() - _seeks ) );
+#else
+        object.insert( "seeks", QJsonValue() );
+#endif
+
+        const qint64 peak = PeakMemory();
+        object.insert( "peakMemory", ( peak < 0 )
+                                         ? QJsonValue()
+                                         : QJsonValue( double( peak ) ) );
+        return object;
+    }
+
+private:
+    qint64 _allocations;
+    qint64 _seeks;
+    qint64 _reads;
+    qint64 _writes;
+    QElapsedTimer _timer;
+};
+
+// Deflate then inflate the tree through the device, and return the measures.
+QJsonObject MeasureThroughput( Block* tree,
+                               int blocksNb,
+                               QIODevice* device,
+                               kuint options )
+{
+    KoreSerializer serializer( options );
+    QJsonObject result;
+
+    int err;
+    {
+        const Measure measure;
+        err = serializer.deflate( device, tree, K_NULL );
+
+        // Count the last writes too, held by the buffer of a file
+        QFileDevice* file = qobject_cast< QFileDevice* >( device );
+        if( K_NULL != file )
+        {
+            file->flush();
+        }
+        result.insert( "deflate", measure.result( blocksNb, device->size() ) );
+    }
+    EXPECT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    result.insert( "bytes", double( device->size() ) );
+
+    if( ! device->isSequential() )
+    {
+        device->seek( 0 );
+    }
+
+    Block* inflatedBlock = K_NULL;
+    {
+        const Measure measure;
+        err = serializer.inflate( device, & inflatedBlock, K_NULL );
+        result.insert( "inflate", measure.result( blocksNb, device->size() ) );
+    }
+    EXPECT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    if( K_NULL != inflatedBlock )
+    {
+        EXPECT_TRUE( inflatedBlock->to< Library >()->totalSize() + 1 ==
+                     blocksNb );
+    }
+    delete inflatedBlock;
+
+    return result;
+}
+
+// Append the results of a run to the JSON file.
+void WriteResults( const QJsonArray& results )
+{
+    const QByteArray path = qgetenv( "KORE_BENCHMARK_JSON" );
+    QFile file( path.isEmpty() ? QString( "serialization_benchmarks.json" )
+                               : QString::fromLocal8Bit( path ) );
+
+    // Runs of the same process are gathered in one document
+    static QJsonObject document;
+    if( document.isEmpty() )
+    {
+        document.insert( "label", QString::fromLocal8Bit(
+                                      qgetenv( "KORE_BENCHMARK_LABEL" ) ) );
+        document.insert( "date", QDateTime::currentDateTimeUtc()
+                                     .toString( Qt::ISODate ) );
+        document.insert( "qt", QString( qVersion() ) );
+    }
+
+    QJsonArray all = document.value( "results" ).toArray();
+    for( int i = 0; i < results.size(); ++i )
+    {
+        all.append( results.at( i ) );
+    }
+    document.insert( "results", all );
+
+    ASSERT_TRUE( file.open( QIODevice::WriteOnly | QIODevice::Truncate ) );
+    file.write( QJsonDocument( document ).toJson() );
+    qDebug( "Results written to %s", qPrintable( file.fileName() ) );
+}
+
+void BenchmarkThroughput( int blocksNb )
+{
+    const TreeShape shapes[] = { Wide, Deep, Balanced, Mixed };
+    QJsonArray results;
+
+    for( int s = 0; s < 4; ++s )
+    {
+        MyLibrary* tree = CreateShapedTree( shapes[ s ], blocksNb );
+
+        for( int d = 0; d < 4; ++d )
+        {
+            QBuffer buffer;
+            QTemporaryFile file;
+            SequentialDevice sequential;
+
+            QIODevice* device;
+            kuint options = 0;
+            const char* deviceName;
+            if( 0 == d )
+            {
+                device = & buffer;
+                deviceName = "buffer";
+            }
+            else if( 1 == d )
+            {
+                device = & file;
+                deviceName = "file";
+            }
+            else if( 2 == d )
+            {
+                device = & file;
+                deviceName = "mapped";
+                options = KoreSerializer::MemoryMapped;
+            }
+            else
+            {
+                // Only the streaming layout can be read back from a pipe
+                device = & sequential;
+                deviceName = "sequential";
+                options = KoreSerializer::Streamable;
+            }
+            ASSERT_TRUE( ( & file == device )
+                             ? file.open()
+                             : device->open( QIODevice::ReadWrite ) );
+
+            QJsonObject result = MeasureThroughput( tree, blocksNb, device,
+                                                    options );
+            result.insert( "shape", QString( ShapeName( shapes[ s ] ) ) );
+            result.insert( "blocks", blocksNb );
+            result.insert( "device", QString( deviceName ) );
+            results.append( result );
+
+            qDebug( "%s tree of %d blocks on %s: deflate %.0f blocks/s, "
+                    "inflate %.0f blocks/s",
+                    ShapeName( shapes[ s ] ), blocksNb, deviceName,
+                    result.value( "deflate" ).toObject()
+                        .value( "blocksPerSecond" ).toDouble(),
+                    result.value( "inflate" ).toObject()
+                        .value( "blocksPerSecond" ).toDouble() );
+        }
+
+        delete tree;
+    }
+
+    WriteResults( results );
+}
+
+}
+
+TEST( SerializationBenchmark, DISABLED_Properties1000000 )
+{
+    BenchmarkProperties( 1000000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_WriteBehind1000000 )
+{
+    BenchmarkWriteBehind( 1000000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_Arena1000000 )
+{
+    BenchmarkArena( 1000000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_Throughput1000 )
+{
+    BenchmarkThroughput( 1000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_Throughput100000 )
+{
+    BenchmarkThroughput( 100000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_Throughput1000000 )
+{
+    BenchmarkThroughput( 1000000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_Throughput10000000 )
+{
+    BenchmarkThroughput( 10000000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_InflateMapped100000 )
+{
+    BenchmarkInflate( 100000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_InflateMapped1000000 )
+{
+    BenchmarkInflate( 1000000 );
+}
+
+TEST( SerializationBenchmark, DISABLED_InflateMapped10000000 )
+{
+    BenchmarkInflate( 10000000 );
+}
@@ -27,12 +27,31 @@
 
 #include <QtCore/QBuffer>
 #include <QtCore/QByteArray>
+#include <QtCore/QDirIterator>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QThread>
+#include <QtCore/QtEndian>
+
+#include <cstring>
 
 #include <gtest/gtest.h>
 
 #include <data/MetaBlock.hpp>
 
+#include <memory/BlockArena.hpp>
+
+#include <serialization/ByteReader.hpp>
+#include <serialization/Crc32c.hpp>
+#include <serialization/DeflateTasklet.hpp>
+#include <serialization/InflateTasklet.hpp>
+#include <serialization/Journal.hpp>
 #include <serialization/KoreSerializer.hpp>
+#include <serialization/PropertyCodecs.hpp>
+#include <serialization/SnapshotStore.hpp>
+#include <serialization/WriteBehind.hpp>
+
+#include <KoreEngine.hpp>
 
 #include "../data/MyBlock.hpp"
 #include "../data/MyBlock1.hpp"
@@ -41,8 +60,182 @@
 
 using namespace DataTestModule;
 using namespace Kore::data;
+using namespace Kore::memory;
+using namespace Kore::parallel;
 using namespace Kore::serialization;
 
+namespace {
+
+// A pipe like device: it can not seek, data is read in the order it was
+// written.
+class SequentialDevice : public QIODevice
+{
+public:
+    SequentialDevice() : _readPos( 0 ) {}
+
+    virtual bool isSequential() const
+    {
+        return true;
+    }
+
+    virtual qint64 bytesAvailable() const
+    {
+        return ( _data.size() - _readPos ) + QIODevice::bytesAvailable();
+    }
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize )
+    {
+        const qint64 size = qMin( maxSize, qint64( _data.size() - _readPos ) );
+        memcpy( data, _data.constData() + _readPos, size );
+        _readPos += size;
+        return size;
+    }
+
+    virtual qint64 writeData( const char* data, qint64 size )
+    {
+        _data.append( data, size );
+        return size;
+    }
+
+private:
+    QByteArray  _data;
+    qint64      _readPos;
+};
+
+// A buffer counting the seeks, reads and writes made by the serializer
+class CountingBuffer : public QBuffer
+{
+public:
+    CountingBuffer( QByteArray* buffer )
+        : QBuffer( buffer )
+        , seeks( 0 )
+        , reads( 0 )
+        , writes( 0 )
+    {}
+
+    virtual bool seek( qint64 pos )
+    {
+        ++seeks;
+        return QBuffer::seek( pos );
+    }
+
+    int seeks;
+    int reads;
+    int writes;
+
+protected:
+    virtual qint64 readData( char* data, qint64 maxSize )
+    {
+        ++reads;
+        return QBuffer::readData( data, maxSize );
+    }
+
+    virtual qint64 writeData( const char* data, qint64 size )
+    {
+        ++writes;
+        return QBuffer::writeData( data, size );
+    }
+};
+
+// A monitor keeping the last blocks progress reported
+class ProgressMonitor : public TreeSerializerMonitor
+{
+public:
+    ProgressMonitor() : blocks( -1 ), blocksTotal( -1 ) {}
+
+    virtual bool shouldStopProcess()
+    {
+        return false;
+    }
+
+    virtual bool event( int errorCode, const QString& message )
+    {
+        Q_UNUSED( errorCode );
+        Q_UNUSED( message );
+        return true;
+    }
+
+    virtual void progress( qint64 min, qint64 progress, qint64 max )
+    {
+        Q_UNUSED( min );
+        blocks = progress;
+        blocksTotal = max;
+    }
+
+    qint64 blocks;
+    qint64 blocksTotal;
+};
+
+// A codec for MyCustomType, counting its calls
+int CustomTypeEncodes = 0;
+int CustomTypeDecodes = 0;
+
+kbool EncodeCustomType( QDataStream& stream,
+                        const QObject* object,
+                        int propertyIdx )
+{
+    MyCustomType value;
+    PropertyCodecs::ReadProperty( object, propertyIdx, & value );
+    stream << value.leInt32 << value.laString.toUtf8();
+    ++CustomTypeEncodes;
+    return QDataStream::Ok == stream.status();
+}
+
+kbool DecodeCustomType( ByteReader& reader, QObject* object, int propertyIdx )
+{
+    MyCustomType value;
+    value.leInt32 = static_cast< qint32 >( reader.readUInt32() );
+
+    const char* utf8;
+    quint32 size;
+    if( ! reader.readByteArray( & utf8, & size ) )
+    {
+        return false;
+    }
+    value.laString = QString::fromUtf8( utf8, size );
+
+    PropertyCodecs::WriteProperty( object, propertyIdx, & value );
+    ++CustomTypeDecodes;
+    return true;
+}
+
+// Rejects the subtree at the given path, and the blocks at odd indices
+class PathFilter : public InflateFilter
+{
+public:
+    PathFilter( const QList< kint >& path ) : rejectedPath( path ) {}
+
+    virtual Decision accept( const MetaBlock* mb,
+                             const QList< kint >& path ) const
+    {
+        Q_UNUSED( mb );
+        if( path == rejectedPath )
+        {
+            return RejectSubtree;
+        }
+        return ( ! path.isEmpty() && ( 1 == path.last() % 2 ) )
+                ? Reject
+                : Accept;
+    }
+
+    QList< kint > rejectedPath;
+};
+
+qint64 DirectorySize( const QString& path )
+{
+    qint64 size = 0;
+    QDirIterator it( path, QDir::Files, QDirIterator::Subdirectories );
+    while( it.hasNext() )
+    {
+        it.next();
+        size += it.fileInfo().size();
+    }
+    return size;
+}
+
+}
+
 TEST( SerializationTest, SerializeBlock )
 {
     MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
@@ -79,6 +272,58 @@ TEST( SerializationTest, SerializeBlock )
     delete inflatedBlock;
 }
 
+TEST( SerializationTest, SerializeBlockCustomCodec )
+{
+    const int customType = qMetaTypeId< MyCustomType >();
+
+    // Built-in codecs, QMetaType for the custom type
+    EXPECT_TRUE( K_NULL != PropertyCodecs::Find( QMetaType::Int ) );
+    EXPECT_TRUE( K_NULL != PropertyCodecs::Find( QMetaType::QString ) );
+    EXPECT_TRUE( K_NULL == PropertyCodecs::Find( customType ) );
+
+    PropertyCodecs::Register( customType,
+                              & EncodeCustomType,
+                              & DecodeCustomType );
+    ASSERT_TRUE( K_NULL != PropertyCodecs::Find( customType ) );
+
+    MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block->setLeInt( -42 );
+    block->setLaString( QString::fromUtf8( "\xc3\xa9t\xc3\xa9" ) );
+    block->leCustomType().laString = "Custom";
+    block->leCustomType().leInt32 = 77;
+
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & device, block, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( 1 == CustomTypeEncodes );
+
+    device.seek( 0 );
+
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( 1 == CustomTypeDecodes );
+
+    ASSERT_TRUE( inflatedBlock->fastInherits< MyBlock1 >() );
+    MyBlock1* iBlock = inflatedBlock->to< MyBlock1 >();
+    EXPECT_TRUE( iBlock->leInt() == -42 );
+    EXPECT_TRUE( iBlock->laString() == block->laString() );
+    EXPECT_TRUE( iBlock->leCustomType().laString == "Custom" );
+    EXPECT_TRUE( iBlock->leCustomType().leInt32 == 77 );
+
+    PropertyCodecs::Unregister( customType );
+    EXPECT_TRUE( K_NULL == PropertyCodecs::Find( customType ) );
+
+    delete block;
+    delete inflatedBlock;
+}
+
 TEST( SerializationTest, SerializeTree )
 {
     MyLibrary* lib1 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
@@ -165,132 +410,2419 @@ TEST( SerializationTest, SerializeTree )
     delete iLib1;
 }
 
-TEST( SerializationTest, SerializeBigTree128 )
+TEST( SerializationTest, SerializeTreeSinglePass )
 {
-    const int childrenNb = 128;
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 10; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( i * 10 + j );
+            // Big enough to grow the scratch buffer
+            block->setLaString( QString( 100 * j, QChar( 'a' + i ) ) );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
 
-    MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    QByteArray buffer;
+    CountingBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
 
-    for( int i = 0; i < childrenNb; ++i )
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // No seek, a single write per block, plus the footer
+    EXPECT_TRUE( 0 == device.seeks );
+    EXPECT_TRUE( 111 + 3 == device.writes ) << device.writes;
+
+    device.seek( 0 );
+
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+    ASSERT_TRUE( iRoot->totalSize() == 110 );
+    for( int i = 0; i < 10; ++i )
     {
-        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
-        lib->addBlock( block );
+        MyLibrary* lib = iRoot->at< MyLibrary >( i );
+        for( int j = 0; j < 10; ++j )
+        {
+            MyBlock1* block = lib->at< MyBlock1 >( j );
+            EXPECT_TRUE( block->leInt() == i * 10 + j );
+            EXPECT_TRUE( block->laString() ==
+                         QString( 100 * j, QChar( 'a' + i ) ) );
+        }
     }
 
-    ASSERT_TRUE( lib->size() == childrenNb );
+    delete root;
+    delete inflatedBlock;
+}
+
+TEST( SerializationTest, SerializeTreeIndexed )
+{
+    // Ordinals: root 0, libraries 1, 6 and 11, blocks in between
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 3; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 4; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 10 * i + j );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
 
-    // Now serialize
     QByteArray buffer;
     QBuffer device( & buffer );
     device.open( QIODevice::ReadWrite );
 
+    // The tree does not start at the beginning of the device
+    device.write( "Some header" );
+
     int err;
 
-    KoreSerializer serializer;
-    err = serializer.deflate( & device, lib, K_NULL );
+    KoreSerializer serializer( KoreSerializer::Indexed );
+    err = serializer.deflate( & device, root, K_NULL );
     ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
 
-    // Reset...
-    device.seek( 0 );
+    // Same table with a parallel deflate
+    {
+        QByteArray parallelBuffer;
+        QBuffer parallelDevice( & parallelBuffer );
+        parallelDevice.open( QIODevice::ReadWrite );
+        parallelDevice.write( "Some header" );
+
+        KoreSerializer parallelSerializer( KoreSerializer::Indexed |
+                                           KoreSerializer::Parallel );
+        err = parallelSerializer.deflate( & parallelDevice, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        EXPECT_TRUE( parallelBuffer == buffer );
+    }
 
+    // A regular inflate ignores the table
+    device.seek( 11 );
     Block* inflatedBlock;
     err = serializer.inflate( & device, & inflatedBlock, K_NULL );
     ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( inflatedBlock->to< MyLibrary >()->totalSize() == 15 );
+    delete inflatedBlock;
 
-    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+    for( int mapped = 0; mapped < 2; ++mapped )
+    {
+        KoreSerializer reader( mapped ? KoreSerializer::MemoryMapped : 0 );
+
+        // A single block, by ordinal and by path
+        err = reader.inflateAt( & device, 9, false, & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        ASSERT_TRUE( inflatedBlock->fastInherits< MyBlock1 >() );
+        EXPECT_TRUE( inflatedBlock->to< MyBlock1 >()->leInt() == 12 );
+        delete inflatedBlock;
+
+        err = reader.inflateAt( & device, QList< kint >() << 1 << 2, false,
+                                & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        ASSERT_TRUE( inflatedBlock->fastInherits< MyBlock1 >() );
+        EXPECT_TRUE( inflatedBlock->to< MyBlock1 >()->leInt() == 12 );
+        delete inflatedBlock;
+
+        // A library, with or without its children
+        err = reader.inflateAt( & device, QList< kint >() << 2, false,
+                                & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+        EXPECT_TRUE( inflatedBlock->to< MyLibrary >()->size() == 0 );
+        delete inflatedBlock;
+
+        err = reader.inflateAt( & device, 11, true, & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+        MyLibrary* lib = inflatedBlock->to< MyLibrary >();
+        ASSERT_TRUE( lib->size() == 4 );
+        EXPECT_TRUE( lib->at< MyBlock1 >( 3 )->leInt() == 23 );
+        delete inflatedBlock;
+
+        // The whole tree
+        err = reader.inflateAt( & device, QList< kint >(), true,
+                                & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        EXPECT_TRUE( inflatedBlock->to< MyLibrary >()->totalSize() == 15 );
+        delete inflatedBlock;
+
+        // Out of the tree
+        err = reader.inflateAt( & device, QList< kint >() << 3, true,
+                                & inflatedBlock, K_NULL );
+        EXPECT_TRUE( KoreSerializer::BlockNotFound == err )
+                << "Error code: " << err;
+        err = reader.inflateAt( & device, QList< kint >() << 0 << 1 << 0,
+                                true, & inflatedBlock, K_NULL );
+        EXPECT_TRUE( KoreSerializer::BlockNotFound == err )
+                << "Error code: " << err;
+        err = reader.inflateAt( & device, 16, true, & inflatedBlock, K_NULL );
+        EXPECT_TRUE( KoreSerializer::BlockNotFound == err )
+                << "Error code: " << err;
+    }
 
-    MyLibrary* iLib = inflatedBlock->to< MyLibrary >();
+    // No table of contents
+    {
+        QByteArray plainBuffer;
+        QBuffer plainDevice( & plainBuffer );
+        plainDevice.open( QIODevice::ReadWrite );
+
+        KoreSerializer plainSerializer;
+        err = plainSerializer.deflate( & plainDevice, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        err = plainSerializer.inflateAt( & plainDevice, 1, true,
+                                         & inflatedBlock, K_NULL );
+        EXPECT_TRUE( KoreSerializer::NotIndexed == err )
+                << "Error code: " << err;
+    }
 
-    ASSERT_TRUE( iLib->size() == childrenNb ) << iLib->size()
-                                              << " child block(s)";
+    // Nor in the streaming layout
+    {
+        QByteArray streamedBuffer;
+        QBuffer streamedDevice( & streamedBuffer );
+        streamedDevice.open( QIODevice::ReadWrite );
+
+        KoreSerializer streamedSerializer( KoreSerializer::Streamable );
+        err = streamedSerializer.deflate( & streamedDevice, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        streamedDevice.seek( 0 );
+        err = streamedSerializer.inflateAt( & streamedDevice, 1, true,
+                                            & inflatedBlock, K_NULL );
+        EXPECT_TRUE( KoreSerializer::NotIndexed == err )
+                << "Error code: " << err;
+    }
 
-    delete lib;
-    delete iLib;
+    delete root;
 }
 
-TEST( SerializationTest, SerializeBigTree512 )
+TEST( SerializationTest, SerializeTreeCompressed )
 {
-    const int childrenNb = 512;
+    // Repetitive data, compressing well
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 20; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 100; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 100 * i + j + 1 );
+            block->setLaString( QString( "Block number %1" ).arg( j ) );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
 
-    MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    QByteArray plainBuffer;
+    QBuffer plainDevice( & plainBuffer );
+    plainDevice.open( QIODevice::ReadWrite );
 
-    for( int i = 0; i < childrenNb; ++i )
+    int err;
+
+    KoreSerializer plainSerializer( KoreSerializer::Indexed );
+    err = plainSerializer.deflate( & plainDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    for( int options = 0; options < 3; ++options )
     {
-        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
-        lib->addBlock( block );
+        const kuint layout = ( 0 == options )
+                                ? KoreSerializer::Indexed
+                                : ( 1 == options )
+                                    ? KoreSerializer::Streamable
+                                    : KoreSerializer::Parallel |
+                                      KoreSerializer::Indexed;
+
+        QByteArray buffer;
+        QBuffer device( & buffer );
+        device.open( QIODevice::ReadWrite );
+
+        // Small chunks, for many of them
+        KoreSerializer serializer( layout | KoreSerializer::Compressed );
+        serializer.setCompressionChunkSize( 4 * 1024 );
+        err = serializer.deflate( & device, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        EXPECT_TRUE( buffer.size() * 2 < plainBuffer.size() )
+                << buffer.size() << " vs " << plainBuffer.size();
+
+        // Inflate recognizes the compressed data
+        device.seek( 0 );
+        KoreSerializer reader;
+        Block* inflatedBlock;
+        err = reader.inflate( & device, & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        EXPECT_TRUE( device.atEnd() );
+
+        MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+        ASSERT_TRUE( iRoot->totalSize() == 20 + 20 * 100 );
+        MyBlock1* block = iRoot->at< MyLibrary >( 19 )->at< MyBlock1 >( 99 );
+        EXPECT_TRUE( block->leInt() == 2000 );
+        EXPECT_TRUE( block->laString() == "Block number 99" );
+        delete inflatedBlock;
+
+        if( 1 != options )
+        {
+            // Random access still works
+            device.seek( 0 );
+            err = reader.inflateAt( & device, QList< kint >() << 13 << 42,
+                                    false, & inflatedBlock, K_NULL );
+            ASSERT_TRUE( KoreSerializer::NoError == err )
+                    << "Error code: " << err;
+            ASSERT_TRUE( inflatedBlock->fastInherits< MyBlock1 >() );
+            EXPECT_TRUE( inflatedBlock->to< MyBlock1 >()->leInt() == 1343 );
+            delete inflatedBlock;
+        }
     }
 
-    ASSERT_TRUE( lib->size() == childrenNb );
+    // The container can not be read from a sequential device
+    {
+        SequentialDevice device;
+        device.open( QIODevice::ReadWrite );
+
+        KoreSerializer serializer( KoreSerializer::Streamable |
+                                   KoreSerializer::Compressed );
+        err = serializer.deflate( & device, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        Block* inflatedBlock;
+        err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+        EXPECT_TRUE( KoreSerializer::RequiresRandomAccess == err )
+                << "Error code: " << err;
+    }
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeSharedStrings )
+{
+    // Few distinct strings, repeated many times
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 200; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 200 * i + j + 1 );
+            block->setLaString( QString( "/a/rather/long/path/to/file/%1" )
+                                    .arg( j % 8 ) );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray plainBuffer;
+    QBuffer plainDevice( & plainBuffer );
+    plainDevice.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer plainSerializer;
+    err = plainSerializer.deflate( & plainDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    for( int parallel = 0; parallel < 2; ++parallel )
+    {
+        QByteArray buffer;
+        QBuffer device( & buffer );
+        device.open( QIODevice::ReadWrite );
+
+        KoreSerializer serializer( KoreSerializer::SharedStrings |
+                                   ( parallel ? KoreSerializer::Parallel
+                                              : 0 ) );
+        err = serializer.deflate( & device, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        EXPECT_TRUE( buffer.size() * 2 < plainBuffer.size() )
+                << buffer.size() << " vs " << plainBuffer.size();
+
+        device.seek( 0 );
+        Block* inflatedBlock;
+        err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+        ASSERT_TRUE( iRoot->totalSize() == 10 + 10 * 200 );
+
+        MyBlock1* first = iRoot->at< MyLibrary >( 2 )->at< MyBlock1 >( 3 );
+        MyBlock1* second = iRoot->at< MyLibrary >( 7 )->at< MyBlock1 >( 11 );
+        EXPECT_TRUE( first->leInt() == 404 );
+        EXPECT_TRUE( first->laString() == "/a/rather/long/path/to/file/3" );
+        EXPECT_TRUE( second->laString() == "/a/rather/long/path/to/file/3" );
+
+        // Equal strings share a single allocation
+        EXPECT_TRUE( first->laString().constData() ==
+                     second->laString().constData() );
+        delete inflatedBlock;
+    }
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeColumnar )
+{
+    // Long runs of blocks of the same type, broken by short ones
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 200; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            // Leave a few values out
+            block->setLeInt( ( 0 == j % 16 ) ? 0 : 200 * i + j );
+            block->setLaString( QString( "Block %1" ).arg( j ) );
+            lib->addBlock( block );
+
+            if( 100 == j )
+            {
+                lib->addBlock( K_BLOCK_CREATE_INSTANCE( MyLibrary ) );
+            }
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray plainBuffer;
+    QBuffer plainDevice( & plainBuffer );
+    plainDevice.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer plainSerializer;
+    err = plainSerializer.deflate( & plainDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    const kuint options[] = { 0,
+                              KoreSerializer::Parallel,
+                              KoreSerializer::Lazy,
+                              KoreSerializer::Streamable };
+    for( int o = 0; o < 4; ++o )
+    {
+        QByteArray buffer;
+        QBuffer device( & buffer );
+        device.open( QIODevice::ReadWrite );
+
+        KoreSerializer serializer( KoreSerializer::Columnar | options[ o ] );
+        err = serializer.deflate( & device, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        EXPECT_TRUE( buffer.size() < plainBuffer.size() )
+                << buffer.size() << " vs " << plainBuffer.size();
+
+        device.seek( 0 );
+        Block* inflatedBlock;
+        err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+        ASSERT_TRUE( iRoot->size() == 10 );
+        for( int i = 0; i < 10; ++i )
+        {
+            MyLibrary* lib = iRoot->at< MyLibrary >( i );
+            ASSERT_TRUE( lib->size() == 201 );
+            EXPECT_TRUE( lib->at( 101 )->isLibrary() );
+
+            MyBlock1* first = lib->at< MyBlock1 >( 3 );
+            MyBlock1* empty = lib->at< MyBlock1 >( 16 );
+            MyBlock1* last = lib->at< MyBlock1 >( 200 );
+            EXPECT_TRUE( first->leInt() == 200 * i + 3 );
+            EXPECT_TRUE( first->laString() == "Block 3" );
+            EXPECT_TRUE( empty->leInt() == 0 );
+            EXPECT_TRUE( last->leInt() == 200 * i + 199 );
+            EXPECT_TRUE( last->laString() == "Block 199" );
+        }
+        delete inflatedBlock;
+    }
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeFiltered )
+{
+    // root: MyBlock1 0, lib1, empty library, lib2 (run of 20 MyBlock1)
+    //   lib1: MyBlock1 1, lib3 (MyBlock1 2)
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    MyLibrary* lib1 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    MyLibrary* lib2 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    MyLibrary* lib3 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+
+    MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block->setLeInt( 0 );
+    root->addBlock( block );
+    root->addBlock( lib1 );
+    root->addBlock( K_BLOCK_CREATE_INSTANCE( MyLibrary ) );
+    root->addBlock( lib2 );
+
+    block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block->setLeInt( 1 );
+    lib1->addBlock( block );
+    lib1->addBlock( lib3 );
+
+    block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block->setLeInt( 2 );
+    lib3->addBlock( block );
+
+    for( int i = 0; i < 20; ++i )
+    {
+        block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        block->setLeInt( 100 + i );
+        lib2->addBlock( block );
+    }
 
-    // Now serialize
     QByteArray buffer;
     QBuffer device( & buffer );
     device.open( QIODevice::ReadWrite );
 
     int err;
 
-    KoreSerializer serializer;
-    err = serializer.deflate( & device, lib, K_NULL );
+    KoreSerializer serializer( KoreSerializer::Columnar );
+    err = serializer.deflate( & device, root, K_NULL );
     ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
 
-    // Reset...
-    device.seek( 0 );
+    // Pruned tree of the MyBlock1, attached to the root
+    InflateFilter typeFilter;
+    typeFilter.addMetaBlock( MyBlock1::StaticMetaBlock() );
 
+    device.seek( 0 );
     Block* inflatedBlock;
-    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    err = serializer.inflateFiltered( & device, typeFilter,
+                                      & inflatedBlock, K_NULL );
     ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
 
-    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+    MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+    ASSERT_TRUE( iRoot->size() == 23 ) << iRoot->size() << " child block(s)";
+    for( int i = 0; i < 3; ++i )
+    {
+        ASSERT_TRUE( iRoot->at( i )->fastInherits< MyBlock1 >() );
+        EXPECT_TRUE( iRoot->at< MyBlock1 >( i )->leInt() == i );
+    }
+    EXPECT_TRUE( iRoot->at< MyBlock1 >( 22 )->leInt() == 119 );
+    delete inflatedBlock;
 
-    MyLibrary* iLib = inflatedBlock->to< MyLibrary >();
+    // The same blocks, unattached
+    device.seek( 0 );
+    QList< Block* > blocks;
+    err = serializer.inflateFiltered( & device, typeFilter, & blocks, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    ASSERT_TRUE( blocks.size() == 23 );
+    EXPECT_TRUE( K_NULL == blocks.at( 0 )->library() );
+    EXPECT_TRUE( blocks.at( 1 )->to< MyBlock1 >()->leInt() == 1 );
+    qDeleteAll( blocks );
 
-    ASSERT_TRUE( iLib->size() == childrenNb ) << iLib->size()
-                                              << " child block(s)";
+    // The two first levels only
+    InflateFilter depthFilter;
+    depthFilter.setMaxDepth( 1 );
 
-    delete lib;
-    delete iLib;
-}
+    device.seek( 0 );
+    err = serializer.inflateFiltered( & device, depthFilter,
+                                      & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
 
+    iRoot = inflatedBlock->to< MyLibrary >();
+    ASSERT_TRUE( iRoot->size() == 4 );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 1 )->size() == 0 );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 3 )->size() == 0 );
+    delete inflatedBlock;
 
-TEST( SerializationTest, SerializeBigTree70000 )
-{
-    const int childrenNb = 70000;
+    // Callback: lib1 is rejected with its subtree, the odd children of the
+    // other libraries are rejected, lib2 included.
+    QList< kint > lib1Path;
+    lib1Path.append( 1 );
+    PathFilter pathFilter( lib1Path );
 
-    MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    device.seek( 0 );
+    err = serializer.inflateFiltered( & device, pathFilter,
+                                      & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
 
-    for( int i = 0; i < childrenNb; ++i )
+    iRoot = inflatedBlock->to< MyLibrary >();
+    ASSERT_TRUE( iRoot->size() == 12 ) << iRoot->size() << " child block(s)";
+    EXPECT_TRUE( iRoot->at< MyBlock1 >( 0 )->leInt() == 0 );
+    EXPECT_TRUE( iRoot->at( 1 )->fastInherits< MyLibrary >() );
+    EXPECT_TRUE( iRoot->at< MyBlock1 >( 2 )->leInt() == 100 );
+    EXPECT_TRUE( iRoot->at< MyBlock1 >( 11 )->leInt() == 118 );
+    delete inflatedBlock;
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeHashed )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 3; ++i )
     {
-        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
-        lib->addBlock( block );
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 4; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 10 * i + j );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
     }
 
-    ASSERT_TRUE( lib->size() == childrenNb );
+    const QByteArray rootHash = KoreSerializer::hash( root );
+    ASSERT_TRUE( 20 == rootHash.size() );
 
-    // Now serialize
     QByteArray buffer;
     QBuffer device( & buffer );
     device.open( QIODevice::ReadWrite );
 
     int err;
 
-    KoreSerializer serializer;
-    err = serializer.deflate( & device, lib, K_NULL );
+    // The hashes lie between the table of contents and the metadata
+    KoreSerializer serializer( KoreSerializer::Hashed |
+                               KoreSerializer::Indexed );
+    err = serializer.deflate( & device, root, K_NULL );
     ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
 
-    // Reset...
     device.seek( 0 );
-
     Block* inflatedBlock;
     err = serializer.inflate( & device, & inflatedBlock, K_NULL );
     ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) == rootHash );
 
-    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+    QList< kint > path;
+    path << 1 << 2;
+    Block* block;
+    err = serializer.inflateAt( & device, path, false, & block, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( block->to< MyBlock1 >()->leInt() == 12 );
+    delete block;
 
-    MyLibrary* iLib = inflatedBlock->to< MyLibrary >();
+    QList< QList< kint > > paths;
+    err = serializer.changedBlocks( & device, inflatedBlock, & paths, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( paths.isEmpty() );
 
-    ASSERT_TRUE( iLib->size() == childrenNb ) << iLib->size()
-                                              << " child block(s)";
+    // A changed property, then a new child
+    MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+    iRoot->at< MyLibrary >( 1 )->at< MyBlock1 >( 2 )->setLeInt( 99 );
+    EXPECT_TRUE( KoreSerializer::hash( iRoot ) != rootHash );
 
-    delete lib;
-    delete iLib;
+    MyBlock1* added = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    iRoot->at< MyLibrary >( 2 )->addBlock( added );
+
+    err = serializer.changedBlocks( & device, iRoot, & paths, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    ASSERT_TRUE( paths.size() == 2 ) << paths.size() << " path(s)";
+    EXPECT_TRUE( paths.at( 0 ) == path );
+    EXPECT_TRUE( paths.at( 1 ) == QList< kint >() << 2 );
+
+    // Back to the original content, the hashes follow
+    iRoot->at< MyLibrary >( 1 )->at< MyBlock1 >( 2 )->setLeInt( 12 );
+    iRoot->at< MyLibrary >( 2 )->removeBlock( added );
+    delete added;
+    EXPECT_TRUE( KoreSerializer::hash( iRoot ) == rootHash );
+
+    // With a shared strings table, the strings are hashed, not their indices
+    {
+        MyLibrary* strings = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 4; ++j )
+        {
+            MyBlock1* b = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            b->setLaString( QString( "String %1" ).arg( j % 2 ) );
+            strings->addBlock( b );
+        }
+
+        QByteArray stringsBuffer;
+        QBuffer stringsDevice( & stringsBuffer );
+        stringsDevice.open( QIODevice::ReadWrite );
+
+        KoreSerializer stringsSerializer( KoreSerializer::Hashed |
+                                          KoreSerializer::Indexed |
+                                          KoreSerializer::SharedStrings );
+        err = stringsSerializer.deflate( & stringsDevice, strings, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+        stringsDevice.seek( 0 );
+        Block* inflatedStrings;
+        err = stringsSerializer.inflate( & stringsDevice, & inflatedStrings,
+                                         K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        EXPECT_TRUE( KoreSerializer::hash( strings ) ==
+                     KoreSerializer::hash( inflatedStrings ) );
+
+        err = stringsSerializer.changedBlocks( & stringsDevice, inflatedStrings,
+                                               & paths, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        EXPECT_TRUE( paths.isEmpty() );
+
+        delete strings;
+        delete inflatedStrings;
+    }
+
+    // Without hashes
+    QByteArray plainBuffer;
+    QBuffer plainDevice( & plainBuffer );
+    plainDevice.open( QIODevice::ReadWrite );
+
+    KoreSerializer plainSerializer;
+    err = plainSerializer.deflate( & plainDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    err = plainSerializer.changedBlocks( & plainDevice, root, & paths,
+                                         K_NULL );
+    EXPECT_TRUE( KoreSerializer::NotHashed == err ) << "Error code: " << err;
+
+    // Nor in the streaming layout
+    QByteArray streamedBuffer;
+    QBuffer streamedDevice( & streamedBuffer );
+    streamedDevice.open( QIODevice::ReadWrite );
+
+    KoreSerializer streamedSerializer( KoreSerializer::Streamable );
+    err = streamedSerializer.deflate( & streamedDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    streamedDevice.seek( 0 );
+    err = streamedSerializer.changedBlocks( & streamedDevice, root, & paths,
+                                            K_NULL );
+    EXPECT_TRUE( KoreSerializer::NotHashed == err ) << "Error code: " << err;
+
+    delete root;
+    delete inflatedBlock;
+}
+
+TEST( SerializationTest, SerializeTreeDelta )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 100; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 100 * i + j + 1 );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+    root->at< MyLibrary >( 2 )->at< MyBlock1 >( 7 )->setLaString( "Reset" );
+
+    QByteArray baseBuffer;
+    QBuffer baseDevice( & baseBuffer );
+    baseDevice.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & baseDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // The deflated tree is the snapshot
+    EXPECT_TRUE( root->checkFlag( Library::ChildrenChanged ) );
+    root->markClean();
+    EXPECT_FALSE( root->checkFlag( Library::ChildrenChanged ) );
+
+    // A property, an addition, a removal and a move
+    MyBlock1* changed = root->at< MyLibrary >( 3 )->at< MyBlock1 >( 42 );
+    changed->setLaString( "Changed" );
+    EXPECT_TRUE( changed->isDirty() );
+    EXPECT_TRUE( root->hasDirtyDescendants() );
+    EXPECT_FALSE( root->at( 4 )->hasDirtyDescendants() );
+
+    // Values that are not deflated in a full tree
+    MyBlock1* reset = root->at< MyLibrary >( 2 )->at< MyBlock1 >( 7 );
+    reset->setLeInt( 0 );
+    reset->setLaString( "" );
+
+    MyBlock1* added = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    added->setLeInt( -1 );
+    root->at< MyLibrary >( 5 )->insertBlock( added, 10 );
+    delete root->at< MyLibrary >( 7 )->at( 0 );
+    root->at< MyLibrary >( 8 )->moveBlock( root->at< MyLibrary >( 8 )->at( 0 ),
+                                           99 );
+
+    QByteArray deltaBuffer;
+    QBuffer deltaDevice( & deltaBuffer );
+    deltaDevice.open( QIODevice::ReadWrite );
+
+    err = serializer.deflateDelta( & deltaDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( deltaBuffer.size() * 10 < baseBuffer.size() )
+            << deltaBuffer.size() << " vs " << baseBuffer.size();
+    EXPECT_FALSE( root->hasDirtyDescendants() );
+    EXPECT_FALSE( changed->isDirty() );
+
+    // Nothing changed since
+    {
+        QByteArray emptyBuffer;
+        QBuffer emptyDevice( & emptyBuffer );
+        emptyDevice.open( QIODevice::ReadWrite );
+
+        err = serializer.deflateDelta( & emptyDevice, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        EXPECT_TRUE( emptyBuffer.size() == 6 ) << emptyBuffer.size();
+    }
+
+    QByteArray expectedBuffer;
+    QBuffer expectedDevice( & expectedBuffer );
+    expectedDevice.open( QIODevice::ReadWrite );
+    err = serializer.deflate( & expectedDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // The delta applied to the snapshot gives the current tree
+    baseDevice.seek( 0 );
+    Block* inflatedBlock;
+    err = serializer.inflate( & baseDevice, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_FALSE( inflatedBlock->hasDirtyDescendants() );
+
+    deltaDevice.seek( 0 );
+    err = serializer.applyDelta( & deltaDevice, inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( deltaDevice.atEnd() );
+    EXPECT_FALSE( inflatedBlock->hasDirtyDescendants() );
+
+    MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 3 )->at< MyBlock1 >( 42 )
+                    ->laString() == "Changed" );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 2 )->at< MyBlock1 >( 7 )
+                    ->leInt() == 0 );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 2 )->at< MyBlock1 >( 7 )
+                    ->laString().isEmpty() );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 5 )->size() == 101 );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 5 )->at< MyBlock1 >( 10 )
+                    ->leInt() == -1 );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 7 )->size() == 99 );
+    EXPECT_TRUE( iRoot->at< MyLibrary >( 8 )->at< MyBlock1 >( 99 )
+                    ->leInt() == 801 );
+
+    QByteArray appliedBuffer;
+    QBuffer appliedDevice( & appliedBuffer );
+    appliedDevice.open( QIODevice::ReadWrite );
+    err = serializer.deflate( & appliedDevice, inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( appliedBuffer == expectedBuffer );
+    delete inflatedBlock;
+
+    // Compaction folds the delta into a new snapshot
+    QByteArray compactBuffer;
+    QBuffer compactDevice( & compactBuffer );
+    compactDevice.open( QIODevice::ReadWrite );
+
+    baseDevice.seek( 0 );
+    deltaDevice.seek( 0 );
+    err = serializer.compact( & baseDevice,
+                              QList< QIODevice* >() << & deltaDevice,
+                              & compactDevice,
+                              K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( compactBuffer == expectedBuffer );
+
+    // A delta does not apply to another tree
+    MyLibrary* other = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    deltaDevice.seek( 0 );
+    err = serializer.applyDelta( & deltaDevice, other, K_NULL );
+    EXPECT_TRUE( KoreSerializer::BlockNotFound == err )
+            << "Error code: " << err;
+    delete other;
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeDiff )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 100; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 100 * i + j + 1 );
+            block->setLaString( QString( "Block %1" ).arg( j % 10 ) );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray baseBuffer;
+    QBuffer baseDevice( & baseBuffer );
+    baseDevice.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & baseDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Identical trees, deflated differently
+    QByteArray sameBuffer;
+    QBuffer sameDevice( & sameBuffer );
+    sameDevice.open( QIODevice::ReadWrite );
+
+    KoreSerializer targetSerializer( KoreSerializer::Columnar |
+                                     KoreSerializer::SharedStrings );
+    err = targetSerializer.deflate( & sameDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    QByteArray sameDeltaBuffer;
+    QBuffer sameDeltaDevice( & sameDeltaBuffer );
+    sameDeltaDevice.open( QIODevice::ReadWrite );
+
+    baseDevice.seek( 0 );
+    sameDevice.seek( 0 );
+    err = serializer.diff( & baseDevice, & sameDevice, & sameDeltaDevice,
+                           K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Magic, version and end only
+    EXPECT_TRUE( 6 == sameDeltaBuffer.size() ) << sameDeltaBuffer.size();
+
+    // Properties, one no longer stored, an addition, a removal and a move
+    root->at< MyLibrary >( 3 )->at< MyBlock1 >( 42 )->setLaString( "Changed" );
+    root->at< MyLibrary >( 2 )->at< MyBlock1 >( 7 )->setLeInt( 0 );
+    MyBlock1* added = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    added->setLeInt( -1 );
+    root->at< MyLibrary >( 5 )->insertBlock( added, 10 );
+    delete root->at< MyLibrary >( 7 )->at( 0 );
+    root->at< MyLibrary >( 8 )->moveBlock( root->at< MyLibrary >( 8 )->at( 0 ),
+                                           99 );
+    const QByteArray targetHash = KoreSerializer::hash( root );
+
+    QByteArray targetBuffer;
+    QBuffer targetDevice( & targetBuffer );
+    targetDevice.open( QIODevice::ReadWrite );
+
+    err = targetSerializer.deflate( & targetDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    QByteArray deltaBuffer;
+    QBuffer deltaDevice( & deltaBuffer );
+    deltaDevice.open( QIODevice::ReadWrite );
+
+    baseDevice.seek( 0 );
+    targetDevice.seek( 0 );
+    err = serializer.diff( & baseDevice, & targetDevice, & deltaDevice,
+                           K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( deltaBuffer.size() * 10 < baseBuffer.size() )
+            << deltaBuffer.size() << " vs " << baseBuffer.size();
+
+    // Applied to the base tree in memory
+    baseDevice.seek( 0 );
+    Block* inflatedBlock;
+    err = serializer.inflate( & baseDevice, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    deltaDevice.seek( 0 );
+    err = serializer.applyDelta( & deltaDevice, inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) == targetHash );
+    delete inflatedBlock;
+
+    // Applied to the base tree deflated
+    QByteArray patchedBuffer;
+    QBuffer patchedDevice( & patchedBuffer );
+    patchedDevice.open( QIODevice::ReadWrite );
+
+    baseDevice.seek( 0 );
+    deltaDevice.seek( 0 );
+    err = serializer.patch( & baseDevice, & deltaDevice, & patchedDevice,
+                            K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    patchedDevice.seek( 0 );
+    err = serializer.inflate( & patchedDevice, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) == targetHash );
+    delete inflatedBlock;
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeInflateInto )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 100; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 100 * i + j + 1 );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    KoreSerializer serializer;
+    int err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    device.seek( 0 );
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    Library* live = inflatedBlock->to< Library >();
+    Block* kept = live->at< Library >( 3 )->at( 42 );
+    Library* keptLib = live->at< Library >( 7 );
+
+    // A property, a type change, an addition and a removal
+    root->at< MyLibrary >( 3 )->at< MyBlock1 >( 42 )->setLeInt( -1 );
+    delete root->at< MyLibrary >( 4 )->at( 0 );
+    root->at< MyLibrary >( 4 )->insertBlock(
+                K_BLOCK_CREATE_INSTANCE( MyBlock2 ), 0 );
+    root->at< MyLibrary >( 5 )->addBlock( K_BLOCK_CREATE_INSTANCE( MyBlock1 ) );
+    delete root->at< MyLibrary >( 9 );
+
+    QByteArray targetBuffer;
+    QBuffer targetDevice( & targetBuffer );
+    targetDevice.open( QIODevice::ReadWrite );
+
+    err = serializer.deflate( & targetDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    targetDevice.seek( 0 );
+    err = serializer.inflateInto( & targetDevice, live, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( live ) == KoreSerializer::hash( root ) );
+    EXPECT_TRUE( targetDevice.atEnd() );
+    EXPECT_FALSE( live->hasDirtyDescendants() );
+
+    // The matching blocks were kept
+    EXPECT_TRUE( 9 == live->size() );
+    EXPECT_TRUE( kept == live->at< Library >( 3 )->at( 42 ) );
+    EXPECT_TRUE( -1 == kept->to< MyBlock1 >()->leInt() );
+    EXPECT_TRUE( keptLib == live->at( 7 ) );
+    EXPECT_TRUE( live->at< Library >( 4 )->at( 0 )
+                     ->fastInherits< MyBlock2 >() );
+    EXPECT_TRUE( 101 == live->at< Library >( 5 )->size() );
+
+    // Another root type
+    MyBlock1* other = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    targetDevice.seek( 0 );
+    err = serializer.inflateInto( & targetDevice, other, K_NULL );
+    EXPECT_TRUE( KoreSerializer::UnsupportedOperation == err )
+            << "Error code: " << err;
+    delete other;
+
+    delete inflatedBlock;
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeChecksummed )
+{
+    // Check value of the CRC-32C
+    EXPECT_TRUE( 0xE3069283 == Crc32c::Compute( "123456789", 9 ) );
+    EXPECT_TRUE( 0xE3069283 == Crc32c::Compute( "6789", 4,
+                                   Crc32c::Compute( "12345", 5 ) ) );
+
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 5; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 20; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 20 * i + j );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    KoreSerializer serializer( KoreSerializer::Checksummed );
+    int err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    device.seek( 0 );
+    err = serializer.verify( & device, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    device.seek( 0 );
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) ==
+                 KoreSerializer::hash( root ) );
+    delete inflatedBlock;
+
+    // Runs, in the streaming layout
+    QByteArray streamBuffer;
+    QBuffer streamDevice( & streamBuffer );
+    streamDevice.open( QIODevice::ReadWrite );
+
+    KoreSerializer streamSerializer( KoreSerializer::Checksummed |
+                                     KoreSerializer::Streamable |
+                                     KoreSerializer::Columnar );
+    err = streamSerializer.deflate( & streamDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    streamDevice.seek( 0 );
+    err = streamSerializer.verify( & streamDevice, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( streamDevice.atEnd() );
+
+    streamDevice.seek( 0 );
+    err = streamSerializer.inflate( & streamDevice, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) ==
+                 KoreSerializer::hash( root ) );
+    delete inflatedBlock;
+
+    // Frames larger than the read window, read from devices
+    {
+        MyBlock1* large = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        large->setLaString( QString( 10000, QLatin1Char( 'L' ) ) );
+
+        KoreSerializer windowSerializer( KoreSerializer::Checksummed );
+        windowSerializer.setReadWindow( 4 * 1024 );
+        EXPECT_TRUE( 4 * 1024 == windowSerializer.readWindow() );
+
+        QByteArray largeBuffer;
+        QBuffer largeDevice( & largeBuffer );
+        largeDevice.open( QIODevice::ReadWrite );
+        err = windowSerializer.deflate( & largeDevice, large, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        ASSERT_TRUE( largeBuffer.size() > windowSerializer.readWindow() );
+
+        largeDevice.seek( 0 );
+        err = windowSerializer.verify( & largeDevice, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+        largeDevice.seek( 0 );
+        err = windowSerializer.inflate( & largeDevice, & inflatedBlock,
+                                        K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) ==
+                     KoreSerializer::hash( large ) );
+        delete inflatedBlock;
+
+        SequentialDevice sequentialDevice;
+        sequentialDevice.open( QIODevice::ReadWrite );
+        sequentialDevice.write( largeBuffer );
+        err = windowSerializer.inflate( & sequentialDevice, & inflatedBlock,
+                                        K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) ==
+                     KoreSerializer::hash( large ) );
+        delete inflatedBlock;
+
+        delete large;
+    }
+
+    // Corrupt the checksum of the root
+    const quint32 rootLength = 0x7FFFFFFF & qFromBigEndian< quint32 >(
+                reinterpret_cast< const uchar* >( buffer.constData() + 4 ) );
+    ASSERT_TRUE( rootLength < static_cast< quint32 >( buffer.size() ) );
+    buffer[ rootLength - 1 ] = buffer.at( rootLength - 1 ) ^ 0x40;
+
+    device.seek( 0 );
+    err = serializer.verify( & device, K_NULL );
+    EXPECT_TRUE( KoreSerializer::ChecksumMismatch == err )
+            << "Error code: " << err;
+
+    device.seek( 0 );
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    EXPECT_TRUE( KoreSerializer::ChecksumMismatch == err )
+            << "Error code: " << err;
+
+    // Without checksums
+    QByteArray plainBuffer;
+    QBuffer plainDevice( & plainBuffer );
+    plainDevice.open( QIODevice::ReadWrite );
+
+    KoreSerializer plainSerializer;
+    err = plainSerializer.deflate( & plainDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    plainDevice.seek( 0 );
+    err = plainSerializer.verify( & plainDevice, K_NULL );
+    EXPECT_TRUE( KoreSerializer::NotChecksummed == err )
+            << "Error code: " << err;
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeWriteBehind )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 20; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 500; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 500 * i + j + 1 );
+            block->setLaString( QString( "Block %1" ).arg( j ) );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray plainBuffer;
+    QBuffer plainDevice( & plainBuffer );
+    plainDevice.open( QIODevice::ReadWrite );
+
+    KoreSerializer plainSerializer;
+    int err = plainSerializer.deflate( & plainDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Small buffers, for the writer thread to fall behind
+    KoreSerializer serializer( KoreSerializer::WriteBehind );
+    serializer.setWriteBehindBufferSize( 4 * _K_1KB );
+    serializer.setWriteBehindBuffers( 3 );
+
+    QTemporaryFile file;
+    ASSERT_TRUE( file.open() );
+    err = serializer.deflate( & file, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( plainBuffer.size() > 4 * serializer.writeBehindBufferSize() );
+    EXPECT_TRUE( file.pos() == plainBuffer.size() );
+
+    // The same bytes as written directly
+    file.seek( 0 );
+    EXPECT_TRUE( file.readAll() == plainBuffer );
+
+    file.seek( 0 );
+    Block* inflatedBlock;
+    err = serializer.inflate( & file, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) ==
+                 KoreSerializer::hash( root ) );
+    delete inflatedBlock;
+
+    // Compressed on the way
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    serializer.setOptions( KoreSerializer::WriteBehind |
+                           KoreSerializer::Compressed );
+    err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    device.seek( 0 );
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) ==
+                 KoreSerializer::hash( root ) );
+    delete inflatedBlock;
+
+    // The write errors of the thread are reported
+    QByteArray readOnlyBuffer;
+    QBuffer readOnlyDevice( & readOnlyBuffer );
+    readOnlyDevice.open( QIODevice::ReadOnly );
+
+    serializer.setOptions( KoreSerializer::WriteBehind );
+    err = serializer.deflate( & readOnlyDevice, root, K_NULL );
+    EXPECT_TRUE( KoreSerializer::IOError == err ) << "Error code: " << err;
+
+    // Opened once, the file holds all the data once closed
+    {
+        QFile writtenFile( file.fileName() );
+        ASSERT_TRUE( writtenFile.open( QIODevice::WriteOnly |
+                                       QIODevice::Truncate ) );
+
+        WriteBehindDevice writeBehind( & writtenFile, 4 * _K_1KB );
+        ASSERT_TRUE( writeBehind.open( QIODevice::WriteOnly ) );
+        EXPECT_FALSE( writeBehind.open( QIODevice::WriteOnly ) );
+        EXPECT_TRUE( writeBehind.write( plainBuffer ) == plainBuffer.size() );
+        writeBehind.close();
+        EXPECT_FALSE( writeBehind.hasError() );
+
+        QFile readFile( file.fileName() );
+        ASSERT_TRUE( readFile.open( QIODevice::ReadOnly ) );
+        EXPECT_TRUE( readFile.readAll() == plainBuffer );
+    }
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeSnapshots )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 100; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 100 * i + j + 1 );
+            block->setLaString( QString( "Block %1" ).arg( j ) );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QTemporaryDir dir;
+    ASSERT_TRUE( dir.isValid() );
+
+    SnapshotStore store( dir.path() );
+    store.setChunkSize( 1024 );
+
+    int err = store.save( "1", root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    const qint64 firstSize = DirectorySize( dir.path() );
+
+    // Chunks are split at subtree boundaries
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    KoreSerializer serializer( KoreSerializer::Streamable );
+    err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    QList< qint64 > boundaries;
+    device.seek( 0 );
+    err = serializer.split( & device, 1024, & boundaries );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    ASSERT_TRUE( boundaries.size() > 10 ) << boundaries.size();
+    EXPECT_TRUE( buffer.size() == boundaries.last() );
+
+    // A single block changed, the unchanged chunks are shared
+    root->at< MyLibrary >( 3 )->at< MyBlock1 >( 42 )->setLaString( "Changed" );
+    const QByteArray hash = KoreSerializer::hash( root );
+
+    err = store.save( "2", root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    const qint64 secondSize = DirectorySize( dir.path() ) - firstSize;
+    EXPECT_TRUE( secondSize * 4 < firstSize )
+            << secondSize << " vs " << firstSize;
+    EXPECT_TRUE( ( QStringList() << "1" << "2" ) == store.snapshots() );
+
+    Block* inflatedBlock;
+    err = store.restore( "2", & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) == hash );
+    delete inflatedBlock;
+
+    // The chunks of the remaining snapshot are kept
+    err = store.remove( "1" );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( QStringList( "2" ) == store.snapshots() );
+
+    err = store.restore( "2", & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) == hash );
+    delete inflatedBlock;
+
+    err = store.restore( "1", & inflatedBlock, K_NULL );
+    EXPECT_TRUE( KoreSerializer::IOError == err ) << "Error code: " << err;
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeJournal )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 4; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 10; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 10 * i + j + 1 );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray checkpointBuffer;
+    QBuffer checkpointDevice( & checkpointBuffer );
+    checkpointDevice.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & checkpointDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    QByteArray logBuffer;
+    QBuffer logDevice( & logBuffer );
+    logDevice.open( QIODevice::ReadWrite );
+
+    Journal journal( serializer );
+    err = journal.attach( root, & logDevice );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Every kind of edit, including in an added library
+    root->at< MyLibrary >( 1 )->at< MyBlock1 >( 3 )->setLaString( "Changed" );
+    root->at< MyLibrary >( 1 )->at< MyBlock1 >( 4 )->setLeInt( 0 );
+    MyLibrary* added = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    root->insertBlock( added, 2 );
+    MyBlock1* addedBlock = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    added->addBlock( addedBlock );
+    addedBlock->setLeInt( -1 );
+    delete root->at< MyLibrary >( 0 )->at( 5 );
+    root->at< MyLibrary >( 3 )->moveBlock( root->at< MyLibrary >( 3 )->at( 0 ),
+                                           9 );
+    root->at< MyLibrary >( 4 )->swapBlocks(
+                root->at< MyLibrary >( 4 )->at( 1 ),
+                root->at< MyLibrary >( 4 )->at( 8 ) );
+    ASSERT_TRUE( KoreSerializer::NoError == journal.error() );
+
+    QByteArray expectedBuffer;
+    QBuffer expectedDevice( & expectedBuffer );
+    expectedDevice.open( QIODevice::ReadWrite );
+    err = serializer.deflate( & expectedDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Replay gives the current tree
+    Block* replayedBlock;
+    checkpointDevice.seek( 0 );
+    logDevice.seek( 0 );
+    err = Journal::Replay( & checkpointDevice, & logDevice, & replayedBlock,
+                           K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    QByteArray replayedBuffer;
+    QBuffer replayedDevice( & replayedBuffer );
+    replayedDevice.open( QIODevice::ReadWrite );
+    err = serializer.deflate( & replayedDevice, replayedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( replayedBuffer == expectedBuffer );
+    delete replayedBlock;
+
+    // A record truncated by a crash is ignored
+    {
+        QByteArray truncatedBuffer = logBuffer.left( logBuffer.size() - 1 );
+        QBuffer truncatedDevice( & truncatedBuffer );
+        truncatedDevice.open( QIODevice::ReadOnly );
+
+        checkpointDevice.seek( 0 );
+        err = Journal::Replay( & checkpointDevice, & truncatedDevice,
+                               & replayedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+
+        // The swap is missing
+        MyLibrary* lib = replayedBlock->to< MyLibrary >()->at< MyLibrary >( 4 );
+        EXPECT_TRUE( lib->at< MyBlock1 >( 1 )->leInt() == 32 );
+        delete replayedBlock;
+    }
+
+    // A checkpoint starts a new log
+    QByteArray newCheckpointBuffer;
+    QBuffer newCheckpointDevice( & newCheckpointBuffer );
+    newCheckpointDevice.open( QIODevice::ReadWrite );
+
+    QByteArray newLogBuffer;
+    QBuffer newLogDevice( & newLogBuffer );
+    newLogDevice.open( QIODevice::ReadWrite );
+
+    err = journal.checkpoint( & newCheckpointDevice, & newLogDevice )
+                .result();
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( newCheckpointBuffer == expectedBuffer );
+
+    const int logSize = logBuffer.size();
+    addedBlock->setLeInt( -2 );
+    EXPECT_TRUE( logBuffer.size() == logSize );
+
+    newCheckpointDevice.seek( 0 );
+    newLogDevice.seek( 0 );
+    err = Journal::Replay( & newCheckpointDevice, & newLogDevice,
+                           & replayedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( replayedBlock->to< MyLibrary >()->at< MyLibrary >( 2 )
+                    ->at< MyBlock1 >( 0 )->leInt() == -2 );
+    delete replayedBlock;
+
+    journal.detach();
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeReadWindow )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 200; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 200 * i + j + 1 );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::WriteOnly );
+
+    KoreSerializer serializer;
+    int err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    device.close();
+
+    // Without buffering, every read reaches the device
+    int reads = 0;
+    for( int window = 0; window < 2; ++window )
+    {
+        serializer.setReadWindow( window ? 4 * _K_1KB : _K_1MB );
+
+        CountingBuffer countingDevice( & buffer );
+        countingDevice.open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+
+        Block* inflatedBlock;
+        err = serializer.inflate( & countingDevice, & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err )
+                << "Error code: " << err;
+        EXPECT_TRUE( inflatedBlock->to< MyLibrary >()->totalSize() ==
+                     10 + 10 * 200 );
+        delete inflatedBlock;
+
+        // The whole tree fits in a 1MB window
+        if( 0 == window )
+        {
+            EXPECT_TRUE( countingDevice.reads <= 2 ) << countingDevice.reads;
+            reads = countingDevice.reads;
+        }
+        else
+        {
+            EXPECT_TRUE( countingDevice.reads > reads )
+                    << countingDevice.reads;
+        }
+    }
+
+    // Variable length integers, decoded from the window or byte by byte at
+    // the end of the data
+    const quint32 values[] = { 0, 127, 128, 16383, 16384, 0xffffffff };
+    QByteArray encoded;
+    for( int i = 0; i < 6; ++i )
+    {
+        quint32 value = values[ i ];
+        for( ; value > 0x7f; value >>= 7 )
+        {
+            encoded.append( static_cast< char >( ( value & 0x7f ) | 0x80 ) );
+        }
+        encoded.append( static_cast< char >( value ) );
+    }
+
+    ByteReader reader( encoded.constData(), encoded.size() );
+    for( int i = 0; i < 6; ++i )
+    {
+        EXPECT_TRUE( values[ i ] == reader.readVariableLength32() ) << i;
+    }
+    EXPECT_FALSE( reader.hasError() );
+    EXPECT_TRUE( reader.pos() == encoded.size() );
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeTasklets )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 200; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 200 * i + j + 1 );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    DeflateTasklet* deflateTasklet =
+            K_BLOCK_CREATE_INSTANCE( DeflateTasklet );
+    deflateTasklet->setDevice( & device );
+    deflateTasklet->setTree( root );
+    Kore::KoreEngine::RunTasklet( deflateTasklet,
+                                  TaskletRunner::Asynchronous );
+    ASSERT_TRUE( deflateTasklet->waitForFinished() );
+    EXPECT_TRUE( KoreSerializer::NoError == deflateTasklet->error() )
+            << "Error code: " << deflateTasklet->error();
+    EXPECT_TRUE( deflateTasklet->bytesProcessed() > 0 );
+    delete deflateTasklet;
+
+    device.seek( 0 );
+    InflateTasklet* inflateTasklet =
+            K_BLOCK_CREATE_INSTANCE( InflateTasklet );
+    inflateTasklet->setDevice( & device );
+    Kore::KoreEngine::RunTasklet( inflateTasklet,
+                                  TaskletRunner::Asynchronous );
+    ASSERT_TRUE( inflateTasklet->waitForFinished() );
+    ASSERT_TRUE( KoreSerializer::NoError == inflateTasklet->error() )
+            << "Error code: " << inflateTasklet->error();
+    EXPECT_TRUE( inflateTasklet->bytesTotal() == buffer.size() );
+
+    Block* inflatedBlock = inflateTasklet->takeTree();
+    ASSERT_TRUE( K_NULL != inflatedBlock );
+    EXPECT_TRUE( inflatedBlock->thread() == QThread::currentThread() );
+    EXPECT_TRUE( inflatedBlock->to< MyLibrary >()->totalSize() ==
+                 10 + 10 * 200 );
+    delete inflatedBlock;
+    delete inflateTasklet;
+
+    // Cancel on the first progress report
+    device.seek( 0 );
+    inflateTasklet = K_BLOCK_CREATE_INSTANCE( InflateTasklet );
+    inflateTasklet->setDevice( & device );
+    QObject::connect( inflateTasklet, SIGNAL( progress( kuint64, kuint64 ) ),
+                      inflateTasklet, SLOT( cancel() ) );
+    Kore::KoreEngine::RunTasklet( inflateTasklet,
+                                  TaskletRunner::Synchronous );
+    EXPECT_TRUE( KoreSerializer::Canceled == inflateTasklet->error() )
+            << "Error code: " << inflateTasklet->error();
+    EXPECT_TRUE( K_NULL == inflateTasklet->tree() );
+    delete inflateTasklet;
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeArena )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 10; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 100; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( 100 * i + j + 1 );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+    EXPECT_TRUE( K_NULL == BlockArena::Of( root ) );
+
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    KoreSerializer serializer( KoreSerializer::Arena );
+    int err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    device.seek( 0 );
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( KoreSerializer::hash( inflatedBlock ) ==
+                 KoreSerializer::hash( root ) );
+
+    // The whole tree comes from a few slabs
+    BlockArena* arena = BlockArena::Of( inflatedBlock );
+    ASSERT_TRUE( K_NULL != arena );
+    Library* inflatedLib = inflatedBlock->to< Library >();
+    EXPECT_TRUE( arena == BlockArena::Of( inflatedLib->at( 9 ) ) );
+    EXPECT_TRUE( arena == BlockArena::Of(
+                     inflatedLib->at< Library >( 9 )->at( 99 ) ) );
+    EXPECT_TRUE( arena->slabsCount() < 10 ) << arena->slabsCount();
+    EXPECT_TRUE( arena->usedBytes() <= arena->reservedBytes() );
+
+    // Blocks added afterwards come from the heap, blocks of the arena can be
+    // deleted one by one.
+    MyBlock1* added = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    EXPECT_TRUE( K_NULL == BlockArena::Of( added ) );
+    inflatedLib->at< Library >( 0 )->addBlock( added );
+    delete inflatedLib->at< Library >( 1 )->at( 0 );
+
+    delete inflatedBlock;
+    delete root;
+}
+
+TEST( SerializationTest, SerializeBigTree128 )
+{
+    const int childrenNb = 128;
+
+    MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+
+    for( int i = 0; i < childrenNb; ++i )
+    {
+        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        lib->addBlock( block );
+    }
+
+    ASSERT_TRUE( lib->size() == childrenNb );
+
+    // Now serialize
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & device, lib, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Reset...
+    device.seek( 0 );
+
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+
+    MyLibrary* iLib = inflatedBlock->to< MyLibrary >();
+
+    ASSERT_TRUE( iLib->size() == childrenNb ) << iLib->size()
+                                              << " child block(s)";
+
+    delete lib;
+    delete iLib;
+}
+
+TEST( SerializationTest, SerializeBigTree512 )
+{
+    const int childrenNb = 512;
+
+    MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+
+    for( int i = 0; i < childrenNb; ++i )
+    {
+        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        lib->addBlock( block );
+    }
+
+    ASSERT_TRUE( lib->size() == childrenNb );
+
+    // Now serialize
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & device, lib, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Reset...
+    device.seek( 0 );
+
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+
+    MyLibrary* iLib = inflatedBlock->to< MyLibrary >();
+
+    ASSERT_TRUE( iLib->size() == childrenNb ) << iLib->size()
+                                              << " child block(s)";
+
+    delete lib;
+    delete iLib;
+}
+
+
+TEST( SerializationTest, SerializeBigTree70000 )
+{
+    const int childrenNb = 70000;
+
+    MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+
+    for( int i = 0; i < childrenNb; ++i )
+    {
+        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        lib->addBlock( block );
+    }
+
+    ASSERT_TRUE( lib->size() == childrenNb );
+
+    // Now serialize
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & device, lib, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Reset...
+    device.seek( 0 );
+
+    Block* inflatedBlock;
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+
+    MyLibrary* iLib = inflatedBlock->to< MyLibrary >();
+
+    ASSERT_TRUE( iLib->size() == childrenNb ) << iLib->size()
+                                              << " child block(s)";
+
+    delete lib;
+    delete iLib;
+}
+
+TEST( SerializationTest, SerializeTreeMemoryMapped )
+{
+    MyLibrary* lib1 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+
+    MyBlock1* block1 = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block1->setLeInt( 123 );
+    block1->setLaString( "Blabla" );
+    block1->leCustomType().laString = "Ahahah";
+    block1->leCustomType().leInt32 = 254;
+    lib1->addBlock( block1 );
+
+    MyLibrary* lib2 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    lib1->addBlock( lib2 );
+
+    MyBlock1* block2 = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block2->setLeInt( 456 );
+    block2->setLaString( "Tududu" );
+    lib2->addBlock( block2 );
+
+    // Serialize to a real file so that it gets memory mapped
+    QTemporaryFile file;
+    ASSERT_TRUE( file.open() );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & file, lib1, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Reset...
+    file.seek( 0 );
+
+    KoreSerializer mappedSerializer( KoreSerializer::MemoryMapped );
+
+    Block* inflatedBlock;
+    err = mappedSerializer.inflate( & file, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+
+    MyLibrary* iLib1 = inflatedBlock->to< MyLibrary >();
+
+    ASSERT_TRUE( iLib1->size() == 2 ) << iLib1->size() << " child block(s)";
+    ASSERT_TRUE( iLib1->at( 0 )->fastInherits< MyBlock1 >() );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->leInt() == 123 );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->laString() == "Blabla" );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->leCustomType().laString ==
+                 "Ahahah" );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->leCustomType().leInt32 == 254 );
+
+    ASSERT_TRUE( iLib1->at( 1 )->fastInherits< MyLibrary >() );
+    ASSERT_TRUE( iLib1->at< MyLibrary >( 1 )->size() == 1 );
+    ASSERT_TRUE(
+        iLib1->at< MyLibrary >( 1 )->at( 0 )->fastInherits< MyBlock1 >() );
+    EXPECT_TRUE(
+        iLib1->at< MyLibrary >( 1 )->at< MyBlock1 >( 0 )->leInt() == 456 );
+    EXPECT_TRUE( iLib1->at< MyLibrary >( 1 )->at< MyBlock1 >( 0 )->laString() ==
+                 "Tududu" );
+
+    delete lib1;
+    delete iLib1;
+}
+
+TEST( SerializationTest, SerializeTreeStreamable )
+{
+    MyLibrary* lib1 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+
+    MyBlock1* block1 = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block1->setLeInt( 123 );
+    block1->setLaString( "Blabla" );
+    block1->leCustomType().laString = "Ahahah";
+    block1->leCustomType().leInt32 = 254;
+    lib1->addBlock( block1 );
+
+    MyLibrary* lib2 = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    lib1->addBlock( lib2 );
+
+    MyBlock1* block2 = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    block2->setLeInt( 456 );
+    block2->setLaString( "Tududu" );
+    lib2->addBlock( block2 );
+
+    // An empty library
+    lib1->addBlock( K_BLOCK_CREATE_INSTANCE( MyLibrary ) );
+
+    int err;
+
+    // The footer based layout can not be inflated from a sequential device
+    SequentialDevice legacyDevice;
+    legacyDevice.open( QIODevice::ReadWrite );
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & legacyDevice, lib1, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    Block* inflatedBlock = K_NULL;
+    err = serializer.inflate( & legacyDevice, & inflatedBlock, K_NULL );
+    EXPECT_TRUE( KoreSerializer::RequiresRandomAccess == err )
+            << "Error code: " << err;
+
+    // The streaming layout can
+    SequentialDevice device;
+    device.open( QIODevice::ReadWrite );
+
+    KoreSerializer streamSerializer( KoreSerializer::Streamable );
+    err = streamSerializer.deflate( & device, lib1, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+
+    MyLibrary* iLib1 = inflatedBlock->to< MyLibrary >();
+
+    ASSERT_TRUE( iLib1->size() == 3 ) << iLib1->size() << " child block(s)";
+    ASSERT_TRUE( iLib1->at( 0 )->fastInherits< MyBlock1 >() );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->leInt() == 123 );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->laString() == "Blabla" );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->leCustomType().laString ==
+                 "Ahahah" );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 0 )->leCustomType().leInt32 == 254 );
+
+    ASSERT_TRUE( iLib1->at( 1 )->fastInherits< MyLibrary >() );
+    ASSERT_TRUE( iLib1->at< MyLibrary >( 1 )->size() == 1 );
+    ASSERT_TRUE(
+        iLib1->at< MyLibrary >( 1 )->at( 0 )->fastInherits< MyBlock1 >() );
+    EXPECT_TRUE(
+        iLib1->at< MyLibrary >( 1 )->at< MyBlock1 >( 0 )->leInt() == 456 );
+    EXPECT_TRUE( iLib1->at< MyLibrary >( 1 )->at< MyBlock1 >( 0 )->laString() ==
+                 "Tududu" );
+
+    ASSERT_TRUE( iLib1->at( 2 )->fastInherits< MyLibrary >() );
+    EXPECT_TRUE( iLib1->at< MyLibrary >( 2 )->size() == 0 );
+
+    // The streaming layout is also readable from random access devices
+    QByteArray buffer;
+    QBuffer bufferDevice( & buffer );
+    bufferDevice.open( QIODevice::ReadWrite );
+
+    err = streamSerializer.deflate( & bufferDevice, lib1, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    bufferDevice.seek( 0 );
+
+    Block* bufferBlock = K_NULL;
+    err = serializer.inflate( & bufferDevice, & bufferBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    ASSERT_TRUE( bufferBlock->fastInherits< MyLibrary >() );
+    EXPECT_TRUE( bufferBlock->to< MyLibrary >()->size() == 3 );
+    EXPECT_TRUE( bufferDevice.atEnd() );
+
+    delete lib1;
+    delete iLib1;
+    delete bufferBlock;
+}
+
+TEST( SerializationTest, SerializeTreeLazy )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 3; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 10; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( i * 10 + j );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray buffer;
+    QBuffer device( & buffer );
+    device.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & device, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    device.seek( 0 );
+
+    KoreSerializer lazySerializer( KoreSerializer::Lazy );
+    lazySerializer.setLazyBudget( 15 );
+
+    Block* inflatedBlock;
+    err = lazySerializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+    MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+
+    // Nothing is loaded until accessed
+    EXPECT_FALSE( iRoot->isLoaded() );
+    ASSERT_TRUE( iRoot->size() == 3 );
+    EXPECT_TRUE( iRoot->isLoaded() );
+
+    MyLibrary* iLib0 = iRoot->at< MyLibrary >( 0 );
+    MyLibrary* iLib1 = iRoot->at< MyLibrary >( 1 );
+    MyLibrary* iLib2 = iRoot->at< MyLibrary >( 2 );
+    EXPECT_FALSE( iLib0->isLoaded() );
+    EXPECT_FALSE( iLib1->isLoaded() );
+    EXPECT_FALSE( iLib2->isLoaded() );
+
+    ASSERT_TRUE( iLib0->size() == 10 );
+    EXPECT_TRUE( iLib0->at< MyBlock1 >( 3 )->leInt() == 3 );
+
+    // Over budget: the oldest library that is not in use goes away
+    ASSERT_TRUE( iLib1->size() == 10 );
+    EXPECT_TRUE( iLib1->at< MyBlock1 >( 4 )->leInt() == 14 );
+    EXPECT_FALSE( iLib0->isLoaded() );
+    EXPECT_TRUE( iRoot->isLoaded() );
+
+    // Modified libraries are never unloaded
+    iLib1->addBlock( K_BLOCK_CREATE_INSTANCE( MyBlock1 ) );
+
+    ASSERT_TRUE( iLib2->size() == 10 );
+    EXPECT_TRUE( iLib2->at< MyBlock1 >( 5 )->leInt() == 25 );
+    EXPECT_TRUE( iLib1->isLoaded() );
+    EXPECT_TRUE( iLib1->size() == 11 );
+
+    // Nor are the libraries holding modified blocks
+    iLib2->at< MyBlock1 >( 5 )->setLeInt( 0 );
+
+    // Unloaded libraries load again
+    ASSERT_TRUE( iLib0->size() == 10 );
+    EXPECT_TRUE( iLib0->at< MyBlock1 >( 9 )->leInt() == 9 );
+    EXPECT_TRUE( iLib2->isLoaded() );
+    EXPECT_TRUE( iLib2->at< MyBlock1 >( 5 )->leInt() == 0 );
+
+    EXPECT_TRUE( iRoot->totalSize() == 34 );
+
+    // The progress of a deflate has no total rather than loading everything
+    // to count the blocks
+    device.seek( 0 );
+    err = lazySerializer.inflate( & device, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    QByteArray lazyBuffer;
+    QBuffer lazyDevice( & lazyBuffer );
+    lazyDevice.open( QIODevice::ReadWrite );
+
+    ProgressMonitor monitor;
+    err = serializer.deflate( & lazyDevice, inflatedBlock, & monitor );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( lazyBuffer == buffer );
+    EXPECT_TRUE( monitor.blocks > 0 ) << monitor.blocks;
+    EXPECT_TRUE( 0 == monitor.blocksTotal ) << monitor.blocksTotal;
+    delete inflatedBlock;
+
+    delete root;
+    delete iRoot;
+}
+
+TEST( SerializationTest, SerializeTreeLazyLayouts )
+{
+    // Nested libraries, with a leaf before and after each of them
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 2; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        MyLibrary* nested = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 3; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( i * 10 + j );
+            nested->addBlock( block );
+        }
+
+        MyBlock1* first = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        first->setLeInt( 100 + i );
+        MyBlock1* last = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        last->setLeInt( 200 + i );
+        lib->addBlock( first );
+        lib->addBlock( nested );
+        lib->addBlock( last );
+        root->addBlock( lib );
+    }
+
+    const int options[] = {
+        0,
+        KoreSerializer::Streamable,
+        KoreSerializer::Indexed,
+        KoreSerializer::Hashed,
+        KoreSerializer::Indexed | KoreSerializer::Hashed
+    };
+
+    for( size_t o = 0; o < sizeof( options ) / sizeof( options[ 0 ] ); ++o )
+    {
+        QByteArray buffer;
+        QBuffer device( & buffer );
+        device.open( QIODevice::ReadWrite );
+
+        KoreSerializer serializer( options[ o ] );
+        int err = serializer.deflate( & device, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+        // The device is left at the same position as by a complete inflate
+        device.seek( 0 );
+        Block* plainBlock;
+        err = serializer.inflate( & device, & plainBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        const qint64 plainEnd = device.pos();
+        delete plainBlock;
+
+        device.seek( 0 );
+        KoreSerializer lazySerializer( KoreSerializer::Lazy );
+        Block* inflatedBlock;
+        err = lazySerializer.inflate( & device, & inflatedBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        EXPECT_TRUE( plainEnd == device.pos() ) << options[ o ];
+
+        MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+
+        // The last subtree first: the first one must be jumped over
+        for( int i = 1; i >= 0; --i )
+        {
+            MyLibrary* iLib = iRoot->at< MyLibrary >( i );
+            ASSERT_TRUE( iLib->size() == 3 ) << options[ o ];
+            EXPECT_TRUE( iLib->at< MyBlock1 >( 0 )->leInt() == 100 + i );
+            EXPECT_TRUE( iLib->at< MyBlock1 >( 2 )->leInt() == 200 + i );
+
+            MyLibrary* iNested = iLib->at< MyLibrary >( 1 );
+            ASSERT_TRUE( iNested->size() == 3 ) << options[ o ];
+            EXPECT_TRUE( iNested->at< MyBlock1 >( 2 )->leInt() == i * 10 + 2 );
+        }
+
+        delete iRoot;
+    }
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeJournalLazy )
+{
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 4; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 10; ++j )
+        {
+            MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+            block->setLeInt( i * 10 + j + 1 );
+            lib->addBlock( block );
+        }
+        root->addBlock( lib );
+    }
+
+    QByteArray checkpointBuffer;
+    QBuffer checkpointDevice( & checkpointBuffer );
+    checkpointDevice.open( QIODevice::ReadWrite );
+
+    int err;
+
+    KoreSerializer serializer;
+    err = serializer.deflate( & checkpointDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    checkpointDevice.seek( 0 );
+
+    KoreSerializer lazySerializer( KoreSerializer::Lazy );
+    lazySerializer.setLazyBudget( 15 );
+
+    Block* inflatedBlock;
+    err = lazySerializer.inflate( & checkpointDevice, & inflatedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+
+    QByteArray logBuffer;
+    QBuffer logDevice( & logBuffer );
+    logDevice.open( QIODevice::ReadWrite );
+
+    Journal journal( serializer );
+    err = journal.attach( iRoot, & logDevice );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    // Attaching does not load anything
+    EXPECT_FALSE( iRoot->isLoaded() );
+    const int headerSize = logBuffer.size();
+
+    // Loading and unloading are not edits
+    ASSERT_TRUE( iRoot->size() == 4 );
+    MyLibrary* iLib0 = iRoot->at< MyLibrary >( 0 );
+    MyLibrary* iLib1 = iRoot->at< MyLibrary >( 1 );
+    MyLibrary* iLib2 = iRoot->at< MyLibrary >( 2 );
+    MyLibrary* iLib3 = iRoot->at< MyLibrary >( 3 );
+    ASSERT_TRUE( iLib0->size() == 10 );
+    ASSERT_TRUE( iLib1->size() == 10 );
+    EXPECT_FALSE( iLib0->isLoaded() );
+    EXPECT_TRUE( logBuffer.size() == headerSize );
+
+    // Edits in loaded libraries are recorded once
+    iLib1->at< MyBlock1 >( 4 )->setLeInt( 0 );
+    root->at< MyLibrary >( 1 )->at< MyBlock1 >( 4 )->setLeInt( 0 );
+    MyBlock1* added = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    added->setLeInt( -1 );
+    iLib2->addBlock( added );
+    added = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+    added->setLeInt( -1 );
+    root->at< MyLibrary >( 2 )->addBlock( added );
+    iLib0->at< MyBlock1 >( 9 )->setLaString( "Reloaded" );
+    root->at< MyLibrary >( 0 )->at< MyBlock1 >( 9 )->setLaString( "Reloaded" );
+    ASSERT_TRUE( KoreSerializer::NoError == journal.error() );
+
+    // Unloaded libraries are cleared without loading their children, in a
+    // single record
+    const int logSize = logBuffer.size();
+    EXPECT_FALSE( iLib3->isLoaded() );
+    iLib3->clear();
+    root->at< MyLibrary >( 3 )->clear();
+    EXPECT_TRUE( iLib3->isLoaded() );
+    EXPECT_TRUE( iLib3->isEmpty() );
+    EXPECT_TRUE( logBuffer.size() > logSize );
+    EXPECT_TRUE( logBuffer.size() - logSize < 16 ) << logBuffer.size();
+    ASSERT_TRUE( KoreSerializer::NoError == journal.error() );
+
+    QByteArray expectedBuffer;
+    QBuffer expectedDevice( & expectedBuffer );
+    expectedDevice.open( QIODevice::ReadWrite );
+    err = serializer.deflate( & expectedDevice, root, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    Block* replayedBlock;
+    checkpointDevice.seek( 0 );
+    logDevice.seek( 0 );
+    err = Journal::Replay( & checkpointDevice, & logDevice, & replayedBlock,
+                           K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+    QByteArray replayedBuffer;
+    QBuffer replayedDevice( & replayedBuffer );
+    replayedDevice.open( QIODevice::ReadWrite );
+    err = serializer.deflate( & replayedDevice, replayedBlock, K_NULL );
+    ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+    EXPECT_TRUE( replayedBuffer == expectedBuffer );
+
+    journal.detach();
+    delete replayedBlock;
+    delete root;
+    delete iRoot;
+}
+
+TEST( SerializationTest, SerializeTreeParallel )
+{
+    // Libraries of libraries, with blocks in between
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 4; ++i )
+    {
+        MyBlock1* block = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+        block->setLeInt( -i );
+        root->addBlock( block );
+
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 3; ++j )
+        {
+            MyLibrary* subLib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+            for( int k = 0; k < 50; ++k )
+            {
+                MyBlock1* subBlock = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+                subBlock->setLeInt( i * 1000 + j * 100 + k );
+                subBlock->setLaString( QString::number( k ) );
+                subLib->addBlock( subBlock );
+            }
+            lib->addBlock( subLib );
+        }
+        root->addBlock( lib );
+    }
+
+    for( int options = 0; options < 2; ++options )
+    {
+        QByteArray buffer;
+        QBuffer device( & buffer );
+        device.open( QIODevice::ReadWrite );
+
+        int err;
+
+        KoreSerializer serializer( ( 0 == options )
+                                        ? 0
+                                        : KoreSerializer::Streamable );
+        err = serializer.deflate( & device, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+        for( int depth = 1; depth <= 3; ++depth )
+        {
+            device.seek( 0 );
+
+            KoreSerializer parallelSerializer( KoreSerializer::Parallel );
+            parallelSerializer.setParallelDepth( depth );
+
+            Block* inflatedBlock;
+            err = parallelSerializer.inflate( & device,
+                                              & inflatedBlock,
+                                              K_NULL );
+            ASSERT_TRUE( KoreSerializer::NoError == err )
+                    << "Error code: " << err;
+
+            ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+            MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+
+            ASSERT_TRUE( iRoot->size() == 8 );
+            EXPECT_TRUE( iRoot->totalSize() == 8 + 4 * ( 3 + 3 * 50 ) );
+
+            for( int i = 0; i < 4; ++i )
+            {
+                ASSERT_TRUE( iRoot->at( 2 * i )->fastInherits< MyBlock1 >() );
+                EXPECT_TRUE( iRoot->at< MyBlock1 >( 2 * i )->leInt() == -i );
+
+                ASSERT_TRUE(
+                    iRoot->at( 2 * i + 1 )->fastInherits< MyLibrary >() );
+                MyLibrary* lib = iRoot->at< MyLibrary >( 2 * i + 1 );
+                ASSERT_TRUE( lib->size() == 3 );
+                EXPECT_TRUE( lib->index() == 2 * i + 1 );
+
+                for( int j = 0; j < 3; ++j )
+                {
+                    MyLibrary* subLib = lib->at< MyLibrary >( j );
+                    ASSERT_TRUE( subLib->size() == 50 );
+                    EXPECT_TRUE( subLib->thread() == QThread::currentThread() );
+
+                    MyBlock1* subBlock = subLib->at< MyBlock1 >( 49 );
+                    EXPECT_TRUE( subBlock->leInt() == i * 1000 + j * 100 + 49 );
+                    EXPECT_TRUE( subBlock->laString() == "49" );
+                    EXPECT_TRUE(
+                        subBlock->thread() == QThread::currentThread() );
+                }
+            }
+
+            delete iRoot;
+        }
+    }
+
+    delete root;
+}
+
+TEST( SerializationTest, SerializeTreeParallelDeflate )
+{
+    // Two block types only appearing below the parallel depth, so that the
+    // type indices have to be remapped
+    MyLibrary* root = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+    for( int i = 0; i < 4; ++i )
+    {
+        MyLibrary* lib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+        for( int j = 0; j < 3; ++j )
+        {
+            MyLibrary* subLib = K_BLOCK_CREATE_INSTANCE( MyLibrary );
+            for( int k = 0; k < 50; ++k )
+            {
+                if( ( k + i ) % 7 )
+                {
+                    MyBlock1* subBlock = K_BLOCK_CREATE_INSTANCE( MyBlock1 );
+                    subBlock->setLeInt( i * 1000 + j * 100 + k );
+                    subBlock->setLaString( QString::number( k ) );
+                    subLib->addBlock( subBlock );
+                }
+                else
+                {
+                    subLib->addBlock( K_BLOCK_CREATE_INSTANCE( MyBlock2 ) );
+                }
+            }
+            lib->addBlock( subLib );
+        }
+        root->addBlock( lib );
+    }
+
+    for( int options = 0; options < 2; ++options )
+    {
+        const kuint layout = ( 0 == options ) ? 0 : KoreSerializer::Streamable;
+
+        QByteArray serialBuffer;
+        QBuffer serialDevice( & serialBuffer );
+        serialDevice.open( QIODevice::ReadWrite );
+
+        int err;
+
+        KoreSerializer serializer( layout );
+        err = serializer.deflate( & serialDevice, root, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+        for( int depth = 1; depth <= 3; ++depth )
+        {
+            QByteArray buffer;
+            QBuffer device( & buffer );
+            device.open( QIODevice::ReadWrite );
+
+            KoreSerializer parallelSerializer( layout
+                                               | KoreSerializer::Parallel );
+            parallelSerializer.setParallelDepth( depth );
+            err = parallelSerializer.deflate( & device, root, K_NULL );
+            ASSERT_TRUE( KoreSerializer::NoError == err )
+                    << "Error code: " << err;
+
+            // Same output as the serial deflate
+            EXPECT_TRUE( buffer == serialBuffer );
+
+            device.seek( 0 );
+
+            Block* inflatedBlock;
+            err = serializer.inflate( & device, & inflatedBlock, K_NULL );
+            ASSERT_TRUE( KoreSerializer::NoError == err )
+                    << "Error code: " << err;
+
+            ASSERT_TRUE( inflatedBlock->fastInherits< MyLibrary >() );
+            MyLibrary* iRoot = inflatedBlock->to< MyLibrary >();
+            EXPECT_TRUE( iRoot->totalSize() == 4 * ( 1 + 3 * ( 1 + 50 ) ) );
+
+            MyLibrary* subLib =
+                    iRoot->at< MyLibrary >( 3 )->at< MyLibrary >( 2 );
+            ASSERT_TRUE( subLib->at( 1 )->fastInherits< MyBlock1 >() );
+            EXPECT_TRUE( subLib->at< MyBlock1 >( 1 )->leInt() == 3201 );
+            EXPECT_TRUE( subLib->at( 4 )->fastInherits< MyBlock2 >() );
+
+            delete iRoot;
+        }
+
+        // A lazily inflated tree, loaded while deflating
+        serialDevice.seek( 0 );
+
+        KoreSerializer lazySerializer( layout | KoreSerializer::Lazy );
+        lazySerializer.setLazyBudget( 60 );
+
+        Block* lazyBlock;
+        err = lazySerializer.inflate( & serialDevice, & lazyBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+
+        QByteArray lazyBuffer;
+        QBuffer lazyDevice( & lazyBuffer );
+        lazyDevice.open( QIODevice::ReadWrite );
+
+        KoreSerializer parallelSerializer( layout | KoreSerializer::Parallel );
+        err = parallelSerializer.deflate( & lazyDevice, lazyBlock, K_NULL );
+        ASSERT_TRUE( KoreSerializer::NoError == err ) << "Error code: " << err;
+        EXPECT_TRUE( lazyBuffer == serialBuffer );
+
+        delete lazyBlock;
+    }
+
+    delete root;
 }